@@ -45,7 +45,7 @@ extern "C" {
 
 #define TX_APP_MEM_POOL_SIZE                     8 * 1024
 
-#define UX_DEVICE_APP_MEM_POOL_SIZE              64 * 1024
+#define UX_DEVICE_APP_MEM_POOL_SIZE              96 * 1024
 
 /* USER CODE BEGIN EC */
 
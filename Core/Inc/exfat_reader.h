@@ -47,12 +47,33 @@ typedef enum {
 #define EXFAT_MAX_PATH        256
 #define EXFAT_MAX_NAME        255
 
+/* FAT sectors kept in RAM for chained files and directories */
+#ifndef EXFAT_FAT_CACHE_SECTORS
+#define EXFAT_FAT_CACHE_SECTORS   4
+#endif
+
+/* Longest single multi-block read issued by ExFAT_FileRead (sectors) */
+#ifndef EXFAT_READ_MAX_SECTORS
+#define EXFAT_READ_MAX_SECTORS    128
+#endif
+
+/* Path components remembered by the lookup cache (0 disables it) */
+#ifndef EXFAT_DENTRY_CACHE_SIZE
+#define EXFAT_DENTRY_CACHE_SIZE   32
+#endif
+
+/* Longest name the lookup cache holds, including the terminator */
+#ifndef EXFAT_DENTRY_NAME_LEN
+#define EXFAT_DENTRY_NAME_LEN     40
+#endif
+
 /* File information structure */
 typedef struct {
   char name[EXFAT_MAX_NAME + 1];  /* File/directory name (UTF-8) */
   uint64_t size;                   /* File size in bytes */
   uint8_t attr;                    /* File attributes */
   uint32_t start_cluster;          /* Starting cluster */
+  uint8_t contiguous;              /* NoFatChain: clusters are contiguous, FAT not used */
   uint16_t create_date;            /* Creation date (DOS format) */
   uint16_t create_time;            /* Creation time (DOS format) */
   uint16_t modify_date;            /* Modification date (DOS format) */
@@ -63,6 +84,7 @@ typedef struct {
 typedef struct {
   uint8_t is_open;                 /* File is open */
   uint8_t is_dir;                  /* Is directory */
+  uint8_t contiguous;              /* NoFatChain: clusters are contiguous */
   uint32_t start_cluster;          /* Starting cluster */
   uint32_t current_cluster;        /* Current cluster being read */
   uint64_t size;                   /* Total size */
@@ -73,7 +95,9 @@ typedef struct {
 /* Directory handle for enumeration */
 typedef struct {
   uint8_t is_open;                 /* Directory is open */
+  uint8_t contiguous;              /* NoFatChain: clusters are contiguous */
   uint32_t start_cluster;          /* Starting cluster of directory */
+  uint32_t end_cluster;            /* First cluster past a contiguous directory */
   uint32_t current_cluster;        /* Current cluster */
   uint32_t entry_offset;           /* Current entry offset in cluster */
 } ExFAT_Dir;
@@ -102,6 +126,14 @@ ExFAT_Result ExFAT_Init(void);
   */
 ExFAT_Result ExFAT_DeInit(void);
 
+/**
+  * @brief  Drop cached FAT sectors and directory lookups
+  * @note   Call when the card may have been written by someone else
+  *         (USB MSC, FatFS) since the last read. SD_SetMode does this on
+  *         every mode switch; no exFAT call may be in progress then.
+  */
+void ExFAT_InvalidateCache(void);
+
 /**
   * @brief  Check if exFAT filesystem is initialized
   * @retval 1 if initialized, 0 otherwise
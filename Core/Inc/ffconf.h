@@ -22,11 +22,11 @@
 #define FF_USE_MKFS		0
 /* Disable f_mkfs (not needed for read-only) */
 
-#define FF_USE_FASTSEEK	0
-/* Disable fast seek */
+#define FF_USE_FASTSEEK	1
+/* Enable fast seek (cluster link maps for JPEG input files) */
 
-#define FF_USE_EXPAND	0
-/* Disable f_expand */
+#define FF_USE_EXPAND	1
+/* Enable f_expand (contiguous pre-allocation of JPEG output files) */
 
 #define FF_USE_CHMOD	0
 /* Disable chmod/utime */
@@ -8,6 +8,7 @@
 #define FS_READER_H
 
 #include "tx_api.h"
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +56,14 @@ void FS_Reader_SetChangeCallback(FS_ChangeCallback_t callback);
   */
 int FS_Reader_IsMounted(void);
 
+/**
+  * @brief  Get the mount generation.
+  *         Changes every time the filesystem is (re)mounted, so caches of
+  *         on-card data can tell that MSC mode may have changed the card.
+  * @retval Generation counter (0 = never mounted).
+  */
+uint32_t FS_Reader_GetMountGeneration(void);
+
 /**
   * @brief  Unmount the filesystem.
   *         Call this before switching to MSC mode.
@@ -0,0 +1,113 @@
+/**
+  ******************************************************************************
+  * @file    jpeg_manifest.h
+  * @brief   JPEG manifest - persistent record of converted .bin files
+  ******************************************************************************
+  * One hidden journal file per volume lists every .bin that was converted
+  * (path hash, size, timestamp, status). It is loaded into a RAM hash table
+  * on first use after each mount, so a scan can skip converted files without
+  * an f_stat per file. New results are appended; the file is rewritten
+  * without stale records once they dominate. A .bin whose size or timestamp
+  * no longer match its record (e.g. replaced over MSC) counts as new.
+  ******************************************************************************
+  */
+#ifndef JPEG_MANIFEST_H
+#define JPEG_MANIFEST_H
+
+#include "ff.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Configuration ------------------------------------------------------------ */
+
+/* Manifest location (hidden from the scanner and the FS monitor) */
+#ifndef JPEG_MANIFEST_PATH
+#define JPEG_MANIFEST_PATH              "/.jpeg_manifest"
+#endif
+
+/* Hash table slots (power of two); at most 3/4 of them are used */
+#ifndef JPEG_MANIFEST_TABLE_SIZE
+#define JPEG_MANIFEST_TABLE_SIZE        512U
+#endif
+
+/* Records buffered in RAM before they are appended to the journal */
+#ifndef JPEG_MANIFEST_PENDING_MAX
+#define JPEG_MANIFEST_PENDING_MAX       32U
+#endif
+
+/* Compact once the journal holds this many records and twice the live ones */
+#ifndef JPEG_MANIFEST_COMPACT_MIN
+#define JPEG_MANIFEST_COMPACT_MIN       128U
+#endif
+
+/* Public types ------------------------------------------------------------- */
+
+/**
+  * @brief  Outcome recorded for a .bin file.
+  */
+typedef enum {
+    JPEG_MANIFEST_CONVERTED = 1,    /**< .jpg written (or found next to it) */
+    JPEG_MANIFEST_FAILED    = 2     /**< Content cannot be encoded; not retried until it changes */
+} JPEG_Manifest_Status_t;
+
+/**
+  * @brief  Manifest counters (current mount).
+  */
+typedef struct {
+    uint32_t entries;       /**< Live entries in the table */
+    uint32_t journal;       /**< Records in the journal file */
+    uint32_t hits;          /**< Lookups that matched size and timestamp */
+    uint32_t stale;         /**< Lookups whose size or timestamp changed */
+    uint32_t misses;        /**< Lookups with no entry */
+} JPEG_Manifest_Stats_t;
+
+/* Public functions --------------------------------------------------------- */
+
+/**
+  * @brief  Create the manifest lock. Call once before the scheduler starts.
+  */
+void JPEG_Manifest_Init(void);
+
+/**
+  * @brief  Look up the outcome recorded for a .bin in its current version.
+  *         A CONVERTED entry only says the .jpg was written once; the caller
+  *         still has to see it on disk (it may have been deleted over MSC).
+  * @param  bin_path  Full path of the .bin file
+  * @param  fno       Directory entry of the .bin (size and timestamp)
+  * @retval Recorded status if size and timestamp match, 0 otherwise.
+  */
+int JPEG_Manifest_Lookup(const char *bin_path, const FILINFO *fno);
+
+/**
+  * @brief  Record the outcome for a .bin (buffered, see JPEG_Manifest_Sync).
+  * @param  bin_path  Full path of the .bin file
+  * @param  fno       Directory entry of the .bin (size and timestamp)
+  * @param  status    Outcome to record
+  */
+void JPEG_Manifest_Record(const char *bin_path, const FILINFO *fno, JPEG_Manifest_Status_t status);
+
+/**
+  * @brief  Same as JPEG_Manifest_Record, reading size and timestamp with f_stat.
+  */
+void JPEG_Manifest_RecordFile(const char *bin_path, JPEG_Manifest_Status_t status);
+
+/**
+  * @brief  Append buffered records to the journal, compacting if due.
+  *         Call after a batch and before the volume is unmounted.
+  */
+void JPEG_Manifest_Sync(void);
+
+/**
+  * @brief  Get a copy of the manifest counters.
+  * @param  stats: Destination
+  */
+void JPEG_Manifest_GetStats(JPEG_Manifest_Stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JPEG_MANIFEST_H */
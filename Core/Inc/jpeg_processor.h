@@ -35,6 +35,85 @@ extern "C" {
 #define JPEG_PROCESSOR_QUALITY          90
 #endif
 
+/* White balance mode (JPEG_AWB_MODE_FIXED keeps the calibrated gains).
+ * Auto modes pre-scan a sparse sample grid through f_lseek before encoding. */
+#ifndef JPEG_PROCESSOR_AWB_MODE
+#define JPEG_PROCESSOR_AWB_MODE         JPEG_AWB_MODE_FIXED
+#endif
+
+/* MCU rows between progress callbacks. Each callback yields the CPU
+ * (tx_thread_relinquish) and checks for an abort request. */
+#ifndef JPEG_PROCESSOR_PROGRESS_MCU_ROWS
+#define JPEG_PROCESSOR_PROGRESS_MCU_ROWS  2
+#endif
+
+/* Progress is logged over CDC every this many percent (0 = off) */
+#ifndef JPEG_PROCESSOR_PROGRESS_LOG_PCT
+#define JPEG_PROCESSOR_PROGRESS_LOG_PCT   25
+#endif
+
+/* Input read-ahead chunk in bytes (power of two, multiple of 512).
+ * Chunks start at multiples of this size in the file, so each one is
+ * sector- and cluster-aligned and FatFs reads it with one multi-block
+ * command straight into the read-ahead buffer. */
+#ifndef JPEG_PROCESSOR_READAHEAD_SIZE
+#define JPEG_PROCESSOR_READAHEAD_SIZE   (16U * 1024U)
+#endif
+
+/* Output coalescing buffer in bytes (power of two, multiple of 512).
+ * Encoder output is collected here and written with one f_write per
+ * full buffer, so every write but the last starts on a buffer-sized
+ * (and therefore sector-aligned) file offset. */
+#ifndef JPEG_PROCESSOR_WRITE_BUF_SIZE
+#define JPEG_PROCESSOR_WRITE_BUF_SIZE   (16U * 1024U)
+#endif
+
+/* Output buffers in the write-behind ring. Full buffers are written by
+ * the writer thread while the encoder fills the next one; the encoder
+ * only blocks when all of them are queued. 1 = no overlap. */
+#ifndef JPEG_PROCESSOR_WRITE_BUFS
+#define JPEG_PROCESSOR_WRITE_BUFS       3U
+#endif
+
+/* Fast-seek link map size in DWORDs for the input file.
+ * Holds (size - 1) / 2 fragments; a more fragmented file is read
+ * through the FAT as before. */
+#ifndef JPEG_PROCESSOR_CLMT_SIZE
+#define JPEG_PROCESSOR_CLMT_SIZE        64U
+#endif
+
+/* Input reader thread. While the encoder works on one raw strip the
+ * reader fetches the next one; it must outrank the encoding thread so a
+ * submitted read starts at once and then sleeps on the SD transfer.
+ * Set JPEG_PROCESSOR_ASYNC_READ to 0 to read inline on the encoder thread. */
+#ifndef JPEG_PROCESSOR_ASYNC_READ
+#define JPEG_PROCESSOR_ASYNC_READ             1
+#endif
+
+#ifndef JPEG_PROCESSOR_READER_PRIORITY
+#define JPEG_PROCESSOR_READER_PRIORITY        15U
+#endif
+
+#ifndef JPEG_PROCESSOR_READER_STACK_SIZE
+#define JPEG_PROCESSOR_READER_STACK_SIZE      3072U  /* f_read + SD driver */
+#endif
+
+/* Output writer thread. Like the reader it outranks the encoding thread
+ * so a queued buffer goes to the card at once; it sleeps through the
+ * transfer and the card's program busy time.
+ * Set JPEG_PROCESSOR_ASYNC_WRITE to 0 to write inline on the encoder thread. */
+#ifndef JPEG_PROCESSOR_ASYNC_WRITE
+#define JPEG_PROCESSOR_ASYNC_WRITE            1
+#endif
+
+#ifndef JPEG_PROCESSOR_WRITER_PRIORITY
+#define JPEG_PROCESSOR_WRITER_PRIORITY        16U
+#endif
+
+#ifndef JPEG_PROCESSOR_WRITER_STACK_SIZE
+#define JPEG_PROCESSOR_WRITER_STACK_SIZE      3072U  /* f_write + SD driver */
+#endif
+
 /* Maximum file size to process (to avoid memory issues) */
 #ifndef JPEG_PROCESSOR_MAX_FILE_SIZE
 #define JPEG_PROCESSOR_MAX_FILE_SIZE    (2 * 1024 * 1024)  /* 2 MB */
@@ -55,9 +134,16 @@ typedef enum {
     JPEG_PROC_ERR_ENCODE,
     JPEG_PROC_ERR_CREATE_OUTPUT,
     JPEG_PROC_ERR_WRITE_OUTPUT,
-    JPEG_PROC_ERR_FS_NOT_MOUNTED
+    JPEG_PROC_ERR_FS_NOT_MOUNTED,
+    JPEG_PROC_ERR_ABORTED
 } JPEG_Processor_Status_t;
 
+/**
+  * @brief  Poll hook called from the encode progress callback.
+  *         Runs on the encoding thread; return non-zero to abort the encode.
+  */
+typedef int (*JPEG_Processor_PollHook_t)(void);
+
 /**
   * @brief  Configuration for the JPEG processor.
   */
@@ -87,6 +173,15 @@ JPEG_Processor_Status_t JPEG_Processor_Init(void);
 JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path, 
                                                     const JPEG_Processor_Config_t *config);
 
+/**
+  * @brief  Install a hook polled at every progress callback (NULL to remove).
+  *         Lets the thread running the encode keep servicing its own inputs.
+  *         A non-zero return stops the encode with JPEG_PROC_ERR_ABORTED and
+  *         the partial .jpg is deleted; this is the only way to abort one.
+  * @param  hook  Poll function, returns non-zero to abort
+  */
+void JPEG_Processor_SetPollHook(JPEG_Processor_PollHook_t hook);
+
 /**
   * @brief  Get the last encoding time in milliseconds.
   * @retval Time in milliseconds for the last successful encoding.
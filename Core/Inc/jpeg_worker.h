@@ -0,0 +1,137 @@
+/**
+  ******************************************************************************
+  * @file    jpeg_worker.h
+  * @brief   JPEG worker - queued .bin to JPEG conversions on their own thread
+  ******************************************************************************
+  * Scanners and the filesystem monitor submit jobs (path + config); a
+  * dedicated thread runs JPEG_Processor_ConvertFile for each one, so the
+  * submitting thread never blocks on an encode.
+  ******************************************************************************
+  */
+#ifndef JPEG_WORKER_H
+#define JPEG_WORKER_H
+
+#include "tx_api.h"
+#include "jpeg_processor.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Configuration ------------------------------------------------------------ */
+
+/* Jobs that can be pending at once (queued + running) */
+#ifndef JPEG_WORKER_QUEUE_DEPTH
+#define JPEG_WORKER_QUEUE_DEPTH         16U
+#endif
+
+/* Worker thread. Keep it below the button thread (20) so clicks are still
+ * seen during an encode; the JPEG reader/writer threads must outrank it. */
+#ifndef JPEG_WORKER_PRIORITY
+#define JPEG_WORKER_PRIORITY            22U
+#endif
+
+#ifndef JPEG_WORKER_STACK_SIZE
+#define JPEG_WORKER_STACK_SIZE          8192U  /* FatFS + JPEG encoding */
+#endif
+
+/* Longest .bin path a job can carry, including the terminator */
+#ifndef JPEG_WORKER_PATH_LEN
+#define JPEG_WORKER_PATH_LEN            128U
+#endif
+
+/* Public types ------------------------------------------------------------- */
+
+/**
+  * @brief  Job priority. High jobs go to the front of the queue.
+  */
+typedef enum {
+    JPEG_JOB_PRIO_NORMAL = 0,
+    JPEG_JOB_PRIO_HIGH
+} JPEG_Job_Priority_t;
+
+/**
+  * @brief  Result of JPEG_Worker_Submit.
+  */
+typedef enum {
+    JPEG_JOB_QUEUED = 0,        /**< Job accepted */
+    JPEG_JOB_DUPLICATE,         /**< Same path already queued, nothing added */
+    JPEG_JOB_QUEUE_FULL,        /**< No free job slot within wait_ticks */
+    JPEG_JOB_INVALID            /**< Worker not running or path too long */
+} JPEG_Job_Result_t;
+
+/**
+  * @brief  Worker counters (since boot).
+  */
+typedef struct {
+    uint32_t queued;        /**< Jobs accepted */
+    uint32_t completed;     /**< Conversions that succeeded */
+    uint32_t failed;        /**< Conversions that returned an error */
+    uint32_t cancelled;     /**< Jobs cancelled before or while running */
+    uint32_t duplicates;    /**< Submits dropped because the path was queued */
+    uint32_t rejected;      /**< Submits refused with the queue full */
+    uint32_t depth;         /**< Jobs waiting right now */
+    uint32_t max_depth;     /**< Highest depth seen */
+} JPEG_Worker_Stats_t;
+
+/* Public functions --------------------------------------------------------- */
+
+/**
+  * @brief  Create the worker thread and its job queue.
+  *         Call after JPEG_Processor_Init, before the scheduler starts.
+  *         Installs the processor poll hook used for cancellation.
+  * @retval TX_SUCCESS on success, error code otherwise.
+  */
+UINT JPEG_Worker_Init(void);
+
+/**
+  * @brief  Queue a conversion.
+  * @param  bin_path    Full path to the .bin file (copied)
+  * @param  config      Optional configuration (copied, NULL for defaults)
+  * @param  priority    JPEG_JOB_PRIO_HIGH jumps ahead of normal jobs
+  * @param  wait_ticks  How long to wait for a free slot (TX_NO_WAIT, ...)
+  * @retval JPEG_JOB_QUEUED or the reason nothing was queued.
+  */
+JPEG_Job_Result_t JPEG_Worker_Submit(const char *bin_path,
+                                     const JPEG_Processor_Config_t *config,
+                                     JPEG_Job_Priority_t priority,
+                                     ULONG wait_ticks);
+
+/**
+  * @brief  Cancel the queued or running job for a path.
+  * @retval 1 if a job was cancelled, 0 if none matched.
+  */
+int JPEG_Worker_Cancel(const char *bin_path);
+
+/**
+  * @brief  Cancel every queued job and stop the running one.
+  *         The running encode ends at its next progress callback.
+  * @retval Number of jobs cancelled.
+  */
+uint32_t JPEG_Worker_CancelAll(void);
+
+/**
+  * @brief  Check whether any job is queued or running.
+  * @retval 1 if busy, 0 if idle.
+  */
+int JPEG_Worker_IsBusy(void);
+
+/**
+  * @brief  Wait until no job is queued or running.
+  * @param  timeout_ticks  Maximum wait in ticks (TX_WAIT_FOREVER allowed)
+  * @retval 0 once idle, -1 on timeout.
+  */
+int JPEG_Worker_WaitIdle(ULONG timeout_ticks);
+
+/**
+  * @brief  Get a copy of the worker counters.
+  * @param  stats: Destination
+  */
+void JPEG_Worker_GetStats(JPEG_Worker_Stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JPEG_WORKER_H */
@@ -27,6 +27,31 @@
 
 #define LOG_MAX_LENGTH 128
 
+/* Log ring size in bytes (power of two). Holds boot logs until a
+ * terminal connects; messages that do not fit are dropped and counted. */
+#ifndef LOG_RING_SIZE
+    #define LOG_RING_SIZE 4096U
+#endif
+
+/* Largest CDC transfer issued by the flush thread (one USBX write buffer) */
+#ifndef LOG_FLUSH_CHUNK
+    #define LOG_FLUSH_CHUNK 1024U
+#endif
+
+/* LogFlush thread: lowest application priority, the only one that waits on USB */
+#ifndef LOG_FLUSH_PRIORITY
+    #define LOG_FLUSH_PRIORITY 25U
+#endif
+
+#ifndef LOG_FLUSH_STACK_SIZE
+    #define LOG_FLUSH_STACK_SIZE 2048U
+#endif
+
+/* How often LogFlush re-checks DTR while idle */
+#ifndef LOG_FLUSH_POLL_MS
+    #define LOG_FLUSH_POLL_MS 100U
+#endif
+
 /* Color codes for terminal output */
 #define LOG_COLOR_RESET   "\033[0m"
 #define LOG_COLOR_RED     "\033[0;31m"
@@ -40,6 +65,7 @@ void Logger_Log(int level, const char *message);
 void Logger_SetCdcInstance(UX_SLAVE_CLASS_CDC_ACM *instance);
 int Logger_IsReady(void);
 void Logger_Run(void);
+uint32_t Logger_GetDropped(void);
 
 /* Simple logging macros */
 #define LOG_DEBUG(message) Logger_Log(LOG_LEVEL_DEBUG, message)
@@ -0,0 +1,141 @@
+/**
+  ******************************************************************************
+  * @file    msc_storage.h
+  * @brief   MSC storage pipeline - read-ahead, staged writes and write-back cache
+  ******************************************************************************
+  * The USBX storage callbacks go through here instead of calling SD_Read /
+  * SD_Write directly. A background thread overlaps the card with the USB
+  * bus: while one chunk travels over USB, the next sequential chunk is
+  * read ahead, or the previous write chunk is being programmed.
+  *
+  * Small writes (FAT, bitmap, directory and .DS_Store updates) land in a
+  * write-back sector cache instead: rewrites of a sector merge in RAM and
+  * the cache goes to the card as runs of adjacent sectors, one multi-block
+  * write each, on SYNCHRONIZE CACHE, eject, idle, mode switch, or when full.
+  *
+  * Writes are acknowledged once copied into RAM. A failure found later is
+  * reported on the next write, SYNCHRONIZE CACHE or eject, or logged if
+  * a mode switch ends MSC first.
+  ******************************************************************************
+  */
+#ifndef MSC_STORAGE_H
+#define MSC_STORAGE_H
+
+#include "tx_api.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Configuration ------------------------------------------------------------ */
+
+/* Staging / read-ahead buffer, in sectors. Match the MSC bulk buffer
+ * (UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE) so one media call fits. */
+#ifndef MSC_STORAGE_STAGE_SECTORS
+#define MSC_STORAGE_STAGE_SECTORS       32U
+#endif
+
+/* Consecutive reads (each starting where the last ended) before the next
+ * extent is read ahead */
+#ifndef MSC_STORAGE_SEQ_THRESHOLD
+#define MSC_STORAGE_SEQ_THRESHOLD       1U
+#endif
+
+/* Write-back cache size, in sectors (512 bytes each) */
+#ifndef MSC_STORAGE_CACHE_SECTORS
+#define MSC_STORAGE_CACHE_SECTORS       64U
+#endif
+
+/* Writes of at most this many sectors go to the cache; longer ones
+ * (file data) are staged and programmed directly */
+#ifndef MSC_STORAGE_CACHE_MAX_WRITE
+#define MSC_STORAGE_CACHE_MAX_WRITE     8U
+#endif
+
+/* Flush the cache once the host has been quiet this long */
+#ifndef MSC_STORAGE_IDLE_FLUSH_MS
+#define MSC_STORAGE_IDLE_FLUSH_MS       500U
+#endif
+
+/* I/O thread. It outranks the USBX storage class thread (20) so a
+ * submitted transfer starts at once, then sleeps on the SD interrupt. */
+#ifndef MSC_STORAGE_PRIORITY
+#define MSC_STORAGE_PRIORITY            18U
+#endif
+
+#ifndef MSC_STORAGE_STACK_SIZE
+#define MSC_STORAGE_STACK_SIZE          1536U  /* SD driver only */
+#endif
+
+/* Public types ------------------------------------------------------------- */
+
+/**
+  * @brief  MSC storage counters (since boot).
+  */
+typedef struct {
+    uint32_t read_sectors;      /**< Sectors read by the host */
+    uint32_t readahead_hits;    /**< Of those, sectors served from read-ahead */
+    uint32_t prefetches;        /**< Read-ahead transfers issued */
+    uint32_t write_sectors;     /**< Sectors written by the host */
+    uint32_t staged_writes;     /**< Writes acknowledged before programming */
+    uint32_t cached_sectors;    /**< Sectors written into the cache */
+    uint32_t merged_sectors;    /**< Of those, rewrites of a sector already cached */
+    uint32_t cache_flushes;     /**< Flushes that wrote something */
+    uint32_t flush_writes;      /**< Multi-block writes issued by flushes */
+    uint32_t write_errors;      /**< Background writes that failed */
+} MSC_StorageStats_t;
+
+/* Public functions --------------------------------------------------------- */
+
+/**
+  * @brief  Create the I/O thread. Call from App_ThreadX_Init after SD_Init.
+  *         Until then (or if it fails) reads and writes are synchronous.
+  * @retval TX_SUCCESS on success, error code otherwise.
+  */
+UINT MSC_Storage_Init(void);
+
+/**
+  * @brief  Read sectors for the host.
+  * @param  buffer: Destination (the MSC bulk IN buffer)
+  * @param  lba: First sector
+  * @param  count: Number of sectors
+  * @retval 0 on success, -1 on error
+  */
+int MSC_Storage_Read(uint8_t *buffer, uint32_t lba, uint32_t count);
+
+/**
+  * @brief  Write sectors for the host. Returns once the data is staged or
+  *         cached; programming completes in the background or at a flush.
+  * @param  buffer: Source (the MSC bulk OUT buffer, reused on return)
+  * @param  lba: First sector
+  * @param  count: Number of sectors
+  * @retval 0 on success, -1 on error (including an earlier staged or
+  *         cached write that failed, or MSC mode having ended)
+  */
+int MSC_Storage_Write(const uint8_t *buffer, uint32_t lba, uint32_t count);
+
+/**
+  * @brief  Wait until every staged and cached write is on the card.
+  *         Called for SYNCHRONIZE CACHE and on eject.
+  * @retval 0 on success, -1 if a write failed since the last check
+  */
+int MSC_Storage_Flush(void);
+
+/**
+  * @brief  Flush (a failure is logged, not returned), then drop read-ahead data.
+  *         Called by SD_SetMode: the other side may rewrite any sector.
+  */
+void MSC_Storage_Invalidate(void);
+
+/**
+  * @brief  Get a copy of the counters.
+  * @param  stats: Destination
+  */
+void MSC_Storage_GetStats(MSC_StorageStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSC_STORAGE_H */
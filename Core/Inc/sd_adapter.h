@@ -6,7 +6,10 @@
   * Thin wrapper around HAL SD functions to:
   * - Provide single entry point for read/write
   * - Handle wait-for-ready in one place
-  * - Track write source (MSC vs FatFS) for future coordination
+  * - Track write source (MSC vs FatFS) and the sector ranges written, so
+  *   the filesystem monitor can rescan only what changed
+  * - Run transfers on the SDMMC IDMA and block the calling thread on a
+  *   semaphore (released from the SDMMC interrupt) instead of polling
   *
   * This is NOT thread-safe by design - the existing code works without
   * mutex protection because USB MSC and FatFS naturally don't collide
@@ -31,6 +34,31 @@ typedef enum {
     SD_SOURCE_MSC
 } SD_Source_t;
 
+/**
+  * @brief  Inclusive range of sectors
+  */
+typedef struct {
+    uint32_t first;     /**< First sector */
+    uint32_t last;      /**< Last sector */
+} SD_LbaRange_t;
+
+/* Ranges held by the dirty map; when it is full the two closest merge */
+#ifndef SD_DIRTY_MAX_RANGES
+#define SD_DIRTY_MAX_RANGES     32U
+#endif
+
+/**
+  * @brief  Sectors written since the map was last taken, as sorted,
+  *         non-adjacent ranges. Merging may make it cover more sectors
+  *         than were written, never fewer.
+  */
+typedef struct {
+    SD_LbaRange_t ranges[SD_DIRTY_MAX_RANGES];
+    uint32_t      count;            /**< Ranges in use */
+    uint32_t      msc_sectors;      /**< Sectors written by MSC (with repeats) */
+    uint32_t      fatfs_sectors;    /**< Sectors written by FatFS (with repeats) */
+} SD_DirtyMap_t;
+
 /**
   * @brief  SD access mode - only one can be active at a time
   */
@@ -39,6 +67,13 @@ typedef enum {
     SD_MODE_MSC          /**< MSC has exclusive access, FatFS is unmounted */
 } SD_Mode_t;
 
+/**
+  * @brief  Create the RTOS objects used for DMA transfers.
+  *         Call from App_ThreadX_Init. Before this (and outside thread
+  *         context) SD_Read/SD_Write fall back to polled transfers.
+  */
+void SD_Init(void);
+
 /**
   * @brief  Get current SD access mode.
   * @retval Current mode (SD_MODE_FATFS or SD_MODE_MSC)
@@ -48,7 +83,8 @@ SD_Mode_t SD_GetMode(void);
 /**
   * @brief  Set SD access mode.
   *         Caller is responsible for unmounting FatFS before switching to MSC
-  *         and remounting FatFS after switching back.
+  *         and remounting FatFS after switching back. Flushes staged MSC
+  *         writes and drops the disk and exFAT reader caches.
   * @param  mode: New mode
   */
 void SD_SetMode(SD_Mode_t mode);
@@ -96,6 +132,22 @@ SD_Source_t SD_GetLastWriteSource(void);
   */
 void SD_ClearWriteSource(void);
 
+/**
+  * @brief  Copy the dirty map and start a new, empty one.
+  *         Writes completing after this call go into the new map.
+  * @param  map: Destination
+  */
+void SD_DirtyMap_Take(SD_DirtyMap_t *map);
+
+/**
+  * @brief  Check whether any sector in [first, last] is in a dirty map.
+  * @param  map: Map returned by SD_DirtyMap_Take
+  * @param  first: First sector
+  * @param  last: Last sector (inclusive)
+  * @retval 1 if the range overlaps a dirty range, 0 otherwise
+  */
+int SD_DirtyMap_Overlaps(const SD_DirtyMap_t *map, uint32_t first, uint32_t last);
+
 /**
   * @brief  Get SD card sector count.
   * @retval Number of sectors, or 0 if not ready
@@ -0,0 +1,64 @@
+/**
+  ******************************************************************************
+  * @file    sd_diskio.h
+  * @brief   FatFs diskio driver for STM32 HAL SD card - sector cache control
+  ******************************************************************************
+  * disk_read/disk_write keep a small write-through LRU cache of single
+  * sectors (FAT, allocation bitmap and directory sectors in practice).
+  * Multi-sector data transfers bypass it.
+  ******************************************************************************
+  */
+#ifndef SD_DISKIO_H
+#define SD_DISKIO_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Configuration -------------------------------------------------------------*/
+
+/* Number of 512-byte sectors held by the cache (0 disables it) */
+#ifndef SD_DISKIO_CACHE_SECTORS
+#define SD_DISKIO_CACHE_SECTORS     16U
+#endif
+
+/* Transfers longer than this many sectors bypass the cache */
+#ifndef SD_DISKIO_CACHE_MAX_XFER
+#define SD_DISKIO_CACHE_MAX_XFER    1U
+#endif
+
+/**
+  * @brief  Sector cache counters (since boot or last reset)
+  */
+typedef struct {
+    uint32_t hits;          /**< Sectors served from the cache */
+    uint32_t misses;        /**< Cacheable sectors read from the card */
+    uint32_t bypassed;      /**< Sectors in transfers that skipped the cache */
+    uint32_t invalidations; /**< Full cache flushes (mode switches) */
+} SD_DiskCacheStats_t;
+
+/**
+  * @brief  Drop every cached sector.
+  *         Called by SD_SetMode: the host may rewrite any sector while MSC
+  *         owns the card.
+  */
+void SD_DiskCache_Invalidate(void);
+
+/**
+  * @brief  Get a copy of the cache counters.
+  * @param  stats: Destination
+  */
+void SD_DiskCache_GetStats(SD_DiskCacheStats_t *stats);
+
+/**
+  * @brief  Reset the cache counters (cached data is kept).
+  */
+void SD_DiskCache_ResetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SD_DISKIO_H */
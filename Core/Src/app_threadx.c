@@ -28,6 +28,10 @@
 #include "button_handler.h"
 #include "fs_reader.h"
 #include "jpeg_processor.h"
+#include "jpeg_manifest.h"
+#include "jpeg_worker.h"
+#include "msc_storage.h"
+#include "sd_adapter.h"
 #include "ux_device_class_cdc_acm.h"
 #include <stdio.h>
 #include <string.h>
@@ -54,8 +58,6 @@
 /* Private variables ---------------------------------------------------------*/
 /* USER CODE BEGIN PV */
 
-static TX_THREAD logger_flush_thread;
-static UCHAR logger_flush_thread_stack[1024];
 
 extern UX_SLAVE_CLASS_CDC_ACM *cdc_acm_instance_ptr;
 
@@ -64,7 +66,6 @@ extern UX_SLAVE_CLASS_CDC_ACM *cdc_acm_instance_ptr;
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
 
-static VOID logger_flush_thread_entry(ULONG thread_input);
 
 /* USER CODE END PFP */
 
@@ -85,14 +86,18 @@ UINT App_ThreadX_Init(VOID *memory_ptr)
    * Only create threads/queues - they will start after tx_kernel_enter().
    */
   
-  /* Phase 1: Initialize Logger (for buffered log output) */
+  /* Phase 1: Initialize Logger (creates the LogFlush thread that drains
+   * buffered output to CDC once a terminal connects) */
   Logger_Init();
-  
-  /* Create thread to flush buffered logs after boot */
-  tx_thread_create(&logger_flush_thread, "LogFlush",
-                   logger_flush_thread_entry, 0,
-                   logger_flush_thread_stack, sizeof(logger_flush_thread_stack),
-                   25, 25, TX_NO_TIME_SLICE, TX_AUTO_START);
+
+  /* SD transfers switch from polling to IDMA + semaphore once threads run */
+  SD_Init();
+
+  /* MSC read-ahead / staged writes (synchronous if this fails) */
+  if (MSC_Storage_Init() != TX_SUCCESS)
+  {
+    LOG_WARN_TAG("BOOT", "MSC I/O thread not created, using direct transfers");
+  }
 
   /* Phase 2: Initialize JPEG processor FIRST (button handler depends on it) */
   JPEG_Processor_Status_t jpeg_status = JPEG_Processor_Init();
@@ -105,6 +110,10 @@ UINT App_ThreadX_Init(VOID *memory_ptr)
     LOG_INFO_TAG("BOOT", "JPEG processor ready");
   }
 
+  /* Encoder worker thread: scans and the FS monitor queue jobs to it */
+  JPEG_Manifest_Init();
+  JPEG_Worker_Init();
+
   /* Phase 3: Initialize button handler (uses JPEG processor) */
   ButtonHandler_Init(UX_NULL);
 
@@ -150,20 +159,4 @@ void MX_ThreadX_Init(void)
 
 /* USER CODE BEGIN 1 */
 
-/**
-  * @brief  Logger flush thread - waits 5 seconds then logs init message to flush buffer
-  */
-static VOID logger_flush_thread_entry(ULONG thread_input)
-{
-  TX_PARAMETER_NOT_USED(thread_input);
-
-  /* Wait 5 seconds for terminal to connect */
-  tx_thread_sleep(5U * TX_TIMER_TICKS_PER_SECOND);
-  
-  /* Log init message - this will flush all buffered boot logs */
-  LOG_INFO("Logger initialized");
-  
-  /* Thread exits - no longer needed */
-}
-
 /* USER CODE END 1 */
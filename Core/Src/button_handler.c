@@ -13,6 +13,8 @@
 #include "ff.h"
 #include "fs_reader.h"
 #include "jpeg_processor.h"
+#include "jpeg_manifest.h"
+#include "jpeg_worker.h"
 #include "sd_adapter.h"
 #include "sdmmc.h"
 #include "usb.h"
@@ -20,22 +22,81 @@
 #include <string.h>
 
 /* Private defines -----------------------------------------------------------*/
-#define BUTTON_THREAD_STACK_SIZE  8192U   /* Large stack for FatFS + JPEG encoding */
+#define BUTTON_THREAD_STACK_SIZE  4096U   /* FatFS directory scan, one level at a time */
 #define BUTTON_THREAD_PRIORITY    20U
 #define BUTTON_POLL_MS            10U
 #define BUTTON_DEBOUNCE_COUNT     5U    /* ~50ms at 10ms poll rate for noise rejection */
 #define BUTTON_DOUBLE_CLICK_MS    400U  /* Max time between clicks for double-click */
 #define MAX_PATH_LEN              128U
 #define MAX_SCAN_DEPTH            4U
+#define SCAN_JPG_SET_SIZE         2048U /* .jpg stems per directory (power of two, 3/4 usable) */
+#define SCAN_JPG_NAMES_SIZE       (16U * 1024U) /* .jpg stem text per directory */
+#define SCAN_ARENA_SIZE           (16U * 1024U) /* .bin names per directory (known failures excluded) */
+#define SCAN_DIR_STACK_SIZE       1024U /* Pending subdirectory paths */
+
+/* Result of one debounced button sample */
+typedef enum {
+  BUTTON_SAMPLE_STABLE = 0,   /* Reading matches the stable state */
+  BUTTON_SAMPLE_CHANGING,     /* Transition in progress or release accepted */
+  BUTTON_SAMPLE_PRESSED       /* Press accepted */
+} Button_Sample_t;
+
+/* A .bin file waiting for its directory to be fully read (arena record) */
+typedef struct {
+    FSIZE_t  fsize;         /* Size and timestamp, for the manifest */
+    WORD     fdate;
+    WORD     ftime;
+    uint32_t stem_hash;     /* scan_stem_hash() of the name */
+    uint16_t next;          /* Arena offset of the next record */
+    uint8_t  recorded;      /* JPEG_Manifest_Lookup() result, 0 if none */
+    char     name[];        /* File name, NUL-terminated */
+} scan_bin_t;
 
 /* Private variables ---------------------------------------------------------*/
 static TX_THREAD button_thread;
 static UCHAR button_thread_stack[BUTTON_THREAD_STACK_SIZE];
 
+/* Debounce and click state */
+static GPIO_PinState stable_state = GPIO_PIN_RESET;
+static uint32_t consecutive_count = 0U;
+static uint32_t last_press_tick = 0U;
+static int pending_click = 0;     /* One click seen, waiting for a potential second */
+static int click_cancelled = 0;   /* Pending click already used to stop an encode */
+static int scan_aborted = 0;      /* Stop the current .bin scan */
+static uint32_t scan_queued = 0;  /* Jobs queued by the current scan */
+static uint32_t scan_known = 0;   /* .bin files the manifest already covers */
+
+/* Scanner working set (button thread only) */
+static uint32_t scan_jpg_set[SCAN_JPG_SET_SIZE];
+static uint16_t scan_jpg_stem[SCAN_JPG_SET_SIZE];   /* Offset of each slot's stem in scan_jpg_names */
+static char scan_jpg_names[SCAN_JPG_NAMES_SIZE];
+static uint32_t scan_jpg_count = 0;
+static uint32_t scan_jpg_names_used = 0;
+static uint8_t scan_arena[SCAN_ARENA_SIZE] __attribute__((aligned(8)));
+static char scan_dir_stack[SCAN_DIR_STACK_SIZE];
+static size_t scan_dir_top = 0;
+static char scan_dir_path[MAX_PATH_LEN];  /* Directory being scanned */
+static char scan_path[MAX_PATH_LEN];      /* Entry path being built */
+static FILINFO scan_fno;                  /* Arena record expanded for the manifest */
+
 /* Private function prototypes -----------------------------------------------*/
 static VOID button_thread_entry(ULONG thread_input);
-static void scan_and_process_bin_files(const char *path, int depth);
+static void scan_and_process_bin_files(void);
+static void scan_directory(const char *path, uint8_t depth);
+static void scan_pair_arena(const char *path, uint32_t used, int set_overflow);
 static int check_jpg_exists(const char *bin_path);
+static void scan_queue_file(const char *bin_path);
+static void scan_handle_bin(const char *bin_path, const FILINFO *fno, int recorded, int check_disk);
+static uint32_t scan_stem_hash(const char *name, size_t name_len);
+static int scan_has_ext(const char *name, size_t name_len, const char *ext);
+static int scan_stem_equal(const char *name, size_t stem_len, const char *stem);
+static int scan_jpg_set_add(uint32_t stem_hash, const char *name, size_t name_len);
+static int scan_jpg_set_has(uint32_t stem_hash, const char *name, size_t name_len);
+static int scan_join_path(char *out, const char *dir, const char *name);
+static int scan_dir_push(const char *path, uint8_t depth);
+static int scan_dir_pop(char *path, uint8_t *depth);
+static Button_Sample_t button_sample(void);
+static int button_cancel_poll(void);
 
 /* Public functions ----------------------------------------------------------*/
 
@@ -97,133 +158,476 @@ static int check_jpg_exists(const char *bin_path)
 }
 
 /**
-  * @brief  Recursively scan directory for .bin files without .jpg counterparts.
-  * @param  path: Directory path to scan
-  * @param  depth: Current recursion depth
+  * @brief  Queue one .bin file for the encoder worker.
+  *         While the queue is full, keeps sampling the button so a press
+  *         still stops the scan.
+  * @param  bin_path: Path to the .bin file
   */
-static void scan_and_process_bin_files(const char *path, int depth)
+static void scan_queue_file(const char *bin_path)
 {
-    DIR dir;
-    FILINFO fno;
-    FRESULT res;
-    char full_path[MAX_PATH_LEN];
-    uint32_t elapsed_ms;
-    int files_found = 0;
-    int bins_processed = 0;
+    for (;;)
+    {
+        JPEG_Job_Result_t result = JPEG_Worker_Submit(bin_path, NULL, JPEG_JOB_PRIO_NORMAL, TX_NO_WAIT);
+        
+        if (result == JPEG_JOB_QUEUED)
+        {
+            scan_queued++;
+            return;
+        }
+        if (result != JPEG_JOB_QUEUE_FULL)
+        {
+            LOG_DEBUG_TAG("BTN", "Not queued (%d): %s", (int)result, bin_path);
+            return;
+        }
+        
+        /* Queue full: wait one poll period for the worker to take a job */
+        tx_thread_sleep(TX_TIMER_TICKS_PER_SECOND / (1000U / BUTTON_POLL_MS));
+        if (button_cancel_poll())
+        {
+            return;
+        }
+    }
+}
+
+/**
+  * @brief  Case-insensitive FNV-1a hash of a file name without its
+  *         4-character extension, so "a.bin" and "A.JPG" hash the same.
+  */
+static uint32_t scan_stem_hash(const char *name, size_t name_len)
+{
+    uint32_t h = 2166136261UL;
+    size_t i;
     
-    if (depth >= MAX_SCAN_DEPTH)
+    for (i = 0; i + 4U < name_len; i++)
     {
-        return;
+        char c = name[i];
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+            c = (char)(c - 'A' + 'a');
+        }
+        h ^= (uint8_t)c;
+        h *= 16777619UL;
     }
     
-    LOG_DEBUG_TAG("BTN", "Scanning: %s (depth=%d)", path, depth);
+    return (h != 0U) ? h : 1U;  /* 0 marks an empty set slot */
+}
+
+/**
+  * @brief  Check a file name extension (".xyz", case-insensitive).
+  */
+static int scan_has_ext(const char *name, size_t name_len, const char *ext)
+{
+    size_t i;
     
-    /* Check if filesystem is still mounted */
-    if (!FS_Reader_IsMounted())
+    if (name_len <= 4U)
     {
-        LOG_ERROR_TAG("BTN", "FS not mounted!");
-        return;
+        return 0;
     }
     
-    res = f_opendir(&dir, path);
-    if (res != FR_OK)
+    name += name_len - 4U;
+    for (i = 0; i < 4U; i++)
     {
-        LOG_ERROR_TAG("BTN", "opendir failed: %s (err=%d)", path, (int)res);
-        return;
+        char c = name[i];
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+            c = (char)(c - 'A' + 'a');
+        }
+        if (c != ext[i])
+        {
+            return 0;
+        }
     }
+    return 1;
+}
+
+/**
+  * @brief  Compare the first stem_len characters of name with a stored
+  *         NUL-terminated stem, case-insensitive.
+  */
+static int scan_stem_equal(const char *name, size_t stem_len, const char *stem)
+{
+    size_t i;
     
-    LOG_DEBUG_TAG("BTN", "opendir OK, starting readdir loop");
+    for (i = 0; i < stem_len; i++)
+    {
+        char a = name[i];
+        char b = stem[i];
+        if ((a >= 'A') && (a <= 'Z'))
+        {
+            a = (char)(a - 'A' + 'a');
+        }
+        if ((b >= 'A') && (b <= 'Z'))
+        {
+            b = (char)(b - 'A' + 'a');
+        }
+        if ((a != b) || (b == '\0'))
+        {
+            return 0;
+        }
+    }
+    return (stem[stem_len] == '\0') ? 1 : 0;
+}
+
+/**
+  * @brief  Add a .jpg stem to the directory set. The stem text is kept so a
+  *         hash hit can be confirmed; colliding stems get their own slots.
+  * @retval 0 on success, -1 once the set is 3/4 full or the text is full.
+  */
+static int scan_jpg_set_add(uint32_t stem_hash, const char *name, size_t name_len)
+{
+    uint32_t idx = stem_hash & (SCAN_JPG_SET_SIZE - 1U);
+    size_t stem_len = name_len - 4U;
     
     for (;;)
     {
-        res = f_readdir(&dir, &fno);
-        if (res != FR_OK)
+        if ((scan_jpg_set[idx] == stem_hash) &&
+            scan_stem_equal(name, stem_len, &scan_jpg_names[scan_jpg_stem[idx]]))
+        {
+            return 0;
+        }
+        if (scan_jpg_set[idx] == 0U)
         {
-            LOG_ERROR_TAG("BTN", "readdir error: %d (sd_init=%d)", (int)res, SDMMC1_IsInitialized());
             break;
         }
-        if (fno.fname[0] == '\0')
+        idx = (idx + 1U) & (SCAN_JPG_SET_SIZE - 1U);
+    }
+    
+    if ((scan_jpg_count >= (SCAN_JPG_SET_SIZE * 3U) / 4U) ||
+        (scan_jpg_names_used + stem_len + 1U > SCAN_JPG_NAMES_SIZE))
+    {
+        return -1;
+    }
+    memcpy(&scan_jpg_names[scan_jpg_names_used], name, stem_len);
+    scan_jpg_names[scan_jpg_names_used + stem_len] = '\0';
+    scan_jpg_stem[idx] = (uint16_t)scan_jpg_names_used;
+    scan_jpg_names_used += stem_len + 1U;
+    scan_jpg_set[idx] = stem_hash;
+    scan_jpg_count++;
+    return 0;
+}
+
+/**
+  * @brief  Look up the stem of a file name (with its 4-character extension)
+  *         in the directory .jpg set; hash hits are confirmed by the text.
+  */
+static int scan_jpg_set_has(uint32_t stem_hash, const char *name, size_t name_len)
+{
+    uint32_t idx = stem_hash & (SCAN_JPG_SET_SIZE - 1U);
+    
+    while (scan_jpg_set[idx] != 0U)
+    {
+        if ((scan_jpg_set[idx] == stem_hash) &&
+            scan_stem_equal(name, name_len - 4U, &scan_jpg_names[scan_jpg_stem[idx]]))
         {
-            break;  /* End of directory */
+            return 1;
         }
-        
-        /* Skip hidden files */
-        if (fno.fname[0] == '.')
+        idx = (idx + 1U) & (SCAN_JPG_SET_SIZE - 1U);
+    }
+    return 0;
+}
+
+/**
+  * @brief  Build "<dir>/<name>" into out.
+  * @retval 0 on success, -1 if it does not fit.
+  */
+static int scan_join_path(char *out, const char *dir, const char *name)
+{
+    int n;
+    
+    if ((dir[0] == '/') && (dir[1] == '\0'))
+    {
+        n = snprintf(out, MAX_PATH_LEN, "/%s", name);
+    }
+    else
+    {
+        n = snprintf(out, MAX_PATH_LEN, "%s/%s", dir, name);
+    }
+    return ((n > 0) && ((size_t)n < MAX_PATH_LEN)) ? 0 : -1;
+}
+
+/**
+  * @brief  Push a directory onto the scan stack.
+  *         Layout per entry: path bytes, '\0', depth, path length.
+  * @retval 0 on success, -1 if the stack is full.
+  */
+static int scan_dir_push(const char *path, uint8_t depth)
+{
+    size_t len = strlen(path);
+    
+    if ((len >= MAX_PATH_LEN) || (scan_dir_top + len + 3U > SCAN_DIR_STACK_SIZE))
+    {
+        return -1;
+    }
+    
+    memcpy(&scan_dir_stack[scan_dir_top], path, len + 1U);
+    scan_dir_top += len + 1U;
+    scan_dir_stack[scan_dir_top++] = (char)depth;
+    scan_dir_stack[scan_dir_top++] = (char)len;
+    return 0;
+}
+
+/**
+  * @brief  Pop the most recently pushed directory.
+  * @retval 1 if a directory was popped, 0 if the stack is empty.
+  */
+static int scan_dir_pop(char *path, uint8_t *depth)
+{
+    size_t len;
+    
+    if (scan_dir_top == 0U)
+    {
+        return 0;
+    }
+    
+    len = (uint8_t)scan_dir_stack[--scan_dir_top];
+    *depth = (uint8_t)scan_dir_stack[--scan_dir_top];
+    scan_dir_top -= len + 1U;
+    memcpy(path, &scan_dir_stack[scan_dir_top], len + 1U);
+    return 1;
+}
+
+/**
+  * @brief  Decide on one .bin file whose .jpg was not seen in the directory:
+  *         queue it, or adopt an existing .jpg into the manifest.
+  * @param  recorded    Manifest status of the .bin (0 if none)
+  * @param  check_disk  Non-zero if the .jpg set is incomplete (overflowed)
+  */
+static void scan_handle_bin(const char *bin_path, const FILINFO *fno, int recorded, int check_disk)
+{
+    if (check_disk && check_jpg_exists(bin_path))
+    {
+        if (recorded == JPEG_MANIFEST_CONVERTED)
         {
-            continue;
+            scan_known++;
+            return;
         }
+        LOG_DEBUG_TAG("BTN", "Skipped (jpg exists): %s", bin_path);
+        JPEG_Manifest_Record(bin_path, fno, JPEG_MANIFEST_CONVERTED);
+        return;
+    }
+    
+    if (recorded == JPEG_MANIFEST_CONVERTED)
+    {
+        LOG_DEBUG_TAG("BTN", "Queueing (jpg missing): %s", bin_path);
+    }
+    else
+    {
+        LOG_DEBUG_TAG("BTN", "Queueing: %s", bin_path);
+    }
+    scan_queue_file(bin_path);
+}
+
+/**
+  * @brief  Pair the .bin files collected in the arena against the .jpg set
+  *         and queue the unmatched ones.
+  * @param  path          Directory path
+  * @param  used          Arena bytes in use
+  * @param  set_overflow  Non-zero if the .jpg set is incomplete
+  */
+static void scan_pair_arena(const char *path, uint32_t used, int set_overflow)
+{
+    uint32_t off = 0;
+    
+    while ((off < used) && !scan_aborted)
+    {
+        const scan_bin_t *bin = (const scan_bin_t *)&scan_arena[off];
+        off = bin->next;
         
-        files_found++;
-        
-        /* Build full path */
-        size_t path_len = strlen(path);
-        if (path_len == 1 && path[0] == '/')
+        if (scan_join_path(scan_path, path, bin->name) != 0)
         {
-            snprintf(full_path, sizeof(full_path), "/%s", fno.fname);
+            continue;
         }
-        else
+        scan_fno.fsize = bin->fsize;
+        scan_fno.fdate = bin->fdate;
+        scan_fno.ftime = bin->ftime;
+        if (scan_jpg_set_has(bin->stem_hash, bin->name, strlen(bin->name)))
         {
-            snprintf(full_path, sizeof(full_path), "%s/%s", path, fno.fname);
+            if (bin->recorded == JPEG_MANIFEST_CONVERTED)
+            {
+                scan_known++;
+                continue;
+            }
+            LOG_DEBUG_TAG("BTN", "Skipped (jpg exists): %s", scan_path);
+            JPEG_Manifest_Record(scan_path, &scan_fno, JPEG_MANIFEST_CONVERTED);
+            continue;
         }
+        scan_handle_bin(scan_path, &scan_fno, bin->recorded, set_overflow);
+    }
+}
+
+/**
+  * @brief  Scan one directory: collect .jpg stems into the hash set, keep
+  *         .bin files except recorded failures, push subdirectories, then
+  *         queue every .bin without a matching .jpg. A manifest CONVERTED
+  *         entry only saves the adopt step; its .jpg must still be present.
+  *         The directory is read once unless its .bin names do not fit the
+  *         arena; then each further pass takes the next batch.
+  * @param  path   Directory path
+  * @param  depth  Directory depth (root = 0)
+  */
+static void scan_directory(const char *path, uint8_t depth)
+{
+    DIR dir;
+    FILINFO fno;
+    FRESULT res;
+    uint32_t files_found = 0;
+    uint32_t bins_found = 0;
+    uint32_t bins_queued = scan_queued;
+    uint32_t batch_start = 0;   /* Index (among .bin entries) of this batch */
+    uint32_t passes = 0;
+    int set_overflow = 0;
+    int more;
+    
+    LOG_DEBUG_TAG("BTN", "Scanning: %s (depth=%u)", path, (unsigned)depth);
+    
+    res = f_opendir(&dir, path);
+    if (res != FR_OK)
+    {
+        LOG_ERROR_TAG("BTN", "opendir failed: %s (err=%d)", path, (int)res);
+        return;
+    }
+    
+    memset(scan_jpg_set, 0, sizeof(scan_jpg_set));
+    scan_jpg_count = 0;
+    scan_jpg_names_used = 0;
+    
+    do
+    {
+        uint32_t bin_index = 0;
+        uint32_t used = 0;
+        int first = (passes == 0U);
+        more = 0;
         
-        if (fno.fattrib & AM_DIR)
+        if (!first && (f_rewinddir(&dir) != FR_OK))
         {
-            LOG_DEBUG_TAG("BTN", "Dir: %s", full_path);
-            /* Recurse into subdirectory */
-            scan_and_process_bin_files(full_path, depth + 1);
+            break;
         }
-        else
+        
+        for (;;)
         {
-            /* Check if it's a .bin file */
+            res = f_readdir(&dir, &fno);
+            if (res != FR_OK)
+            {
+                LOG_ERROR_TAG("BTN", "readdir error: %d (sd_init=%d)", (int)res, SDMMC1_IsInitialized());
+                break;
+            }
+            if (fno.fname[0] == '\0')
+            {
+                break;  /* End of directory */
+            }
+            
+            /* Skip hidden files */
+            if (fno.fname[0] == '.')
+            {
+                continue;
+            }
+            
             size_t name_len = strlen(fno.fname);
-            int is_bin = 0;
+            if (first)
+            {
+                files_found++;
+            }
             
-            if (name_len > 4)
+            if (fno.fattrib & AM_DIR)
             {
-                const char *ext = &fno.fname[name_len - 4];
-                if (ext[0] == '.' &&
-                    (ext[1] == 'b' || ext[1] == 'B') &&
-                    (ext[2] == 'i' || ext[2] == 'I') &&
-                    (ext[3] == 'n' || ext[3] == 'N'))
+                if (first && (depth + 1U < MAX_SCAN_DEPTH) &&
+                    ((scan_join_path(scan_path, path, fno.fname) != 0) ||
+                     (scan_dir_push(scan_path, (uint8_t)(depth + 1U)) != 0)))
                 {
-                    is_bin = 1;
+                    LOG_WARN_TAG("BTN", "Skipping dir (path or stack full): %s/%s", path, fno.fname);
                 }
             }
-            
-            if (is_bin)
+            else if (scan_has_ext(fno.fname, name_len, ".jpg"))
             {
-                LOG_DEBUG_TAG("BTN", "Found .bin: %s", full_path);
+                if (first && (scan_jpg_set_add(scan_stem_hash(fno.fname, name_len), fno.fname, name_len) != 0))
+                {
+                    set_overflow = 1;
+                }
+            }
+            else if (scan_has_ext(fno.fname, name_len, ".bin"))
+            {
+                /* Only the current batch; earlier ones are done, later ones
+                 * wait for the next pass */
+                uint32_t index = bin_index++;
+                if ((index < batch_start) || more)
+                {
+                    continue;
+                }
+                
+                size_t need = (sizeof(scan_bin_t) + name_len + 1U + 7U) & ~(size_t)7U;
+                if (used + need > SCAN_ARENA_SIZE)
+                {
+                    batch_start = index;
+                    more = 1;
+                    continue;
+                }
                 
-                /* Check if .jpg exists */
-                if (!check_jpg_exists(full_path))
+                bins_found++;
+                if ((scan_join_path(scan_path, path, fno.fname) != 0))
                 {
-                    LOG_INFO_TAG("BTN", "Processing: %s", fno.fname);
-                    bins_processed++;
-                    
-                    JPEG_Processor_Status_t status;
-                    TIME_IT(elapsed_ms, status = JPEG_Processor_ConvertFile(full_path, NULL));
-                    
-                    if (status == JPEG_PROC_OK)
-                    {
-                        LOG_INFO_TAG("BTN", "Done: %lu ms, %lu bytes",
-                                     (unsigned long)elapsed_ms,
-                                     (unsigned long)JPEG_Processor_GetLastOutputSize());
-                    }
-                    else
-                    {
-                        LOG_ERROR_TAG("BTN", "Failed: err=%d", (int)status);
-                    }
+                    LOG_WARN_TAG("BTN", "Path too long: %s/%s", path, fno.fname);
+                    continue;
                 }
-                else
+                int recorded = JPEG_Manifest_Lookup(scan_path, &fno);
+                if (recorded == JPEG_MANIFEST_FAILED)
                 {
-                    LOG_DEBUG_TAG("BTN", "Skipped (jpg exists): %s", fno.fname);
+                    scan_known++;   /* Not retried until the .bin changes */
+                    continue;
                 }
+                
+                /* Decide once the whole directory is read: its .jpg may come later */
+                scan_bin_t *bin = (scan_bin_t *)&scan_arena[used];
+                bin->fsize = fno.fsize;
+                bin->fdate = fno.fdate;
+                bin->ftime = fno.ftime;
+                bin->stem_hash = scan_stem_hash(fno.fname, name_len);
+                bin->next = (uint16_t)(used + need);
+                bin->recorded = (uint8_t)recorded;
+                memcpy(bin->name, fno.fname, name_len + 1U);
+                used += need;
+            }
+            
+            if (scan_aborted)
+            {
+                break;
             }
         }
-    }
+        
+        passes++;
+        scan_pair_arena(path, used, set_overflow);
+    } while (more && (res == FR_OK) && !scan_aborted);
     
     f_closedir(&dir);
-    LOG_DEBUG_TAG("BTN", "Dir done: %s (%d files, %d bins)", path, files_found, bins_processed);
+    
+    LOG_DEBUG_TAG("BTN", "Dir done: %s (%lu files, %lu bins, %lu queued, %lu passes)", path,
+                  (unsigned long)files_found, (unsigned long)bins_found,
+                  (unsigned long)(scan_queued - bins_queued), (unsigned long)passes);
+}
+
+/**
+  * @brief  Scan the volume for .bin files without .jpg counterparts.
+  *         Directories are walked depth-first from an explicit stack, one
+  *         open directory at a time; matching files go to the encoder worker,
+  *         which starts on the first one while the walk continues.
+  */
+static void scan_and_process_bin_files(void)
+{
+    uint8_t depth;
+    
+    /* Check if filesystem is still mounted */
+    if (!FS_Reader_IsMounted())
+    {
+        LOG_ERROR_TAG("BTN", "FS not mounted!");
+        return;
+    }
+    
+    scan_dir_top = 0;
+    (void)scan_dir_push("/", 0U);
+    
+    while (!scan_aborted && scan_dir_pop(scan_dir_path, &depth))
+    {
+        scan_directory(scan_dir_path, depth);
+    }
 }
 
 /**
@@ -255,10 +659,17 @@ static void handle_single_click(void)
     
     LOG_INFO_TAG("BTN", "Scanning for unprocessed .bin files...");
     
+    /* The walk only queues jobs; the encoder worker converts them */
     uint32_t total_ms;
-    TIME_IT(total_ms, scan_and_process_bin_files("/", 0));
+    scan_aborted = 0;
+    scan_queued = 0;
+    scan_known = 0;
+    TIME_IT(total_ms, scan_and_process_bin_files());
+    JPEG_Manifest_Sync();
     
-    LOG_INFO_TAG("BTN", "Scan complete (%lu ms)", (unsigned long)total_ms);
+    LOG_INFO_TAG("BTN", "Scan %s: %lu queued, %lu already handled (%lu ms)",
+                 scan_aborted ? "stopped" : "complete",
+                 (unsigned long)scan_queued, (unsigned long)scan_known, (unsigned long)total_ms);
 }
 
 /**
@@ -300,7 +711,15 @@ static void handle_double_click(void)
          */
         LOG_INFO_TAG("BTN", "Switching to MSC mode...");
         
-        /* Step 1: Unmount FatFS */
+        /* Step 1: Stop pending conversions, then unmount FatFS */
+        JPEG_Worker_CancelAll();
+        if (JPEG_Worker_WaitIdle(TX_TIMER_TICKS_PER_SECOND * 5U) != 0)
+        {
+            LOG_WARN_TAG("BTN", "Encoder still busy - staying in FatFS mode");
+            return;
+        }
+        JPEG_Manifest_Sync();
+        
         FS_Reader_Unmount();
         
         /* Step 2: Check if we need to signal media change */
@@ -384,6 +803,70 @@ static void handle_double_click(void)
     }
 }
 
+/**
+  * @brief  Take one debounced sample of USER_BUTTON.
+  * @retval BUTTON_SAMPLE_PRESSED when a press has just been accepted.
+  */
+static Button_Sample_t button_sample(void)
+{
+  GPIO_PinState current_state = HAL_GPIO_ReadPin(USER_BUTTON_GPIO_Port, USER_BUTTON_Pin);
+  Button_Sample_t result = BUTTON_SAMPLE_CHANGING;
+
+  if (current_state == stable_state)
+  {
+    /* Same as stable state - reset debounce counter */
+    consecutive_count = 0U;
+    return BUTTON_SAMPLE_STABLE;
+  }
+
+  /* Different from stable state - count consecutive readings */
+  consecutive_count++;
+  if (consecutive_count >= BUTTON_DEBOUNCE_COUNT)
+  {
+    /* State has been different for long enough - accept transition */
+    if ((current_state == GPIO_PIN_SET) && (stable_state == GPIO_PIN_RESET))
+    {
+      result = BUTTON_SAMPLE_PRESSED;
+    }
+    /* Note: We only act on press, not release */
+
+    stable_state = current_state;
+    consecutive_count = 0U;
+  }
+
+  return result;
+}
+
+/**
+  * @brief  Stop the scan and every queued conversion.
+  *         The press counts as the first click, so a double-click still
+  *         switches to MSC once the worker has unwound.
+  */
+static void button_cancel_conversions(void)
+{
+  LOG_INFO_TAG("BTN", "Button pressed - stopping conversion");
+  JPEG_Worker_CancelAll();
+  pending_click = 1;
+  click_cancelled = 1;
+  last_press_tick = HAL_GetTick();
+  scan_aborted = 1;
+}
+
+/**
+  * @brief  Button poll while a scan waits for queue space.
+  * @retval 1 if a press stopped the scan, 0 to continue.
+  */
+static int button_cancel_poll(void)
+{
+  if (button_sample() == BUTTON_SAMPLE_PRESSED)
+  {
+    button_cancel_conversions();
+    return 1;
+  }
+
+  return 0;
+}
+
 /**
   * @brief  Button handler thread - polls USER_BUTTON with single/double click detection.
   * @param  thread_input: Thread input parameter (unused).
@@ -391,17 +874,13 @@ static void handle_double_click(void)
   * Click detection:
   * - Single click: press + release, wait for double-click timeout
   * - Double click: two presses within BUTTON_DOUBLE_CLICK_MS
+  * - A press while the encoder worker is busy stops it and drops its queue;
+  *   it still counts towards a double-click
   */
 static VOID button_thread_entry(ULONG thread_input)
 {
   TX_PARAMETER_NOT_USED(thread_input);
 
-  GPIO_PinState stable_state = GPIO_PIN_RESET;  /* Assume released initially */
-  GPIO_PinState current_state;
-  uint32_t consecutive_count = 0U;
-  uint32_t last_press_tick = 0U;
-  int pending_click = 0;  /* Set when we have one click and waiting for potential second */
-
   /* Wait for GPIO to stabilize after boot */
   tx_thread_sleep(TX_TIMER_TICKS_PER_SECOND / 2U);
 
@@ -413,48 +892,45 @@ static VOID button_thread_entry(ULONG thread_input)
 
   for (;;)
   {
-    current_state = HAL_GPIO_ReadPin(USER_BUTTON_GPIO_Port, USER_BUTTON_Pin);
+    Button_Sample_t sample = button_sample();
     uint32_t now = HAL_GetTick();
 
-    if (current_state == stable_state)
+    if (sample == BUTTON_SAMPLE_STABLE)
     {
-      /* Same as stable state - reset debounce counter */
-      consecutive_count = 0U;
-      
       /* Check if we have a pending single click that timed out */
       if (pending_click && (now - last_press_tick) > BUTTON_DOUBLE_CLICK_MS)
       {
         pending_click = 0;
-        handle_single_click();
+        if (click_cancelled)
+        {
+          /* That click stopped an encode - don't start a new scan */
+          click_cancelled = 0;
+        }
+        else
+        {
+          handle_single_click();
+        }
       }
     }
-    else
+    else if (sample == BUTTON_SAMPLE_PRESSED)
     {
-      /* Different from stable state - count consecutive readings */
-      consecutive_count++;
-      if (consecutive_count >= BUTTON_DEBOUNCE_COUNT)
+      if (!pending_click && JPEG_Worker_IsBusy())
       {
-        /* State has been different for long enough - accept transition */
-        if ((current_state == GPIO_PIN_SET) && (stable_state == GPIO_PIN_RESET))
-        {
-          /* Button pressed */
-          if (pending_click && (now - last_press_tick) <= BUTTON_DOUBLE_CLICK_MS)
-          {
-            /* This is a double-click! */
-            pending_click = 0;
-            handle_double_click();
-          }
-          else
-          {
-            /* First click - mark as pending and wait for potential second click */
-            pending_click = 1;
-            last_press_tick = now;
-          }
-        }
-        /* Note: We only act on press, not release */
-        
-        stable_state = current_state;
-        consecutive_count = 0U;
+        /* Conversions running in the background - stop them */
+        button_cancel_conversions();
+      }
+      else if (pending_click && (now - last_press_tick) <= BUTTON_DOUBLE_CLICK_MS)
+      {
+        /* This is a double-click! */
+        pending_click = 0;
+        click_cancelled = 0;
+        handle_double_click();
+      }
+      else
+      {
+        /* First click - mark as pending and wait for potential second click */
+        pending_click = 1;
+        last_press_tick = now;
       }
     }
 
@@ -13,6 +13,7 @@
 
 #include "exfat_reader.h"
 #include "sdmmc.h"
+#include "sd_adapter.h"
 #include "logger.h"
 #include <string.h>
 #include <stdlib.h>
@@ -56,6 +57,9 @@ typedef struct {
 #define EXFAT_ENTRY_STREAM       0xC0  /* Stream extension entry */
 #define EXFAT_ENTRY_NAME         0xC1  /* File name entry */
 
+/* Stream extension GeneralSecondaryFlags */
+#define EXFAT_STREAM_NO_FAT_CHAIN 0x02 /* Clusters are contiguous, FAT entries unused */
+
 /* File Directory Entry (32 bytes) */
 typedef struct {
   uint8_t  entry_type;             /* 0x85 for file entry */
@@ -136,6 +140,37 @@ static ExFAT_State fs_state;
 #define SECTOR_BUFFER_SIZE  512
 static uint8_t sector_buffer[SECTOR_BUFFER_SIZE];
 
+/* FAT sector cache (chained files and directories), least recently used out */
+typedef struct {
+  uint64_t sector;                  /* FAT sector held, 0 if empty */
+  uint32_t last_use;                /* Use stamp for LRU replacement */
+  uint8_t  data[SECTOR_BUFFER_SIZE];
+} ExFAT_FatCacheLine;
+
+static ExFAT_FatCacheLine fat_cache[EXFAT_FAT_CACHE_SECTORS];
+static uint32_t fat_cache_stamp;
+
+/* Directory lookup cache: one line per resolved (parent cluster, name) */
+typedef struct {
+  uint32_t parent_cluster;          /* Directory holding the entry, 0 if empty */
+  uint16_t name_hash;               /* exFAT NameHash of the entry */
+  uint8_t  attr;
+  uint8_t  contiguous;
+  uint32_t start_cluster;
+  uint64_t size;
+  uint16_t create_date;
+  uint16_t create_time;
+  uint16_t modify_date;
+  uint16_t modify_time;
+  uint32_t last_use;                /* Use stamp for LRU replacement */
+  char     name[EXFAT_DENTRY_NAME_LEN];
+} ExFAT_DentryCacheLine;
+
+#if EXFAT_DENTRY_CACHE_SIZE > 0
+static ExFAT_DentryCacheLine dentry_cache[EXFAT_DENTRY_CACHE_SIZE];
+static uint32_t dentry_cache_stamp;
+#endif
+
 /* ============================================================================
  * Low-Level SD Card Access
  * ============================================================================ */
@@ -149,18 +184,11 @@ static ExFAT_Result read_sectors(uint64_t sector, uint32_t count, uint8_t *buffe
     return EXFAT_ERR_NO_MEDIA;
   }
 
-  if (HAL_SD_ReadBlocks(&hsd1, buffer, (uint32_t)sector, count, 1000) != HAL_OK) {
+  /* One multi-block command for the whole span (IDMA when the buffer allows) */
+  if (SD_Read(buffer, (uint32_t)sector, count) != 0) {
     return EXFAT_ERR_READ;
   }
 
-  /* Wait for card to be ready */
-  uint32_t start = HAL_GetTick();
-  while (HAL_SD_GetCardState(&hsd1) != HAL_SD_CARD_TRANSFER) {
-    if ((HAL_GetTick() - start) > 1000) {
-      return EXFAT_ERR_READ;
-    }
-  }
-
   return EXFAT_OK;
 }
 
@@ -191,18 +219,65 @@ static ExFAT_Result get_next_cluster(uint32_t current, uint32_t *next)
   uint64_t fat_sector = fs_state.fat_sector + (fat_offset / fs_state.bytes_per_sector);
   uint32_t entry_offset = fat_offset % fs_state.bytes_per_sector;
 
-  /* Read FAT sector */
-  ExFAT_Result res = read_sectors(fat_sector, 1, sector_buffer);
-  if (res != EXFAT_OK) {
-    return res;
+  /* Look up the FAT sector in the cache, else replace the oldest line */
+  ExFAT_FatCacheLine *line = &fat_cache[0];
+  for (int i = 0; i < EXFAT_FAT_CACHE_SECTORS; i++) {
+    if (fat_cache[i].sector == fat_sector) {
+      line = &fat_cache[i];
+      break;
+    }
+    if (fat_cache[i].last_use < line->last_use) {
+      line = &fat_cache[i];
+    }
+  }
+
+  if (line->sector != fat_sector) {
+    line->sector = 0;
+    ExFAT_Result res = read_sectors(fat_sector, 1, line->data);
+    if (res != EXFAT_OK) {
+      return res;
+    }
+    line->sector = fat_sector;
   }
+  line->last_use = ++fat_cache_stamp;
 
   /* Get FAT entry */
-  *next = *(uint32_t *)(sector_buffer + entry_offset);
+  memcpy(next, line->data + entry_offset, sizeof(*next));
 
   return EXFAT_OK;
 }
 
+/**
+  * @brief  Drop every cached FAT sector
+  */
+static void fat_cache_invalidate(void)
+{
+  memset(fat_cache, 0, sizeof(fat_cache));
+  fat_cache_stamp = 0;
+}
+
+/**
+  * @brief  First cluster past a contiguous chain of the given size
+  */
+static uint32_t chain_end_cluster(uint32_t start, uint64_t size)
+{
+  return start + (uint32_t)((size + fs_state.bytes_per_cluster - 1) / fs_state.bytes_per_cluster);
+}
+
+/**
+  * @brief  Get the cluster following current in a chain
+  * @param  contiguous: NoFatChain chain, clusters follow each other up to end_cluster
+  */
+static ExFAT_Result next_cluster(uint32_t current, uint8_t contiguous, uint32_t end_cluster,
+                                 uint32_t *next)
+{
+  if (contiguous) {
+    *next = (current + 1 < end_cluster) ? current + 1 : EXFAT_CLUSTER_END;
+    return EXFAT_OK;
+  }
+  return get_next_cluster(current, next);
+}
+
 /* ============================================================================
  * Name Handling
  * ============================================================================ */
@@ -233,6 +308,30 @@ static void ucs2_to_utf8(const uint16_t *ucs2, int len, char *utf8, int max_len)
   utf8[j] = '\0';
 }
 
+/**
+  * @brief  exFAT NameHash of an ASCII name, as stored in its stream entry
+  * @retval 1 if computed, 0 if the name is not plain ASCII (the hash depends
+  *         on the volume up-case table then)
+  */
+static int ascii_name_hash(const char *name, uint16_t *hash, uint32_t *length)
+{
+  uint16_t h = 0;
+  uint32_t len = 0;
+
+  for (; *name; name++, len++) {
+    uint8_t c = (uint8_t)*name;
+    if (c >= 0x80) return 0;
+    if (c >= 'a' && c <= 'z') c -= 32;
+    /* Up-cased UCS-2 character, low byte then high byte (always 0 here) */
+    h = (uint16_t)(((h & 1) ? 0x8000 : 0) + (h >> 1) + c);
+    h = (uint16_t)(((h & 1) ? 0x8000 : 0) + (h >> 1));
+  }
+
+  *hash = h;
+  *length = len;
+  return 1;
+}
+
 /**
   * @brief  Case-insensitive string compare for ASCII
   */
@@ -277,6 +376,7 @@ static ExFAT_Result parse_file_entry(const uint8_t *entry_buffer, int entry_coun
   info->attr = file->file_attributes & 0xFF;
   info->start_cluster = stream->first_cluster;
   info->size = stream->data_length;
+  info->contiguous = (stream->general_secondary_flags & EXFAT_STREAM_NO_FAT_CHAIN) ? 1 : 0;
 
   /* Parse timestamps (DOS format) */
   info->create_date = (file->create_timestamp >> 16) & 0xFFFF;
@@ -307,16 +407,109 @@ static ExFAT_Result parse_file_entry(const uint8_t *entry_buffer, int entry_coun
   return EXFAT_OK;
 }
 
+/* ============================================================================
+ * Directory Lookup Cache
+ * ============================================================================ */
+
+/**
+  * @brief  Drop every cached lookup
+  */
+static void dentry_cache_invalidate(void)
+{
+#if EXFAT_DENTRY_CACHE_SIZE > 0
+  memset(dentry_cache, 0, sizeof(dentry_cache));
+  dentry_cache_stamp = 0;
+#endif
+}
+
+/**
+  * @brief  Look up a name resolved earlier in the same directory
+  * @retval 1 on a hit (info filled), 0 otherwise
+  */
+static int dentry_cache_find(uint32_t parent_cluster, uint16_t name_hash, const char *name,
+                             ExFAT_FileInfo *info)
+{
+#if EXFAT_DENTRY_CACHE_SIZE > 0
+  for (int i = 0; i < EXFAT_DENTRY_CACHE_SIZE; i++) {
+    ExFAT_DentryCacheLine *line = &dentry_cache[i];
+    if (line->parent_cluster != parent_cluster || line->name_hash != name_hash ||
+        strcasecmp_ascii(line->name, name) != 0) {
+      continue;
+    }
+
+    memset(info, 0, sizeof(*info));
+    strcpy(info->name, line->name);
+    info->size = line->size;
+    info->attr = line->attr;
+    info->start_cluster = line->start_cluster;
+    info->contiguous = line->contiguous;
+    info->create_date = line->create_date;
+    info->create_time = line->create_time;
+    info->modify_date = line->modify_date;
+    info->modify_time = line->modify_time;
+    line->last_use = ++dentry_cache_stamp;
+    return 1;
+  }
+#else
+  (void)parent_cluster; (void)name_hash; (void)name; (void)info;
+#endif
+  return 0;
+}
+
+/**
+  * @brief  Remember a resolved name, replacing the least recently used line
+  */
+static void dentry_cache_add(uint32_t parent_cluster, uint16_t name_hash,
+                             const ExFAT_FileInfo *info)
+{
+#if EXFAT_DENTRY_CACHE_SIZE > 0
+  if (strlen(info->name) >= EXFAT_DENTRY_NAME_LEN) return;
+
+  ExFAT_DentryCacheLine *line = &dentry_cache[0];
+  for (int i = 1; i < EXFAT_DENTRY_CACHE_SIZE; i++) {
+    if (dentry_cache[i].last_use < line->last_use) {
+      line = &dentry_cache[i];
+    }
+  }
+
+  line->parent_cluster = parent_cluster;
+  line->name_hash = name_hash;
+  line->attr = info->attr;
+  line->contiguous = info->contiguous;
+  line->start_cluster = info->start_cluster;
+  line->size = info->size;
+  line->create_date = info->create_date;
+  line->create_time = info->create_time;
+  line->modify_date = info->modify_date;
+  line->modify_time = info->modify_time;
+  strcpy(line->name, info->name);
+  line->last_use = ++dentry_cache_stamp;
+#else
+  (void)parent_cluster; (void)name_hash; (void)info;
+#endif
+}
+
 /**
   * @brief  Find entry in directory by name
+  * @note   ASCII names are served from the lookup cache when possible, and
+  *         entry sets whose NameHash or length differ are skipped unparsed.
   */
-static ExFAT_Result find_in_directory(uint32_t dir_cluster, const char *name,
+static ExFAT_Result find_in_directory(uint32_t dir_cluster, uint8_t dir_contiguous,
+                                       uint64_t dir_size, const char *name,
                                        ExFAT_FileInfo *info)
 {
   uint32_t cluster = dir_cluster;
+  uint32_t end_cluster = chain_end_cluster(dir_cluster, dir_size);
   uint8_t entry_set[32 * 20];  /* Buffer for entry set (up to 20 entries) */
   int entry_set_count = 0;
   int collecting_set = 0;
+  uint16_t name_hash = 0;
+  uint32_t name_length = 0;
+  int filtered = ascii_name_hash(name, &name_hash, &name_length);
+
+  if (filtered && dentry_cache_find(dir_cluster, name_hash, name, info)) {
+    return EXFAT_OK;
+  }
 
   while (cluster >= EXFAT_FIRST_DATA_CLUSTER && cluster < EXFAT_CLUSTER_END) {
     uint64_t sector = cluster_to_sector(cluster);
@@ -353,6 +546,16 @@ static ExFAT_Result find_in_directory(uint32_t dir_cluster, const char *name,
             entry_set_count++;
           }
 
+          /* Stream entry: drop sets that cannot match before any name work */
+          if (filtered && entry_set_count == 2) {
+            const ExFAT_StreamEntry *stream = (const ExFAT_StreamEntry *)(entry_set + 32);
+            if (stream->name_hash != name_hash || stream->name_length != name_length) {
+              collecting_set = 0;
+              entry_set_count = 0;
+              continue;
+            }
+          }
+
           /* Check if we have the complete set */
           ExFAT_FileEntry *file = (ExFAT_FileEntry *)entry_set;
           if (entry_set_count == file->secondary_count + 1) {
@@ -360,6 +563,9 @@ static ExFAT_Result find_in_directory(uint32_t dir_cluster, const char *name,
             ExFAT_FileInfo temp_info;
             if (parse_file_entry(entry_set, entry_set_count, &temp_info) == EXFAT_OK) {
               if (strcasecmp_ascii(temp_info.name, name) == 0) {
+                if (filtered) {
+                  dentry_cache_add(dir_cluster, name_hash, &temp_info);
+                }
                 *info = temp_info;
                 return EXFAT_OK;
               }
@@ -372,7 +578,7 @@ static ExFAT_Result find_in_directory(uint32_t dir_cluster, const char *name,
     }
 
     /* Get next cluster */
-    ExFAT_Result res = get_next_cluster(cluster, &cluster);
+    ExFAT_Result res = next_cluster(cluster, dir_contiguous, end_cluster, &cluster);
     if (res != EXFAT_OK) return res;
   }
 
@@ -408,6 +614,8 @@ static ExFAT_Result navigate_path(const char *path, ExFAT_FileInfo *info, uint32
   }
 
   uint32_t current_cluster = fs_state.root_cluster;
+  uint8_t current_contiguous = 0;  /* Root directory always uses the FAT */
+  uint64_t current_size = 0;
   char component[EXFAT_MAX_NAME + 1];
   const char *p = path;
   ExFAT_FileInfo current_info;
@@ -425,7 +633,8 @@ static ExFAT_Result navigate_path(const char *path, ExFAT_FileInfo *info, uint32
     if (*p == '/') p++;
 
     /* Find in current directory */
-    ExFAT_Result res = find_in_directory(current_cluster, component, &current_info);
+    ExFAT_Result res = find_in_directory(current_cluster, current_contiguous, current_size,
+                                         component, &current_info);
     if (res != EXFAT_OK) return res;
 
     /* If more path remains, this must be a directory */
@@ -438,6 +647,8 @@ static ExFAT_Result navigate_path(const char *path, ExFAT_FileInfo *info, uint32
     }
 
     current_cluster = current_info.start_cluster;
+    current_contiguous = current_info.contiguous;
+    current_size = current_info.size;
   }
 
   if (info != NULL) {
@@ -459,6 +670,7 @@ ExFAT_Result ExFAT_Init(void)
   }
 
   memset(&fs_state, 0, sizeof(fs_state));
+  ExFAT_InvalidateCache();
 
   /* Read boot sector */
   ExFAT_Result res = read_sectors(0, 1, sector_buffer);
@@ -519,9 +731,16 @@ ExFAT_Result ExFAT_Init(void)
 ExFAT_Result ExFAT_DeInit(void)
 {
   memset(&fs_state, 0, sizeof(fs_state));
+  ExFAT_InvalidateCache();
   return EXFAT_OK;
 }
 
+void ExFAT_InvalidateCache(void)
+{
+  fat_cache_invalidate();
+  dentry_cache_invalidate();
+}
+
 int ExFAT_IsInitialized(void)
 {
   return fs_state.initialized ? 1 : 0;
@@ -559,6 +778,7 @@ ExFAT_Result ExFAT_FileOpen(const char *path, ExFAT_File *file)
 
   file->is_open = 1;
   file->is_dir = 0;
+  file->contiguous = info.contiguous;
   file->start_cluster = info.start_cluster;
   file->current_cluster = info.start_cluster;
   file->size = info.size;
@@ -595,6 +815,7 @@ ExFAT_Result ExFAT_FileRead(ExFAT_File *file, void *buffer, size_t size, size_t
 
   uint8_t *dest = (uint8_t *)buffer;
   size_t remaining = size;
+  uint32_t end_cluster = chain_end_cluster(file->start_cluster, file->size);
 
   while (remaining > 0 && file->current_cluster >= EXFAT_FIRST_DATA_CLUSTER && 
          file->current_cluster < EXFAT_CLUSTER_END) {
@@ -603,27 +824,52 @@ ExFAT_Result ExFAT_FileRead(ExFAT_File *file, void *buffer, size_t size, size_t
     uint64_t cluster_sector = cluster_to_sector(file->current_cluster);
     uint32_t sector_in_cluster = file->cluster_offset / fs_state.bytes_per_sector;
     uint32_t offset_in_sector = file->cluster_offset % fs_state.bytes_per_sector;
+    uint32_t chunk;
+    ExFAT_Result res;
 
-    /* Read sector */
-    ExFAT_Result res = read_sectors(cluster_sector + sector_in_cluster, 1, sector_buffer);
-    if (res != EXFAT_OK) return res;
+    if (offset_in_sector != 0 || remaining < fs_state.bytes_per_sector) {
+      /* Partial sector: read it into the sector buffer and copy out */
+      res = read_sectors(cluster_sector + sector_in_cluster, 1, sector_buffer);
+      if (res != EXFAT_OK) return res;
+
+      chunk = fs_state.bytes_per_sector - offset_in_sector;
+      if (chunk > remaining) chunk = remaining;
+      memcpy(dest, sector_buffer + offset_in_sector, chunk);
+    } else {
+      /* Whole sectors: read straight into the caller's buffer, extending
+       * the run over clusters that follow each other on the card */
+      uint32_t want = (uint32_t)(remaining / fs_state.bytes_per_sector);
+      uint32_t run = fs_state.sectors_per_cluster - sector_in_cluster;
+      uint32_t cluster = file->current_cluster;
+
+      if (want > EXFAT_READ_MAX_SECTORS) want = EXFAT_READ_MAX_SECTORS;
+      while (run < want) {
+        uint32_t next;
+        res = next_cluster(cluster, file->contiguous, end_cluster, &next);
+        if (res != EXFAT_OK) return res;
+        if (next != cluster + 1) break;
+        cluster = next;
+        run += fs_state.sectors_per_cluster;
+      }
+      if (run > want) run = want;
 
-    /* Copy data from sector */
-    uint32_t bytes_in_sector = fs_state.bytes_per_sector - offset_in_sector;
-    if (bytes_in_sector > remaining) bytes_in_sector = remaining;
+      res = read_sectors(cluster_sector + sector_in_cluster, run, dest);
+      if (res != EXFAT_OK) return res;
+      chunk = run * fs_state.bytes_per_sector;
+    }
 
-    memcpy(dest, sector_buffer + offset_in_sector, bytes_in_sector);
-    dest += bytes_in_sector;
-    remaining -= bytes_in_sector;
-    *bytes_read += bytes_in_sector;
-    file->position += bytes_in_sector;
-    file->cluster_offset += bytes_in_sector;
+    dest += chunk;
+    remaining -= chunk;
+    *bytes_read += chunk;
+    file->position += chunk;
+    file->cluster_offset += chunk;
 
-    /* Move to next cluster if needed */
-    if (file->cluster_offset >= fs_state.bytes_per_cluster) {
-      res = get_next_cluster(file->current_cluster, &file->current_cluster);
+    /* Move to the cluster holding the new position */
+    while (file->cluster_offset >= fs_state.bytes_per_cluster) {
+      res = next_cluster(file->current_cluster, file->contiguous, end_cluster,
+                         &file->current_cluster);
       if (res != EXFAT_OK) return res;
-      file->cluster_offset = 0;
+      file->cluster_offset -= fs_state.bytes_per_cluster;
     }
   }
 
@@ -650,10 +896,17 @@ ExFAT_Result ExFAT_FileSeek(ExFAT_File *file, int64_t offset, int origin)
   uint64_t cluster_index = (uint64_t)new_pos / fs_state.bytes_per_cluster;
   uint32_t cluster = file->start_cluster;
 
-  for (uint64_t i = 0; i < cluster_index && cluster >= EXFAT_FIRST_DATA_CLUSTER && 
-       cluster < EXFAT_CLUSTER_END; i++) {
-    ExFAT_Result res = get_next_cluster(cluster, &cluster);
-    if (res != EXFAT_OK) return res;
+  if (file->contiguous) {
+    /* NoFatChain: no FAT walk needed */
+    uint32_t end_cluster = chain_end_cluster(file->start_cluster, file->size);
+    cluster = (file->start_cluster + cluster_index < end_cluster) ?
+              file->start_cluster + (uint32_t)cluster_index : EXFAT_CLUSTER_END;
+  } else {
+    for (uint64_t i = 0; i < cluster_index && cluster >= EXFAT_FIRST_DATA_CLUSTER && 
+         cluster < EXFAT_CLUSTER_END; i++) {
+      ExFAT_Result res = get_next_cluster(cluster, &cluster);
+      if (res != EXFAT_OK) return res;
+    }
   }
 
   file->position = (uint64_t)new_pos;
@@ -697,7 +950,9 @@ ExFAT_Result ExFAT_DirOpen(const char *path, ExFAT_Dir *dir)
   }
 
   dir->is_open = 1;
+  dir->contiguous = info.contiguous;
   dir->start_cluster = info.start_cluster;
+  dir->end_cluster = chain_end_cluster(info.start_cluster, info.size);
   dir->current_cluster = info.start_cluster;
   dir->entry_offset = 0;
 
@@ -770,7 +1025,8 @@ ExFAT_Result ExFAT_DirRead(ExFAT_Dir *dir, ExFAT_FileInfo *info)
     }
 
     /* Move to next cluster */
-    ExFAT_Result res = get_next_cluster(dir->current_cluster, &dir->current_cluster);
+    ExFAT_Result res = next_cluster(dir->current_cluster, dir->contiguous, dir->end_cluster,
+                                    &dir->current_cluster);
     if (res != EXFAT_OK) return res;
     dir->entry_offset = 0;
   }
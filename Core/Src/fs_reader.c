@@ -17,40 +17,78 @@
 #include "tx_api.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 /* Private defines -----------------------------------------------------------*/
 #define FS_READER_THREAD_STACK_SIZE   4096U  /* Stack for FatFs + exFAT + recursion */
 #define FS_READER_THREAD_PRIORITY     8U     /* Higher than USB (10) to mount before USB enumerates */
 
 /* Filesystem monitoring configuration */
-#define FS_MONITOR_MAX_ENTRIES     128U  /* Max total files/dirs to track */
-#define FS_MONITOR_POLL_SECONDS    5U    /* Poll interval in seconds */
-#define FS_MONITOR_MAX_PATH_LEN    128U  /* Max full path length */
-#define FS_MONITOR_MAX_DEPTH       4U    /* Max recursion depth for subdirectories */
+#define FS_MONITOR_MAX_ENTRIES     1024U   /* Max total files/dirs to track */
+#define FS_MONITOR_NAME_ARENA_SIZE 16384U  /* Bytes of entry names per snapshot (< 32 KB) */
+#define FS_MONITOR_POLL_SECONDS    5U      /* Poll interval in seconds */
+#define FS_MONITOR_MAX_PATH_LEN    128U    /* Max full path length */
+#define FS_MONITOR_MAX_DEPTH       4U      /* Max recursion depth for subdirectories */
+#define FS_MONITOR_MAX_DIRS        128U    /* Directories whose sectors are tracked per snapshot */
+
+#define FS_MONITOR_NO_PARENT       0xFFFFU  /* Parent index of root entries */
+#define FS_MONITOR_NAME_DIR        0x8000U  /* Directory flag in FS_EntryCache_t.name */
+#define FS_MONITOR_NAME_MASK       0x7FFFU
+#define FS_MONITOR_NO_EXTENT       0xFFFFFFFFUL  /* Directory without a tracked extent */
+
+#define FS_SECTOR_SIZE             FF_MAX_SS
+#define FS_DIR_GROW_MARGIN         (21U * 32U)  /* Largest entry set (FAT LFN); exFAT needs at most 19 */
+
+#define FS_FNV_OFFSET              2166136261UL
+#define FS_FNV_PRIME               16777619UL
 
 /* Private types -------------------------------------------------------------*/
 
 /**
-  * @brief  Cached file/directory entry for change detection.
-  *         Stores full path for callback notification.
+  * @brief  Cached file/directory entry for change detection (16 bytes).
+  *         The full path is rebuilt from the parent chain when an event
+  *         is reported; only the name is stored, in the snapshot arena.
   */
 typedef struct {
-    char     path[FS_MONITOR_MAX_PATH_LEN];  /* Full path (e.g., "/subdir/file.txt") */
-    FSIZE_t  size;                            /* File size (0 for directories) */
-    WORD     fdate;                           /* Modification date */
-    WORD     ftime;                           /* Modification time */
-    BYTE     is_dir;                          /* 1 if directory, 0 if file */
-    BYTE     valid;                           /* 1 if entry is in use */
+    uint32_t hash;      /* FNV-1a of the full path (e.g., "/subdir/file.txt") */
+    uint32_t size;      /* File size folded to 32 bits; extent index for directories */
+    WORD     fdate;     /* Modification date */
+    WORD     ftime;     /* Modification time */
+    uint16_t parent;    /* Index of the parent directory, FS_MONITOR_NO_PARENT at the root */
+    uint16_t name;      /* Name offset in the arena | FS_MONITOR_NAME_DIR */
 } FS_EntryCache_t;
 
+/**
+  * @brief  Sectors a directory was read from. A later write to any of
+  *         them (or to the FAT/bitmap sector that would extend the chain
+  *         past last_clust) means the directory has to be read again.
+  */
+typedef struct {
+    uint32_t first_sect;  /* Lowest directory sector read */
+    uint32_t last_sect;   /* Highest, including the slot after the last entry */
+    uint32_t last_clust;  /* Last cluster reached (0: fixed FAT12/16 root) */
+    uint32_t end_sect;    /* Slot after the last entry, always inside last_clust */
+} FS_DirExtent_t;
+
 /**
   * @brief  Snapshot of entire filesystem tree for change detection.
+  *         Entries are kept in walk order (so parent indices stay valid);
+  *         order[] lists them sorted by (hash, parent hash, name) for the diff.
   */
 typedef struct {
     FS_EntryCache_t entries[FS_MONITOR_MAX_ENTRIES];
+    uint16_t        order[FS_MONITOR_MAX_ENTRIES];
+    char            names[FS_MONITOR_NAME_ARENA_SIZE];
+    FS_DirExtent_t  dirs[FS_MONITOR_MAX_DIRS];
+    FS_DirExtent_t  root;        /* Extent of the root directory */
+    uint32_t        layout;      /* Volume layout the extents belong to */
     uint16_t        count;       /* Number of valid entries */
+    uint16_t        names_used;  /* Bytes used in names[] */
+    uint16_t        dir_count;   /* Extents used in dirs[] */
+    uint16_t        dirs_read;   /* Directories read (the rest were copied) */
     uint8_t         initialized; /* 1 if snapshot has been taken */
     uint8_t         has_error;   /* 1 if disk error occurred during snapshot */
+    uint8_t         truncated;   /* 1 if the walk stopped at the entry or name limit */
 } FS_Snapshot_t;
 
 /* Private variables ---------------------------------------------------------*/
@@ -59,9 +97,29 @@ static UCHAR fs_reader_thread_stack[FS_READER_THREAD_STACK_SIZE];
 
 static FATFS SDFatFs;       /* FatFs filesystem object */
 static volatile int fs_mounted = 0;
+static volatile uint32_t fs_mount_generation = 0;  /* Bumped on every mount */
+
+/* Filesystem snapshots for change detection: the current one and the
+ * one being taken by a poll. Both are only touched under fs_monitor_mutex. */
+static FS_Snapshot_t fs_snapshots[2];
+static FS_Snapshot_t *fs_snapshot = &fs_snapshots[0];
+static TX_MUTEX fs_monitor_mutex;
+
+/* Walk and event path buffers (monitor mutex held) */
+static char fs_walk_path[FS_MONITOR_MAX_PATH_LEN];
+static char fs_event_path[FS_MONITOR_MAX_PATH_LEN];
 
-/* Filesystem snapshot for change detection */
-static FS_Snapshot_t fs_snapshot;
+/* Snapshot being sorted (qsort has no context argument) */
+static const FS_Snapshot_t *fs_sort_snapshot;
+
+/* Set once the limit warning was logged, until a walk fits again */
+static uint8_t fs_monitor_limit_logged = 0;
+
+/* Set when written ranges were consumed by a failed walk */
+static uint8_t fs_monitor_full_walk = 0;
+
+/* Sectors written since the current snapshot (taken at each snapshot) */
+static SD_DirtyMap_t fs_dirty;
 
 /* User-registered callback for change notifications */
 static FS_ChangeCallback_t fs_change_callback = NULL;
@@ -70,12 +128,35 @@ static FS_ChangeCallback_t fs_change_callback = NULL;
 static VOID fs_reader_thread_entry(ULONG thread_input);
 static void fs_list_directory(const char *path);
 static const char* fs_result_str(FRESULT res);
-static void fs_take_snapshot_recursive(const char *path, FS_Snapshot_t *snapshot, int depth);
+static uint32_t fs_hash_name(uint32_t hash, const char *name);
+static uint32_t fs_parent_hash(const FS_Snapshot_t *snap, uint16_t index);
+static void fs_take_snapshot(FS_Snapshot_t *snapshot, FS_Snapshot_t *old);
+static uint16_t fs_add_entry(FS_Snapshot_t *snapshot, const char *name, size_t name_len,
+                             uint16_t parent, uint32_t hash, int is_dir);
+static FS_DirExtent_t* fs_dir_extent(FS_Snapshot_t *snap, uint16_t index);
+static void fs_walk_dir(FS_Snapshot_t *snapshot, FS_Snapshot_t *old, uint16_t old_dir,
+                        FS_DirExtent_t *extent, size_t path_len,
+                        uint16_t parent, uint32_t parent_hash, int depth);
+static void fs_copy_dir(FS_Snapshot_t *snapshot, FS_Snapshot_t *old, uint16_t old_dir,
+                        size_t path_len, uint16_t parent, int depth);
+static uint32_t fs_volume_layout(void);
+static uint32_t fs_cluster_last_sect(uint32_t clst);
+static int fs_extent_dirty(const FS_DirExtent_t *extent);
+static uint16_t fs_find_entry(const FS_Snapshot_t *snap, uint32_t hash,
+                              uint32_t parent_hash, const char *name);
+static void fs_monitor_update(void);
+static void fs_monitor_poll(void);
 static void fs_detect_changes(FS_Snapshot_t *old_snap, FS_Snapshot_t *new_snap);
-static const FS_EntryCache_t* fs_find_entry(const FS_Snapshot_t *snap, const char *path);
+static int fs_entry_key_compare(const FS_Snapshot_t *snap, uint16_t index,
+                                uint32_t hash, uint32_t parent_hash, const char *name);
+static int fs_entry_compare(const FS_Snapshot_t *snap_a, uint16_t a,
+                            const FS_Snapshot_t *snap_b, uint16_t b);
+static int fs_entry_sort_cmp(const void *a, const void *b);
+static void fs_report_entry(FS_EventType_t file_event, FS_EventType_t dir_event,
+                            const FS_Snapshot_t *snap, uint16_t index);
+static const char* fs_entry_path(const FS_Snapshot_t *snap, uint16_t index);
 static void fs_notify_change(FS_EventType_t event, const char *path);
 static void fs_default_change_handler(FS_EventType_t event_type, const char *path);
-static void fs_build_path(char *dest, size_t dest_len, const char *dir, const char *name);
 static void format_size(FSIZE_t size, char *buf, size_t buf_len);
 
 /* Public functions ----------------------------------------------------------*/
@@ -110,6 +191,13 @@ UINT FS_Reader_Init(TX_BYTE_POOL *byte_pool)
     /* Set default callback to log changes */
     fs_change_callback = fs_default_change_handler;
 
+    status = tx_mutex_create(&fs_monitor_mutex, "FS Monitor", TX_INHERIT);
+    if (status != TX_SUCCESS)
+    {
+        LOG_ERROR_TAG("FS", "Failed to create FS monitor mutex: %u", (unsigned)status);
+        return status;
+    }
+
     status = tx_thread_create(&fs_reader_thread,
                               "FS Reader",
                               fs_reader_thread_entry,
@@ -145,6 +233,14 @@ int FS_Reader_IsMounted(void)
     return fs_mounted;
 }
 
+/**
+  * @brief  Get the mount generation.
+  */
+uint32_t FS_Reader_GetMountGeneration(void)
+{
+    return fs_mount_generation;
+}
+
 /**
   * @brief  Unmount the filesystem for MSC mode.
   */
@@ -157,12 +253,13 @@ int FS_Reader_Unmount(void)
     
     LOG_INFO_TAG("FS", "Unmounting filesystem for MSC mode...");
     
-    /* Unmount FatFS */
+    /* Bring the snapshot up to date, then unmount FatFS. The snapshot is
+     * kept: on the next mount only what the host wrote is read again. */
+    tx_mutex_get(&fs_monitor_mutex, TX_WAIT_FOREVER);
+    fs_monitor_update();
     f_mount(NULL, "", 0);
     fs_mounted = 0;
-    
-    /* Clear snapshot since it's no longer valid */
-    memset(&fs_snapshot, 0, sizeof(fs_snapshot));
+    tx_mutex_put(&fs_monitor_mutex);
     
     return 0;
 }
@@ -187,20 +284,26 @@ int FS_Reader_Mount(void)
     
     LOG_INFO_TAG("FS", "Mounting filesystem...");
     
+    tx_mutex_get(&fs_monitor_mutex, TX_WAIT_FOREVER);
     res = f_mount(&SDFatFs, "", 1);
     if (res != FR_OK)
     {
+        tx_mutex_put(&fs_monitor_mutex);
         LOG_ERROR_TAG("FS", "Mount failed: %s", fs_result_str(res));
         return -1;
     }
     
     fs_mounted = 1;
+    fs_mount_generation++;
     
-    /* Take fresh snapshot for monitoring */
-    memset(&fs_snapshot, 0, sizeof(fs_snapshot));
-    fs_take_snapshot_recursive("/", &fs_snapshot, 0);
+    /* Report what changed while unmounted, reading only the directories
+     * the host's writes may have touched */
+    fs_monitor_update();
+    tx_mutex_put(&fs_monitor_mutex);
     
-    LOG_INFO_TAG("FS", "Filesystem mounted (%u entries)", (unsigned)fs_snapshot.count);
+    LOG_INFO_TAG("FS", "Filesystem mounted (%u entries, %u dirs read, %lu sectors written by host)",
+                 (unsigned)fs_snapshot->count, (unsigned)fs_snapshot->dirs_read,
+                 (unsigned long)fs_dirty.msc_sectors);
     return 0;
 }
 
@@ -420,6 +523,7 @@ int FS_Reader_Remount(void)
     }
     
     fs_mounted = 1;
+    fs_mount_generation++;
     LOG_DEBUG_TAG("FS", "Remount complete");
     return 0;
 }
@@ -453,6 +557,7 @@ static VOID fs_reader_thread_entry(ULONG thread_input)
     }
 
     fs_mounted = 1;
+    fs_mount_generation++;
 
     /* Detect and log filesystem type */
     {
@@ -470,61 +575,198 @@ static VOID fs_reader_thread_entry(ULONG thread_input)
 
     /* List root directory once at boot */
     fs_list_directory("/");
+
+    /* Baseline for the change monitor */
+    tx_mutex_get(&fs_monitor_mutex, TX_WAIT_FOREVER);
+    fs_take_snapshot(fs_snapshot, NULL);
+    tx_mutex_put(&fs_monitor_mutex);
     
-    LOG_INFO_TAG("FS", "Filesystem ready");
+    LOG_INFO_TAG("FS", "Filesystem ready (%u entries)", (unsigned)fs_snapshot->count);
 
-    /* Thread is done - no continuous monitoring needed.
-     * FatFS is accessed only on-demand via button handler.
-     * This thread just sleeps forever to keep the mount valid.
+    /* Poll the tree for changes while FatFS owns the card.
+     * A poll reads only directories whose sectors were written since the
+     * last one, then does an O(n) merge of two sorted snapshots.
      */
     for (;;)
     {
-        tx_thread_sleep(TX_TIMER_TICKS_PER_SECOND * 60);  /* Sleep for 1 minute, repeat */
+        tx_thread_sleep(TX_TIMER_TICKS_PER_SECOND * FS_MONITOR_POLL_SECONDS);
+        fs_monitor_poll();
+    }
+}
+
+/**
+  * @brief  Fold a name into a running FNV-1a path hash.
+  */
+static uint32_t fs_hash_name(uint32_t hash, const char *name)
+{
+    hash ^= (uint8_t)'/';
+    hash *= FS_FNV_PRIME;
+    while (*name != '\0')
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= FS_FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+  * @brief  Parent path hash of an entry (FNV offset basis for root entries).
+  */
+static uint32_t fs_parent_hash(const FS_Snapshot_t *snap, uint16_t index)
+{
+    uint16_t parent = snap->entries[index].parent;
+
+    return (parent == FS_MONITOR_NO_PARENT) ? FS_FNV_OFFSET : snap->entries[parent].hash;
+}
+
+/**
+  * @brief  Take a snapshot of the tree and sort it for the diff.
+  *         With a previous snapshot, directories that no write since then
+  *         can have changed are copied from it instead of being read.
+  * @param  snapshot  Destination
+  * @param  old       Previous snapshot of this mount, or NULL for a full walk
+  */
+static void fs_take_snapshot(FS_Snapshot_t *snapshot, FS_Snapshot_t *old)
+{
+    snapshot->count = 0;
+    snapshot->names_used = 0;
+    snapshot->dir_count = 0;
+    snapshot->dirs_read = 0;
+    snapshot->initialized = 0;
+    snapshot->has_error = 0;
+    snapshot->truncated = 0;
+    snapshot->layout = fs_volume_layout();
+
+    /* Writes completing from here on land in the next map and are
+     * looked at again by the next snapshot */
+    SD_DirtyMap_Take(&fs_dirty);
+
+    if (old != NULL && (!old->initialized || old->truncated || old->layout != snapshot->layout))
+    {
+        old = NULL;  /* Not a complete picture of this volume */
+    }
+
+    fs_walk_path[0] = '\0';
+    fs_walk_dir(snapshot, old, FS_MONITOR_NO_PARENT, &snapshot->root,
+                0, FS_MONITOR_NO_PARENT, FS_FNV_OFFSET, 0);
+
+    for (uint16_t i = 0; i < snapshot->count; i++)
+    {
+        snapshot->order[i] = i;
+    }
+    fs_sort_snapshot = snapshot;
+    qsort(snapshot->order, snapshot->count, sizeof(snapshot->order[0]), fs_entry_sort_cmp);
+
+    if (snapshot->truncated && !fs_monitor_limit_logged)
+    {
+        LOG_WARN_TAG("FS", "Monitor limit reached: %u entries, %u name bytes",
+                     (unsigned)snapshot->count, (unsigned)snapshot->names_used);
     }
+    fs_monitor_limit_logged = snapshot->truncated;
+
+    /* A walk cut short by a disk error is not a usable baseline */
+    snapshot->initialized = snapshot->has_error ? 0 : 1;
 }
 
 /**
-  * @brief  Build full path from directory path and filename.
+  * @brief  Add an entry to a snapshot, its name to the arena.
+  * @retval Index of the entry, or FS_MONITOR_NO_PARENT if the snapshot is full.
   */
-static void fs_build_path(char *dest, size_t dest_len, const char *dir, const char *name)
+static uint16_t fs_add_entry(FS_Snapshot_t *snapshot, const char *name, size_t name_len,
+                             uint16_t parent, uint32_t hash, int is_dir)
 {
-    size_t dir_len = strlen(dir);
+    /* Stopping at the first entry that doesn't fit keeps the snapshot a
+     * prefix of the walk, so unchanged trees diff clean */
+    if (snapshot->count >= FS_MONITOR_MAX_ENTRIES ||
+        snapshot->names_used + name_len + 1U > FS_MONITOR_NAME_ARENA_SIZE)
+    {
+        snapshot->truncated = 1;
+        return FS_MONITOR_NO_PARENT;
+    }
+
+    uint16_t index = snapshot->count++;
+    FS_EntryCache_t *entry = &snapshot->entries[index];
 
-    if (dir_len == 1 && dir[0] == '/')
+    entry->hash = hash;
+    entry->size = 0U;
+    entry->fdate = 0U;
+    entry->ftime = 0U;
+    entry->parent = parent;
+    entry->name = (uint16_t)(snapshot->names_used | (is_dir ? FS_MONITOR_NAME_DIR : 0U));
+    memcpy(&snapshot->names[snapshot->names_used], name, name_len + 1U);
+    snapshot->names_used += (uint16_t)(name_len + 1U);
+
+    if (is_dir)
     {
-        /* Root directory - just prepend slash */
-        snprintf(dest, dest_len, "/%s", name);
+        entry->size = (snapshot->dir_count < FS_MONITOR_MAX_DIRS) ?
+                      (uint32_t)snapshot->dir_count++ : FS_MONITOR_NO_EXTENT;
     }
-    else
+
+    return index;
+}
+
+/**
+  * @brief  Get the extent of a directory in a snapshot.
+  * @param  index  Directory entry, FS_MONITOR_NO_PARENT for the root
+  * @retval Extent, or NULL if none was recorded.
+  */
+static FS_DirExtent_t* fs_dir_extent(FS_Snapshot_t *snap, uint16_t index)
+{
+    if (index == FS_MONITOR_NO_PARENT)
     {
-        /* Subdirectory - append with slash */
-        snprintf(dest, dest_len, "%s/%s", dir, name);
+        return &snap->root;
     }
+    if (snap->entries[index].size == FS_MONITOR_NO_EXTENT)
+    {
+        return NULL;
+    }
+    return &snap->dirs[snap->entries[index].size];
 }
 
 /**
-  * @brief  Take a snapshot of directory contents recursively.
+  * @brief  Snapshot one directory and its subdirectories.
+  *         fs_walk_path holds the directory path ("" for the root).
+  * @param  old      Previous snapshot, or NULL to read everything below
+  * @param  old_dir  This directory in old (FS_MONITOR_NO_PARENT for the root)
+  * @param  extent   Where to record the directory's sectors, or NULL
+  * @param  parent   This directory in snapshot (FS_MONITOR_NO_PARENT for the root)
   */
-static void fs_take_snapshot_recursive(const char *path, FS_Snapshot_t *snapshot, int depth)
+static void fs_walk_dir(FS_Snapshot_t *snapshot, FS_Snapshot_t *old, uint16_t old_dir,
+                        FS_DirExtent_t *extent, size_t path_len,
+                        uint16_t parent, uint32_t parent_hash, int depth)
 {
     FRESULT res;
     DIR dir;
     FILINFO fno;
-    char full_path[FS_MONITOR_MAX_PATH_LEN];
 
     /* Limit recursion depth to prevent stack overflow */
-    if (depth >= FS_MONITOR_MAX_DEPTH)
+    if (depth >= (int)FS_MONITOR_MAX_DEPTH)
     {
         return;
     }
 
-    /* Stop if we already encountered an error */
-    if (snapshot->has_error)
+    /* Stop if we already encountered an error or ran out of room */
+    if (snapshot->has_error || snapshot->truncated)
     {
         return;
     }
 
-    res = f_opendir(&dir, path);
+    if (old != NULL)
+    {
+        const FS_DirExtent_t *old_extent = fs_dir_extent(old, old_dir);
+
+        if (old_extent != NULL && !fs_extent_dirty(old_extent))
+        {
+            if (extent != NULL)
+            {
+                *extent = *old_extent;
+            }
+            fs_copy_dir(snapshot, old, old_dir, path_len, parent, depth);
+            return;
+        }
+    }
+
+    res = f_opendir(&dir, (path_len == 0U) ? "/" : fs_walk_path);
     if (res != FR_OK)
     {
         if (res == FR_DISK_ERR || res == FR_NOT_READY || res == FR_TIMEOUT)
@@ -533,6 +775,10 @@ static void fs_take_snapshot_recursive(const char *path, FS_Snapshot_t *snapshot
         }
         return;
     }
+    snapshot->dirs_read++;
+
+    /* f_opendir leaves dir.sect at the first entry */
+    FS_DirExtent_t ext = { (uint32_t)dir.sect, (uint32_t)dir.sect, dir.clust, (uint32_t)dir.sect };
 
     for (;;)
     {
@@ -551,141 +797,468 @@ static void fs_take_snapshot_recursive(const char *path, FS_Snapshot_t *snapshot
             break;
         }
 
+        /* dir.sect now points at the next slot (possibly the end marker,
+         * where a new entry would be written); 0 once the chain ran out,
+         * in which case the rest of the last cluster holds this entry.
+         * Clusters of a fragmented chain need not ascend, so the end of
+         * the directory is tracked apart from the highest sector. */
+        if (dir.sect == 0U)
+        {
+            ext.end_sect = fs_cluster_last_sect(ext.last_clust);
+        }
+        else
+        {
+            ext.end_sect = (uint32_t)dir.sect;
+            ext.last_clust = dir.clust;
+            if (ext.end_sect < ext.first_sect)
+            {
+                ext.first_sect = ext.end_sect;
+            }
+        }
+        if (ext.end_sect > ext.last_sect)
+        {
+            ext.last_sect = ext.end_sect;
+        }
+
         /* Skip hidden files */
         if (fno.fname[0] == '.')
         {
             continue;
         }
 
-        /* Check if we have room for more entries */
-        if (snapshot->count >= FS_MONITOR_MAX_ENTRIES)
+        /* Skip entries whose full path would not fit */
+        size_t name_len = strlen(fno.fname);
+        if (path_len + 1U + name_len >= FS_MONITOR_MAX_PATH_LEN)
         {
-            break;
+            continue;
         }
 
-        /* Build full path */
-        fs_build_path(full_path, sizeof(full_path), path, fno.fname);
+        int is_dir = (fno.fattrib & AM_DIR) ? 1 : 0;
+        uint32_t hash = fs_hash_name(parent_hash, fno.fname);
+        uint16_t index = fs_add_entry(snapshot, fno.fname, name_len, parent, hash, is_dir);
+        if (index == FS_MONITOR_NO_PARENT)
+        {
+            break;
+        }
 
-        /* Add entry to snapshot */
-        FS_EntryCache_t *entry = &snapshot->entries[snapshot->count];
-        strncpy(entry->path, full_path, FS_MONITOR_MAX_PATH_LEN - 1);
-        entry->path[FS_MONITOR_MAX_PATH_LEN - 1] = '\0';
-        entry->size = fno.fsize;
+        FS_EntryCache_t *entry = &snapshot->entries[index];
+        if (!is_dir)
+        {
+            entry->size = (uint32_t)(fno.fsize ^ ((uint64_t)fno.fsize >> 32));
+            entry->fdate = fno.fdate;
+            entry->ftime = fno.ftime;
+            continue;
+        }
         entry->fdate = fno.fdate;
         entry->ftime = fno.ftime;
-        entry->is_dir = (fno.fattrib & AM_DIR) ? 1 : 0;
-        entry->valid = 1;
-        snapshot->count++;
 
-        /* Recurse into subdirectories */
-        if (entry->is_dir)
+        /* Recurse into subdirectories; one that was in the old snapshot
+         * may still be copied from it */
+        uint16_t old_child = FS_MONITOR_NO_PARENT;
+        if (old != NULL)
         {
-            fs_take_snapshot_recursive(full_path, snapshot, depth + 1);
+            old_child = fs_find_entry(old, hash, parent_hash, fno.fname);
+            if (old_child != FS_MONITOR_NO_PARENT &&
+                !(old->entries[old_child].name & FS_MONITOR_NAME_DIR))
+            {
+                old_child = FS_MONITOR_NO_PARENT;
+            }
         }
+
+        fs_walk_path[path_len] = '/';
+        memcpy(&fs_walk_path[path_len + 1U], fno.fname, name_len + 1U);
+        fs_walk_dir(snapshot, (old_child != FS_MONITOR_NO_PARENT) ? old : NULL, old_child,
+                    fs_dir_extent(snapshot, index), path_len + 1U + name_len,
+                    index, hash, depth + 1);
+        fs_walk_path[path_len] = '\0';
     }
 
     f_closedir(&dir);
-    snapshot->initialized = 1;
+
+    if (extent != NULL)
+    {
+        *extent = ext;
+    }
 }
 
 /**
-  * @brief  Find an entry in a snapshot by full path.
+  * @brief  Copy the entries of an unchanged directory from the old snapshot.
+  *         Subdirectories are checked (and read if needed) on their own.
   */
-static const FS_EntryCache_t* fs_find_entry(const FS_Snapshot_t *snap, const char *path)
+static void fs_copy_dir(FS_Snapshot_t *snapshot, FS_Snapshot_t *old, uint16_t old_dir,
+                        size_t path_len, uint16_t parent, int depth)
 {
-    for (uint16_t i = 0; i < snap->count; i++)
+    /* Entries are in walk order: a directory's subtree directly follows it
+     * and ends at the first entry whose parent comes before it */
+    for (uint16_t j = (old_dir == FS_MONITOR_NO_PARENT) ? 0U : (uint16_t)(old_dir + 1U);
+         j < old->count; j++)
     {
-        if (snap->entries[i].valid && strcmp(snap->entries[i].path, path) == 0)
+        const FS_EntryCache_t *old_entry = &old->entries[j];
+
+        if (old_entry->parent != old_dir)
         {
-            return &snap->entries[i];
+            if (old_dir != FS_MONITOR_NO_PARENT &&
+                (old_entry->parent == FS_MONITOR_NO_PARENT || old_entry->parent < old_dir))
+            {
+                break;
+            }
+            continue;  /* Deeper in the subtree */
+        }
+
+        const char *name = &old->names[old_entry->name & FS_MONITOR_NAME_MASK];
+        size_t name_len = strlen(name);
+        int is_dir = (old_entry->name & FS_MONITOR_NAME_DIR) ? 1 : 0;
+        uint16_t index = fs_add_entry(snapshot, name, name_len, parent, old_entry->hash, is_dir);
+        if (index == FS_MONITOR_NO_PARENT)
+        {
+            return;
+        }
+
+        FS_EntryCache_t *entry = &snapshot->entries[index];
+        entry->fdate = old_entry->fdate;
+        entry->ftime = old_entry->ftime;
+        if (!is_dir)
+        {
+            entry->size = old_entry->size;
+            continue;
+        }
+
+        fs_walk_path[path_len] = '/';
+        memcpy(&fs_walk_path[path_len + 1U], name, name_len + 1U);
+        fs_walk_dir(snapshot, old, j, fs_dir_extent(snapshot, index), path_len + 1U + name_len,
+                    index, old_entry->hash, depth + 1);
+        fs_walk_path[path_len] = '\0';
+
+        if (snapshot->has_error || snapshot->truncated)
+        {
+            return;
         }
     }
-    return NULL;
 }
 
 /**
-  * @brief  Detect and report changes between two snapshots via callback.
+  * @brief  Fingerprint of the mounted volume's layout. Extents recorded
+  *         under a different layout (card reformatted) mean nothing.
   */
-static void fs_detect_changes(FS_Snapshot_t *old_snap, FS_Snapshot_t *new_snap)
+static uint32_t fs_volume_layout(void)
 {
-    if (!old_snap->initialized)
+    uint32_t hash = FS_FNV_OFFSET;
+    uint32_t fields[6];
+
+    fields[0] = SDFatFs.fs_type;
+    fields[1] = SDFatFs.csize;
+    fields[2] = (uint32_t)SDFatFs.volbase;
+    fields[3] = (uint32_t)SDFatFs.fatbase;
+    fields[4] = (uint32_t)SDFatFs.database;
+    fields[5] = SDFatFs.n_fatent;
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
     {
-        return;  /* No previous snapshot to compare */
+        hash = (hash ^ fields[i]) * FS_FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+  * @brief  Last sector of a directory cluster (of the root area for 0).
+  */
+static uint32_t fs_cluster_last_sect(uint32_t clst)
+{
+    if (clst < 2U)
+    {
+        return (uint32_t)SDFatFs.dirbase + SDFatFs.n_rootdir / (FS_SECTOR_SIZE / 32U) - 1U;
+    }
+    return (uint32_t)SDFatFs.database + (clst - 2U) * SDFatFs.csize + SDFatFs.csize - 1U;
+}
+
+/**
+  * @brief  Check whether writes since the old snapshot may have changed
+  *         a directory: its own sectors, or the allocation records a
+  *         write would touch to grow it by a cluster.
+  * @retval 1 if the directory must be read again, 0 if it can be copied.
+  */
+static int fs_extent_dirty(const FS_DirExtent_t *extent)
+{
+    uint32_t clst = extent->last_clust;
+    uint32_t fat_first;
+    uint32_t fat_last;
+
+    if (SD_DirtyMap_Overlaps(&fs_dirty, extent->first_sect, extent->last_sect))
+    {
+        return 1;
     }
 
-    /* Check for new entries and modifications */
-    for (uint16_t i = 0; i < new_snap->count; i++)
+    if (clst < 2U)
     {
-        const FS_EntryCache_t *new_entry = &new_snap->entries[i];
-        if (!new_entry->valid)
+        return 0;  /* Fixed FAT12/16 root directory cannot grow */
+    }
+
+    /* A host only adds a cluster when the entries no longer fit after the
+     * end of the directory (end_sect, which lies in the last cluster) */
+    if ((fs_cluster_last_sect(clst) - extent->end_sect) * FS_SECTOR_SIZE >= FS_DIR_GROW_MARGIN)
+    {
+        return 0;
+    }
+
+    /* FAT entry of the last cluster (links the next one) */
+    switch (SDFatFs.fs_type)
+    {
+        case FS_FAT12:
+            fat_first = (clst + clst / 2U) / FS_SECTOR_SIZE;
+            fat_last = (clst + clst / 2U + 1U) / FS_SECTOR_SIZE;
+            break;
+        case FS_FAT16:
+            fat_first = clst / (FS_SECTOR_SIZE / 2U);
+            fat_last = fat_first;
+            break;
+        default:
+            fat_first = clst / (FS_SECTOR_SIZE / 4U);
+            fat_last = fat_first;
+            break;
+    }
+    if (SD_DirtyMap_Overlaps(&fs_dirty, (uint32_t)SDFatFs.fatbase + fat_first,
+                             (uint32_t)SDFatFs.fatbase + fat_last))
+    {
+        return 1;
+    }
+
+    /* exFAT can grow a contiguous directory without a FAT entry: the next
+     * cluster is only marked in the allocation bitmap */
+    if (SDFatFs.fs_type == FS_EXFAT)
+    {
+        uint32_t bit_sect = (uint32_t)SDFatFs.bitbase + (clst + 1U - 2U) / (FS_SECTOR_SIZE * 8U);
+
+        if (SD_DirtyMap_Overlaps(&fs_dirty, bit_sect, bit_sect))
         {
-            continue;
+            return 1;
         }
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  Find an entry by path key in a sorted snapshot.
+  * @retval Entry index, or FS_MONITOR_NO_PARENT if not present.
+  */
+static uint16_t fs_find_entry(const FS_Snapshot_t *snap, uint32_t hash,
+                              uint32_t parent_hash, const char *name)
+{
+    uint16_t lo = 0;
+    uint16_t hi = snap->count;
 
-        const FS_EntryCache_t *old_entry = fs_find_entry(old_snap, new_entry->path);
+    while (lo < hi)
+    {
+        uint16_t mid = (uint16_t)((lo + hi) / 2U);
+        int cmp = fs_entry_key_compare(snap, snap->order[mid], hash, parent_hash, name);
 
-        if (old_entry == NULL)
+        if (cmp == 0)
         {
-            /* Entry is new - created */
-            if (new_entry->is_dir)
-            {
-                fs_notify_change(FS_EVENT_DIR_CREATED, new_entry->path);
-            }
-            else
-            {
-                fs_notify_change(FS_EVENT_FILE_CREATED, new_entry->path);
-            }
+            return snap->order[mid];
+        }
+        if (cmp < 0)
+        {
+            lo = (uint16_t)(mid + 1U);
         }
         else
         {
-            /* Entry exists - check for modifications (files only) */
-            if (!new_entry->is_dir)
-            {
-                int modified = 0;
+            hi = mid;
+        }
+    }
+    return FS_MONITOR_NO_PARENT;
+}
 
-                /* Check size change */
-                if (new_entry->size != old_entry->size)
-                {
-                    modified = 1;
-                }
+/**
+  * @brief  Refresh the monitor snapshot and report what changed.
+  *         Caller holds fs_monitor_mutex and the volume is mounted.
+  */
+static void fs_monitor_update(void)
+{
+    FS_Snapshot_t *next = (fs_snapshot == &fs_snapshots[0]) ? &fs_snapshots[1] : &fs_snapshots[0];
 
-                /* Check date/time change */
-                if (new_entry->fdate != old_entry->fdate ||
-                    new_entry->ftime != old_entry->ftime)
-                {
-                    modified = 1;
-                }
+    fs_take_snapshot(next, fs_monitor_full_walk ? NULL : fs_snapshot);
+    if (next->has_error)
+    {
+        /* Keep the old snapshot; a partial walk would report false deletions.
+         * The writes it consumed are lost, so the next walk reads everything. */
+        LOG_DEBUG_TAG("FS", "Monitor poll skipped (disk error)");
+        fs_monitor_full_walk = 1;
+        return;
+    }
+    fs_monitor_full_walk = 0;
 
-                if (modified)
-                {
-                    fs_notify_change(FS_EVENT_FILE_MODIFIED, new_entry->path);
-                }
-            }
-        }
+    fs_detect_changes(fs_snapshot, next);
+    fs_snapshot->initialized = 0;
+    fs_snapshot = next;
+}
+
+/**
+  * @brief  Poll for changes while FatFS owns the card.
+  */
+static void fs_monitor_poll(void)
+{
+    tx_mutex_get(&fs_monitor_mutex, TX_WAIT_FOREVER);
+
+    if (fs_mounted)
+    {
+        fs_monitor_update();
+    }
+
+    tx_mutex_put(&fs_monitor_mutex);
+}
+
+/**
+  * @brief  Order an entry against a path key (hash, parent hash, name).
+  */
+static int fs_entry_key_compare(const FS_Snapshot_t *snap, uint16_t index,
+                                uint32_t hash, uint32_t parent_hash, const char *name)
+{
+    const FS_EntryCache_t *entry = &snap->entries[index];
+
+    if (entry->hash != hash)
+    {
+        return (entry->hash < hash) ? -1 : 1;
+    }
+
+    uint32_t entry_parent_hash = fs_parent_hash(snap, index);
+    if (entry_parent_hash != parent_hash)
+    {
+        return (entry_parent_hash < parent_hash) ? -1 : 1;
+    }
+
+    return strcmp(&snap->names[entry->name & FS_MONITOR_NAME_MASK], name);
+}
+
+/**
+  * @brief  Order two entries by (path hash, parent hash, name).
+  *         Entries comparing equal are the same path.
+  */
+static int fs_entry_compare(const FS_Snapshot_t *snap_a, uint16_t a,
+                            const FS_Snapshot_t *snap_b, uint16_t b)
+{
+    const FS_EntryCache_t *eb = &snap_b->entries[b];
+
+    return fs_entry_key_compare(snap_a, a, eb->hash, fs_parent_hash(snap_b, b),
+                                &snap_b->names[eb->name & FS_MONITOR_NAME_MASK]);
+}
+
+/**
+  * @brief  qsort comparator for FS_Snapshot_t.order.
+  */
+static int fs_entry_sort_cmp(const void *a, const void *b)
+{
+    return fs_entry_compare(fs_sort_snapshot, *(const uint16_t *)a,
+                            fs_sort_snapshot, *(const uint16_t *)b);
+}
+
+/**
+  * @brief  Rebuild the full path of an entry from its parent chain.
+  * @retval Pointer to fs_event_path.
+  */
+static const char* fs_entry_path(const FS_Snapshot_t *snap, uint16_t index)
+{
+    uint16_t chain[FS_MONITOR_MAX_DEPTH];
+    size_t depth = 0;
+    size_t len = 0;
+
+    while (index != FS_MONITOR_NO_PARENT && depth < FS_MONITOR_MAX_DEPTH)
+    {
+        chain[depth++] = index;
+        index = snap->entries[index].parent;
+    }
+
+    /* Lengths were checked when the snapshot was taken */
+    while (depth > 0U)
+    {
+        const char *name = &snap->names[snap->entries[chain[--depth]].name & FS_MONITOR_NAME_MASK];
+        size_t name_len = strlen(name);
+
+        fs_event_path[len++] = '/';
+        memcpy(&fs_event_path[len], name, name_len);
+        len += name_len;
+    }
+    fs_event_path[len] = '\0';
+
+    return fs_event_path;
+}
+
+/**
+  * @brief  Report a created or deleted entry with the event for its type.
+  */
+static void fs_report_entry(FS_EventType_t file_event, FS_EventType_t dir_event,
+                            const FS_Snapshot_t *snap, uint16_t index)
+{
+    FS_EventType_t event = (snap->entries[index].name & FS_MONITOR_NAME_DIR) ? dir_event : file_event;
+
+    fs_notify_change(event, fs_entry_path(snap, index));
+}
+
+/**
+  * @brief  Detect and report changes between two snapshots via callback.
+  *         Both snapshots are sorted, so this is a single merge pass.
+  */
+static void fs_detect_changes(FS_Snapshot_t *old_snap, FS_Snapshot_t *new_snap)
+{
+    uint16_t i = 0;
+    uint16_t j = 0;
+
+    if (!old_snap->initialized)
+    {
+        return;  /* No previous snapshot to compare */
     }
 
-    /* Check for deleted entries */
-    for (uint16_t i = 0; i < old_snap->count; i++)
+    while (i < old_snap->count || j < new_snap->count)
     {
-        const FS_EntryCache_t *old_entry = &old_snap->entries[i];
-        if (!old_entry->valid)
+        int cmp;
+
+        if (i >= old_snap->count)
         {
-            continue;
+            cmp = 1;
+        }
+        else if (j >= new_snap->count)
+        {
+            cmp = -1;
+        }
+        else
+        {
+            cmp = fs_entry_compare(old_snap, old_snap->order[i], new_snap, new_snap->order[j]);
         }
 
-        const FS_EntryCache_t *new_entry = fs_find_entry(new_snap, old_entry->path);
-
-        if (new_entry == NULL)
+        if (cmp < 0)
+        {
+            /* Only in the old snapshot - deleted */
+            fs_report_entry(FS_EVENT_FILE_DELETED, FS_EVENT_DIR_DELETED, old_snap, old_snap->order[i]);
+            i++;
+        }
+        else if (cmp > 0)
+        {
+            /* Only in the new snapshot - created */
+            fs_report_entry(FS_EVENT_FILE_CREATED, FS_EVENT_DIR_CREATED, new_snap, new_snap->order[j]);
+            j++;
+        }
+        else
         {
-            /* Entry was deleted */
-            if (old_entry->is_dir)
+            const FS_EntryCache_t *old_entry = &old_snap->entries[old_snap->order[i]];
+            const FS_EntryCache_t *new_entry = &new_snap->entries[new_snap->order[j]];
+
+            if ((old_entry->name ^ new_entry->name) & FS_MONITOR_NAME_DIR)
             {
-                fs_notify_change(FS_EVENT_DIR_DELETED, old_entry->path);
+                /* Replaced by an entry of the other type */
+                fs_report_entry(FS_EVENT_FILE_DELETED, FS_EVENT_DIR_DELETED, old_snap, old_snap->order[i]);
+                fs_report_entry(FS_EVENT_FILE_CREATED, FS_EVENT_DIR_CREATED, new_snap, new_snap->order[j]);
             }
-            else
+            else if (!(new_entry->name & FS_MONITOR_NAME_DIR))
             {
-                fs_notify_change(FS_EVENT_FILE_DELETED, old_entry->path);
+                /* Entry exists - check for size or date/time change (files only) */
+                if (new_entry->size != old_entry->size ||
+                    new_entry->fdate != old_entry->fdate ||
+                    new_entry->ftime != old_entry->ftime)
+                {
+                    fs_notify_change(FS_EVENT_FILE_MODIFIED, fs_entry_path(new_snap, new_snap->order[j]));
+                }
             }
+            i++;
+            j++;
         }
     }
 }
@@ -0,0 +1,488 @@
+/**
+  ******************************************************************************
+  * @file    jpeg_manifest.c
+  * @brief   JPEG manifest - persistent record of converted .bin files
+  ******************************************************************************
+  * File layout: an 8-byte header followed by fixed 16-byte records. Records
+  * are only ever appended; when loading, a later record for the same path
+  * replaces the earlier one. Compaction writes the live table to a temporary
+  * file and renames it over the journal, so a power cut leaves either the
+  * old or the new file (the temporary one is picked up on the next load).
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "jpeg_manifest.h"
+#include "fs_reader.h"
+#include "logger.h"
+#include "tx_api.h"
+#include <string.h>
+
+/* Private defines -----------------------------------------------------------*/
+#define MANIFEST_TAG        "MAN"
+#define MANIFEST_MAGIC      0x464E414AUL   /* "JANF" */
+#define MANIFEST_VERSION    1U
+#define MANIFEST_TMP_PATH   JPEG_MANIFEST_PATH ".tmp"
+#define MANIFEST_MAX_LIVE   ((JPEG_MANIFEST_TABLE_SIZE * 3U) / 4U)
+#define MANIFEST_IO_RECS    32U            /* Records per f_read/f_write */
+
+#if (JPEG_MANIFEST_TABLE_SIZE & (JPEG_MANIFEST_TABLE_SIZE - 1U)) != 0U
+#error "JPEG_MANIFEST_TABLE_SIZE must be a power of two"
+#endif
+
+/* Private types -------------------------------------------------------------*/
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_size;
+} manifest_header_t;
+
+/* One journal record, also the hash table entry (name_hash 0 = empty) */
+typedef struct {
+    uint32_t name_hash;     /* FNV-1a of the path, ASCII case folded */
+    uint32_t size;          /* .bin size in bytes */
+    uint16_t fdate;         /* .bin modification date (FatFs format) */
+    uint16_t ftime;         /* .bin modification time (FatFs format) */
+    uint8_t  status;        /* JPEG_Manifest_Status_t */
+    uint8_t  reserved[3];
+} manifest_rec_t;
+
+/* Private variables ---------------------------------------------------------*/
+static TX_MUTEX manifest_mutex;
+static int manifest_ready = 0;
+
+static manifest_rec_t table[JPEG_MANIFEST_TABLE_SIZE];
+static manifest_rec_t pending[JPEG_MANIFEST_PENDING_MAX];
+static manifest_rec_t io_buf[MANIFEST_IO_RECS];
+static uint32_t pending_count = 0;
+static uint32_t loaded_generation = 0;      /* Mount the table belongs to */
+static int needs_rewrite = 0;               /* Journal missing, corrupt or torn */
+static int table_full_logged = 0;
+static JPEG_Manifest_Stats_t stats;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint32_t manifest_hash(const char *path);
+static manifest_rec_t *table_slot(uint32_t name_hash);
+static int table_put(const manifest_rec_t *rec);
+static int manifest_ensure_loaded(void);
+static void manifest_load(void);
+static void manifest_append(void);
+static void manifest_compact(void);
+
+/* Public functions ----------------------------------------------------------*/
+
+void JPEG_Manifest_Init(void)
+{
+    if (!manifest_ready && (tx_mutex_create(&manifest_mutex, "JPEG Manifest", TX_INHERIT) == TX_SUCCESS))
+    {
+        manifest_ready = 1;
+    }
+}
+
+int JPEG_Manifest_Lookup(const char *bin_path, const FILINFO *fno)
+{
+    int status = 0;
+
+    if (!manifest_ready || (bin_path == NULL) || (fno == NULL))
+    {
+        return 0;
+    }
+
+    tx_mutex_get(&manifest_mutex, TX_WAIT_FOREVER);
+    if (manifest_ensure_loaded() == 0)
+    {
+        manifest_rec_t *rec = table_slot(manifest_hash(bin_path));
+
+        if ((rec == NULL) || (rec->name_hash == 0U))
+        {
+            stats.misses++;
+        }
+        else if ((rec->size == (uint32_t)fno->fsize) &&
+                 (rec->fdate == fno->fdate) && (rec->ftime == fno->ftime))
+        {
+            stats.hits++;
+            status = rec->status;
+        }
+        else
+        {
+            stats.stale++;
+        }
+    }
+    tx_mutex_put(&manifest_mutex);
+
+    return status;
+}
+
+void JPEG_Manifest_Record(const char *bin_path, const FILINFO *fno, JPEG_Manifest_Status_t status)
+{
+    manifest_rec_t rec;
+
+    if (!manifest_ready || (bin_path == NULL) || (fno == NULL))
+    {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.name_hash = manifest_hash(bin_path);
+    rec.size = (uint32_t)fno->fsize;
+    rec.fdate = fno->fdate;
+    rec.ftime = fno->ftime;
+    rec.status = (uint8_t)status;
+
+    tx_mutex_get(&manifest_mutex, TX_WAIT_FOREVER);
+    if ((manifest_ensure_loaded() == 0) && (table_put(&rec) == 0))
+    {
+        if (pending_count < JPEG_MANIFEST_PENDING_MAX)
+        {
+            pending[pending_count++] = rec;
+        }
+        else
+        {
+            needs_rewrite = 1;  /* Kept in the table; the next flush rewrites it */
+        }
+        if (pending_count == JPEG_MANIFEST_PENDING_MAX)
+        {
+            manifest_append();
+        }
+    }
+    tx_mutex_put(&manifest_mutex);
+}
+
+void JPEG_Manifest_RecordFile(const char *bin_path, JPEG_Manifest_Status_t status)
+{
+    FILINFO fno;
+
+    if ((bin_path != NULL) && (f_stat(bin_path, &fno) == FR_OK))
+    {
+        JPEG_Manifest_Record(bin_path, &fno, status);
+    }
+}
+
+void JPEG_Manifest_Sync(void)
+{
+    if (!manifest_ready)
+    {
+        return;
+    }
+
+    tx_mutex_get(&manifest_mutex, TX_WAIT_FOREVER);
+    if (manifest_ensure_loaded() == 0)
+    {
+        if ((pending_count > 0U) || needs_rewrite)
+        {
+            manifest_append();
+        }
+        if ((stats.journal >= JPEG_MANIFEST_COMPACT_MIN) && (stats.journal >= 2U * stats.entries))
+        {
+            manifest_compact();
+        }
+    }
+    tx_mutex_put(&manifest_mutex);
+}
+
+void JPEG_Manifest_GetStats(JPEG_Manifest_Stats_t *out)
+{
+    if ((out == NULL) || !manifest_ready)
+    {
+        return;
+    }
+
+    tx_mutex_get(&manifest_mutex, TX_WAIT_FOREVER);
+    *out = stats;
+    tx_mutex_put(&manifest_mutex);
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  FNV-1a hash of a path; exFAT names are case-insensitive.
+  */
+static uint32_t manifest_hash(const char *path)
+{
+    uint32_t h = 2166136261UL;
+
+    while (*path != '\0')
+    {
+        char c = *path++;
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+            c = (char)(c - 'A' + 'a');
+        }
+        h ^= (uint8_t)c;
+        h *= 16777619UL;
+    }
+
+    return (h != 0U) ? h : 1U;  /* 0 marks an empty slot */
+}
+
+/**
+  * @brief  Find the slot holding name_hash, or the empty slot it would use.
+  * @retval NULL if the hash is absent and the table has no room left.
+  */
+static manifest_rec_t *table_slot(uint32_t name_hash)
+{
+    uint32_t idx = name_hash & (JPEG_MANIFEST_TABLE_SIZE - 1U);
+    uint32_t n;
+
+    for (n = 0; n < JPEG_MANIFEST_TABLE_SIZE; n++)
+    {
+        manifest_rec_t *rec = &table[idx];
+        if ((rec->name_hash == name_hash) || (rec->name_hash == 0U))
+        {
+            return rec;
+        }
+        idx = (idx + 1U) & (JPEG_MANIFEST_TABLE_SIZE - 1U);
+    }
+
+    return NULL;
+}
+
+/**
+  * @brief  Insert or replace a record in the RAM table.
+  * @retval 0 on success, -1 if the table is full.
+  */
+static int table_put(const manifest_rec_t *rec)
+{
+    manifest_rec_t *slot = table_slot(rec->name_hash);
+
+    if ((slot != NULL) && (slot->name_hash == 0U) && (stats.entries >= MANIFEST_MAX_LIVE))
+    {
+        slot = NULL;
+    }
+    if (slot == NULL)
+    {
+        if (!table_full_logged)
+        {
+            LOG_WARN_TAG(MANIFEST_TAG, "Table full (%u entries), new files are checked on disk",
+                         (unsigned)stats.entries);
+            table_full_logged = 1;
+        }
+        return -1;
+    }
+
+    if (slot->name_hash == 0U)
+    {
+        stats.entries++;
+    }
+    *slot = *rec;
+    return 0;
+}
+
+/**
+  * @brief  Make sure the table matches the current mount; reload after a
+  *         remount since the card may have been changed over MSC meanwhile.
+  *         Caller holds manifest_mutex.
+  * @retval 0 if the table is usable, -1 if no filesystem is mounted.
+  */
+static int manifest_ensure_loaded(void)
+{
+    uint32_t generation;
+
+    if (!FS_Reader_IsMounted())
+    {
+        return -1;
+    }
+
+    generation = FS_Reader_GetMountGeneration();
+    if (generation != loaded_generation)
+    {
+        memset(table, 0, sizeof(table));
+        memset(&stats, 0, sizeof(stats));
+        pending_count = 0;
+        needs_rewrite = 0;
+        table_full_logged = 0;
+        loaded_generation = generation;
+        manifest_load();
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  Load the journal into the table.
+  */
+static void manifest_load(void)
+{
+    FIL fil;
+    FRESULT res;
+    manifest_header_t hdr;
+    UINT br = 0;
+
+    /* A compaction interrupted after the unlink leaves only the new file */
+    res = f_open(&fil, JPEG_MANIFEST_PATH, FA_READ);
+    if (res == FR_NO_FILE)
+    {
+        if (f_rename(MANIFEST_TMP_PATH, JPEG_MANIFEST_PATH) == FR_OK)
+        {
+            res = f_open(&fil, JPEG_MANIFEST_PATH, FA_READ);
+        }
+    }
+    if (res != FR_OK)
+    {
+        LOG_DEBUG_TAG(MANIFEST_TAG, "No manifest (err=%d)", (int)res);
+        needs_rewrite = 1;
+        return;
+    }
+
+    if ((f_read(&fil, &hdr, sizeof(hdr), &br) != FR_OK) || (br != sizeof(hdr)) ||
+        (hdr.magic != MANIFEST_MAGIC) || (hdr.version != MANIFEST_VERSION) ||
+        (hdr.rec_size != sizeof(manifest_rec_t)))
+    {
+        LOG_WARN_TAG(MANIFEST_TAG, "Manifest header invalid, starting over");
+        f_close(&fil);
+        needs_rewrite = 1;
+        return;
+    }
+
+    for (;;)
+    {
+        uint32_t i;
+
+        res = f_read(&fil, io_buf, sizeof(io_buf), &br);
+        if (res != FR_OK)
+        {
+            LOG_WARN_TAG(MANIFEST_TAG, "Manifest read error %d", (int)res);
+            needs_rewrite = 1;
+            break;
+        }
+        for (i = 0; i < br / sizeof(manifest_rec_t); i++)
+        {
+            if (io_buf[i].name_hash != 0U)
+            {
+                (void)table_put(&io_buf[i]);
+            }
+            stats.journal++;
+        }
+        if ((br % sizeof(manifest_rec_t)) != 0U)
+        {
+            needs_rewrite = 1;  /* Torn append: rewrite so records stay aligned */
+        }
+        if (br < sizeof(io_buf))
+        {
+            break;
+        }
+    }
+
+    f_close(&fil);
+    LOG_INFO_TAG(MANIFEST_TAG, "Manifest: %u entries (%u records)",
+                 (unsigned)stats.entries, (unsigned)stats.journal);
+}
+
+/**
+  * @brief  Append the pending records to the journal (one f_write).
+  *         Caller holds manifest_mutex.
+  */
+static void manifest_append(void)
+{
+    FIL fil;
+    FRESULT res;
+    UINT bw = 0;
+    UINT len = (UINT)(pending_count * sizeof(manifest_rec_t));
+
+    if (needs_rewrite)
+    {
+        manifest_compact();  /* The table already holds the pending records */
+        return;
+    }
+
+    res = f_open(&fil, JPEG_MANIFEST_PATH, FA_WRITE | FA_OPEN_APPEND);
+    if (res == FR_OK)
+    {
+        res = f_write(&fil, pending, len, &bw);
+        if ((res == FR_OK) && (bw != len))
+        {
+            res = FR_DENIED;  /* Volume full */
+        }
+        if (f_close(&fil) != FR_OK && res == FR_OK)
+        {
+            res = FR_DISK_ERR;
+        }
+    }
+
+    if (res != FR_OK)
+    {
+        LOG_WARN_TAG(MANIFEST_TAG, "Journal append failed (err=%d)", (int)res);
+        needs_rewrite = 1;
+    }
+    else
+    {
+        stats.journal += pending_count;
+    }
+    pending_count = 0;
+}
+
+/**
+  * @brief  Rewrite the journal with one record per live entry.
+  *         Caller holds manifest_mutex.
+  */
+static void manifest_compact(void)
+{
+    FIL fil;
+    FRESULT res;
+    UINT bw = 0;
+    uint32_t i;
+    uint32_t n = 0;
+    uint32_t written = 0;
+    manifest_header_t hdr = { MANIFEST_MAGIC, MANIFEST_VERSION, (uint16_t)sizeof(manifest_rec_t) };
+
+    /* The table holds every pending record, so they are dropped whether or
+     * not the rewrite succeeds; on failure needs_rewrite retries it */
+    pending_count = 0;
+
+    res = f_open(&fil, MANIFEST_TMP_PATH, FA_WRITE | FA_CREATE_ALWAYS);
+    if (res != FR_OK)
+    {
+        LOG_WARN_TAG(MANIFEST_TAG, "Compaction failed (err=%d)", (int)res);
+        needs_rewrite = 1;
+        return;
+    }
+
+    res = f_write(&fil, &hdr, sizeof(hdr), &bw);
+    for (i = 0; (i < JPEG_MANIFEST_TABLE_SIZE) && (res == FR_OK); i++)
+    {
+        if (table[i].name_hash != 0U)
+        {
+            io_buf[n++] = table[i];
+        }
+        if ((n == MANIFEST_IO_RECS) || ((i == JPEG_MANIFEST_TABLE_SIZE - 1U) && (n > 0U)))
+        {
+            UINT len = (UINT)(n * sizeof(manifest_rec_t));
+            res = f_write(&fil, io_buf, len, &bw);
+            if ((res == FR_OK) && (bw != len))
+            {
+                res = FR_DENIED;
+            }
+            written += n;
+            n = 0;
+        }
+    }
+    if (f_close(&fil) != FR_OK && res == FR_OK)
+    {
+        res = FR_DISK_ERR;
+    }
+
+    if (res == FR_OK)
+    {
+        res = f_unlink(JPEG_MANIFEST_PATH);
+        if (res == FR_NO_FILE)
+        {
+            res = FR_OK;
+        }
+    }
+    if (res == FR_OK)
+    {
+        res = f_rename(MANIFEST_TMP_PATH, JPEG_MANIFEST_PATH);
+    }
+
+    if (res != FR_OK)
+    {
+        LOG_WARN_TAG(MANIFEST_TAG, "Compaction failed (err=%d)", (int)res);
+        needs_rewrite = 1;
+        return;
+    }
+
+    LOG_DEBUG_TAG(MANIFEST_TAG, "Compacted: %u -> %u records",
+                  (unsigned)stats.journal, (unsigned)written);
+    stats.journal = written;
+    needs_rewrite = 0;
+}
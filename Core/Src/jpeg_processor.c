@@ -10,28 +10,103 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "jpeg_processor.h"
+#include "jpeg_worker.h"
 #include "jpeg_encoder.h"
 #include "jpeg_encoder_timing.h"
 #include "ff.h"
 #include "fs_reader.h"
 #include "logger.h"
+#include "sd_adapter.h"
 #include "time_it.h"
 #include <string.h>
 
 /* Private defines -----------------------------------------------------------*/
 #define JPEG_PROC_TAG  "JPEG"
 
+/* Input read-ahead state: one aligned chunk of the input file */
+typedef struct {
+    uint8_t *buf;          /* JPEG_PROCESSOR_READAHEAD_SIZE bytes */
+    FSIZE_t buf_pos;       /* File offset of buf[0] */
+    UINT buf_len;          /* Valid bytes in buf */
+    FSIZE_t pos;           /* Logical read position seen by the encoder */
+    uint8_t sparse;        /* Set by seek: next miss reads only the requested span */
+    uint32_t fetch_count;  /* f_read calls issued */
+    uint32_t fetch_bytes;  /* Bytes read from the card */
+    uint32_t served_bytes; /* Bytes handed to the encoder */
+} jpeg_readahead_t;
+
+#if JPEG_PROCESSOR_WRITE_BUFS < 1
+#error "JPEG_PROCESSOR_WRITE_BUFS must be at least 1"
+#endif
+
+/* Output write-behind ring state. The encoder thread fills ring slot
+ * 'head'; the writer thread drains queued slots from 'tail'. */
+typedef struct {
+    uint8_t *buf;          /* Slot being filled, JPEG_PROCESSOR_WRITE_BUF_SIZE bytes */
+    UINT len;              /* Bytes pending in buf */
+    uint32_t head;         /* Ring index of buf */
+    uint32_t tail;         /* Next ring index to write (writer thread) */
+    UINT slot_len[JPEG_PROCESSOR_WRITE_BUFS]; /* Bytes queued per slot */
+    uint32_t write_count;  /* f_write calls issued */
+    uint32_t busy_us;      /* Time spent in f_write */
+    uint32_t stall_us;     /* Time the encoder waited for a free slot */
+    FRESULT error;         /* First f_write error, FR_OK if none */
+} jpeg_writebuf_t;
+
 /* Stream context for FatFS file I/O */
 typedef struct {
     FIL *fin;              /* Input file handle */
+    jpeg_readahead_t ra;   /* Input read-ahead */
     FIL *fout;             /* Output file handle */
+    jpeg_writebuf_t wb;    /* Output coalescing */
     size_t bytes_written;  /* Track output size */
+    uint32_t next_log_pct; /* Next progress percentage to report */
 } jpeg_stream_ctx_t;
 
 /* Private variables ---------------------------------------------------------*/
 static int jpeg_proc_initialized = 0;
 static uint32_t last_encoding_time_ms = 0;
 static size_t last_output_size = 0;
+static JPEG_Processor_PollHook_t poll_hook = NULL;
+
+/* Read-ahead buffer (word aligned for the SDMMC internal DMA) */
+static uint8_t readahead_buf[JPEG_PROCESSOR_READAHEAD_SIZE] __attribute__((aligned(32)));
+
+/* Output write-behind ring */
+static uint8_t writebuf_ring[JPEG_PROCESSOR_WRITE_BUFS][JPEG_PROCESSOR_WRITE_BUF_SIZE] __attribute__((aligned(32)));
+
+/* Fast-seek cluster link map for the input file */
+static DWORD input_clmt[JPEG_PROCESSOR_CLMT_SIZE];
+
+#if JPEG_PROCESSOR_ASYNC_READ
+/* Input reader thread: runs one jpeg_stream_read per request */
+typedef struct {
+    jpeg_stream_ctx_t *ctx;    /* Stream being read */
+    void *buf;                 /* Destination strip */
+    size_t size;               /* Bytes requested */
+    size_t result;             /* Bytes read */
+    uint32_t busy_us;          /* Time spent reading (this encode) */
+    uint32_t wait_us;          /* Time the encoder blocked in read_wait */
+} jpeg_reader_job_t;
+
+static TX_THREAD reader_thread;
+static UCHAR reader_thread_stack[JPEG_PROCESSOR_READER_STACK_SIZE];
+static TX_SEMAPHORE reader_req_sem;
+static TX_SEMAPHORE reader_done_sem;
+static int reader_ready = 0;
+static jpeg_reader_job_t reader_job;
+#endif
+
+#if JPEG_PROCESSOR_ASYNC_WRITE
+/* Output writer thread. writer_free_sem counts ring slots that are neither
+ * being filled nor queued, so it is back at WRITE_BUFS - 1 when idle. */
+static TX_THREAD writer_thread;
+static UCHAR writer_thread_stack[JPEG_PROCESSOR_WRITER_STACK_SIZE];
+static TX_SEMAPHORE writer_req_sem;
+static TX_SEMAPHORE writer_free_sem;
+static int writer_ready = 0;
+static jpeg_stream_ctx_t *writer_ctx = NULL;
+#endif
 
 /* Debug counters for stream callbacks */
 static volatile uint32_t read_call_count = 0;
@@ -50,7 +125,22 @@ static const JPEG_Processor_Config_t default_config = {
 static void jpeg_fs_change_handler(FS_EventType_t event_type, const char *path);
 static int jpeg_build_output_path(char *out_path, size_t out_len, const char *bin_path);
 static size_t jpeg_stream_read(void *ctx, void *buf, size_t size);
+static int jpeg_readahead_fill(jpeg_readahead_t *ra, FIL *fin);
 static size_t jpeg_stream_write(void *ctx, const void *buf, size_t size);
+static void jpeg_writebuf_write_slot(jpeg_stream_ctx_t *stream_ctx, uint32_t slot);
+static int jpeg_writebuf_submit(jpeg_stream_ctx_t *stream_ctx);
+static void jpeg_writebuf_drain(jpeg_stream_ctx_t *stream_ctx);
+static int jpeg_writebuf_flush(jpeg_stream_ctx_t *stream_ctx);
+static int jpeg_stream_seek(void *ctx, size_t offset);
+static int jpeg_progress(void *ctx, uint32_t rows_done, uint32_t rows_total);
+#if JPEG_PROCESSOR_ASYNC_READ
+static void jpeg_reader_thread_entry(ULONG arg);
+static int jpeg_stream_read_submit(void *ctx, void *buf, size_t size);
+static size_t jpeg_stream_read_wait(void *ctx, void *buf);
+#endif
+#if JPEG_PROCESSOR_ASYNC_WRITE
+static void jpeg_writer_thread_entry(ULONG arg);
+#endif
 
 /* Public functions ----------------------------------------------------------*/
 
@@ -90,6 +180,40 @@ JPEG_Processor_Status_t JPEG_Processor_Init(void)
     /* Register our handler with the filesystem monitor */
     FS_Reader_SetChangeCallback(jpeg_fs_change_handler);
     
+#if JPEG_PROCESSOR_ASYNC_READ
+    /* Input reader thread; without it the encoder reads inline */
+    if ((tx_semaphore_create(&reader_req_sem, "JPEG Rd Req", 0U) == TX_SUCCESS) &&
+        (tx_semaphore_create(&reader_done_sem, "JPEG Rd Done", 0U) == TX_SUCCESS) &&
+        (tx_thread_create(&reader_thread, "JPEG Reader", jpeg_reader_thread_entry, 0,
+                          reader_thread_stack, JPEG_PROCESSOR_READER_STACK_SIZE,
+                          JPEG_PROCESSOR_READER_PRIORITY, JPEG_PROCESSOR_READER_PRIORITY,
+                          TX_NO_TIME_SLICE, TX_AUTO_START) == TX_SUCCESS))
+    {
+        reader_ready = 1;
+    }
+    else
+    {
+        LOG_WARN_TAG(JPEG_PROC_TAG, "Reader thread not created, using inline reads");
+    }
+#endif
+    
+#if JPEG_PROCESSOR_ASYNC_WRITE
+    /* Output writer thread; without it full buffers are written inline */
+    if ((tx_semaphore_create(&writer_req_sem, "JPEG Wr Req", 0U) == TX_SUCCESS) &&
+        (tx_semaphore_create(&writer_free_sem, "JPEG Wr Free", JPEG_PROCESSOR_WRITE_BUFS - 1U) == TX_SUCCESS) &&
+        (tx_thread_create(&writer_thread, "JPEG Writer", jpeg_writer_thread_entry, 0,
+                          writer_thread_stack, JPEG_PROCESSOR_WRITER_STACK_SIZE,
+                          JPEG_PROCESSOR_WRITER_PRIORITY, JPEG_PROCESSOR_WRITER_PRIORITY,
+                          TX_NO_TIME_SLICE, TX_AUTO_START) == TX_SUCCESS))
+    {
+        writer_ready = 1;
+    }
+    else
+    {
+        LOG_WARN_TAG(JPEG_PROC_TAG, "Writer thread not created, using inline writes");
+    }
+#endif
+    
     jpeg_proc_initialized = 1;
     LOG_INFO_TAG(JPEG_PROC_TAG, "JPEG processor initialized");
     
@@ -157,6 +281,16 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
         return JPEG_PROC_ERR_FILE_TOO_LARGE;
     }
     
+    /* Build the fast-seek link map so reads and seeks skip the FAT walk */
+    input_clmt[0] = JPEG_PROCESSOR_CLMT_SIZE;
+    fin.cltbl = input_clmt;
+    fres = f_lseek(&fin, CREATE_LINKMAP);
+    if (fres != FR_OK)
+    {
+        LOG_DEBUG_TAG(JPEG_PROC_TAG, "No link map (err=%d, need %lu)", fres, (unsigned long)input_clmt[0]);
+        fin.cltbl = NULL;
+    }
+    
     /* Open output file */
     fres = f_open(&fout, jpg_path, FA_WRITE | FA_CREATE_ALWAYS);
     if (fres != FR_OK)
@@ -169,8 +303,11 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
     /* Set up stream context */
     jpeg_stream_ctx_t stream_ctx = {
         .fin = &fin,
+        .ra = { .buf = readahead_buf },
         .fout = &fout,
-        .bytes_written = 0
+        .wb = { .buf = writebuf_ring[0], .error = FR_OK },
+        .bytes_written = 0,
+        .next_log_pct = JPEG_PROCESSOR_PROGRESS_LOG_PCT
     };
     
     /* Set up stream interface */
@@ -178,7 +315,12 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
         .read = jpeg_stream_read,
         .read_ctx = &stream_ctx,
         .write = jpeg_stream_write,
-        .write_ctx = &stream_ctx
+        .write_ctx = &stream_ctx,
+        .seek = jpeg_stream_seek,
+#if JPEG_PROCESSOR_ASYNC_READ
+        .read_submit = jpeg_stream_read_submit,
+        .read_wait = jpeg_stream_read_wait
+#endif
     };
     
     /* Configure encoder */
@@ -190,12 +332,26 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
     enc_config.bayer_pattern = JPEG_BAYER_PATTERN_GBRG;
     enc_config.quality = config->quality;
     enc_config.start_offset_lines = config->start_offset_lines;
-    enc_config.apply_awb = true;
+    enc_config.awb_mode = JPEG_PROCESSOR_AWB_MODE;
+    enc_config.apply_awb = (enc_config.awb_mode == JPEG_AWB_MODE_FIXED);
     enc_config.awb_r_gain = JPEG_DEMOSAIC_RED_GAIN;
     enc_config.awb_g_gain = JPEG_DEMOSAIC_GREEN_GAIN;
     enc_config.awb_b_gain = JPEG_DEMOSAIC_BLUE_GAIN;
     enc_config.enable_fast_mode = true;  /* Always use fast mode for performance */
     enc_config.subsample = JPEG_SUBSAMPLE_422;  /* 4:2:2 - faster than 4:2:0, better quality */
+    enc_config.progress = jpeg_progress;
+    enc_config.progress_ctx = &stream_ctx;
+    enc_config.progress_interval = JPEG_PROCESSOR_PROGRESS_MCU_ROWS;
+    
+    /* Pre-allocate a contiguous extent for the worst-case output so the file
+     * does not grow cluster by cluster (NoFatChain on exFAT); trimmed below */
+    FSIZE_t out_bound = (FSIZE_t)jpeg_encoder_estimate_output_size(&enc_config);
+    int out_expanded = (f_expand(&fout, out_bound, 1) == FR_OK);
+    if (!out_expanded)
+    {
+        LOG_DEBUG_TAG(JPEG_PROC_TAG, "No contiguous %lu KB for output, growing normally",
+                      (unsigned long)(out_bound / 1024U));
+    }
     
     /* Check memory requirements before encoding */
     size_t mem_req = jpeg_encoder_estimate_memory_requirement(&enc_config);
@@ -204,16 +360,52 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
     /* Reset read counters */
     read_call_count = 0;
     read_total_bytes = 0;
+#if JPEG_PROCESSOR_ASYNC_READ
+    reader_job.busy_us = 0;
+    reader_job.wait_us = 0;
+#endif
+#if JPEG_PROCESSOR_ASYNC_WRITE
+    writer_ctx = &stream_ctx;
+#endif
     
     /* Encode using streaming (low memory usage) */
     LOG_DEBUG_TAG(JPEG_PROC_TAG, "Starting encode...");
     TIME_IT(elapsed_ms, encode_result = jpeg_encode_stream(&stream, &enc_config));
     LOG_DEBUG_TAG(JPEG_PROC_TAG, "Encode returned: %d", encode_result);
     
+    /* Write out the tail and wait for the writer thread: nothing may be
+     * in flight on fout once it is truncated, closed or unlinked */
+    if (encode_result == 0)
+    {
+        (void)jpeg_writebuf_flush(&stream_ctx);
+    }
+    else
+    {
+        jpeg_writebuf_drain(&stream_ctx);
+    }
+    
+    /* Drop the unused part of the pre-allocated extent */
+    if (out_expanded && encode_result == 0 && stream_ctx.wb.error == FR_OK)
+    {
+        fres = f_truncate(&fout);
+        if (fres != FR_OK)
+        {
+            LOG_ERROR_TAG(JPEG_PROC_TAG, "Truncate failed: %s (err=%d)", jpg_path, fres);
+            stream_ctx.wb.error = fres;
+        }
+    }
+    
     /* Close files */
     f_close(&fin);
     f_close(&fout);
     
+    if (encode_result == -(int)JPEG_ENCODER_ERR_ABORTED)
+    {
+        LOG_WARN_TAG(JPEG_PROC_TAG, "Encode aborted: %s", bin_path);
+        f_unlink(jpg_path);
+        return JPEG_PROC_ERR_ABORTED;
+    }
+    
     if (encode_result != 0)
     {
         jpeg_encoder_error_t err;
@@ -225,6 +417,13 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
         return JPEG_PROC_ERR_ENCODE;
     }
     
+    if (stream_ctx.wb.error != FR_OK)
+    {
+        LOG_ERROR_TAG(JPEG_PROC_TAG, "Write failed: %s (err=%d)", jpg_path, (int)stream_ctx.wb.error);
+        f_unlink(jpg_path);
+        return JPEG_PROC_ERR_WRITE_OUTPUT;
+    }
+    
     /* Update stats */
     last_encoding_time_ms = elapsed_ms;
     last_output_size = stream_ctx.bytes_written;
@@ -237,6 +436,49 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
                  jpg_path, (unsigned long)stream_ctx.bytes_written, 
                  ratio_x10 / 10UL, ratio_x10 % 10UL, (unsigned long)elapsed_ms);
     
+    /* Read-ahead efficiency: amplification = fetched / served (x100) */
+    {
+        const jpeg_readahead_t *ra = &stream_ctx.ra;
+        unsigned long amp_x100 = (ra->served_bytes > 0U) ?
+                      ((unsigned long)ra->fetch_bytes * 100UL) / (unsigned long)ra->served_bytes : 0UL;
+        unsigned long avg_cmd = (ra->fetch_count > 0U) ?
+                      (unsigned long)ra->fetch_bytes / (unsigned long)ra->fetch_count : 0UL;
+        LOG_INFO_TAG(JPEG_PROC_TAG, "Input: %lu reads -> %lu cmds, avg %lu B/cmd, amplification %lu.%02lux",
+                     (unsigned long)read_call_count, (unsigned long)ra->fetch_count, avg_cmd,
+                     amp_x100 / 100UL, amp_x100 % 100UL);
+        LOG_INFO_TAG(JPEG_PROC_TAG, "Output: %lu writes, avg %lu B/cmd",
+                     (unsigned long)stream_ctx.wb.write_count,
+                     (stream_ctx.wb.write_count > 0U) ?
+                     (unsigned long)stream_ctx.bytes_written / (unsigned long)stream_ctx.wb.write_count : 0UL);
+    }
+    
+#if JPEG_PROCESSOR_ASYNC_WRITE
+    /* Write/compute overlap: the encoder only waits when the ring is full
+     * and at the final flush */
+    if (writer_ready && (stream_ctx.wb.busy_us > 0U))
+    {
+        uint32_t hidden_us = (stream_ctx.wb.busy_us > stream_ctx.wb.stall_us) ?
+                             (stream_ctx.wb.busy_us - stream_ctx.wb.stall_us) : 0U;
+        LOG_INFO_TAG(JPEG_PROC_TAG, "Output overlap: write %lu ms, stalled %lu ms (%lu%% hidden)",
+                     (unsigned long)(stream_ctx.wb.busy_us / 1000U),
+                     (unsigned long)(stream_ctx.wb.stall_us / 1000U),
+                     (unsigned long)((hidden_us * 100ULL) / stream_ctx.wb.busy_us));
+    }
+#endif
+    
+#if JPEG_PROCESSOR_ASYNC_READ
+    /* Read/compute overlap: reader busy time the encoder did not wait for */
+    if (reader_job.busy_us > 0U)
+    {
+        uint32_t hidden_us = (reader_job.busy_us > reader_job.wait_us) ?
+                             (reader_job.busy_us - reader_job.wait_us) : 0U;
+        LOG_INFO_TAG(JPEG_PROC_TAG, "Input overlap: read %lu ms, stalled %lu ms (%lu%% hidden)",
+                     (unsigned long)(reader_job.busy_us / 1000U),
+                     (unsigned long)(reader_job.wait_us / 1000U),
+                     (unsigned long)((hidden_us * 100ULL) / reader_job.busy_us));
+    }
+#endif
+    
 #if JPEG_TIMING_ENABLED
     /* Log detailed timing breakdown */
     {
@@ -245,9 +487,10 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
         uint32_t unpack_ms = JPEG_TIMING_TO_MS(JPEG_TIMING_CYCLES(JPEG_TIMING_UNPACK));
         uint32_t demosaic_ms = JPEG_TIMING_TO_MS(JPEG_TIMING_CYCLES(JPEG_TIMING_DEMOSAIC));
         uint32_t mcu_ms = JPEG_TIMING_TO_MS(JPEG_TIMING_CYCLES(JPEG_TIMING_MCU_PREPARE));
+        uint32_t wait_ms = JPEG_TIMING_TO_MS(JPEG_TIMING_CYCLES(JPEG_TIMING_READ_WAIT));
         
-        LOG_INFO_TAG(JPEG_PROC_TAG, "Timing: Total=%lums Read=%lums Unpack=%lums Demosaic=%lums MCU=%lums",
-                     (unsigned long)total_ms, (unsigned long)read_ms, 
+        LOG_INFO_TAG(JPEG_PROC_TAG, "Timing: Total=%lums Read=%lums Wait=%lums Unpack=%lums Demosaic=%lums MCU=%lums",
+                     (unsigned long)total_ms, (unsigned long)read_ms, (unsigned long)wait_ms,
                      (unsigned long)unpack_ms, (unsigned long)demosaic_ms, 
                      (unsigned long)mcu_ms);
         
@@ -257,10 +500,12 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
             uint32_t unpack_pct = (unpack_ms * 1000) / total_ms;
             uint32_t demosaic_pct = (demosaic_ms * 1000) / total_ms;
             uint32_t mcu_pct = (mcu_ms * 1000) / total_ms;
-            uint32_t other_pct = 1000 - read_pct - unpack_pct - demosaic_pct - mcu_pct;
+            uint32_t wait_pct = (wait_ms * 1000) / total_ms;
+            uint32_t other_pct = 1000 - read_pct - wait_pct - unpack_pct - demosaic_pct - mcu_pct;
             
-            LOG_INFO_TAG(JPEG_PROC_TAG, "Breakdown: Read=%lu.%lu%% Unpack=%lu.%lu%% Demosaic=%lu.%lu%% MCU=%lu.%lu%% Other=%lu.%lu%%",
+            LOG_INFO_TAG(JPEG_PROC_TAG, "Breakdown: Read=%lu.%lu%% Wait=%lu.%lu%% Unpack=%lu.%lu%% Demosaic=%lu.%lu%% MCU=%lu.%lu%% Other=%lu.%lu%%",
                          read_pct/10, read_pct%10,
+                         wait_pct/10, wait_pct%10,
                          unpack_pct/10, unpack_pct%10,
                          demosaic_pct/10, demosaic_pct%10,
                          mcu_pct/10, mcu_pct%10,
@@ -272,6 +517,11 @@ JPEG_Processor_Status_t JPEG_Processor_ConvertFile(const char *bin_path,
     return JPEG_PROC_OK;
 }
 
+void JPEG_Processor_SetPollHook(JPEG_Processor_PollHook_t hook)
+{
+    poll_hook = hook;
+}
+
 uint32_t JPEG_Processor_GetLastEncodingTime(void)
 {
     return last_encoding_time_ms;
@@ -304,13 +554,14 @@ static void jpeg_fs_change_handler(FS_EventType_t event_type, const char *path)
         return;
     }
     
-    /* Process the .bin file */
+    /* Hand the .bin file to the worker; the monitor thread must not encode.
+     * New captures go ahead of any batch scan still in the queue. */
     LOG_INFO_TAG(JPEG_PROC_TAG, "Detected RAW file: %s", path);
     
-    JPEG_Processor_Status_t status = JPEG_Processor_ConvertFile(path, NULL);
-    if (status != JPEG_PROC_OK)
+    JPEG_Job_Result_t result = JPEG_Worker_Submit(path, NULL, JPEG_JOB_PRIO_HIGH, TX_NO_WAIT);
+    if (result == JPEG_JOB_QUEUE_FULL || result == JPEG_JOB_INVALID)
     {
-        LOG_ERROR_TAG(JPEG_PROC_TAG, "Conversion failed: %d", (int)status);
+        LOG_ERROR_TAG(JPEG_PROC_TAG, "Not queued: %s (%d)", path, (int)result);
     }
 }
 
@@ -339,29 +590,135 @@ static int jpeg_build_output_path(char *out_path, size_t out_len, const char *bi
     return 0;
 }
 
+/**
+  * @brief  Load the read-ahead chunk containing ra->pos.
+  * @retval 0 on success (buf_len may be 0 at EOF), -1 on error
+  */
+static int jpeg_readahead_fill(jpeg_readahead_t *ra, FIL *fin)
+{
+    FSIZE_t chunk_pos = ra->pos & ~((FSIZE_t)JPEG_PROCESSOR_READAHEAD_SIZE - 1U);
+    UINT bytes_read = 0;
+    FRESULT res;
+    
+    if (f_tell(fin) != chunk_pos)
+    {
+        res = f_lseek(fin, chunk_pos);
+        if (res != FR_OK)
+        {
+            LOG_ERROR_TAG(JPEG_PROC_TAG, "Read-ahead seek error: %d", (int)res);
+            return -1;
+        }
+    }
+    
+    res = f_read(fin, ra->buf, JPEG_PROCESSOR_READAHEAD_SIZE, &bytes_read);
+    if (res != FR_OK)
+    {
+        LOG_ERROR_TAG(JPEG_PROC_TAG, "Read-ahead error: %d (chunk %lu)", (int)res,
+                      (unsigned long)(chunk_pos / JPEG_PROCESSOR_READAHEAD_SIZE));
+        return -1;
+    }
+    
+    ra->buf_pos = chunk_pos;
+    ra->buf_len = bytes_read;
+    ra->fetch_count++;
+    ra->fetch_bytes += bytes_read;
+    return 0;
+}
+
+/**
+  * @brief  Read exactly [ra->pos, ra->pos + size) into dst, bypassing the chunk.
+  *         Used for the first read after a seek, where the caller is skipping
+  *         through the file (AWB pre-scan) and a full chunk would be wasted.
+  * @retval 0 on success, -1 on error
+  */
+static int jpeg_readahead_direct(jpeg_readahead_t *ra, FIL *fin, uint8_t *dst, size_t size, UINT *bytes_read)
+{
+    FRESULT res;
+    
+    *bytes_read = 0;
+    if (f_tell(fin) != ra->pos)
+    {
+        res = f_lseek(fin, ra->pos);
+        if (res != FR_OK)
+        {
+            LOG_ERROR_TAG(JPEG_PROC_TAG, "Read-ahead seek error: %d", (int)res);
+            return -1;
+        }
+    }
+    
+    res = f_read(fin, dst, (UINT)size, bytes_read);
+    if (res != FR_OK)
+    {
+        LOG_ERROR_TAG(JPEG_PROC_TAG, "Sparse read error: %d (offset %lu)", (int)res,
+                      (unsigned long)ra->pos);
+        return -1;
+    }
+    
+    ra->fetch_count++;
+    ra->fetch_bytes += *bytes_read;
+    return 0;
+}
+
 /**
   * @brief  Stream read callback for FatFS.
+  *         Serves the encoder from aligned read-ahead chunks instead of
+  *         passing its row-sized (never sector-aligned) requests to f_read.
+  *         The first read after a seek that misses the chunk fetches only
+  *         the requested span.
   */
 static size_t jpeg_stream_read(void *ctx, void *buf, size_t size)
 {
     jpeg_stream_ctx_t *stream_ctx = (jpeg_stream_ctx_t *)ctx;
-    UINT bytes_read = 0;
+    jpeg_readahead_t *ra;
+    uint8_t *dst = (uint8_t *)buf;
+    size_t copied = 0;
     
     if (stream_ctx == NULL || stream_ctx->fin == NULL || buf == NULL || size == 0)
     {
         return 0;
     }
     
-    FRESULT res = f_read(stream_ctx->fin, buf, (UINT)size, &bytes_read);
-    if (res != FR_OK)
+    ra = &stream_ctx->ra;
+    while (copied < size)
     {
-        LOG_ERROR_TAG(JPEG_PROC_TAG, "Stream read error: %d (call #%lu)", 
-                      (int)res, (unsigned long)read_call_count);
-        return 0;
+        /* Refill when the position is outside the buffered chunk */
+        if ((ra->pos < ra->buf_pos) || (ra->pos >= ra->buf_pos + ra->buf_len))
+        {
+            if (ra->sparse)
+            {
+                UINT direct = 0;
+                if (jpeg_readahead_direct(ra, stream_ctx->fin, dst + copied, size - copied, &direct) == 0)
+                {
+                    copied += direct;
+                    ra->pos += direct;
+                }
+                break;
+            }
+            if (jpeg_readahead_fill(ra, stream_ctx->fin) != 0)
+            {
+                break;
+            }
+            if ((ra->pos >= ra->buf_pos + ra->buf_len))
+            {
+                break;  /* End of file */
+            }
+        }
+        
+        UINT offset = (UINT)(ra->pos - ra->buf_pos);
+        size_t chunk = ra->buf_len - offset;
+        if (chunk > size - copied)
+        {
+            chunk = size - copied;
+        }
+        memcpy(dst + copied, ra->buf + offset, chunk);
+        copied += chunk;
+        ra->pos += chunk;
     }
     
+    ra->sparse = 0;
     read_call_count++;
-    read_total_bytes += bytes_read;
+    read_total_bytes += copied;
+    ra->served_bytes += copied;
     
     /* Log progress every 100 calls */
     if ((read_call_count % 100) == 0)
@@ -371,29 +728,290 @@ static size_t jpeg_stream_read(void *ctx, void *buf, size_t size)
                       (unsigned long)(read_total_bytes / 1024));
     }
     
-    return (size_t)bytes_read;
+    return copied;
 }
 
+#if JPEG_PROCESSOR_ASYNC_READ
 /**
-  * @brief  Stream write callback for FatFS.
+  * @brief  Input reader thread.
+  *         Runs each submitted strip read; the SD transfer itself sleeps on
+  *         the SDMMC interrupt, so the encoder thread keeps the CPU meanwhile.
   */
-static size_t jpeg_stream_write(void *ctx, const void *buf, size_t size)
+static void jpeg_reader_thread_entry(ULONG arg)
+{
+    (void)arg;
+    
+    for (;;)
+    {
+        uint32_t busy_us = 0;
+        
+        if (tx_semaphore_get(&reader_req_sem, TX_WAIT_FOREVER) != TX_SUCCESS)
+        {
+            continue;
+        }
+        TIME_IT_US(busy_us, reader_job.result = jpeg_stream_read(reader_job.ctx, reader_job.buf, reader_job.size));
+        reader_job.busy_us += busy_us;
+        tx_semaphore_put(&reader_done_sem);
+    }
+}
+
+/**
+  * @brief  Stream read_submit callback: hand the next strip to the reader.
+  *         Returns non-zero (encoder reads inline) if there is no reader.
+  */
+static int jpeg_stream_read_submit(void *ctx, void *buf, size_t size)
+{
+    if (!reader_ready)
+    {
+        return -1;
+    }
+    
+    reader_job.ctx = (jpeg_stream_ctx_t *)ctx;
+    reader_job.buf = buf;
+    reader_job.size = size;
+    reader_job.result = 0;
+    tx_semaphore_put(&reader_req_sem);
+    return 0;
+}
+
+/**
+  * @brief  Stream read_wait callback: block until the submitted strip is in.
+  */
+static size_t jpeg_stream_read_wait(void *ctx, void *buf)
+{
+    uint32_t wait_us = 0;
+    
+    (void)ctx;
+    (void)buf;
+    TIME_IT_US(wait_us, (void)tx_semaphore_get(&reader_done_sem, TX_WAIT_FOREVER));
+    reader_job.wait_us += wait_us;
+    return reader_job.result;
+}
+#endif
+
+/**
+  * @brief  Stream seek callback (input file, absolute offset).
+  *         Only moves the read-ahead position; the next read fetches just
+  *         its own span unless the chunk already holds it, so sparse seeks
+  *         (AWB pre-scan) do not pull in a whole chunk each.
+  */
+static int jpeg_stream_seek(void *ctx, size_t offset)
 {
     jpeg_stream_ctx_t *stream_ctx = (jpeg_stream_ctx_t *)ctx;
+    
+    if (stream_ctx == NULL || stream_ctx->fin == NULL)
+    {
+        return -1;
+    }
+    
+    if ((FSIZE_t)offset > f_size(stream_ctx->fin))
+    {
+        LOG_ERROR_TAG(JPEG_PROC_TAG, "Stream seek past EOF: %lu", (unsigned long)offset);
+        return -1;
+    }
+    
+    stream_ctx->ra.pos = (FSIZE_t)offset;
+    stream_ctx->ra.sparse = 1;
+    return 0;
+}
+
+/**
+  * @brief  Encoder progress callback: reports over CDC, yields, checks abort.
+  * @retval Non-zero to abort the encode.
+  */
+static int jpeg_progress(void *ctx, uint32_t rows_done, uint32_t rows_total)
+{
+    jpeg_stream_ctx_t *stream_ctx = (jpeg_stream_ctx_t *)ctx;
+    
+    if ((JPEG_PROCESSOR_PROGRESS_LOG_PCT > 0) && (rows_total > 0))
+    {
+        uint32_t pct = (rows_done * 100U) / rows_total;
+        if ((pct >= stream_ctx->next_log_pct) && (pct < 100U))
+        {
+            LOG_INFO_TAG(JPEG_PROC_TAG, "Progress: %lu%% (%lu/%lu rows)",
+                         (unsigned long)pct, (unsigned long)rows_done, (unsigned long)rows_total);
+            stream_ctx->next_log_pct = (pct / JPEG_PROCESSOR_PROGRESS_LOG_PCT + 1U) * JPEG_PROCESSOR_PROGRESS_LOG_PCT;
+        }
+    }
+    
+    /* Let equal-priority threads (USB, logger) run between MCU rows */
+    tx_thread_relinquish();
+    
+    /* Stop if the hook asks to, or if the card was handed over to MSC meanwhile */
+    if ((poll_hook != NULL) && poll_hook())
+    {
+        return 1;
+    }
+    return (SD_GetMode() != SD_MODE_FATFS) ? 1 : 0;
+}
+
+/**
+  * @brief  Write one queued ring slot with a single f_write.
+  *         After the first error the remaining slots are only recycled.
+  */
+static void jpeg_writebuf_write_slot(jpeg_stream_ctx_t *stream_ctx, uint32_t slot)
+{
+    jpeg_writebuf_t *wb = &stream_ctx->wb;
+    UINT len = wb->slot_len[slot];
     UINT bytes_written = 0;
+    uint32_t busy_us = 0;
+    FRESULT res;
     
-    if (stream_ctx == NULL || stream_ctx->fout == NULL || buf == NULL || size == 0)
+    if (wb->error != FR_OK)
     {
-        return 0;
+        return;
     }
     
-    FRESULT res = f_write(stream_ctx->fout, buf, (UINT)size, &bytes_written);
+    TIME_IT_US(busy_us, res = f_write(stream_ctx->fout, writebuf_ring[slot], len, &bytes_written));
+    wb->busy_us += busy_us;
+    wb->write_count++;
+    if (res == FR_OK && bytes_written != len)
+    {
+        res = FR_DENIED;  /* Volume full */
+    }
     if (res != FR_OK)
     {
         LOG_ERROR_TAG(JPEG_PROC_TAG, "Stream write error: %d", (int)res);
+        wb->error = res;
+    }
+}
+
+/**
+  * @brief  Queue the slot being filled and move on to the next one.
+  *         Blocks only while every other slot is still queued.
+  * @retval 0 on success, -1 once a write has failed (error kept in wb.error)
+  */
+static int jpeg_writebuf_submit(jpeg_stream_ctx_t *stream_ctx)
+{
+    jpeg_writebuf_t *wb = &stream_ctx->wb;
+    
+    if (wb->len == 0U)
+    {
+        return (wb->error != FR_OK) ? -1 : 0;
+    }
+    
+    wb->slot_len[wb->head] = wb->len;
+#if JPEG_PROCESSOR_ASYNC_WRITE
+    if (writer_ready)
+    {
+        uint32_t stall_us = 0;
+        
+        tx_semaphore_put(&writer_req_sem);
+        wb->head = (wb->head + 1U) % JPEG_PROCESSOR_WRITE_BUFS;
+        TIME_IT_US(stall_us, (void)tx_semaphore_get(&writer_free_sem, TX_WAIT_FOREVER));
+        wb->stall_us += stall_us;
+    }
+    else
+#endif
+    {
+        jpeg_writebuf_write_slot(stream_ctx, wb->head);
+    }
+    
+    wb->buf = writebuf_ring[wb->head];
+    wb->len = 0;
+    return (wb->error != FR_OK) ? -1 : 0;
+}
+
+/**
+  * @brief  Barrier: wait until the writer thread has written every queued
+  *         slot. The slot being filled is left alone.
+  */
+static void jpeg_writebuf_drain(jpeg_stream_ctx_t *stream_ctx)
+{
+    (void)stream_ctx;
+#if JPEG_PROCESSOR_ASYNC_WRITE
+    if (writer_ready)
+    {
+        uint32_t i;
+        
+        /* All other slots free again means nothing is in flight */
+        for (i = 0; i < JPEG_PROCESSOR_WRITE_BUFS - 1U; i++)
+        {
+            uint32_t stall_us = 0;
+            TIME_IT_US(stall_us, (void)tx_semaphore_get(&writer_free_sem, TX_WAIT_FOREVER));
+            stream_ctx->wb.stall_us += stall_us;
+        }
+        for (i = 0; i < JPEG_PROCESSOR_WRITE_BUFS - 1U; i++)
+        {
+            tx_semaphore_put(&writer_free_sem);
+        }
+    }
+#endif
+}
+
+/**
+  * @brief  Queue the partial slot and wait for all output to reach the card.
+  * @retval 0 on success, -1 on error (first error kept in wb.error)
+  */
+static int jpeg_writebuf_flush(jpeg_stream_ctx_t *stream_ctx)
+{
+    (void)jpeg_writebuf_submit(stream_ctx);
+    jpeg_writebuf_drain(stream_ctx);
+    return (stream_ctx->wb.error != FR_OK) ? -1 : 0;
+}
+
+#if JPEG_PROCESSOR_ASYNC_WRITE
+/**
+  * @brief  Output writer thread: writes queued ring slots in order.
+  */
+static void jpeg_writer_thread_entry(ULONG arg)
+{
+    (void)arg;
+    
+    for (;;)
+    {
+        if (tx_semaphore_get(&writer_req_sem, TX_WAIT_FOREVER) != TX_SUCCESS)
+        {
+            continue;
+        }
+        jpeg_writebuf_t *wb = &writer_ctx->wb;
+        jpeg_writebuf_write_slot(writer_ctx, wb->tail);
+        wb->tail = (wb->tail + 1U) % JPEG_PROCESSOR_WRITE_BUFS;
+        tx_semaphore_put(&writer_free_sem);
+    }
+}
+#endif
+
+/**
+  * @brief  Stream write callback for FatFS.
+  *         Coalesces the encoder's small output chunks; the card only sees
+  *         JPEG_PROCESSOR_WRITE_BUF_SIZE writes plus the final tail, issued
+  *         by the writer thread while encoding continues.
+  */
+static size_t jpeg_stream_write(void *ctx, const void *buf, size_t size)
+{
+    jpeg_stream_ctx_t *stream_ctx = (jpeg_stream_ctx_t *)ctx;
+    const uint8_t *src = (const uint8_t *)buf;
+    size_t copied = 0;
+    
+    if (stream_ctx == NULL || stream_ctx->fout == NULL || buf == NULL || size == 0)
+    {
         return 0;
     }
     
-    stream_ctx->bytes_written += bytes_written;
-    return (size_t)bytes_written;
+    jpeg_writebuf_t *wb = &stream_ctx->wb;
+    if (wb->error != FR_OK)
+    {
+        return 0;  /* Card already failed; drop the rest */
+    }
+    
+    while (copied < size)
+    {
+        size_t chunk = JPEG_PROCESSOR_WRITE_BUF_SIZE - wb->len;
+        if (chunk > size - copied)
+        {
+            chunk = size - copied;
+        }
+        memcpy(wb->buf + wb->len, src + copied, chunk);
+        wb->len += (UINT)chunk;
+        copied += chunk;
+        
+        if (wb->len == JPEG_PROCESSOR_WRITE_BUF_SIZE && jpeg_writebuf_submit(stream_ctx) != 0)
+        {
+            return 0;
+        }
+    }
+    
+    stream_ctx->bytes_written += copied;
+    return copied;
 }
@@ -0,0 +1,441 @@
+/**
+  ******************************************************************************
+  * @file    jpeg_worker.c
+  * @brief   JPEG worker - queued .bin to JPEG conversions on their own thread
+  ******************************************************************************
+  * Jobs live in a fixed pool of slots; the ThreadX queue carries slot
+  * indices. A slot stays taken from submit until the worker is done with it,
+  * which is what bounds the queue and lets submits be de-duplicated.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "jpeg_worker.h"
+#include "jpeg_manifest.h"
+#include "logger.h"
+#include "sd_diskio.h"
+#include "time_it.h"
+#include <string.h>
+
+/* Private defines -----------------------------------------------------------*/
+#define JPEG_WORKER_TAG  "JOB"
+
+/* Private types -------------------------------------------------------------*/
+typedef enum {
+    JOB_FREE = 0,
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_CANCELLED       /* Still in the queue or running, skip/abort it */
+} jpeg_job_state_t;
+
+typedef struct {
+    char path[JPEG_WORKER_PATH_LEN];
+    JPEG_Processor_Config_t config;
+    uint8_t has_config;
+    volatile uint8_t state;     /* jpeg_job_state_t */
+} jpeg_job_t;
+
+/* Private variables ---------------------------------------------------------*/
+static TX_THREAD worker_thread;
+static UCHAR worker_thread_stack[JPEG_WORKER_STACK_SIZE];
+static TX_QUEUE job_queue;
+static ULONG job_queue_storage[JPEG_WORKER_QUEUE_DEPTH];
+static TX_SEMAPHORE slot_sem;       /* Free job slots */
+static TX_MUTEX job_mutex;          /* Guards job_pool states and stats */
+static int worker_ready = 0;
+
+static jpeg_job_t job_pool[JPEG_WORKER_QUEUE_DEPTH];
+static jpeg_job_t *running_job = NULL;
+static JPEG_Worker_Stats_t stats;
+
+/* Counters for the batch in progress (reset when the worker goes idle) */
+static uint32_t batch_done = 0;
+static uint32_t batch_failed = 0;
+static uint32_t batch_ms = 0;
+
+/* Private function prototypes -----------------------------------------------*/
+static VOID worker_thread_entry(ULONG thread_input);
+static int worker_poll(void);
+static int worker_busy_locked(const jpeg_job_t *except);
+
+/* Public functions ----------------------------------------------------------*/
+
+UINT JPEG_Worker_Init(void)
+{
+    UINT status;
+
+    if (worker_ready)
+    {
+        return TX_SUCCESS;
+    }
+
+    status = tx_mutex_create(&job_mutex, "JPEG Jobs", TX_INHERIT);
+    if (status == TX_SUCCESS)
+    {
+        status = tx_semaphore_create(&slot_sem, "JPEG Slots", JPEG_WORKER_QUEUE_DEPTH);
+    }
+    if (status == TX_SUCCESS)
+    {
+        status = tx_queue_create(&job_queue, "JPEG Queue", TX_1_ULONG,
+                                 job_queue_storage, sizeof(job_queue_storage));
+    }
+    if (status == TX_SUCCESS)
+    {
+        status = tx_thread_create(&worker_thread,
+                                  "JPEG Worker",
+                                  worker_thread_entry,
+                                  0U,
+                                  worker_thread_stack,
+                                  JPEG_WORKER_STACK_SIZE,
+                                  JPEG_WORKER_PRIORITY,
+                                  JPEG_WORKER_PRIORITY,
+                                  TX_NO_TIME_SLICE,
+                                  TX_AUTO_START);
+    }
+
+    if (status != TX_SUCCESS)
+    {
+        LOG_ERROR_TAG(JPEG_WORKER_TAG, "Failed to create JPEG worker: %u", (unsigned)status);
+        return status;
+    }
+
+    /* Cancellation is checked at every encoder progress callback */
+    JPEG_Processor_SetPollHook(worker_poll);
+    worker_ready = 1;
+    return TX_SUCCESS;
+}
+
+JPEG_Job_Result_t JPEG_Worker_Submit(const char *bin_path,
+                                     const JPEG_Processor_Config_t *config,
+                                     JPEG_Job_Priority_t priority,
+                                     ULONG wait_ticks)
+{
+    jpeg_job_t *job = NULL;
+    uint32_t i;
+
+    if (!worker_ready || (bin_path == NULL) || (strlen(bin_path) >= JPEG_WORKER_PATH_LEN))
+    {
+        return JPEG_JOB_INVALID;
+    }
+
+    if (tx_semaphore_get(&slot_sem, wait_ticks) != TX_SUCCESS)
+    {
+        tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+        stats.rejected++;
+        tx_mutex_put(&job_mutex);
+        return JPEG_JOB_QUEUE_FULL;
+    }
+
+    tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+
+    /* One pending job per path: a second event for the same file adds nothing */
+    for (i = 0; i < JPEG_WORKER_QUEUE_DEPTH; i++)
+    {
+        if ((job_pool[i].state == JOB_QUEUED) && (strcmp(job_pool[i].path, bin_path) == 0))
+        {
+            stats.duplicates++;
+            tx_mutex_put(&job_mutex);
+            tx_semaphore_put(&slot_sem);
+            return JPEG_JOB_DUPLICATE;
+        }
+    }
+
+    /* A slot is guaranteed free: slot_sem counts them */
+    for (i = 0; i < JPEG_WORKER_QUEUE_DEPTH; i++)
+    {
+        if (job_pool[i].state == JOB_FREE)
+        {
+            job = &job_pool[i];
+            break;
+        }
+    }
+
+    strcpy(job->path, bin_path);
+    job->has_config = (config != NULL) ? 1U : 0U;
+    if (config != NULL)
+    {
+        job->config = *config;
+    }
+    job->state = JOB_QUEUED;
+    stats.queued++;
+    stats.depth++;
+    if (stats.depth > stats.max_depth)
+    {
+        stats.max_depth = stats.depth;
+    }
+
+    /* Cannot fail or block: the queue holds one entry per slot */
+    ULONG index = (ULONG)(job - job_pool);
+    if (priority == JPEG_JOB_PRIO_HIGH)
+    {
+        (void)tx_queue_front_send(&job_queue, &index, TX_NO_WAIT);
+    }
+    else
+    {
+        (void)tx_queue_send(&job_queue, &index, TX_NO_WAIT);
+    }
+
+    tx_mutex_put(&job_mutex);
+    return JPEG_JOB_QUEUED;
+}
+
+int JPEG_Worker_Cancel(const char *bin_path)
+{
+    uint32_t i;
+    int cancelled = 0;
+
+    if (!worker_ready || (bin_path == NULL))
+    {
+        return 0;
+    }
+
+    tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+    for (i = 0; i < JPEG_WORKER_QUEUE_DEPTH; i++)
+    {
+        jpeg_job_t *job = &job_pool[i];
+        if (((job->state == JOB_QUEUED) || (job->state == JOB_RUNNING)) &&
+            (strcmp(job->path, bin_path) == 0))
+        {
+            if (job->state == JOB_QUEUED)
+            {
+                stats.depth--;
+            }
+            job->state = JOB_CANCELLED;
+            cancelled = 1;
+        }
+    }
+    tx_mutex_put(&job_mutex);
+
+    return cancelled;
+}
+
+uint32_t JPEG_Worker_CancelAll(void)
+{
+    uint32_t i;
+    uint32_t cancelled = 0;
+
+    if (!worker_ready)
+    {
+        return 0;
+    }
+
+    tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+    for (i = 0; i < JPEG_WORKER_QUEUE_DEPTH; i++)
+    {
+        jpeg_job_t *job = &job_pool[i];
+        if ((job->state == JOB_QUEUED) || (job->state == JOB_RUNNING))
+        {
+            if (job->state == JOB_QUEUED)
+            {
+                stats.depth--;
+            }
+            job->state = JOB_CANCELLED;
+            cancelled++;
+        }
+    }
+    tx_mutex_put(&job_mutex);
+
+    return cancelled;
+}
+
+int JPEG_Worker_IsBusy(void)
+{
+    int busy;
+
+    if (!worker_ready)
+    {
+        return 0;
+    }
+
+    tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+    busy = worker_busy_locked(NULL);
+    tx_mutex_put(&job_mutex);
+
+    return busy;
+}
+
+int JPEG_Worker_WaitIdle(ULONG timeout_ticks)
+{
+    ULONG start = tx_time_get();
+
+    while (JPEG_Worker_IsBusy())
+    {
+        if ((timeout_ticks != TX_WAIT_FOREVER) && ((tx_time_get() - start) >= timeout_ticks))
+        {
+            return -1;
+        }
+        tx_thread_sleep(1U);
+    }
+
+    return 0;
+}
+
+void JPEG_Worker_GetStats(JPEG_Worker_Stats_t *out)
+{
+    if (out == NULL)
+    {
+        return;
+    }
+
+    if (worker_ready)
+    {
+        tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+    }
+    *out = stats;
+    if (worker_ready)
+    {
+        tx_mutex_put(&job_mutex);
+    }
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Any slot other than 'except' (may be NULL) in use? Caller holds job_mutex.
+  */
+static int worker_busy_locked(const jpeg_job_t *except)
+{
+    uint32_t i;
+
+    for (i = 0; i < JPEG_WORKER_QUEUE_DEPTH; i++)
+    {
+        if ((&job_pool[i] != except) && (job_pool[i].state != JOB_FREE))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+  * @brief  Processor poll hook: abort the running encode once it is cancelled.
+  *         Runs on the worker thread.
+  */
+static int worker_poll(void)
+{
+    return ((running_job != NULL) && (running_job->state == JOB_CANCELLED)) ? 1 : 0;
+}
+
+/**
+  * @brief  Worker thread - runs queued conversions one at a time.
+  * @param  thread_input: Thread input parameter (unused).
+  */
+static VOID worker_thread_entry(ULONG thread_input)
+{
+    TX_PARAMETER_NOT_USED(thread_input);
+
+    for (;;)
+    {
+        ULONG index;
+        jpeg_job_t *job;
+        JPEG_Processor_Status_t status = JPEG_PROC_ERR_ABORTED;
+        uint32_t elapsed_ms = 0;
+        int skip;
+
+        if (tx_queue_receive(&job_queue, &index, TX_WAIT_FOREVER) != TX_SUCCESS)
+        {
+            continue;
+        }
+        job = &job_pool[index];
+
+        tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+        skip = (job->state == JOB_CANCELLED);
+        if (!skip)
+        {
+            job->state = JOB_RUNNING;
+            stats.depth--;
+        }
+        tx_mutex_put(&job_mutex);
+
+        /* First job of a batch: start the cache counters afresh */
+        if (!skip && (batch_done + batch_failed == 0U) && (batch_ms == 0U))
+        {
+            SD_DiskCache_ResetStats();
+        }
+
+        if (!skip)
+        {
+            LOG_INFO_TAG(JPEG_WORKER_TAG, "Processing: %s", job->path);
+            running_job = job;
+            TIME_IT(elapsed_ms, status = JPEG_Processor_ConvertFile(job->path,
+                                                                    job->has_config ? &job->config : NULL));
+            running_job = NULL;
+
+            if (status == JPEG_PROC_OK)
+            {
+                LOG_INFO_TAG(JPEG_WORKER_TAG, "Done: %lu ms, %lu bytes",
+                             (unsigned long)elapsed_ms,
+                             (unsigned long)JPEG_Processor_GetLastOutputSize());
+            }
+            else if (status == JPEG_PROC_ERR_ABORTED)
+            {
+                LOG_INFO_TAG(JPEG_WORKER_TAG, "Stopped: %s", job->path);
+            }
+            else
+            {
+                LOG_ERROR_TAG(JPEG_WORKER_TAG, "Failed: %s (err=%d)", job->path, (int)status);
+            }
+            
+            /* Remember the outcome; only content errors are final */
+            if (status == JPEG_PROC_OK)
+            {
+                JPEG_Manifest_RecordFile(job->path, JPEG_MANIFEST_CONVERTED);
+            }
+            else if ((status == JPEG_PROC_ERR_ENCODE) || (status == JPEG_PROC_ERR_FILE_TOO_LARGE))
+            {
+                JPEG_Manifest_RecordFile(job->path, JPEG_MANIFEST_FAILED);
+            }
+        }
+
+        /* Write the batch's manifest records once, when this is the last
+         * job queued; the slot is still held, so WaitIdle covers the write */
+        tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+        int last = !worker_busy_locked(job);
+        tx_mutex_put(&job_mutex);
+        if (last)
+        {
+            JPEG_Manifest_Sync();
+        }
+
+        /* Release the slot and account for the job */
+        tx_mutex_get(&job_mutex, TX_WAIT_FOREVER);
+        if ((job->state == JOB_CANCELLED) || (status == JPEG_PROC_ERR_ABORTED))
+        {
+            stats.cancelled++;
+        }
+        else if (status == JPEG_PROC_OK)
+        {
+            stats.completed++;
+            batch_done++;
+        }
+        else
+        {
+            stats.failed++;
+            batch_failed++;
+        }
+        batch_ms += elapsed_ms;
+        job->state = JOB_FREE;
+        int idle = !worker_busy_locked(NULL);
+        tx_mutex_put(&job_mutex);
+        tx_semaphore_put(&slot_sem);
+
+        /* Summarize each batch once the queue runs dry */
+        if (idle)
+        {
+            if (batch_done + batch_failed > 0U)
+            {
+                SD_DiskCacheStats_t cache;
+                SD_DiskCache_GetStats(&cache);
+                LOG_INFO_TAG(JPEG_WORKER_TAG, "Queue idle: %lu done, %lu failed, %lu ms, max depth %lu",
+                             (unsigned long)batch_done, (unsigned long)batch_failed,
+                             (unsigned long)batch_ms, (unsigned long)stats.max_depth);
+                LOG_INFO_TAG(JPEG_WORKER_TAG, "Sector cache: %lu hits, %lu misses, %lu bypassed",
+                             (unsigned long)cache.hits, (unsigned long)cache.misses,
+                             (unsigned long)cache.bypassed);
+            }
+            batch_done = 0;
+            batch_failed = 0;
+            batch_ms = 0;
+        }
+    }
+}
@@ -1,8 +1,16 @@
 /**
   * @file    logger.c
   * @brief   Simple logger with ring buffer - flushes to CDC when terminal ready
-  *          Thread-safe: uses ThreadX mutex for synchronization
+  *          Lock-free: any thread or ISR can log without blocking
   *          Timestamps: HH:MM:SS.mmm since boot (no RTC)
+  *
+  * The ring holds records: a 4-byte header, then the text padded to 4 bytes.
+  * A producer reserves space by moving ring_head with compare-and-swap,
+  * copies its text in, then publishes the header (length + commit bit).
+  * Only the LogFlush thread reads: it gathers committed records into one
+  * CDC transfer, zeroes what it consumed (so a stale header never looks
+  * committed) and moves ring_tail. A record that does not fit is dropped
+  * and counted; nothing ever waits for USB except LogFlush.
   */
 
 #include "logger.h"
@@ -15,102 +23,163 @@ extern UX_SLAVE_CLASS_CDC_ACM *cdc_acm_instance_ptr;
 /* Boot timestamp reference */
 static uint32_t boot_tick = 0U;
 
-/* Simple ring buffer - stores raw bytes */
-#define RING_SIZE 2048
-static char ring_buf[RING_SIZE];
-static volatile uint32_t ring_head = 0U;  /* Write position */
-static volatile uint32_t ring_tail = 0U;  /* Read position */
+#if (LOG_RING_SIZE & (LOG_RING_SIZE - 1U)) != 0
+#error "LOG_RING_SIZE must be a power of two"
+#endif
 
-/* ThreadX mutex for thread-safe logging */
-static TX_MUTEX logger_mutex;
-static UINT logger_mutex_created = 0U;
-static UINT scheduler_started = 0U;  /* Set when first thread context detected */
+/* Record header: payload length in the low 16 bits, commit flag on top */
+#define REC_HDR_SIZE      4U
+#define REC_COMMITTED     0x80000000UL
+#define REC_LEN_MASK      0x0000FFFFUL
+#define REC_SIZE(len)     (REC_HDR_SIZE + (((len) + 3U) & ~3U))
+#define RING_MASK         (LOG_RING_SIZE - 1U)
 
-/* Try to acquire mutex - returns 1 if acquired, 0 if not available or not in thread context */
-static int logger_lock(void)
+/* Longest single record (one formatted line, or one piece of a _write) */
+#define LOG_LINE_MAX      192U
+
+#if LOG_FLUSH_CHUNK < LOG_LINE_MAX
+#error "LOG_FLUSH_CHUNK must hold the longest record"
+#endif
+
+/* Ring buffer - free-running positions, masked on access */
+static uint8_t ring_buf[LOG_RING_SIZE] __attribute__((aligned(4)));
+static volatile uint32_t ring_head = 0U;  /* Next free byte (producers) */
+static volatile uint32_t ring_tail = 0U;  /* Oldest unread byte (LogFlush) */
+static volatile uint32_t ring_dropped = 0U;
+
+/* Flush thread */
+static TX_THREAD flush_thread;
+static UCHAR flush_thread_stack[LOG_FLUSH_STACK_SIZE];
+static TX_SEMAPHORE flush_sem;
+static volatile UINT flush_ready = 0U;
+static char flush_buf[LOG_FLUSH_CHUNK];
+
+static VOID flush_thread_entry(ULONG thread_input);
+
+/* Copy into the ring at a (masked) position, wrapping if needed */
+static void ring_copy_in(uint32_t pos, const char *data, uint32_t len)
 {
-  /* Don't try to lock if mutex not created yet (early boot) */
-  if (logger_mutex_created == 0U)
-    return 1;  /* Allow logging without lock during early boot */
-  
-  /* Check if we're in a thread context */
-  TX_THREAD *current = tx_thread_identify();
-  
-  if (current == TX_NULL)
+  uint32_t off = pos & RING_MASK;
+  uint32_t first = LOG_RING_SIZE - off;
+
+  if (first >= len)
+  {
+    memcpy(&ring_buf[off], data, len);
+  }
+  else
   {
-    /* Not in thread context - either ISR or pre-scheduler */
-    if (scheduler_started)
+    memcpy(&ring_buf[off], data, first);
+    memcpy(ring_buf, data + first, len - first);
+  }
+}
+
+/* Copy out of the ring, then zero the bytes read */
+static void ring_take(uint32_t pos, char *out, uint32_t copy_len, uint32_t clear_len)
+{
+  uint32_t off = pos & RING_MASK;
+  uint32_t first = LOG_RING_SIZE - off;
+
+  if (first >= clear_len)
+  {
+    memcpy(out, &ring_buf[off], copy_len);
+    memset(&ring_buf[off], 0, clear_len);
+  }
+  else
+  {
+    if (copy_len > first)
     {
-      /* Scheduler is running, so this is an ISR - skip to avoid hang */
-      return 0;
+      memcpy(out, &ring_buf[off], first);
+      memcpy(out + first, ring_buf, copy_len - first);
     }
     else
     {
-      /* Scheduler not started yet - allow logging without mutex */
-      return 1;
+      memcpy(out, &ring_buf[off], copy_len);
     }
+    memset(&ring_buf[off], 0, first);
+    memset(ring_buf, 0, clear_len - first);
   }
-  
-  /* We're in a thread - scheduler must be running */
-  scheduler_started = 1U;
-  
-  /* Short timeout to avoid blocking USBX / MSC threads.
-   * If the mutex is held by a CDC flush, we drop this message rather
-   * than stalling time-critical USB operations.  50 ms is enough for
-   * a normal CDC write to complete but short enough to prevent
-   * cascading thread stalls. */
-  if (tx_mutex_get(&logger_mutex, 5U) == TX_SUCCESS)
-    return 1;
-  
-  return 0;
 }
 
-/* Release mutex */
-static void logger_unlock(void)
+/* Add one record to the ring. Safe from any thread or ISR; never blocks. */
+static void ring_write(const char *data, uint32_t len)
 {
-  if (logger_mutex_created == 0U)
+  uint32_t size = REC_SIZE(len);
+  uint32_t head;
+  uint32_t hdr;
+
+  if (len == 0U)
     return;
-  
-  if (tx_thread_identify() != TX_NULL)
-    tx_mutex_put(&logger_mutex);
-}
 
-/* Add data to ring buffer */
-static void ring_write(const char *data, uint32_t len)
-{
-  for (uint32_t i = 0; i < len; i++)
+  head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+  do
   {
-    uint32_t next = (ring_head + 1U) % RING_SIZE;
-    if (next == ring_tail)
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+    if ((LOG_RING_SIZE - (head - tail)) < size)
     {
-      /* Buffer full - drop oldest */
-      ring_tail = (ring_tail + 1U) % RING_SIZE;
+      /* Buffer full - drop this message (older ones may be mid-write) */
+      __atomic_fetch_add(&ring_dropped, 1U, __ATOMIC_RELAXED);
+      return;
     }
-    ring_buf[ring_head] = data[i];
-    ring_head = next;
-  }
+  } while (!__atomic_compare_exchange_n(&ring_head, &head, head + size, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  /* [head, head + size) is ours; the header word stays zero until commit */
+  ring_copy_in(head + REC_HDR_SIZE, data, len);
+  hdr = REC_COMMITTED | len;
+  __atomic_store_n((uint32_t *)&ring_buf[head & RING_MASK], hdr, __ATOMIC_RELEASE);
+
+  if (flush_ready)
+    (void)tx_semaphore_ceiling_put(&flush_sem, 1U);
 }
 
 /* Check if terminal is ready (DTR set) */
 static int terminal_ready(void)
 {
   ULONG line_state = 0U;
-  
+
   if (cdc_acm_instance_ptr == UX_NULL)
     return 0;
-  
+
   ux_device_class_cdc_acm_ioctl(cdc_acm_instance_ptr,
                                 UX_SLAVE_CLASS_CDC_ACM_IOCTL_GET_LINE_STATE,
                                 &line_state);
-  
+
   return (line_state & UX_SLAVE_CLASS_CDC_ACM_LINE_STATE_DTR) ? 1 : 0;
 }
 
-/* Flush ring buffer to CDC - only if terminal is ready */
+/* Move committed records (up to LOG_FLUSH_CHUNK bytes) into flush_buf */
+static uint32_t ring_gather(void)
+{
+  uint32_t tail = ring_tail;   /* Only this side writes it */
+  uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+  uint32_t out_len = 0U;
+
+  while (tail != head)
+  {
+    uint32_t hdr = __atomic_load_n((uint32_t *)&ring_buf[tail & RING_MASK], __ATOMIC_ACQUIRE);
+    uint32_t len = hdr & REC_LEN_MASK;
+
+    /* Stop at a record still being written, to keep the order */
+    if ((hdr & REC_COMMITTED) == 0U)
+      break;
+    if (out_len + len > sizeof(flush_buf))
+      break;
+
+    ring_take(tail + REC_HDR_SIZE, &flush_buf[out_len], len, REC_SIZE(len) - REC_HDR_SIZE);
+    __atomic_store_n((uint32_t *)&ring_buf[tail & RING_MASK], 0U, __ATOMIC_RELAXED);
+    out_len += len;
+    tail += REC_SIZE(len);
+  }
+
+  /* Zeroed bytes must be visible before producers may reuse them */
+  __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+  return out_len;
+}
+
+/* Flush ring buffer to CDC - only if terminal is ready. LogFlush only. */
 static void ring_flush(void)
 {
   ULONG actual;
-  char chunk[64];
   uint32_t chunk_len;
 
   /* Take a local copy of the CDC instance pointer to prevent TOCTOU race.
@@ -131,26 +200,17 @@ static void ring_flush(void)
       return;
   }
 
-  while (ring_tail != ring_head)
+  while ((chunk_len = ring_gather()) > 0U)
   {
-    chunk_len = 0;
-    while (ring_tail != ring_head && chunk_len < sizeof(chunk))
-    {
-      chunk[chunk_len++] = ring_buf[ring_tail];
-      ring_tail = (ring_tail + 1U) % RING_SIZE;
-    }
-    if (chunk_len > 0)
-    {
-      /* Re-verify pointer: deactivation may have occurred during a
-       * previous chunk write in this same flush loop. */
-      if (cdc_acm_instance_ptr == UX_NULL)
-        break;
-
-      UINT ux_status = ux_device_class_cdc_acm_write(cdc, (UCHAR*)chunk,
-                                                     chunk_len, &actual);
-      if (ux_status != UX_SUCCESS)
-        break;  /* Endpoint stalled / host not reading - stop flushing */
-    }
+    /* Re-verify pointer: deactivation may have occurred during a
+     * previous chunk write in this same flush loop. */
+    if (cdc_acm_instance_ptr == UX_NULL)
+      break;
+
+    UINT ux_status = ux_device_class_cdc_acm_write(cdc, (UCHAR*)flush_buf,
+                                                   chunk_len, &actual);
+    if (ux_status != UX_SUCCESS)
+      break;  /* Endpoint stalled / host not reading - chunk is lost */
   }
 }
 
@@ -158,15 +218,21 @@ void Logger_Init(void)
 {
   /* Record boot time reference */
   boot_tick = HAL_GetTick();
-  
-  /* Create mutex for thread-safe logging */
-  if (logger_mutex_created == 0U)
+
+#if !defined(USBX_STANDALONE_BRINGUP)
+  /* Flush thread drains the ring; producers only signal it */
+  if (flush_ready == 0U)
   {
-    if (tx_mutex_create(&logger_mutex, "LoggerMutex", TX_NO_INHERIT) == TX_SUCCESS)
+    if ((tx_semaphore_create(&flush_sem, "LogFlush", 0U) == TX_SUCCESS) &&
+        (tx_thread_create(&flush_thread, "LogFlush", flush_thread_entry, 0U,
+                          flush_thread_stack, sizeof(flush_thread_stack),
+                          LOG_FLUSH_PRIORITY, LOG_FLUSH_PRIORITY,
+                          TX_NO_TIME_SLICE, TX_AUTO_START) == TX_SUCCESS))
     {
-      logger_mutex_created = 1U;
+      flush_ready = 1U;
     }
   }
+#endif
 }
 
 /**
@@ -181,7 +247,7 @@ static void format_timestamp(char *buf, size_t buf_len)
   uint32_t total_mins = total_secs / 60U;
   uint32_t mins = total_mins % 60U;
   uint32_t hours = total_mins / 60U;
-  
+
   snprintf(buf, buf_len, "%02lu:%02lu:%02lu.%03lu",
            (unsigned long)hours, (unsigned long)mins,
            (unsigned long)secs, (unsigned long)ms);
@@ -190,6 +256,10 @@ static void format_timestamp(char *buf, size_t buf_len)
 void Logger_SetCdcInstance(UX_SLAVE_CLASS_CDC_ACM *instance)
 {
   (void)instance;
+
+  /* Connect / disconnect: let LogFlush look at DTR again */
+  if (flush_ready)
+    (void)tx_semaphore_ceiling_put(&flush_sem, 1U);
 }
 
 int Logger_IsReady(void)
@@ -197,25 +267,31 @@ int Logger_IsReady(void)
   return terminal_ready();
 }
 
-void Logger_Run(void) {}
+uint32_t Logger_GetDropped(void)
+{
+  return __atomic_load_n(&ring_dropped, __ATOMIC_RELAXED);
+}
+
+/* Standalone bring-up has no LogFlush thread: drain from the main loop */
+void Logger_Run(void)
+{
+  if (flush_ready == 0U)
+    ring_flush();
+}
 
 void Logger_Log(int level, const char *message)
 {
-  char buf[192];
+  char buf[LOG_LINE_MAX];
   char timestamp[16];
   int len;
   const char *prefix;
-  
+
   if (message == NULL) return;
   if (level > LOG_LEVEL) return;
-  
-  /* Try to acquire lock - skip if in ISR or can't acquire */
-  if (!logger_lock())
-    return;
-  
+
   /* Get timestamp */
   format_timestamp(timestamp, sizeof(timestamp));
-  
+
   switch (level) {
     case LOG_LEVEL_ERROR: prefix = "\033[31m[ERROR]"; break;
     case LOG_LEVEL_WARN:  prefix = "\033[33m[WARN] "; break;
@@ -223,33 +299,65 @@ void Logger_Log(int level, const char *message)
     case LOG_LEVEL_DEBUG: prefix = "\033[36m[DEBUG]"; break;
     default: prefix = ""; break;
   }
-  
+
   len = snprintf(buf, sizeof(buf), "[%s] %s %s\033[0m\r\n", timestamp, prefix, message);
   if (len > 0)
   {
+    /* Truncated lines still end the escape sequence and the line */
+    if (len >= (int)sizeof(buf))
+    {
+      len = (int)sizeof(buf) - 1;
+      memcpy(&buf[len - 6], "\033[0m\r\n", 6);
+    }
     ring_write(buf, (uint32_t)len);
-    ring_flush();
   }
-  
-  logger_unlock();
-  
-  /* Note: Removed tx_thread_relinquish() - was causing USB starvation issues.
-   * USB thread runs at higher priority (10) so it will preempt anyway. */
 }
 
 int _write(int file, char *ptr, int len)
 {
+  int done = 0;
+
   (void)file;
-  if (len > 0)
+  while (done < len)
+  {
+    uint32_t piece = (uint32_t)(len - done);
+    if (piece > LOG_LINE_MAX)
+      piece = LOG_LINE_MAX;
+    ring_write(ptr + done, piece);
+    done += (int)piece;
+  }
+  return len;  /* Dropped output is counted, never retried */
+}
+
+/**
+  * @brief  LogFlush thread - drains the ring to CDC in large transfers
+  *         and reports dropped messages
+  */
+static VOID flush_thread_entry(ULONG thread_input)
+{
+  uint32_t reported = 0U;
+  ULONG poll = (LOG_FLUSH_POLL_MS * TX_TIMER_TICKS_PER_SECOND + 999U) / 1000U;
+
+  TX_PARAMETER_NOT_USED(thread_input);
+
+  for (;;)
   {
-    /* Try to acquire lock - skip output if in ISR or can't acquire */
-    if (!logger_lock())
-      return len;  /* Pretend we wrote it to avoid caller retrying */
-    
-    ring_write(ptr, (uint32_t)len);
+    /* Woken per message; the timeout catches a terminal connecting */
+    (void)tx_semaphore_get(&flush_sem, poll);
+
+    if (!terminal_ready())
+      continue;   /* Keep boot logs until someone is listening */
+
+    uint32_t dropped = Logger_GetDropped();
+    if (dropped != reported)
+    {
+      char msg[48];
+      snprintf(msg, sizeof(msg), "[LOG] %lu messages dropped",
+               (unsigned long)(dropped - reported));
+      reported = dropped;
+      Logger_Log(LOG_LEVEL_WARN, msg);
+    }
+
     ring_flush();
-    
-    logger_unlock();
   }
-  return len;
 }
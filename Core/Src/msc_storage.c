@@ -0,0 +1,578 @@
+/**
+  ******************************************************************************
+  * @file    msc_storage.c
+  * @brief   MSC storage pipeline - read-ahead, staged writes and write-back cache
+  ******************************************************************************
+  * One staging buffer and one background job at a time. The buffer holds
+  * either the read-ahead extent or the write being programmed; every card
+  * access from the host side waits for the job first, so the card sees
+  * requests in the host's order and only one transfer is ever in flight.
+  *
+  * The write-back cache only holds dirty sectors, unordered. Reads copy
+  * cached sectors over whatever came from the card; a long write drops
+  * the cached sectors it covers. A flush sorts the cache and writes each
+  * run of adjacent sectors through the staging buffer.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "msc_storage.h"
+#include "sd_adapter.h"
+#include "logger.h"
+#include <string.h>
+
+/* Private defines -----------------------------------------------------------*/
+#define MSC_SECTOR_SIZE     512U
+#define MSC_STORAGE_IDLE_FLUSH_TICKS \
+    ((MSC_STORAGE_IDLE_FLUSH_MS * TX_TIMER_TICKS_PER_SECOND + 999U) / 1000U)
+
+/* Private types -------------------------------------------------------------*/
+typedef enum {
+    MSC_JOB_READ = 0,   /* Read ahead into the staging buffer */
+    MSC_JOB_WRITE       /* Program the staging buffer */
+} msc_job_type_t;
+
+typedef struct {
+    msc_job_type_t type;
+    uint32_t lba;
+    uint32_t count;
+    int result;
+} msc_job_t;
+
+/* Private variables ---------------------------------------------------------*/
+static TX_THREAD io_thread;
+static UCHAR io_thread_stack[MSC_STORAGE_STACK_SIZE];
+static TX_SEMAPHORE io_req_sem;
+static TX_SEMAPHORE io_done_sem;
+static TX_MUTEX msc_mutex;          /* Host callbacks vs. mode switches */
+static int io_ready = 0;
+
+static msc_job_t io_job;
+static int io_busy = 0;             /* Job submitted, not yet waited for */
+static uint8_t stage_buf[MSC_STORAGE_STAGE_SECTORS * MSC_SECTOR_SIZE] __attribute__((aligned(32)));
+
+/* Read-ahead extent held (or being read) in stage_buf */
+static int ra_valid = 0;
+static uint32_t ra_lba = 0;
+static uint32_t ra_count = 0;
+
+/* Sequential read detection */
+static uint32_t seq_next_lba = 0;
+static uint32_t seq_run = 0;
+
+/* Write-back cache: cache_lba[i] tags cache_data[i], entries 0..cache_count-1 */
+static uint32_t cache_lba[MSC_STORAGE_CACHE_SECTORS];
+static uint8_t cache_data[MSC_STORAGE_CACHE_SECTORS][MSC_SECTOR_SIZE] __attribute__((aligned(32)));
+static uint32_t cache_count = 0;
+static ULONG last_activity = 0;     /* tx_time_get() of the last host access */
+
+static int write_error = 0;         /* A staged or cached write failed, not yet reported */
+static MSC_StorageStats_t stats;
+
+/* Private function prototypes -----------------------------------------------*/
+static VOID io_thread_entry(ULONG thread_input);
+static void io_submit(msc_job_type_t type, uint32_t lba, uint32_t count);
+static void io_wait(void);
+static void read_ahead(uint32_t lba);
+static int cache_find(uint32_t lba);
+static int cache_put(const uint8_t *buffer, uint32_t lba, uint32_t count);
+static void cache_drop(uint32_t lba, uint32_t count);
+static void cache_overlay(uint8_t *buffer, uint32_t lba, uint32_t count);
+static int cache_flush(void);
+static void cache_idle_flush(void);
+
+/* Public functions ----------------------------------------------------------*/
+
+UINT MSC_Storage_Init(void)
+{
+    UINT status;
+
+    if (io_ready)
+    {
+        return TX_SUCCESS;
+    }
+
+    status = tx_mutex_create(&msc_mutex, "MSC Storage", TX_INHERIT);
+    if (status == TX_SUCCESS)
+    {
+        status = tx_semaphore_create(&io_req_sem, "MSC IO Req", 0U);
+    }
+    if (status == TX_SUCCESS)
+    {
+        status = tx_semaphore_create(&io_done_sem, "MSC IO Done", 0U);
+    }
+    if (status == TX_SUCCESS)
+    {
+        status = tx_thread_create(&io_thread, "MSC IO", io_thread_entry, 0U,
+                                  io_thread_stack, MSC_STORAGE_STACK_SIZE,
+                                  MSC_STORAGE_PRIORITY, MSC_STORAGE_PRIORITY,
+                                  TX_NO_TIME_SLICE, TX_AUTO_START);
+    }
+
+    if (status == TX_SUCCESS)
+    {
+        io_ready = 1;
+    }
+    return status;
+}
+
+int MSC_Storage_Read(uint8_t *buffer, uint32_t lba, uint32_t count)
+{
+    int served = 0;
+    int result = 0;
+
+    if (!io_ready)
+    {
+        return SD_Read(buffer, lba, count);
+    }
+
+    tx_mutex_get(&msc_mutex, TX_WAIT_FOREVER);
+
+    /* Checked again under the lock: after a mode switch's invalidate no
+     * card read or read-ahead may start alongside FatFs */
+    if (!SD_IsMscAllowed())
+    {
+        tx_mutex_put(&msc_mutex);
+        return -1;
+    }
+
+    /* Inside the read-ahead extent: wait for it if still in flight */
+    if (ra_valid && (lba >= ra_lba) && ((lba - ra_lba) + count <= ra_count))
+    {
+        io_wait();
+        if (ra_valid)
+        {
+            memcpy(buffer, &stage_buf[(lba - ra_lba) * MSC_SECTOR_SIZE], count * MSC_SECTOR_SIZE);
+            stats.readahead_hits += count;
+            served = 1;
+        }
+    }
+
+    if (!served)
+    {
+        /* Let a staged write or stale read-ahead finish first */
+        io_wait();
+        result = SD_Read(buffer, lba, count);
+    }
+    if (result == 0)
+    {
+        cache_overlay(buffer, lba, count);
+    }
+    stats.read_sectors += count;
+    last_activity = tx_time_get();
+
+    /* Sequential stream: fetch the next extent while this one goes out */
+    seq_run = (lba == seq_next_lba) ? (seq_run + 1U) : 0U;
+    seq_next_lba = lba + count;
+    if ((result == 0) && (seq_run >= MSC_STORAGE_SEQ_THRESHOLD))
+    {
+        read_ahead(seq_next_lba);
+    }
+
+    tx_mutex_put(&msc_mutex);
+    return result;
+}
+
+int MSC_Storage_Write(const uint8_t *buffer, uint32_t lba, uint32_t count)
+{
+    int result = 0;
+
+    if (!io_ready)
+    {
+        return SD_Write(buffer, lba, count, SD_SOURCE_MSC);
+    }
+
+    tx_mutex_get(&msc_mutex, TX_WAIT_FOREVER);
+
+    /* Checked again under the lock: a mode switch flushes under it too,
+     * so nothing can be staged after that flush */
+    if (!SD_IsMscAllowed())
+    {
+        tx_mutex_put(&msc_mutex);
+        return -1;
+    }
+
+    /* Previous write programmed (or read-ahead done) before reusing the buffer */
+    io_wait();
+    ra_valid = 0;
+    seq_run = 0;
+    stats.write_sectors += count;
+    last_activity = tx_time_get();
+
+    if (write_error)
+    {
+        write_error = 0;
+        result = -1;
+    }
+    else if (count <= MSC_STORAGE_CACHE_MAX_WRITE)
+    {
+        result = cache_put(buffer, lba, count);
+    }
+    else
+    {
+        /* The new data supersedes any cached copy of these sectors */
+        cache_drop(lba, count);
+        if (count > MSC_STORAGE_STAGE_SECTORS)
+        {
+            result = SD_Write(buffer, lba, count, SD_SOURCE_MSC);
+        }
+        else
+        {
+            memcpy(stage_buf, buffer, count * MSC_SECTOR_SIZE);
+            io_submit(MSC_JOB_WRITE, lba, count);
+            stats.staged_writes++;
+        }
+    }
+
+    tx_mutex_put(&msc_mutex);
+    return result;
+}
+
+int MSC_Storage_Flush(void)
+{
+    int result;
+
+    if (!io_ready)
+    {
+        return 0;
+    }
+
+    tx_mutex_get(&msc_mutex, TX_WAIT_FOREVER);
+    io_wait();
+    (void)cache_flush();
+    result = write_error ? -1 : 0;
+    write_error = 0;
+    tx_mutex_put(&msc_mutex);
+
+    return result;
+}
+
+void MSC_Storage_Invalidate(void)
+{
+    int lost;
+
+    if (!io_ready)
+    {
+        return;
+    }
+
+    tx_mutex_get(&msc_mutex, TX_WAIT_FOREVER);
+    io_wait();
+    (void)cache_flush();
+    lost = write_error;
+    write_error = 0;
+    ra_valid = 0;
+    seq_run = 0;
+    tx_mutex_put(&msc_mutex);
+
+    /* The host is gone and will never see this error; runs on the
+     * button thread, so logging is safe here */
+    if (lost)
+    {
+        LOG_ERROR_TAG("MSC", "Host write failed before mode switch (%lu total)",
+                      (unsigned long)stats.write_errors);
+    }
+}
+
+void MSC_Storage_GetStats(MSC_StorageStats_t *out)
+{
+    if (out == NULL)
+    {
+        return;
+    }
+
+    if (io_ready)
+    {
+        tx_mutex_get(&msc_mutex, TX_WAIT_FOREVER);
+    }
+    *out = stats;
+    if (io_ready)
+    {
+        tx_mutex_put(&msc_mutex);
+    }
+}
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Hand a job to the I/O thread. Caller holds msc_mutex and has
+  *         waited for the previous job.
+  */
+static void io_submit(msc_job_type_t type, uint32_t lba, uint32_t count)
+{
+    io_job.type = type;
+    io_job.lba = lba;
+    io_job.count = count;
+    io_job.result = 0;
+    io_busy = 1;
+    tx_semaphore_put(&io_req_sem);
+}
+
+/**
+  * @brief  Block until the submitted job (if any) is done. Caller holds msc_mutex.
+  */
+static void io_wait(void)
+{
+    if (io_busy)
+    {
+        (void)tx_semaphore_get(&io_done_sem, TX_WAIT_FOREVER);
+        io_busy = 0;
+    }
+}
+
+/**
+  * @brief  Start reading the extent at lba into the staging buffer, unless
+  *         it is already there. Caller holds msc_mutex.
+  */
+static void read_ahead(uint32_t lba)
+{
+    uint32_t total = SD_GetSectorCount();
+    uint32_t count = MSC_STORAGE_STAGE_SECTORS;
+
+    if (ra_valid && (lba >= ra_lba) && (lba < ra_lba + ra_count))
+    {
+        return;     /* Rest of the current extent still unread */
+    }
+    if (lba >= total)
+    {
+        return;
+    }
+    if (count > total - lba)
+    {
+        count = total - lba;
+    }
+
+    io_wait();
+    ra_lba = lba;
+    ra_count = count;
+    ra_valid = 1;
+    stats.prefetches++;
+    io_submit(MSC_JOB_READ, lba, count);
+}
+
+/**
+  * @brief  Index of the cached copy of a sector, or -1.
+  */
+static int cache_find(uint32_t lba)
+{
+    uint32_t i;
+
+    for (i = 0; i < cache_count; i++)
+    {
+        if (cache_lba[i] == lba)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+  * @brief  Copy a short write into the cache, flushing first if the new
+  *         sectors do not fit. Caller holds msc_mutex, no job pending.
+  * @retval 0 on success, -1 if the flush that made room failed
+  */
+static int cache_put(const uint8_t *buffer, uint32_t lba, uint32_t count)
+{
+    uint32_t i;
+    uint32_t missing = 0;
+    int result = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (cache_find(lba + i) < 0)
+        {
+            missing++;
+        }
+    }
+    if (cache_count + missing > MSC_STORAGE_CACHE_SECTORS)
+    {
+        result = cache_flush();
+        write_error = 0;    /* Reported by this write */
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        int slot = cache_find(lba + i);
+        if (slot >= 0)
+        {
+            stats.merged_sectors++;
+        }
+        else
+        {
+            slot = (int)cache_count++;
+            cache_lba[slot] = lba + i;
+        }
+        memcpy(cache_data[slot], &buffer[i * MSC_SECTOR_SIZE], MSC_SECTOR_SIZE);
+    }
+    stats.cached_sectors += count;
+
+    return result;
+}
+
+/**
+  * @brief  Forget cached sectors in [lba, lba + count). Caller holds msc_mutex.
+  */
+static void cache_drop(uint32_t lba, uint32_t count)
+{
+    uint32_t i = 0;
+
+    while (i < cache_count)
+    {
+        if ((cache_lba[i] >= lba) && (cache_lba[i] - lba < count))
+        {
+            /* Move the last entry into the hole */
+            cache_count--;
+            cache_lba[i] = cache_lba[cache_count];
+            memcpy(cache_data[i], cache_data[cache_count], MSC_SECTOR_SIZE);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/**
+  * @brief  Copy cached sectors in [lba, lba + count) over data read from
+  *         the card. Caller holds msc_mutex.
+  */
+static void cache_overlay(uint8_t *buffer, uint32_t lba, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < cache_count; i++)
+    {
+        if ((cache_lba[i] >= lba) && (cache_lba[i] - lba < count))
+        {
+            memcpy(&buffer[(cache_lba[i] - lba) * MSC_SECTOR_SIZE], cache_data[i], MSC_SECTOR_SIZE);
+        }
+    }
+}
+
+/**
+  * @brief  Write the whole cache out, one multi-block write per run of
+  *         adjacent sectors, and empty it. Uses the staging buffer, so the
+  *         read-ahead extent is dropped. Caller holds msc_mutex, no job pending.
+  * @retval 0 on success, -1 if a write failed (the sectors are dropped
+  *         and write_error is set)
+  */
+static int cache_flush(void)
+{
+    uint16_t order[MSC_STORAGE_CACHE_SECTORS];
+    uint32_t i;
+    uint32_t n = cache_count;
+    int result = 0;
+
+    if (n == 0U)
+    {
+        return 0;
+    }
+    ra_valid = 0;
+
+    /* Insertion sort of entry indices by LBA (the cache is small) */
+    for (i = 0; i < n; i++)
+    {
+        uint32_t j = i;
+        while ((j > 0U) && (cache_lba[order[j - 1U]] > cache_lba[i]))
+        {
+            order[j] = order[j - 1U];
+            j--;
+        }
+        order[j] = (uint16_t)i;
+    }
+
+    i = 0;
+    while (i < n)
+    {
+        uint32_t first = cache_lba[order[i]];
+        uint32_t len = 0;
+
+        while ((i < n) && (len < MSC_STORAGE_STAGE_SECTORS) && (cache_lba[order[i]] == first + len))
+        {
+            memcpy(&stage_buf[len * MSC_SECTOR_SIZE], cache_data[order[i]], MSC_SECTOR_SIZE);
+            len++;
+            i++;
+        }
+
+        if (SD_Write(stage_buf, first, len, SD_SOURCE_MSC) != 0)
+        {
+            write_error = 1;
+            stats.write_errors++;
+            result = -1;
+        }
+        stats.flush_writes++;
+    }
+
+    cache_count = 0;
+    stats.cache_flushes++;
+    return result;
+}
+
+/**
+  * @brief  Idle flush, from the I/O thread. Skipped if the host side holds
+  *         the lock: it may be waiting on this thread.
+  */
+static void cache_idle_flush(void)
+{
+    if (tx_mutex_get(&msc_mutex, TX_NO_WAIT) != TX_SUCCESS)
+    {
+        return;
+    }
+    if ((cache_count == 0U) ||
+        ((tx_time_get() - last_activity) < MSC_STORAGE_IDLE_FLUSH_TICKS))
+    {
+        tx_mutex_put(&msc_mutex);
+        return;
+    }
+
+    /* A job submitted since the timeout has not run yet (this thread runs
+     * it), so only claim one that already finished */
+    if (io_busy && (tx_semaphore_get(&io_done_sem, TX_NO_WAIT) == TX_SUCCESS))
+    {
+        io_busy = 0;
+    }
+    if (!io_busy)
+    {
+        (void)cache_flush();
+    }
+    tx_mutex_put(&msc_mutex);
+}
+
+/**
+  * @brief  I/O thread - runs one read-ahead or staged write at a time.
+  * @param  thread_input: Thread input parameter (unused).
+  */
+static VOID io_thread_entry(ULONG thread_input)
+{
+    TX_PARAMETER_NOT_USED(thread_input);
+
+    for (;;)
+    {
+        if (tx_semaphore_get(&io_req_sem, MSC_STORAGE_IDLE_FLUSH_TICKS) != TX_SUCCESS)
+        {
+            cache_idle_flush();
+            continue;
+        }
+
+        if (io_job.type == MSC_JOB_WRITE)
+        {
+            io_job.result = SD_Write(stage_buf, io_job.lba, io_job.count, SD_SOURCE_MSC);
+            if (io_job.result != 0)
+            {
+                write_error = 1;
+                stats.write_errors++;
+            }
+        }
+        else
+        {
+            io_job.result = SD_Read(stage_buf, io_job.lba, io_job.count);
+            if (io_job.result != 0)
+            {
+                ra_valid = 0;
+            }
+        }
+
+        tx_semaphore_put(&io_done_sem);
+    }
+}
@@ -5,22 +5,43 @@
   ******************************************************************************
   * Thin wrapper around HAL SD functions. Centralizes:
   * - Wait-for-ready logic with timeout
+  * - IDMA transfers completed by the SDMMC interrupt through a semaphore,
+  *   so other threads (e.g. the encoder) run while a transfer is in flight
   * - Error handling (graceful failures, no blocking)
-  * - Write source tracking
+  * - Write source tracking and a map of written sector ranges
   * - MSC/FatFS coordination (flags only, no mutex)
   *
-  * Design: NO MUTEX - allow concurrent access attempts. When MSC and FatFS
-  * collide, one will timeout gracefully. The fs_reader handles disk errors
-  * by skipping the monitoring cycle (has_error flag).
+  * Design: NO MUTEX between MSC and FatFS - allow concurrent access attempts.
+  * When they collide, one will timeout gracefully. The fs_reader handles disk
+  * errors by skipping the monitoring cycle (has_error flag). Only the
+  * controller itself is locked: one thread at a time runs the wait-ready /
+  * start / wait-complete sequence, since the completion semaphore and status
+  * are shared.
   ******************************************************************************
   */
 
 #include "sd_adapter.h"
+#include "sd_diskio.h"
+#include "msc_storage.h"
+#include "exfat_reader.h"
 #include "sdmmc.h"
 #include "stm32h5xx_hal.h"
+#include "tx_api.h"
+#include <string.h>
 
 /* Private defines -----------------------------------------------------------*/
 #define SD_TIMEOUT_MS       1000U
+#define SD_TIMEOUT_TICKS    ((SD_TIMEOUT_MS * TX_TIMER_TICKS_PER_SECOND) / 1000U)
+#define SD_BUSY_SPIN_MS     1U     /* Poll this long before sleeping between checks */
+#define SD_LOCK_TIMEOUT_TICKS (3U * SD_TIMEOUT_TICKS)  /* One full transfer of another thread */
+
+/* DMA transfer completion status (set from the SDMMC interrupt) */
+typedef enum {
+    SD_XFER_IDLE = 0,
+    SD_XFER_PENDING,
+    SD_XFER_DONE,
+    SD_XFER_ERROR
+} SD_XferStatus_t;
 
 /* Private variables ---------------------------------------------------------*/
 static volatile SD_Source_t last_write_source = SD_SOURCE_NONE;
@@ -30,9 +51,85 @@ static volatile uint8_t fatfs_busy = 0U;          /* Set when FatFS is accessing
 static volatile uint32_t msc_last_activity_tick = 0U;  /* Last MSC read/write tick */
 static volatile uint8_t media_changed = 0U;       /* Set when mode changes to trigger UNIT ATTENTION */
 static volatile uint8_t media_ejected = 0U;       /* Set when host requests eject */
+static TX_SEMAPHORE xfer_sem;                     /* Put by the transfer-complete callbacks */
+static uint8_t xfer_sem_created = 0U;
+static TX_MUTEX xfer_mutex;                       /* Held for a whole SD_Read/SD_Write */
+static uint8_t xfer_mutex_created = 0U;
+static volatile SD_XferStatus_t xfer_status = SD_XFER_IDLE;
+
+/* Written sector ranges, sorted. One spare slot lets a new range be
+ * inserted before the closest pair is merged back down to the limit. */
+static SD_LbaRange_t dirty_ranges[SD_DIRTY_MAX_RANGES + 1U];
+static uint32_t dirty_count = 0U;
+static uint32_t dirty_msc_sectors = 0U;
+static uint32_t dirty_fatfs_sectors = 0U;
 
 /* Private functions ---------------------------------------------------------*/
 
+/**
+  * @brief  Add a written range to the dirty map.
+  *         Called with interrupts disabled (SD_Write and SD_DirtyMap_Take
+  *         run on different threads).
+  */
+static void dirty_map_add(uint32_t first, uint32_t last)
+{
+    uint32_t i = 0U;
+    uint32_t j;
+
+    /* Skip ranges that end before the new one and don't touch it */
+    while (i < dirty_count && dirty_ranges[i].last < first && (first - dirty_ranges[i].last) > 1U)
+    {
+        i++;
+    }
+
+    /* Absorb ranges that overlap or touch it */
+    j = i;
+    while (j < dirty_count && (dirty_ranges[j].first <= last || (dirty_ranges[j].first - last) == 1U))
+    {
+        if (dirty_ranges[j].first < first)
+        {
+            first = dirty_ranges[j].first;
+        }
+        if (dirty_ranges[j].last > last)
+        {
+            last = dirty_ranges[j].last;
+        }
+        j++;
+    }
+
+    if (j > i)
+    {
+        dirty_ranges[i].first = first;
+        dirty_ranges[i].last = last;
+        memmove(&dirty_ranges[i + 1U], &dirty_ranges[j], (dirty_count - j) * sizeof(dirty_ranges[0]));
+        dirty_count -= (j - i - 1U);
+        return;
+    }
+
+    memmove(&dirty_ranges[i + 1U], &dirty_ranges[i], (dirty_count - i) * sizeof(dirty_ranges[0]));
+    dirty_ranges[i].first = first;
+    dirty_ranges[i].last = last;
+    dirty_count++;
+
+    if (dirty_count > SD_DIRTY_MAX_RANGES)
+    {
+        /* Merge the pair with the smallest gap */
+        uint32_t best = 0U;
+        for (uint32_t k = 1U; k + 1U < dirty_count; k++)
+        {
+            if (dirty_ranges[k + 1U].first - dirty_ranges[k].last <
+                dirty_ranges[best + 1U].first - dirty_ranges[best].last)
+            {
+                best = k;
+            }
+        }
+        dirty_ranges[best].last = dirty_ranges[best + 1U].last;
+        memmove(&dirty_ranges[best + 1U], &dirty_ranges[best + 2U],
+                (dirty_count - best - 2U) * sizeof(dirty_ranges[0]));
+        dirty_count--;
+    }
+}
+
 /**
   * @brief  Wait for SD card to be in transfer state.
   * @retval 0 if ready, -1 on timeout
@@ -40,19 +137,148 @@ static volatile uint8_t media_ejected = 0U;       /* Set when host requests ejec
 static int wait_for_transfer_ready(void)
 {
     uint32_t start = HAL_GetTick();
+    int can_sleep = (xfer_sem_created != 0U) && (tx_thread_identify() != TX_NULL);
     
     while (HAL_SD_GetCardState(&hsd1) != HAL_SD_CARD_TRANSFER)
     {
-        if ((HAL_GetTick() - start) > SD_TIMEOUT_MS)
+        uint32_t elapsed = HAL_GetTick() - start;
+        if (elapsed > SD_TIMEOUT_MS)
         {
             return -1;
         }
+        /* Reads and short programming phases finish within the spin window;
+         * longer write busy (erase/program) yields the CPU a tick at a time */
+        if (can_sleep && elapsed >= SD_BUSY_SPIN_MS)
+        {
+            tx_thread_sleep(1);
+        }
     }
     return 0;
 }
 
+/**
+  * @brief  Take the controller for one transfer sequence.
+  *         Before the kernel runs there is only one context, so no lock.
+  * @retval 1 if the mutex was taken, 0 if not needed, -1 on timeout
+  */
+static int xfer_lock(void)
+{
+    if ((xfer_mutex_created == 0U) || (tx_thread_identify() == TX_NULL))
+    {
+        return 0;
+    }
+    return (tx_mutex_get(&xfer_mutex, SD_LOCK_TIMEOUT_TICKS) == TX_SUCCESS) ? 1 : -1;
+}
+
+static void xfer_unlock(int locked)
+{
+    if (locked > 0)
+    {
+        (void)tx_mutex_put(&xfer_mutex);
+    }
+}
+
+/**
+  * @brief  Check whether a transfer can use IDMA and sleep on the semaphore.
+  *         IDMA needs a word-aligned buffer; blocking needs a thread.
+  */
+static int can_use_dma(const uint8_t *buffer)
+{
+    return (xfer_sem_created != 0U) &&
+           (((uint32_t)buffer & 3U) == 0U) &&
+           (tx_thread_identify() != TX_NULL);
+}
+
+/**
+  * @brief  Run one IDMA transfer and sleep until the SDMMC interrupt completes it.
+  * @retval 0 on success, -1 on error or timeout
+  */
+static int transfer_dma(uint8_t *buffer, uint32_t sector, uint32_t count, int write)
+{
+    HAL_StatusTypeDef status;
+    
+    /* Drop a completion left over from a transfer that timed out */
+    while (tx_semaphore_get(&xfer_sem, TX_NO_WAIT) == TX_SUCCESS)
+    {
+    }
+    
+    xfer_status = SD_XFER_PENDING;
+    if (write)
+    {
+        status = HAL_SD_WriteBlocks_DMA(&hsd1, buffer, sector, count);
+    }
+    else
+    {
+        status = HAL_SD_ReadBlocks_DMA(&hsd1, buffer, sector, count);
+    }
+    if (status != HAL_OK)
+    {
+        xfer_status = SD_XFER_IDLE;
+        return -1;
+    }
+    
+    if (tx_semaphore_get(&xfer_sem, SD_TIMEOUT_TICKS) != TX_SUCCESS)
+    {
+        (void)HAL_SD_Abort(&hsd1);
+        xfer_status = SD_XFER_IDLE;
+        return -1;
+    }
+    
+    return (xfer_status == SD_XFER_DONE) ? 0 : -1;
+}
+
+/**
+  * @brief  Record the transfer result and wake the waiting thread.
+  */
+static void transfer_complete(SD_XferStatus_t result)
+{
+    if (xfer_status == SD_XFER_PENDING)
+    {
+        xfer_status = result;
+        (void)tx_semaphore_put(&xfer_sem);
+    }
+}
+
+/* HAL callbacks (interrupt context) -----------------------------------------*/
+
+void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
+{
+    (void)hsd;
+    transfer_complete(SD_XFER_DONE);
+}
+
+void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd)
+{
+    (void)hsd;
+    transfer_complete(SD_XFER_DONE);
+}
+
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+    (void)hsd;
+    transfer_complete(SD_XFER_ERROR);
+}
+
 /* Public functions ----------------------------------------------------------*/
 
+void SD_Init(void)
+{
+    if (xfer_sem_created == 0U)
+    {
+        if (tx_semaphore_create(&xfer_sem, "SD Xfer", 0U) == TX_SUCCESS)
+        {
+            xfer_sem_created = 1U;
+        }
+    }
+    if (xfer_mutex_created == 0U)
+    {
+        if (tx_mutex_create(&xfer_mutex, "SD Xfer Lock", TX_INHERIT) == TX_SUCCESS)
+        {
+            xfer_mutex_created = 1U;
+        }
+    }
+}
+
 int SD_Read(uint8_t *buffer, uint32_t sector, uint32_t count)
 {
     if (buffer == NULL || count == 0U)
@@ -65,25 +291,36 @@ int SD_Read(uint8_t *buffer, uint32_t sector, uint32_t count)
         return -1;
     }
     
-    /* Wait for card to be ready before starting */
-    if (wait_for_transfer_ready() != 0)
+    int locked = xfer_lock();
+    if (locked < 0)
     {
         return -1;
     }
     
-    /* Perform read */
-    if (HAL_SD_ReadBlocks(&hsd1, buffer, sector, count, SD_TIMEOUT_MS) != HAL_OK)
+    /* Wait for card to be ready before starting */
+    int result = wait_for_transfer_ready();
+    
+    /* Perform read (IDMA when possible, else polled FIFO) */
+    if (result == 0)
     {
-        return -1;
+        if (can_use_dma(buffer))
+        {
+            result = transfer_dma(buffer, sector, count, 0);
+        }
+        else if (HAL_SD_ReadBlocks(&hsd1, buffer, sector, count, SD_TIMEOUT_MS) != HAL_OK)
+        {
+            result = -1;
+        }
     }
     
     /* Wait for completion */
-    if (wait_for_transfer_ready() != 0)
+    if (result == 0 && wait_for_transfer_ready() != 0)
     {
-        return -1;
+        result = -1;
     }
     
-    return 0;
+    xfer_unlock(locked);
+    return result;
 }
 
 int SD_Write(const uint8_t *buffer, uint32_t sector, uint32_t count, SD_Source_t source)
@@ -98,20 +335,55 @@ int SD_Write(const uint8_t *buffer, uint32_t sector, uint32_t count, SD_Source_t
         return -1;
     }
     
+    int locked = xfer_lock();
+    if (locked < 0)
+    {
+        return -1;
+    }
+    
     /* Wait for card to be ready before starting */
     if (wait_for_transfer_ready() != 0)
     {
+        xfer_unlock(locked);
         return -1;
     }
     
-    /* Perform write */
-    if (HAL_SD_WriteBlocks(&hsd1, (uint8_t *)buffer, sector, count, SD_TIMEOUT_MS) != HAL_OK)
+    /* Perform write (IDMA when possible, else polled FIFO) */
+    int result = 0;
+    if (can_use_dma(buffer))
     {
-        return -1;
+        if (transfer_dma((uint8_t *)buffer, sector, count, 1) != 0)
+        {
+            result = -1;
+        }
+    }
+    else if (HAL_SD_WriteBlocks(&hsd1, (uint8_t *)buffer, sector, count, SD_TIMEOUT_MS) != HAL_OK)
+    {
+        result = -1;
     }
     
     /* Wait for completion */
-    if (wait_for_transfer_ready() != 0)
+    if (result == 0 && wait_for_transfer_ready() != 0)
+    {
+        result = -1;
+    }
+    xfer_unlock(locked);
+    
+    /* Record the range once the data is on the card - even after an error,
+     * since part of it may have been written */
+    UINT old_posture = tx_interrupt_control(TX_INT_DISABLE);
+    dirty_map_add(sector, sector + count - 1U);
+    if (source == SD_SOURCE_MSC)
+    {
+        dirty_msc_sectors += count;
+    }
+    else
+    {
+        dirty_fatfs_sectors += count;
+    }
+    tx_interrupt_control(old_posture);
+    
+    if (result != 0)
     {
         return -1;
     }
@@ -133,6 +405,35 @@ int SD_IsReady(void)
     return (HAL_SD_GetCardState(&hsd1) == HAL_SD_CARD_TRANSFER) ? 1 : 0;
 }
 
+void SD_DirtyMap_Take(SD_DirtyMap_t *map)
+{
+    UINT old_posture = tx_interrupt_control(TX_INT_DISABLE);
+    memcpy(map->ranges, dirty_ranges, dirty_count * sizeof(dirty_ranges[0]));
+    map->count = dirty_count;
+    map->msc_sectors = dirty_msc_sectors;
+    map->fatfs_sectors = dirty_fatfs_sectors;
+    dirty_count = 0U;
+    dirty_msc_sectors = 0U;
+    dirty_fatfs_sectors = 0U;
+    tx_interrupt_control(old_posture);
+}
+
+int SD_DirtyMap_Overlaps(const SD_DirtyMap_t *map, uint32_t first, uint32_t last)
+{
+    for (uint32_t i = 0U; i < map->count; i++)
+    {
+        if (map->ranges[i].first > last)
+        {
+            break;  /* Sorted: nothing further can overlap */
+        }
+        if (map->ranges[i].last >= first)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 SD_Source_t SD_GetLastWriteSource(void)
 {
     return last_write_source;
@@ -254,6 +555,12 @@ void SD_SetMode(SD_Mode_t mode)
 {
     current_mode = mode;
     __DSB();  /* Mode change must be visible to all threads before we return */
+    
+    /* Staged host writes reach the card before FatFS can read it, and
+     * either side may have rewritten any sector while the other owned it */
+    MSC_Storage_Invalidate();
+    SD_DiskCache_Invalidate();
+    ExFAT_InvalidateCache();
 }
 
 int SD_IsMscAllowed(void)
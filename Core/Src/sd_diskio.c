@@ -5,6 +5,11 @@
   ******************************************************************************
   * This file implements the disk I/O functions required by FatFs to access
   * the SD card through the STM32 HAL SD driver.
+  *
+  * Single-sector transfers go through a small write-through LRU cache
+  * tagged by LBA. FatFs moves FAT, bitmap and directory sectors one at a
+  * time through its window, so directory walks and f_stat lookups hit the
+  * cache instead of the card. Longer (data) transfers bypass it.
   ******************************************************************************
   */
 
@@ -13,11 +18,131 @@
 #include "diskio.h"
 #include "sdmmc.h"
 #include "sd_adapter.h"
+#include "sd_diskio.h"
 #include <string.h>
 
 /* Private defines -----------------------------------------------------------*/
 #define SD_DEFAULT_BLOCK_SIZE   512U
 
+#if SD_DISKIO_CACHE_SECTORS > 0U
+
+/* Private types -------------------------------------------------------------*/
+typedef struct {
+    LBA_t lba;          /* Cached sector */
+    uint32_t last_use;  /* LRU stamp, 0 = empty */
+} sd_cache_tag_t;
+
+/* Private variables ---------------------------------------------------------*/
+static sd_cache_tag_t cache_tags[SD_DISKIO_CACHE_SECTORS];
+static BYTE cache_data[SD_DISKIO_CACHE_SECTORS][SD_DEFAULT_BLOCK_SIZE] __attribute__((aligned(32)));
+static uint32_t cache_clock = 0U;
+#endif /* SD_DISKIO_CACHE_SECTORS > 0U */
+
+static SD_DiskCacheStats_t cache_stats;
+
+#if SD_DISKIO_CACHE_SECTORS > 0U
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Find the cache line holding a sector.
+  * @retval Line index, or -1 if not cached
+  */
+static int cache_find(LBA_t lba)
+{
+    for (int i = 0; i < (int)SD_DISKIO_CACHE_SECTORS; i++)
+    {
+        if (cache_tags[i].last_use != 0U && cache_tags[i].lba == lba)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+  * @brief  Pick the line to (re)fill: an empty one, else the least recently used.
+  */
+static int cache_victim(void)
+{
+    int victim = 0;
+
+    for (int i = 0; i < (int)SD_DISKIO_CACHE_SECTORS; i++)
+    {
+        if (cache_tags[i].last_use < cache_tags[victim].last_use)
+        {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+/**
+  * @brief  Mark a line most recently used.
+  */
+static void cache_touch(int line)
+{
+    if (++cache_clock == 0U)
+    {
+        /* Stamp wrapped: keep only this line rather than mis-order the rest */
+        LBA_t lba = cache_tags[line].lba;
+        memset(cache_tags, 0, sizeof(cache_tags));
+        cache_tags[line].lba = lba;
+        cache_clock = 1U;
+    }
+    cache_tags[line].last_use = cache_clock;
+}
+
+/**
+  * @brief  Store one sector and mark it most recently used.
+  */
+static void cache_put(int line, LBA_t lba, const BYTE *buff)
+{
+    memcpy(cache_data[line], buff, SD_DEFAULT_BLOCK_SIZE);
+    cache_tags[line].lba = lba;
+    cache_touch(line);
+}
+
+/**
+  * @brief  Drop cached copies of sectors [lba, lba + count).
+  */
+static void cache_drop_range(LBA_t lba, UINT count)
+{
+    for (int i = 0; i < (int)SD_DISKIO_CACHE_SECTORS; i++)
+    {
+        if (cache_tags[i].last_use != 0U &&
+            cache_tags[i].lba >= lba && cache_tags[i].lba - lba < (LBA_t)count)
+        {
+            cache_tags[i].last_use = 0U;
+        }
+    }
+}
+#endif /* SD_DISKIO_CACHE_SECTORS > 0U */
+
+/* Public functions ----------------------------------------------------------*/
+
+void SD_DiskCache_Invalidate(void)
+{
+#if SD_DISKIO_CACHE_SECTORS > 0U
+    memset(cache_tags, 0, sizeof(cache_tags));
+    cache_clock = 0U;
+#endif
+    cache_stats.invalidations++;
+}
+
+void SD_DiskCache_GetStats(SD_DiskCacheStats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = cache_stats;
+    }
+}
+
+void SD_DiskCache_ResetStats(void)
+{
+    memset(&cache_stats, 0, sizeof(cache_stats));
+}
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -83,7 +208,36 @@ DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
         return RES_NOTRDY;
     }
 
+#if SD_DISKIO_CACHE_SECTORS > 0U
+    if (count <= SD_DISKIO_CACHE_MAX_XFER)
+    {
+        for (UINT i = 0; i < count; i++)
+        {
+            BYTE *dst = buff + (i * SD_DEFAULT_BLOCK_SIZE);
+            int line = cache_find(sector + i);
+
+            if (line >= 0)
+            {
+                memcpy(dst, cache_data[line], SD_DEFAULT_BLOCK_SIZE);
+                cache_touch(line);
+                cache_stats.hits++;
+                continue;
+            }
+
+            /* Read straight into the caller's buffer, then keep a copy */
+            if (SD_Read(dst, (uint32_t)(sector + i), 1U) != 0)
+            {
+                return RES_ERROR;
+            }
+            cache_put(cache_victim(), sector + i, dst);
+            cache_stats.misses++;
+        }
+        return RES_OK;
+    }
+#endif
+
     /* Use SD adapter for read */
+    cache_stats.bypassed += count;
     if (SD_Read(buff, (uint32_t)sector, count) == 0)
     {
         return RES_OK;
@@ -110,12 +264,32 @@ DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
     }
 
     /* Use SD adapter for write (mark as FatFS source) */
-    if (SD_Write(buff, (uint32_t)sector, count, SD_SOURCE_FATFS) == 0)
+    int ok = (SD_Write(buff, (uint32_t)sector, count, SD_SOURCE_FATFS) == 0);
+
+#if SD_DISKIO_CACHE_SECTORS > 0U
+    /* Write-through: refresh cached copies of small writes, drop the rest
+     * (and everything touched by a failed write, whose state is unknown) */
+    if (ok && count <= SD_DISKIO_CACHE_MAX_XFER)
     {
-        return RES_OK;
+        for (UINT i = 0; i < count; i++)
+        {
+            int line = cache_find(sector + i);
+            cache_put((line >= 0) ? line : cache_victim(), sector + i,
+                      buff + (i * SD_DEFAULT_BLOCK_SIZE));
+        }
+    }
+    else
+    {
+        cache_drop_range(sector, count);
     }
+#endif
 
-    return RES_ERROR;
+    if (count > SD_DISKIO_CACHE_MAX_XFER)
+    {
+        cache_stats.bypassed += count;
+    }
+
+    return ok ? RES_OK : RES_ERROR;
 }
 
 #endif /* FF_FS_READONLY == 0 */
@@ -0,0 +1,319 @@
+/**
+  ******************************************************************************
+  * @file    hal_mock.c
+  * @brief   Host mock of the HAL SD driver, HAL tick and ThreadX calls
+  ******************************************************************************
+  * Just enough behaviour for sd_adapter.c: a RAM-backed card with a busy
+  * (programming) phase after writes, polled and IDMA transfers, interrupt
+  * callbacks delivered while the caller waits, and a mock clock.
+  ******************************************************************************
+  */
+
+#include "hal_mock.h"
+#include "sdmmc.h"
+#include <string.h>
+
+/* Interrupt owed to the last DMA transfer */
+typedef enum {
+    IRQ_NONE = 0,
+    IRQ_RX_DONE,
+    IRQ_TX_DONE,
+    IRQ_ERROR
+} mock_irq_t;
+
+SD_HandleTypeDef hsd1;
+mock_sd_t mock_sd;
+
+static uint8_t card[MOCK_SECTORS][MOCK_SECTOR_SIZE];
+static uint64_t now_us = 0U;
+static uint64_t busy_until_us = 0U;
+static mock_irq_t pending_irq = IRQ_NONE;
+static mock_irq_t last_irq = IRQ_NONE;
+static TX_SEMAPHORE *xfer_sem = NULL;
+static int mutex_created = 0;
+static TX_THREAD thread;
+
+/* Mock controls ------------------------------------------------------------*/
+
+void mock_reset(void)
+{
+    memset(&mock_sd, 0, sizeof(mock_sd));
+    mock_sd.initialized = 1;
+    mock_sd.in_thread = 1;
+    mock_sd.dma_mode = MOCK_DMA_COMPLETE;
+    pending_irq = IRQ_NONE;
+    busy_until_us = now_us;
+}
+
+uint64_t mock_now_us(void)
+{
+    return now_us;
+}
+
+void mock_card_busy(uint32_t us)
+{
+    busy_until_us = now_us + us;
+}
+
+uint8_t *mock_card(uint32_t sector)
+{
+    return card[sector];
+}
+
+static void deliver(mock_irq_t irq)
+{
+    if (irq == IRQ_RX_DONE)
+    {
+        HAL_SD_RxCpltCallback(&hsd1);
+    }
+    else if (irq == IRQ_TX_DONE)
+    {
+        HAL_SD_TxCpltCallback(&hsd1);
+    }
+    else if (irq == IRQ_ERROR)
+    {
+        HAL_SD_ErrorCallback(&hsd1);
+    }
+}
+
+void mock_late_completion(void)
+{
+    deliver(last_irq);
+}
+
+void mock_stale_completion(void)
+{
+    if (xfer_sem != NULL)
+    {
+        xfer_sem->count++;
+    }
+}
+
+/* HAL ----------------------------------------------------------------------*/
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t)(now_us / 1000U);
+}
+
+int SDMMC1_IsInitialized(void)
+{
+    return mock_sd.initialized;
+}
+
+HAL_SD_CardStateTypeDef HAL_SD_GetCardState(SD_HandleTypeDef *hsd)
+{
+    (void)hsd;
+    now_us += MOCK_POLL_US;
+    return (now_us < busy_until_us) ? HAL_SD_CARD_PROGRAMMING : HAL_SD_CARD_TRANSFER;
+}
+
+HAL_StatusTypeDef HAL_SD_GetCardInfo(SD_HandleTypeDef *hsd, HAL_SD_CardInfoTypeDef *pCardInfo)
+{
+    (void)hsd;
+    memset(pCardInfo, 0, sizeof(*pCardInfo));
+    pCardInfo->BlockNbr = MOCK_SECTORS;
+    pCardInfo->BlockSize = MOCK_SECTOR_SIZE;
+    pCardInfo->LogBlockNbr = MOCK_SECTORS;
+    pCardInfo->LogBlockSize = MOCK_SECTOR_SIZE;
+    return HAL_OK;
+}
+
+static int in_range(uint32_t sector, uint32_t count)
+{
+    return (sector < MOCK_SECTORS) && (count <= MOCK_SECTORS - sector);
+}
+
+/* Once the lock exists, every transfer from a thread must hold it */
+static void check_locked(void)
+{
+    if (mutex_created && mock_sd.in_thread && mock_sd.mutex_depth == 0)
+    {
+        mock_sd.unlocked_transfers++;
+    }
+}
+
+HAL_StatusTypeDef HAL_SD_ReadBlocks(SD_HandleTypeDef *hsd, uint8_t *pData, uint32_t BlockAdd,
+                                    uint32_t NumberOfBlocks, uint32_t Timeout)
+{
+    (void)hsd;
+    (void)Timeout;
+    mock_sd.polled_reads++;
+    check_locked();
+    if (mock_sd.polled_fail || !in_range(BlockAdd, NumberOfBlocks))
+    {
+        return HAL_ERROR;
+    }
+    memcpy(pData, card[BlockAdd], NumberOfBlocks * MOCK_SECTOR_SIZE);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_WriteBlocks(SD_HandleTypeDef *hsd, const uint8_t *pData, uint32_t BlockAdd,
+                                     uint32_t NumberOfBlocks, uint32_t Timeout)
+{
+    (void)hsd;
+    (void)Timeout;
+    mock_sd.polled_writes++;
+    check_locked();
+    if (mock_sd.polled_fail || !in_range(BlockAdd, NumberOfBlocks))
+    {
+        return HAL_ERROR;
+    }
+    memcpy(card[BlockAdd], pData, NumberOfBlocks * MOCK_SECTOR_SIZE);
+    busy_until_us = now_us + mock_sd.write_busy_us;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_ReadBlocks_DMA(SD_HandleTypeDef *hsd, uint8_t *pData, uint32_t BlockAdd,
+                                        uint32_t NumberOfBlocks)
+{
+    (void)hsd;
+    mock_sd.dma_reads++;
+    check_locked();
+    if (mock_sd.dma_mode == MOCK_DMA_START_FAIL || !in_range(BlockAdd, NumberOfBlocks))
+    {
+        return HAL_ERROR;
+    }
+    memcpy(pData, card[BlockAdd], NumberOfBlocks * MOCK_SECTOR_SIZE);
+    last_irq = (mock_sd.dma_mode == MOCK_DMA_ERROR) ? IRQ_ERROR : IRQ_RX_DONE;
+    pending_irq = (mock_sd.dma_mode == MOCK_DMA_NO_IRQ) ? IRQ_NONE : last_irq;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_WriteBlocks_DMA(SD_HandleTypeDef *hsd, const uint8_t *pData, uint32_t BlockAdd,
+                                         uint32_t NumberOfBlocks)
+{
+    (void)hsd;
+    mock_sd.dma_writes++;
+    check_locked();
+    if (mock_sd.dma_mode == MOCK_DMA_START_FAIL || !in_range(BlockAdd, NumberOfBlocks))
+    {
+        return HAL_ERROR;
+    }
+    memcpy(card[BlockAdd], pData, NumberOfBlocks * MOCK_SECTOR_SIZE);
+    busy_until_us = now_us + mock_sd.write_busy_us;
+    last_irq = (mock_sd.dma_mode == MOCK_DMA_ERROR) ? IRQ_ERROR : IRQ_TX_DONE;
+    pending_irq = (mock_sd.dma_mode == MOCK_DMA_NO_IRQ) ? IRQ_NONE : last_irq;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SD_Abort(SD_HandleTypeDef *hsd)
+{
+    (void)hsd;
+    mock_sd.aborts++;
+    pending_irq = IRQ_NONE;
+    return HAL_OK;
+}
+
+/* ThreadX ------------------------------------------------------------------*/
+
+static void advance_ticks(ULONG ticks)
+{
+    now_us += ((uint64_t)ticks * 1000000U) / TX_TIMER_TICKS_PER_SECOND;
+}
+
+UINT tx_semaphore_create(TX_SEMAPHORE *semaphore_ptr, CHAR *name_ptr, ULONG initial_count)
+{
+    (void)name_ptr;
+    semaphore_ptr->count = initial_count;
+    xfer_sem = semaphore_ptr;
+    return TX_SUCCESS;
+}
+
+UINT tx_semaphore_get(TX_SEMAPHORE *semaphore_ptr, ULONG wait_option)
+{
+    if (semaphore_ptr->count == 0U && wait_option != TX_NO_WAIT)
+    {
+        mock_sd.sem_wait = wait_option;
+        /* The caller sleeps; the SDMMC interrupt (if any) arrives meanwhile */
+        mock_irq_t irq = pending_irq;
+        pending_irq = IRQ_NONE;
+        deliver(irq);
+        if (semaphore_ptr->count == 0U)
+        {
+            advance_ticks(wait_option);
+        }
+    }
+    if (semaphore_ptr->count == 0U)
+    {
+        return TX_NO_INSTANCE;
+    }
+    semaphore_ptr->count--;
+    return TX_SUCCESS;
+}
+
+UINT tx_semaphore_put(TX_SEMAPHORE *semaphore_ptr)
+{
+    semaphore_ptr->count++;
+    return TX_SUCCESS;
+}
+
+UINT tx_mutex_create(TX_MUTEX *mutex_ptr, CHAR *name_ptr, UINT inherit)
+{
+    (void)name_ptr;
+    (void)inherit;
+    mutex_ptr->owned = 0U;
+    mutex_created = 1;
+    return TX_SUCCESS;
+}
+
+UINT tx_mutex_get(TX_MUTEX *mutex_ptr, ULONG wait_option)
+{
+    mock_sd.mutex_gets++;
+    mock_sd.mutex_wait = wait_option;
+    if (mock_sd.mutex_busy)
+    {
+        advance_ticks(wait_option);
+        return TX_NOT_AVAILABLE;
+    }
+    mutex_ptr->owned++;
+    mock_sd.mutex_depth++;
+    return TX_SUCCESS;
+}
+
+UINT tx_mutex_put(TX_MUTEX *mutex_ptr)
+{
+    if (mutex_ptr->owned == 0U)
+    {
+        return TX_NOT_AVAILABLE;
+    }
+    mutex_ptr->owned--;
+    mock_sd.mutex_depth--;
+    return TX_SUCCESS;
+}
+
+TX_THREAD *tx_thread_identify(void)
+{
+    return mock_sd.in_thread ? &thread : TX_NULL;
+}
+
+UINT tx_thread_sleep(ULONG timer_ticks)
+{
+    mock_sd.sleeps++;
+    advance_ticks(timer_ticks);
+    return TX_SUCCESS;
+}
+
+UINT tx_interrupt_control(UINT new_posture)
+{
+    UINT old_posture = mock_sd.irq_disabled ? TX_INT_DISABLE : TX_INT_ENABLE;
+    mock_sd.irq_disabled = (new_posture == TX_INT_DISABLE);
+    return old_posture;
+}
+
+ULONG tx_time_get(void)
+{
+    return (ULONG)((now_us * TX_TIMER_TICKS_PER_SECOND) / 1000000U);
+}
+
+/* Called by SD_SetMode -------------------------------------------------------*/
+
+void MSC_Storage_Invalidate(void)
+{
+    mock_sd.msc_invalidates++;
+}
+
+void SD_DiskCache_Invalidate(void)
+{
+    mock_sd.disk_cache_invalidates++;
+}
@@ -0,0 +1,91 @@
+/**
+  ******************************************************************************
+  * @file    hal_mock.h
+  * @brief   Controls and counters for the host HAL / ThreadX mock
+  ******************************************************************************
+  * The mock is single-threaded. Time only moves when the code under test
+  * polls the card (MOCK_POLL_US per HAL_SD_GetCardState), sleeps, or waits
+  * on a semaphore or mutex that never becomes available. A DMA transfer
+  * moves the data at start; its interrupt is delivered while the caller
+  * waits on the completion semaphore, as on the target.
+  ******************************************************************************
+  */
+#ifndef HAL_MOCK_H
+#define HAL_MOCK_H
+
+#include "stm32h5xx_hal.h"
+#include "tx_api.h"
+
+#define MOCK_SECTOR_SIZE    512U
+#define MOCK_SECTORS        4096U
+#define MOCK_POLL_US        100U     /* Cost of one card state query */
+
+typedef enum {
+    MOCK_DMA_COMPLETE = 0,  /* Transfer-complete interrupt during the wait */
+    MOCK_DMA_ERROR,         /* Error interrupt during the wait */
+    MOCK_DMA_NO_IRQ,        /* No interrupt: the wait times out */
+    MOCK_DMA_START_FAIL     /* HAL_SD_*_DMA refuses to start */
+} mock_dma_mode_t;
+
+typedef struct {
+    /* Controls */
+    int             initialized;        /* SDMMC1_IsInitialized() */
+    int             in_thread;          /* tx_thread_identify() returns a thread */
+    int             mutex_busy;         /* Another thread holds every mutex for good */
+    mock_dma_mode_t dma_mode;
+    int             polled_fail;        /* Polled transfers return HAL_ERROR */
+    uint32_t        write_busy_us;      /* Programming time after each write */
+
+    /* Observations */
+    uint32_t dma_reads;
+    uint32_t dma_writes;
+    uint32_t polled_reads;
+    uint32_t polled_writes;
+    uint32_t aborts;
+    uint32_t sleeps;
+    uint32_t mutex_gets;
+    ULONG    mutex_wait;                /* wait_option of the last tx_mutex_get */
+    int      mutex_depth;               /* Mutexes currently held */
+    uint32_t unlocked_transfers;        /* Transfers started in a thread without the lock */
+    ULONG    sem_wait;                  /* wait_option of the last blocking tx_semaphore_get */
+    int      irq_disabled;
+    uint32_t msc_invalidates;
+    uint32_t disk_cache_invalidates;
+} mock_sd_t;
+
+extern mock_sd_t mock_sd;
+
+/**
+  * @brief  Restore default controls (initialized, in a thread, DMA completes)
+  *         and clear the counters. Card contents and the clock are kept.
+  */
+void mock_reset(void);
+
+/**
+  * @brief  Microseconds of mock time since start.
+  */
+uint64_t mock_now_us(void);
+
+/**
+  * @brief  Keep the card out of the transfer state for us microseconds.
+  */
+void mock_card_busy(uint32_t us);
+
+/**
+  * @brief  Card contents (MOCK_SECTORS sectors).
+  */
+uint8_t *mock_card(uint32_t sector);
+
+/**
+  * @brief  Deliver the interrupt of the last DMA transfer now, as if it
+  *         arrived after the caller gave up on it.
+  */
+void mock_late_completion(void);
+
+/**
+  * @brief  Put one token on the completion semaphore, as if an earlier
+  *         interrupt had been left unconsumed.
+  */
+void mock_stale_completion(void);
+
+#endif /* HAL_MOCK_H */
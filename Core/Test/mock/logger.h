@@ -0,0 +1,19 @@
+/**
+  ******************************************************************************
+  * @file    logger.h (host mock)
+  * @brief   Tagged log macros that compile their arguments and print nothing
+  ******************************************************************************
+  */
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+
+#define LOG_MOCK(format, ...) do { if (0) { printf(format, ##__VA_ARGS__); } } while (0)
+
+#define LOG_DEBUG_TAG(tag, format, ...) LOG_MOCK("[%s] " format, tag, ##__VA_ARGS__)
+#define LOG_INFO_TAG(tag, format, ...)  LOG_MOCK("[%s] " format, tag, ##__VA_ARGS__)
+#define LOG_WARN_TAG(tag, format, ...)  LOG_MOCK("[%s] " format, tag, ##__VA_ARGS__)
+#define LOG_ERROR_TAG(tag, format, ...) LOG_MOCK("[%s] " format, tag, ##__VA_ARGS__)
+
+#endif /* LOGGER_H */
@@ -0,0 +1,16 @@
+/**
+  ******************************************************************************
+  * @file    sdmmc.h (host mock)
+  * @brief   SDMMC1 handle and init flag, backed by hal_mock.c
+  ******************************************************************************
+  */
+#ifndef SDMMC_H
+#define SDMMC_H
+
+#include "stm32h5xx_hal.h"
+
+extern SD_HandleTypeDef hsd1;
+
+int SDMMC1_IsInitialized(void);
+
+#endif /* SDMMC_H */
@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file    stm32h5xx_hal.h (host mock)
+  * @brief   The slice of the STM32H5 HAL SD API that sd_adapter.c uses
+  ******************************************************************************
+  * Shadows the real header when Core/Test is built on the host. The card
+  * behind these calls is simulated in hal_mock.c and driven by the tests
+  * through hal_mock.h.
+  ******************************************************************************
+  */
+#ifndef STM32H5XX_HAL_H
+#define STM32H5XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    HAL_OK      = 0x00U,
+    HAL_ERROR   = 0x01U,
+    HAL_BUSY    = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef uint32_t HAL_SD_CardStateTypeDef;
+
+#define HAL_SD_CARD_READY           0x00000001U
+#define HAL_SD_CARD_TRANSFER        0x00000004U
+#define HAL_SD_CARD_SENDING         0x00000005U
+#define HAL_SD_CARD_RECEIVING       0x00000006U
+#define HAL_SD_CARD_PROGRAMMING     0x00000007U
+
+typedef struct {
+    uint32_t CardType;
+    uint32_t CardVersion;
+    uint32_t Class;
+    uint32_t RelCardAdd;
+    uint32_t BlockNbr;
+    uint32_t BlockSize;
+    uint32_t LogBlockNbr;
+    uint32_t LogBlockSize;
+    uint32_t CardSpeed;
+} HAL_SD_CardInfoTypeDef;
+
+typedef struct {
+    uint32_t ErrorCode;
+} SD_HandleTypeDef;
+
+#define __DSB()     __sync_synchronize()
+
+uint32_t HAL_GetTick(void);
+
+HAL_SD_CardStateTypeDef HAL_SD_GetCardState(SD_HandleTypeDef *hsd);
+HAL_StatusTypeDef HAL_SD_GetCardInfo(SD_HandleTypeDef *hsd, HAL_SD_CardInfoTypeDef *pCardInfo);
+HAL_StatusTypeDef HAL_SD_ReadBlocks(SD_HandleTypeDef *hsd, uint8_t *pData, uint32_t BlockAdd,
+                                    uint32_t NumberOfBlocks, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SD_WriteBlocks(SD_HandleTypeDef *hsd, const uint8_t *pData, uint32_t BlockAdd,
+                                     uint32_t NumberOfBlocks, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SD_ReadBlocks_DMA(SD_HandleTypeDef *hsd, uint8_t *pData, uint32_t BlockAdd,
+                                        uint32_t NumberOfBlocks);
+HAL_StatusTypeDef HAL_SD_WriteBlocks_DMA(SD_HandleTypeDef *hsd, const uint8_t *pData, uint32_t BlockAdd,
+                                         uint32_t NumberOfBlocks);
+HAL_StatusTypeDef HAL_SD_Abort(SD_HandleTypeDef *hsd);
+
+/* Implemented by the code under test */
+void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd);
+void HAL_SD_TxCpltCallback(SD_HandleTypeDef *hsd);
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd);
+
+#endif /* STM32H5XX_HAL_H */
@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file    tx_api.h (host mock)
+  * @brief   The ThreadX calls used by sd_adapter.c, single-threaded
+  ******************************************************************************
+  * No scheduler: semaphores are counters, a mutex can be made to look
+  * owned by another thread, and sleeping advances the mock clock. See
+  * hal_mock.h for the controls.
+  ******************************************************************************
+  */
+#ifndef TX_API_H
+#define TX_API_H
+
+#include <stdint.h>
+
+typedef unsigned int    UINT;
+typedef unsigned long   ULONG;
+typedef char            CHAR;
+typedef unsigned char   UCHAR;
+typedef void            VOID;
+
+#define TX_NULL                     ((void *)0)
+#define TX_SUCCESS                  0x00U
+#define TX_NO_INSTANCE              0x0DU
+#define TX_NOT_AVAILABLE            0x1DU
+#define TX_NO_WAIT                  0x00000000UL
+#define TX_WAIT_FOREVER             0xFFFFFFFFUL
+#define TX_INHERIT                  1U
+#define TX_NO_INHERIT               0U
+#define TX_INT_DISABLE              1U
+#define TX_INT_ENABLE               0U
+
+#ifndef TX_TIMER_TICKS_PER_SECOND
+#define TX_TIMER_TICKS_PER_SECOND   1000UL
+#endif
+
+typedef struct {
+    ULONG count;
+} TX_SEMAPHORE;
+
+typedef struct {
+    UINT owned;
+} TX_MUTEX;
+
+typedef struct {
+    UINT id;
+} TX_THREAD;
+
+UINT tx_semaphore_create(TX_SEMAPHORE *semaphore_ptr, CHAR *name_ptr, ULONG initial_count);
+UINT tx_semaphore_get(TX_SEMAPHORE *semaphore_ptr, ULONG wait_option);
+UINT tx_semaphore_put(TX_SEMAPHORE *semaphore_ptr);
+UINT tx_mutex_create(TX_MUTEX *mutex_ptr, CHAR *name_ptr, UINT inherit);
+UINT tx_mutex_get(TX_MUTEX *mutex_ptr, ULONG wait_option);
+UINT tx_mutex_put(TX_MUTEX *mutex_ptr);
+TX_THREAD *tx_thread_identify(void);
+UINT tx_thread_sleep(ULONG timer_ticks);
+UINT tx_interrupt_control(UINT new_posture);
+ULONG tx_time_get(void);
+
+#endif /* TX_API_H */
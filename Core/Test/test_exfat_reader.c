@@ -0,0 +1,455 @@
+/**
+  ******************************************************************************
+  * @file    test_exfat_reader.c
+  * @brief   Host test of the exFAT reader against a small image on the mock card
+  ******************************************************************************
+  * Builds an exFAT volume in the mock card (512-byte sectors, 4 sectors per
+  * cluster) and runs Core/Src/exfat_reader.c over sd_adapter.c on it. SD
+  * commands are counted to check that whole sectors go out as multi-block
+  * reads, that NoFatChain files never touch the FAT, that repeated lookups
+  * are served from the lookup cache, and that a mode switch drops the
+  * cached FAT sectors and lookups.
+  ******************************************************************************
+  */
+
+#include "exfat_reader.h"
+#include "sd_adapter.h"
+#include "hal_mock.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SPC                 4U      /* Sectors per cluster */
+#define CLUSTER_BYTES       (SPC * MOCK_SECTOR_SIZE)
+#define FAT_SECTOR          24U
+#define FAT_LENGTH          8U
+#define HEAP_SECTOR         64U
+#define CLUSTER_COUNT       ((MOCK_SECTORS - HEAP_SECTOR) / SPC)
+#define ROOT_CLUSTER        4U
+#define SUB_CLUSTER_1       60U     /* "sub" spans two chained clusters */
+#define SUB_CLUSTER_2       70U
+
+#define STREAM_ALLOC        0x01U
+#define STREAM_NO_FAT_CHAIN 0x02U
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    const char *name;
+    uint8_t id;                 /* Seeds the file contents */
+    uint32_t size;
+    uint8_t contiguous;         /* NoFatChain: clusters[0] onwards, no FAT entries */
+    uint8_t attr;
+    uint32_t clusters[8];       /* FAT chain, 0-terminated */
+} image_file_t;
+
+/* Fragmented: 10-12 follow each other, then two jumps */
+static const image_file_t chain_bin  = { "chain.bin", 1, 12000U, 0, 0x20, { 10, 11, 12, 20, 21, 30, 0 } };
+static const image_file_t contig_bin = { "contig.bin", 2, 20000U, 1, 0x20, { 40, 0 } };
+static const image_file_t sub_dir    = { "sub", 0, 2U * CLUSTER_BYTES, 0, 0x10, { SUB_CLUSTER_1, SUB_CLUSTER_2, 0 } };
+static const image_file_t deep_txt   = { "deep.txt", 3, 700U, 0, 0x20, { 80, 0 } };
+static const image_file_t root_deep  = { "deep.txt", 4, 300U, 0, 0x20, { 90, 0 } };
+static const image_file_t cafe_txt   = { "caf\xe9.txt", 5, 100U, 0, 0x20, { 91, 0 } };     /* U+00E9 */
+static const image_file_t long_name  = { "a_name_longer_than_the_lookup_cache_keeps.bin", 6, 100U, 0, 0x20, { 92, 0 } };
+static const image_file_t decoy_bin  = { "decoy.bin", 7, 100U, 0, 0x20, { 93, 0 } };
+
+static uint8_t read_buf[32768] __attribute__((aligned(32)));
+
+/* Image ---------------------------------------------------------------------*/
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void put32(uint8_t *p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+static void put64(uint8_t *p, uint64_t v) { put32(p, (uint32_t)v); put32(p + 4, (uint32_t)(v >> 32)); }
+
+static uint8_t *cluster_ptr(uint32_t cluster)
+{
+    return mock_card(HEAP_SECTOR + (cluster - 2U) * SPC);
+}
+
+static void set_fat(uint32_t cluster, uint32_t value)
+{
+    put32(mock_card(FAT_SECTOR) + cluster * 4U, value);
+}
+
+static uint8_t file_byte(uint8_t id, uint32_t offset)
+{
+    return (uint8_t)((offset * 13U) + (offset >> 9) + id * 71U);
+}
+
+static uint16_t name_hash(const char *name)
+{
+    uint16_t h = 0;
+    for (; *name; name++)
+    {
+        uint16_t c = (uint8_t)*name;
+        if (c >= 'a' && c <= 'z')
+        {
+            c -= 32U;
+        }
+        h = (uint16_t)(((h & 1U) ? 0x8000U : 0U) + (h >> 1) + (c & 0xFFU));
+        h = (uint16_t)(((h & 1U) ? 0x8000U : 0U) + (h >> 1) + (c >> 8));
+    }
+    return h;
+}
+
+/* Write the file's entry set at dir and return the entries used */
+static uint32_t put_entry_set(uint8_t *dir, const image_file_t *f)
+{
+    uint32_t len = (uint32_t)strlen(f->name);
+    uint32_t name_entries = (len + 14U) / 15U;
+    uint32_t first = f->clusters[0];
+
+    memset(dir, 0, 32U * (2U + name_entries));
+    dir[0] = 0x85;
+    dir[1] = (uint8_t)(1U + name_entries);
+    put16(dir + 4, f->attr);
+    put32(dir + 12, 0x5C210000U);   /* 2026-01-01 */
+
+    dir[32] = 0xC0;
+    dir[33] = (uint8_t)(STREAM_ALLOC | (f->contiguous ? STREAM_NO_FAT_CHAIN : 0U));
+    dir[35] = (uint8_t)len;
+    put16(dir + 36, name_hash(f->name));
+    put64(dir + 40, f->size);
+    put32(dir + 52, first);
+    put64(dir + 56, f->size);
+
+    for (uint32_t i = 0U; i < len; i++)
+    {
+        uint8_t *e = dir + 64U + (i / 15U) * 32U;
+        e[0] = 0xC1;
+        put16(e + 2U + (i % 15U) * 2U, (uint8_t)f->name[i]);
+    }
+
+    uint16_t sum = 0;
+    for (uint32_t i = 0U; i < 32U * (2U + name_entries); i++)
+    {
+        if (i != 2U && i != 3U)
+        {
+            sum = (uint16_t)(((sum & 1U) ? 0x8000U : 0U) + (sum >> 1) + dir[i]);
+        }
+    }
+    put16(dir + 2, sum);
+    return 2U + name_entries;
+}
+
+/* Link the chain in the FAT (chained files only) and fill the data */
+static void put_file_data(const image_file_t *f)
+{
+    uint32_t n = 0U;
+    uint32_t clusters = (f->size + CLUSTER_BYTES - 1U) / CLUSTER_BYTES;
+
+    for (uint32_t c = 0U; c < clusters; c++)
+    {
+        uint32_t cluster = f->contiguous ? f->clusters[0] + c : f->clusters[c];
+        if (!f->contiguous)
+        {
+            set_fat(cluster, (f->clusters[c + 1U] != 0U) ? f->clusters[c + 1U] : 0xFFFFFFFFU);
+        }
+        if (f->attr & 0x10)
+        {
+            continue;
+        }
+        uint8_t *p = cluster_ptr(cluster);
+        for (uint32_t i = 0U; i < CLUSTER_BYTES && n < f->size; i++, n++)
+        {
+            p[i] = file_byte(f->id, n);
+        }
+    }
+}
+
+static void build_image(void)
+{
+    for (uint32_t s = 0U; s < MOCK_SECTORS; s++)
+    {
+        memset(mock_card(s), 0, MOCK_SECTOR_SIZE);
+    }
+
+    uint8_t *boot = mock_card(0U);
+    boot[0] = 0xEB; boot[1] = 0x76; boot[2] = 0x90;
+    memcpy(boot + 3, "EXFAT   ", 8);
+    put64(boot + 72, MOCK_SECTORS);
+    put32(boot + 80, FAT_SECTOR);
+    put32(boot + 84, FAT_LENGTH);
+    put32(boot + 88, HEAP_SECTOR);
+    put32(boot + 92, CLUSTER_COUNT);
+    put32(boot + 96, ROOT_CLUSTER);
+    put16(boot + 104, 0x0100);
+    boot[108] = 9;      /* 512-byte sectors */
+    boot[109] = 2;      /* 4 sectors per cluster */
+    boot[110] = 1;
+    put16(boot + 510, 0xAA55);
+
+    set_fat(0U, 0xFFFFFFF8U);
+    set_fat(1U, 0xFFFFFFFFU);
+    set_fat(ROOT_CLUSTER, 0xFFFFFFFFU);
+
+    /* Root: volume label, then the entry sets */
+    uint8_t *root = cluster_ptr(ROOT_CLUSTER);
+    root[0] = 0x83;
+    root[1] = 4;
+    put16(root + 2, 'T'); put16(root + 4, 'E'); put16(root + 6, 'S'); put16(root + 8, 'T');
+    uint32_t e = 1U;
+    e += put_entry_set(root + e * 32U, &chain_bin);
+    e += put_entry_set(root + e * 32U, &contig_bin);
+    e += put_entry_set(root + e * 32U, &sub_dir);
+    e += put_entry_set(root + e * 32U, &root_deep);
+    e += put_entry_set(root + e * 32U, &cafe_txt);
+    e += put_entry_set(root + e * 32U, &long_name);
+    (void)put_entry_set(root + e * 32U, &decoy_bin);
+    put16(root + e * 32U + 36U, name_hash("DECOY.BIM"));   /* Wrong NameHash, same length */
+
+    /* sub: first cluster all deleted entries, deep.txt in the second */
+    for (uint32_t i = 0U; i < CLUSTER_BYTES / 32U; i++)
+    {
+        cluster_ptr(SUB_CLUSTER_1)[i * 32U] = 0x05;
+    }
+    (void)put_entry_set(cluster_ptr(SUB_CLUSTER_2), &deep_txt);
+
+    put_file_data(&chain_bin);
+    put_file_data(&contig_bin);
+    put_file_data(&sub_dir);
+    put_file_data(&deep_txt);
+    put_file_data(&root_deep);
+    put_file_data(&cafe_txt);
+    put_file_data(&long_name);
+    put_file_data(&decoy_bin);
+}
+
+/* Helpers -------------------------------------------------------------------*/
+
+static uint32_t sd_reads(void)
+{
+    return mock_sd.dma_reads + mock_sd.polled_reads;
+}
+
+static int data_matches(const uint8_t *buf, uint8_t id, uint32_t offset, uint32_t len)
+{
+    for (uint32_t i = 0U; i < len; i++)
+    {
+        if (buf[i] != file_byte(id, offset + i))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void begin(const char *name)
+{
+    printf("=== Running [%s] ===\n", name);
+    mock_reset();
+}
+
+/* Tests ---------------------------------------------------------------------*/
+
+static void test_mount(void)
+{
+    begin("Mount and volume info");
+    ExFAT_FSInfo info;
+    CHECK(ExFAT_Init() == EXFAT_OK);
+    CHECK(ExFAT_GetInfo(&info) == EXFAT_OK);
+    CHECK(info.cluster_count == CLUSTER_COUNT);
+    CHECK(info.sectors_per_cluster == SPC && info.bytes_per_sector == MOCK_SECTOR_SIZE);
+    CHECK(strcmp(info.volume_label, "TEST") == 0);
+    CHECK(ExFAT_IsDirectory("/sub") == 1);
+    CHECK(ExFAT_Exists("/missing.bin") == 0);
+}
+
+static void test_chained_read(void)
+{
+    begin("FAT-chained file: one command per run of adjacent clusters");
+    ExFAT_File f;
+    size_t br = 0;
+    CHECK(ExFAT_FileOpen("/chain.bin", &f) == EXFAT_OK);
+    CHECK(f.contiguous == 0 && ExFAT_FileSize(&f) == chain_bin.size);
+
+    uint32_t before = sd_reads();
+    CHECK(ExFAT_FileRead(&f, read_buf, sizeof(read_buf), &br) == EXFAT_OK);
+    CHECK(br == chain_bin.size);
+    CHECK(data_matches(read_buf, chain_bin.id, 0U, chain_bin.size));
+    /* 10-12 (12 sectors), 20-21 (8), 30 (3 whole + 1 partial), one FAT sector */
+    CHECK(sd_reads() - before == 5U);
+    CHECK(ExFAT_FileEOF(&f) == 1);
+    CHECK(ExFAT_FileRead(&f, read_buf, 1U, &br) == EXFAT_ERR_EOF);
+
+    /* Unaligned start across a cluster jump */
+    CHECK(ExFAT_FileSeek(&f, 6000, 0) == EXFAT_OK);
+    CHECK(ExFAT_FileRead(&f, read_buf, 3000U, &br) == EXFAT_OK);
+    CHECK(br == 3000U && data_matches(read_buf, chain_bin.id, 6000U, 3000U));
+    CHECK(ExFAT_FileTell(&f) == 9000);
+    ExFAT_FileClose(&f);
+}
+
+static void test_contiguous_read(void)
+{
+    begin("NoFatChain file: no FAT reads, one command for the whole span");
+    ExFAT_File f;
+    size_t br = 0;
+    CHECK(ExFAT_FileOpen("/contig.bin", &f) == EXFAT_OK);
+    CHECK(f.contiguous == 1);
+
+    uint32_t before = sd_reads();
+    CHECK(ExFAT_FileRead(&f, read_buf, sizeof(read_buf), &br) == EXFAT_OK);
+    CHECK(br == contig_bin.size);
+    CHECK(data_matches(read_buf, contig_bin.id, 0U, contig_bin.size));
+    CHECK(sd_reads() - before == 2U);   /* 39 whole sectors + the tail */
+
+    CHECK(ExFAT_FileSeek(&f, -5000, 2) == EXFAT_OK);
+    CHECK(ExFAT_FileRead(&f, read_buf, sizeof(read_buf), &br) == EXFAT_OK);
+    CHECK(br == 5000U && data_matches(read_buf, contig_bin.id, contig_bin.size - 5000U, 5000U));
+    ExFAT_FileClose(&f);
+}
+
+static void test_chained_directory(void)
+{
+    begin("Directory spanning two chained clusters");
+    ExFAT_File f;
+    ExFAT_Dir d;
+    ExFAT_FileInfo info;
+    size_t br = 0;
+
+    CHECK(ExFAT_FileOpen("/sub/deep.txt", &f) == EXFAT_OK);
+    CHECK(ExFAT_FileRead(&f, read_buf, sizeof(read_buf), &br) == EXFAT_OK);
+    CHECK(br == deep_txt.size && data_matches(read_buf, deep_txt.id, 0U, deep_txt.size));
+    ExFAT_FileClose(&f);
+
+    CHECK(ExFAT_DirOpen("/sub", &d) == EXFAT_OK);
+    CHECK(ExFAT_DirRead(&d, &info) == EXFAT_OK);
+    CHECK(strcmp(info.name, "deep.txt") == 0 && info.size == deep_txt.size);
+    CHECK(ExFAT_DirRead(&d, &info) == EXFAT_ERR_NOT_FOUND);
+    ExFAT_DirClose(&d);
+}
+
+static void test_mode_switch_fat(void)
+{
+    begin("Mode switch drops cached FAT sectors");
+    ExFAT_File f;
+    size_t br = 0;
+
+    /* While in MSC mode the host moves the last cluster of chain.bin
+     * from 30 to 31 and puts other data in 30 */
+    SD_SetMode(SD_MODE_MSC);
+    memcpy(cluster_ptr(31U), cluster_ptr(30U), CLUSTER_BYTES);
+    memset(cluster_ptr(30U), 0xEE, CLUSTER_BYTES);
+    set_fat(21U, 31U);
+    set_fat(31U, 0xFFFFFFFFU);
+    set_fat(30U, 0U);
+    SD_SetMode(SD_MODE_FATFS);
+
+    CHECK(ExFAT_FileOpen("/chain.bin", &f) == EXFAT_OK);
+    CHECK(ExFAT_FileRead(&f, read_buf, sizeof(read_buf), &br) == EXFAT_OK);
+    CHECK(br == chain_bin.size && data_matches(read_buf, chain_bin.id, 0U, chain_bin.size));
+    ExFAT_FileClose(&f);
+}
+
+static void test_lookup_cache(void)
+{
+    begin("Repeated lookups come from the lookup cache");
+    ExFAT_FileInfo info;
+
+    CHECK(ExFAT_Stat("/sub/deep.txt", &info) == EXFAT_OK);
+    uint32_t before = sd_reads();
+    CHECK(ExFAT_Stat("/sub/deep.txt", &info) == EXFAT_OK);
+    CHECK(ExFAT_Stat("/SUB/Deep.TXT", &info) == EXFAT_OK);
+    CHECK(sd_reads() == before);
+    CHECK(info.size == deep_txt.size && info.start_cluster == deep_txt.clusters[0]);
+
+    /* Keyed on the parent directory: same name, different file */
+    CHECK(ExFAT_Stat("/deep.txt", &info) == EXFAT_OK);
+    CHECK(info.size == root_deep.size && info.start_cluster == root_deep.clusters[0]);
+    CHECK(ExFAT_Stat("/sub/deep.txt", &info) == EXFAT_OK);
+    CHECK(info.size == deep_txt.size);
+
+    /* Names the cache cannot hold are looked up on the card every time */
+    CHECK(ExFAT_Stat("/a_name_longer_than_the_lookup_cache_keeps.bin", &info) == EXFAT_OK);
+    before = sd_reads();
+    CHECK(ExFAT_Stat("/a_name_longer_than_the_lookup_cache_keeps.bin", &info) == EXFAT_OK);
+    CHECK(sd_reads() > before && info.size == long_name.size);
+
+    CHECK(ExFAT_Stat("/caf\xc3\xa9.txt", &info) == EXFAT_OK);  /* UTF-8 */
+    before = sd_reads();
+    CHECK(ExFAT_Stat("/caf\xc3\xa9.txt", &info) == EXFAT_OK);
+    CHECK(sd_reads() > before && info.size == cafe_txt.size);
+
+    /* Misses are not cached */
+    CHECK(ExFAT_Stat("/sub/missing.txt", &info) == EXFAT_ERR_NOT_FOUND);
+    before = sd_reads();
+    CHECK(ExFAT_Stat("/sub/missing.txt", &info) == EXFAT_ERR_NOT_FOUND);
+    CHECK(sd_reads() > before);
+}
+
+static void test_name_hash_filter(void)
+{
+    begin("Entry sets are matched on NameHash before the name");
+    ExFAT_FileInfo info;
+
+    /* Every other set in the root has a different hash or length */
+    CHECK(ExFAT_Stat("/contig.bin", &info) == EXFAT_OK && info.contiguous == 1);
+    CHECK(ExFAT_Stat("/CHAIN.BIN", &info) == EXFAT_OK && strcmp(info.name, "chain.bin") == 0);
+
+    /* The hash is trusted: a set whose stored hash is wrong is never parsed */
+    CHECK(ExFAT_Stat("/decoy.bin", &info) == EXFAT_ERR_NOT_FOUND);
+
+    /* Enumeration does not filter */
+    ExFAT_Dir d;
+    int seen = 0;
+    CHECK(ExFAT_DirOpen("/", &d) == EXFAT_OK);
+    while (ExFAT_DirRead(&d, &info) == EXFAT_OK)
+    {
+        seen += (strcmp(info.name, "decoy.bin") == 0);
+    }
+    ExFAT_DirClose(&d);
+    CHECK(seen == 1);
+}
+
+static void test_mode_switch_lookup(void)
+{
+    begin("Mode switch drops cached lookups");
+    ExFAT_File f;
+    ExFAT_FileInfo info;
+    size_t br = 0;
+    image_file_t moved = deep_txt;
+
+    CHECK(ExFAT_Stat("/sub/deep.txt", &info) == EXFAT_OK);
+
+    /* While in MSC mode the host rewrites sub/deep.txt, larger and elsewhere */
+    SD_SetMode(SD_MODE_MSC);
+    moved.id = 8;
+    moved.size = 1500U;
+    moved.clusters[0] = 81U;
+    (void)put_entry_set(cluster_ptr(SUB_CLUSTER_2), &moved);
+    put_file_data(&moved);
+    SD_SetMode(SD_MODE_FATFS);
+
+    CHECK(ExFAT_Stat("/sub/deep.txt", &info) == EXFAT_OK);
+    CHECK(info.size == moved.size && info.start_cluster == moved.clusters[0]);
+    CHECK(ExFAT_FileOpen("/sub/deep.txt", &f) == EXFAT_OK);
+    CHECK(ExFAT_FileRead(&f, read_buf, sizeof(read_buf), &br) == EXFAT_OK);
+    CHECK(br == moved.size && data_matches(read_buf, moved.id, 0U, moved.size));
+    ExFAT_FileClose(&f);
+}
+
+int main(void)
+{
+    build_image();
+    SD_Init();
+
+    test_mount();
+    test_chained_read();
+    test_contiguous_read();
+    test_chained_directory();
+    test_mode_switch_fat();
+    test_lookup_cache();
+    test_name_hash_filter();
+    test_mode_switch_lookup();
+
+    CHECK(ExFAT_DeInit() == EXFAT_OK);
+    printf("\nResult: %s (%d failed check%s)\n", failures ? "FAILED" : "SUCCESS", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,434 @@
+/**
+  ******************************************************************************
+  * @file    test_sd_adapter.c
+  * @brief   Host test of the sd_adapter transfer state machine and dirty map
+  ******************************************************************************
+  * Runs Core/Src/sd_adapter.c against the HAL / ThreadX mock in mock/.
+  * The adapter keeps its state in statics, so the tests run in order:
+  * the polled path before SD_Init, then everything that needs the
+  * semaphore and mutex.
+  ******************************************************************************
+  */
+
+#include "sd_adapter.h"
+#include "hal_mock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Mirrors of the private timeouts in sd_adapter.c (1 kHz mock tick) */
+#define SD_TIMEOUT_TICKS        1000U
+#define SD_LOCK_TIMEOUT_TICKS   3000U
+
+#define MAX_XFER_SECTORS        64U
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static uint32_t exfat_invalidates = 0U;
+
+/* The exFAT reader is not linked here; count what SD_SetMode asks of it */
+void ExFAT_InvalidateCache(void)
+{
+    exfat_invalidates++;
+}
+
+static uint8_t xfer_buf[MAX_XFER_SECTORS * MOCK_SECTOR_SIZE + 4U] __attribute__((aligned(32)));
+
+static void fill_card(void)
+{
+    for (uint32_t s = 0U; s < MOCK_SECTORS; s++)
+    {
+        memset(mock_card(s), (int)(s * 7U + 1U) & 0xFF, MOCK_SECTOR_SIZE);
+    }
+}
+
+static int card_matches(const uint8_t *buf, uint32_t sector, uint32_t count)
+{
+    return memcmp(buf, mock_card(sector), count * MOCK_SECTOR_SIZE) == 0;
+}
+
+static void begin(const char *name)
+{
+    printf("=== Running [%s] ===\n", name);
+    mock_reset();
+}
+
+/* Transfers ----------------------------------------------------------------*/
+
+static void test_polled_before_init(void)
+{
+    begin("Polled transfers before SD_Init");
+    CHECK(SD_Read(xfer_buf, 10U, 4U) == 0);
+    CHECK(card_matches(xfer_buf, 10U, 4U));
+    CHECK(mock_sd.polled_reads == 1U && mock_sd.dma_reads == 0U);
+    CHECK(mock_sd.mutex_gets == 0U);
+}
+
+static void test_dma_roundtrip(void)
+{
+    begin("IDMA read and write, lock held throughout");
+    memset(xfer_buf, 0xA5, 8U * MOCK_SECTOR_SIZE);
+    CHECK(SD_Write(xfer_buf, 100U, 8U, SD_SOURCE_FATFS) == 0);
+    CHECK(card_matches(xfer_buf, 100U, 8U));
+    memset(xfer_buf, 0, 8U * MOCK_SECTOR_SIZE);
+    CHECK(SD_Read(xfer_buf, 100U, 8U) == 0);
+    CHECK(card_matches(xfer_buf, 100U, 8U));
+    CHECK(mock_sd.dma_writes == 1U && mock_sd.dma_reads == 1U);
+    CHECK(mock_sd.polled_reads == 0U && mock_sd.polled_writes == 0U);
+    CHECK(mock_sd.sem_wait == SD_TIMEOUT_TICKS);
+    CHECK(mock_sd.mutex_gets == 2U && mock_sd.mutex_wait == SD_LOCK_TIMEOUT_TICKS);
+    CHECK(mock_sd.mutex_depth == 0);
+    CHECK(mock_sd.unlocked_transfers == 0U);
+    CHECK(mock_sd.irq_disabled == 0);
+}
+
+static void test_polled_fallback(void)
+{
+    begin("Polled fallback: unaligned buffer, no thread");
+    CHECK(SD_Read(xfer_buf + 1, 20U, 2U) == 0);
+    CHECK(card_matches(xfer_buf + 1, 20U, 2U));
+    CHECK(mock_sd.polled_reads == 1U && mock_sd.dma_reads == 0U);
+    CHECK(mock_sd.unlocked_transfers == 0U);
+
+    mock_sd.in_thread = 0;
+    CHECK(SD_Write(xfer_buf, 30U, 1U, SD_SOURCE_FATFS) == 0);
+    CHECK(mock_sd.polled_writes == 1U && mock_sd.dma_writes == 0U);
+    CHECK(mock_sd.mutex_gets == 1U);    /* Only the threaded read locked */
+    CHECK(mock_sd.sleeps == 0U);
+
+    mock_sd.in_thread = 1;
+    mock_sd.polled_fail = 1;
+    CHECK(SD_Read(xfer_buf + 1, 20U, 2U) == -1);
+    CHECK(mock_sd.mutex_depth == 0);
+}
+
+static void test_dma_errors(void)
+{
+    begin("IDMA error interrupt and refused start");
+    mock_sd.dma_mode = MOCK_DMA_ERROR;
+    CHECK(SD_Read(xfer_buf, 40U, 1U) == -1);
+    CHECK(mock_sd.aborts == 0U);
+
+    mock_sd.dma_mode = MOCK_DMA_START_FAIL;
+    mock_sd.sem_wait = 0U;
+    CHECK(SD_Write(xfer_buf, 40U, 1U, SD_SOURCE_MSC) == -1);
+    CHECK(mock_sd.sem_wait == 0U);      /* Never waited */
+
+    mock_sd.dma_mode = MOCK_DMA_COMPLETE;
+    CHECK(SD_Read(xfer_buf, 41U, 2U) == 0);
+    CHECK(card_matches(xfer_buf, 41U, 2U));
+    CHECK(mock_sd.mutex_depth == 0);
+}
+
+static void test_dma_timeout(void)
+{
+    begin("IDMA timeout, abort, then a late interrupt");
+    uint64_t start = mock_now_us();
+    mock_sd.dma_mode = MOCK_DMA_NO_IRQ;
+    CHECK(SD_Read(xfer_buf, 50U, 1U) == -1);
+    CHECK(mock_sd.aborts == 1U);
+    CHECK(mock_now_us() - start >= SD_TIMEOUT_TICKS * 1000U);
+    CHECK(mock_sd.mutex_depth == 0);
+
+    /* The interrupt for the abandoned transfer arrives after all; it must
+     * not complete the next one early */
+    mock_late_completion();
+    mock_sd.dma_mode = MOCK_DMA_NO_IRQ;
+    CHECK(SD_Read(xfer_buf, 51U, 1U) == -1);
+    CHECK(mock_sd.aborts == 2U);
+
+    mock_sd.dma_mode = MOCK_DMA_COMPLETE;
+    CHECK(SD_Read(xfer_buf, 52U, 3U) == 0);
+    CHECK(card_matches(xfer_buf, 52U, 3U));
+}
+
+static void test_stale_completion(void)
+{
+    begin("Leftover completion token is drained before a transfer");
+    mock_stale_completion();
+    mock_stale_completion();
+    mock_sd.dma_mode = MOCK_DMA_NO_IRQ;
+    CHECK(SD_Read(xfer_buf, 60U, 1U) == -1);
+    CHECK(mock_sd.aborts == 1U);        /* Waited for its own interrupt */
+
+    mock_stale_completion();
+    mock_sd.dma_mode = MOCK_DMA_COMPLETE;
+    CHECK(SD_Read(xfer_buf, 61U, 1U) == 0);
+    CHECK(card_matches(xfer_buf, 61U, 1U));
+}
+
+static void test_busy_wait(void)
+{
+    begin("Card busy: spin, then sleep a tick at a time, then time out");
+    mock_card_busy(5000U);
+    CHECK(SD_Read(xfer_buf, 70U, 1U) == 0);
+    CHECK(mock_sd.sleeps >= 3U && mock_sd.sleeps <= 6U);
+
+    mock_reset();
+    mock_sd.write_busy_us = 3000U;      /* Programming after the write */
+    CHECK(SD_Write(xfer_buf, 71U, 1U, SD_SOURCE_MSC) == 0);
+    CHECK(mock_sd.sleeps >= 1U);
+
+    mock_reset();
+    uint64_t start = mock_now_us();
+    mock_card_busy(2000000U);
+    CHECK(SD_Read(xfer_buf, 72U, 1U) == -1);
+    CHECK(mock_sd.dma_reads == 0U);     /* Never started */
+    CHECK(mock_now_us() - start > 1000000U && mock_now_us() - start < 1100000U);
+    CHECK(mock_sd.mutex_depth == 0);
+    mock_card_busy(0U);
+}
+
+static void test_lock_timeout(void)
+{
+    begin("Controller lock not available");
+    SD_DirtyMap_t map;
+    SD_DirtyMap_Take(&map);
+
+    mock_sd.mutex_busy = 1;
+    CHECK(SD_Read(xfer_buf, 80U, 1U) == -1);
+    CHECK(mock_sd.mutex_wait == SD_LOCK_TIMEOUT_TICKS);
+    CHECK(SD_Write(xfer_buf, 80U, 1U, SD_SOURCE_MSC) == -1);
+    CHECK(mock_sd.dma_reads + mock_sd.dma_writes + mock_sd.polled_reads + mock_sd.polled_writes == 0U);
+    CHECK(mock_sd.mutex_depth == 0);
+
+    SD_DirtyMap_Take(&map);
+    CHECK(map.count == 0U);             /* Nothing reached the card */
+}
+
+static void test_not_initialized(void)
+{
+    begin("Card not initialized");
+    mock_sd.initialized = 0;
+    CHECK(SD_Read(xfer_buf, 0U, 1U) == -1);
+    CHECK(SD_Write(xfer_buf, 0U, 1U, SD_SOURCE_FATFS) == -1);
+    CHECK(SD_Read(NULL, 0U, 1U) == -1);
+    CHECK(SD_Read(xfer_buf, 0U, 0U) == -1);
+    CHECK(mock_sd.mutex_gets == 0U);
+    CHECK(SD_GetSectorCount() == 0U && SD_GetSectorSize() == 512U);
+}
+
+/* Dirty map ----------------------------------------------------------------*/
+
+static void write_range(uint32_t first, uint32_t count, SD_Source_t source)
+{
+    CHECK(SD_Write(xfer_buf, first, count, source) == 0);
+}
+
+static int map_is(const SD_DirtyMap_t *map, const uint32_t *expect, uint32_t pairs)
+{
+    if (map->count != pairs)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0U; i < pairs; i++)
+    {
+        if (map->ranges[i].first != expect[2U * i] || map->ranges[i].last != expect[2U * i + 1U])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_dirty_merge(void)
+{
+    begin("Dirty map: insert, touch, overlap and bridge");
+    SD_DirtyMap_t map;
+    SD_DirtyMap_Take(&map);
+
+    write_range(100U, 10U, SD_SOURCE_FATFS);    /* 100-109 */
+    write_range(50U, 5U, SD_SOURCE_FATFS);      /* before: 50-54 */
+    write_range(200U, 1U, SD_SOURCE_MSC);       /* after: 200 */
+    write_range(110U, 5U, SD_SOURCE_MSC);       /* touches the end: 100-114 */
+    write_range(45U, 5U, SD_SOURCE_FATFS);      /* touches the start: 45-54 */
+    write_range(0U, 1U, SD_SOURCE_FATFS);       /* sector 0 */
+    SD_DirtyMap_Take(&map);
+    {
+        static const uint32_t expect[] = { 0, 0, 45, 54, 100, 114, 200, 200 };
+        CHECK(map_is(&map, expect, 4U));
+    }
+    CHECK(map.msc_sectors == 6U && map.fatfs_sectors == 21U);
+
+    /* One write absorbing several ranges, overlapping both ends */
+    write_range(10U, 2U, SD_SOURCE_FATFS);
+    write_range(13U, 2U, SD_SOURCE_FATFS);
+    write_range(16U, 2U, SD_SOURCE_FATFS);
+    write_range(30U, 1U, SD_SOURCE_FATFS);
+    write_range(11U, 6U, SD_SOURCE_FATFS);      /* 11-16 */
+    SD_DirtyMap_Take(&map);
+    {
+        static const uint32_t expect[] = { 10, 17, 30, 30 };
+        CHECK(map_is(&map, expect, 2U));
+    }
+
+    /* Gap of one sector stays split; filling it joins */
+    write_range(300U, 1U, SD_SOURCE_FATFS);
+    write_range(302U, 1U, SD_SOURCE_FATFS);
+    SD_DirtyMap_Take(&map);
+    CHECK(map.count == 2U);
+    CHECK(SD_DirtyMap_Overlaps(&map, 301U, 301U) == 0);
+    CHECK(SD_DirtyMap_Overlaps(&map, 301U, 302U) == 1);
+    CHECK(SD_DirtyMap_Overlaps(&map, 0U, 299U) == 0);
+    CHECK(SD_DirtyMap_Overlaps(&map, 303U, 4000U) == 0);
+    write_range(300U, 1U, SD_SOURCE_FATFS);
+    write_range(302U, 1U, SD_SOURCE_FATFS);
+    write_range(301U, 1U, SD_SOURCE_FATFS);
+    SD_DirtyMap_Take(&map);
+    {
+        static const uint32_t expect[] = { 300, 302 };
+        CHECK(map_is(&map, expect, 1U));
+    }
+}
+
+static void test_dirty_overflow(void)
+{
+    begin("Dirty map: full map merges the closest pair");
+    SD_DirtyMap_t map;
+    SD_DirtyMap_Take(&map);
+
+    /* 33 single sectors 10 apart, except one pair only 3 apart */
+    for (uint32_t i = 0U; i <= SD_DIRTY_MAX_RANGES; i++)
+    {
+        uint32_t sector = (i == 6U) ? 53U : i * 10U;
+        write_range(sector, 1U, SD_SOURCE_FATFS);
+    }
+    SD_DirtyMap_Take(&map);
+    CHECK(map.count == SD_DIRTY_MAX_RANGES);
+    CHECK(map.ranges[5].first == 50U && map.ranges[5].last == 53U);
+    CHECK(map.ranges[0].first == 0U && map.ranges[SD_DIRTY_MAX_RANGES - 1U].last == SD_DIRTY_MAX_RANGES * 10U);
+}
+
+static void test_dirty_failed_write(void)
+{
+    begin("Dirty map: a failed write is still recorded");
+    SD_DirtyMap_t map;
+    SD_DirtyMap_Take(&map);
+    SD_ClearWriteSource();
+
+    mock_sd.dma_mode = MOCK_DMA_ERROR;
+    CHECK(SD_Write(xfer_buf, 500U, 4U, SD_SOURCE_MSC) == -1);
+    CHECK(SD_GetLastWriteSource() == SD_SOURCE_NONE);
+    SD_DirtyMap_Take(&map);
+    {
+        static const uint32_t expect[] = { 500, 503 };
+        CHECK(map_is(&map, expect, 1U));
+    }
+    CHECK(map.msc_sectors == 4U);
+
+    mock_sd.dma_mode = MOCK_DMA_COMPLETE;
+    CHECK(SD_Write(xfer_buf, 500U, 4U, SD_SOURCE_MSC) == 0);
+    CHECK(SD_GetLastWriteSource() == SD_SOURCE_MSC);
+    SD_DirtyMap_Take(&map);
+}
+
+/* Random writes against a sector bitmap: ranges stay sorted, separated by
+ * at least one clean sector, within the limit, and cover every written
+ * sector; while no merge was forced they are exact */
+static void test_dirty_random(void)
+{
+    begin("Dirty map: random writes against a reference bitmap");
+    enum { SPAN = 3000 };
+    static uint8_t written[SPAN];
+    SD_DirtyMap_t map;
+    SD_DirtyMap_Take(&map);
+    srand(1234);
+
+    for (int round = 0; round < 300; round++)
+    {
+        int writes = 1 + rand() % 60;
+        int bad = 0;
+        memset(written, 0, sizeof(written));
+        for (int w = 0; w < writes; w++)
+        {
+            uint32_t count = 1U + (uint32_t)(rand() % 16);
+            uint32_t first = (uint32_t)(rand() % (SPAN - 16));
+            write_range(first, count, SD_SOURCE_FATFS);
+            memset(&written[first], 1, count);
+        }
+        SD_DirtyMap_Take(&map);
+
+        uint32_t runs = 0U;
+        for (int s = 0; s < SPAN; s++)
+        {
+            if (written[s] && (s == 0 || !written[s - 1]))
+            {
+                runs++;
+            }
+        }
+        for (int s = 0; s < SPAN; s++)
+        {
+            int dirty = SD_DirtyMap_Overlaps(&map, (uint32_t)s, (uint32_t)s);
+            if (written[s] && !dirty)
+            {
+                bad = 1;
+            }
+            if (runs <= SD_DIRTY_MAX_RANGES && !written[s] && dirty)
+            {
+                bad = 1;    /* Only an overflow merge may cover clean sectors */
+            }
+        }
+        if (map.count > SD_DIRTY_MAX_RANGES || (runs <= SD_DIRTY_MAX_RANGES && map.count != runs))
+        {
+            bad = 1;
+        }
+        for (uint32_t i = 0U; i < map.count; i++)
+        {
+            if (map.ranges[i].first > map.ranges[i].last ||
+                (i > 0U && map.ranges[i].first <= map.ranges[i - 1U].last + 1U))
+            {
+                bad = 1;
+            }
+        }
+        if (bad)
+        {
+            printf("  FAILED round %d: %d writes, %u runs, %u ranges\n", round, writes, runs, map.count);
+            failures++;
+            break;
+        }
+    }
+}
+
+/* Mode -----------------------------------------------------------------------*/
+
+static void test_mode_switch(void)
+{
+    begin("Mode switch invalidates every cache");
+    SD_SetMode(SD_MODE_MSC);
+    CHECK(SD_IsMscAllowed() == 1);
+    SD_SetMode(SD_MODE_FATFS);
+    CHECK(SD_IsMscAllowed() == 0);
+    CHECK(mock_sd.msc_invalidates == 2U && mock_sd.disk_cache_invalidates == 2U);
+    CHECK(exfat_invalidates == 2U);
+}
+
+int main(void)
+{
+    fill_card();
+
+    test_polled_before_init();
+    SD_Init();
+    test_dma_roundtrip();
+    test_polled_fallback();
+    test_dma_errors();
+    test_dma_timeout();
+    test_stale_completion();
+    test_busy_wait();
+    test_lock_timeout();
+    test_not_initialized();
+    test_dirty_merge();
+    test_dirty_overflow();
+    test_dirty_failed_write();
+    test_dirty_random();
+    test_mode_switch();
+
+    printf("\nResult: %s (%d failed check%s)\n", failures ? "FAILED" : "SUCCESS", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -427,7 +427,9 @@ extern   "C" {
 
 /* Define buffer length for IN/OUT pipes.  This should match the size of the endpoint maximum buffer size. */
 
+#ifndef UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE
 #define UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE                              UX_SLAVE_REQUEST_DATA_MAX_LENGTH
+#endif
 
 
 /* Define MMC2 CD-ROM / DVD-ROM bit fields */
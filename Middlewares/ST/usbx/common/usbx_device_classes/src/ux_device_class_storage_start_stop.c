@@ -79,8 +79,8 @@ UINT  _ux_device_class_storage_start_stop(UX_SLAVE_CLASS_STORAGE *storage, ULONG
                                             UX_SLAVE_ENDPOINT *endpoint_out, UCHAR * cbwcb)
 {
 UCHAR   start_stop_flags;
+ULONG   media_status;
 
-    UX_PARAMETER_NOT_USED(lun);
     UX_PARAMETER_NOT_USED(endpoint_in);
     UX_PARAMETER_NOT_USED(endpoint_out);
 
@@ -96,11 +96,19 @@ UCHAR   start_stop_flags;
     /* Check for eject request: LoEj=1 and Start=0 means "eject media" */
     if ((start_stop_flags & 0x02) && !(start_stop_flags & 0x01))
     {
-        /* Host requested media eject - notify application via weak callback */
-        extern void USBD_STORAGE_EjectNotify(void) __attribute__((weak));
+        /* Host requested media eject - notify application via weak callback.
+         * The callback flushes cached writes; a failure fails the command
+         * with the sense data it returns, so the host sees the lost data */
+        extern UINT USBD_STORAGE_EjectNotify(ULONG *media_status) __attribute__((weak));
         if (USBD_STORAGE_EjectNotify)
         {
-            USBD_STORAGE_EjectNotify();
+            media_status = 0;
+            if (USBD_STORAGE_EjectNotify(&media_status) != UX_SUCCESS)
+            {
+                storage -> ux_slave_class_storage_lun[lun].ux_slave_class_storage_request_sense_status = media_status;
+                storage -> ux_slave_class_storage_csw_status = UX_SLAVE_CLASS_STORAGE_CSW_FAILED;
+                return(UX_ERROR);
+            }
         }
     }
 
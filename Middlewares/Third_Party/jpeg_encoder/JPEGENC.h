@@ -45,7 +45,16 @@
 #endif
 
 /* Defines and variables */
+// Output staging buffer for file I/O; the core calls pfnWrite whenever less
+// than JPEGE_FILE_BUF_MARGIN bytes (room for one worst-case MCU) are left.
+// Override from the build to hand the writer fewer, larger chunks.
+#ifndef JPEGE_FILE_BUF_SIZE
 #define JPEGE_FILE_BUF_SIZE 2048
+#endif
+#define JPEGE_FILE_BUF_MARGIN 1536
+#if JPEGE_FILE_BUF_SIZE < 2048
+#error "JPEGE_FILE_BUF_SIZE must hold the JPEG header plus one MCU (>= 2048)"
+#endif
 
 #ifndef DCTSIZE
 #define DCTSIZE 64
@@ -130,6 +139,20 @@ enum {
     JPEGE_Q_LOW
 };
 
+// Deadzone quantizer: AC coefficients are split into bands by zigzag index
+// (1-5, 6-14, 15-27, 28-63), each with its own rounding offset
+#define JPEGE_DEADZONE_BANDS 4
+
+// Optional quantizer statistics (coefficient-domain squared error, which
+// equals pixel-domain error for the orthonormal DCT)
+typedef struct jpege_qstats_tag
+{
+  double dSSE; // sum of squared reconstruction error
+  uint32_t u32Blocks; // 8x8 blocks quantized
+  uint32_t u32NonZero; // non-zero AC coefficients written
+  uint32_t u32Isolated; // isolated +/-1 AC coefficients dropped
+} JPEGE_QSTATS;
+
 typedef struct jpege_file_tag
 {
   int32_t iPos; // current file position
@@ -167,6 +190,10 @@ typedef struct jpege_image_tag
     PIL_CODE pc;
     int *huffdc[2];
     signed short sQuantTable[DCTSIZE*4];
+    signed short sQuantBias[DCTSIZE*2]; // rounding offset per coefficient (Q/2 = round to nearest)
+    unsigned short usQuantTrue[DCTSIZE*2]; // unscaled quantizer values (for statistics)
+    uint8_t ucIsolatedStart; // zigzag index from which isolated +/-1 AC terms are dropped (64 = off)
+    JPEGE_QSTATS *pQStats; // optional, collected in JPEGQuantize when non-NULL
     signed char MCUc[6*DCTSIZE]; // captured image data
     signed short MCUs[DCTSIZE]; // final processed output
     JPEGE_READ_CALLBACK *pfnRead;
@@ -210,6 +237,8 @@ int JPEGOpenFile(JPEGE_IMAGE *pJPEG, const char *szFilename);
 int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHeight, uint8_t ucPixelType, uint8_t ucSubSample, uint8_t ucQFactor);
 int JPEGEncodeEnd(JPEGE_IMAGE *pJPEG);
 int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch);
+int JPEGAddMCU420P(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, const uint8_t *pY, int iYPitch, const uint8_t *pCb, const uint8_t *pCr, int iCPitch);
+int JPEGSetDeadzone(JPEGE_IMAGE *pJPEG, const uint8_t *pLumBias, const uint8_t *pChromaBias, int iIsolatedStart);
 int JPEGGetLastError(JPEGE_IMAGE *pJPEG);
 #endif // __cplusplus
 
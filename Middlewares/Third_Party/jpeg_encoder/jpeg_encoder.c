@@ -2,6 +2,7 @@
 #include "jpeg_encoder_timing.h"
 #include "JPEGENC.h"
 #include "jpegenc.inl"
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -31,25 +32,22 @@ jpeg_timing_t g_jpeg_timing;
  *   P5: Caller loop invariant hoisting + 32-bit chroma copy
  *
  * ───────────────────────────────────────────────────────────────────────
- * P2: DMA DOUBLE-BUFFER ARCHITECTURE (NOT IMPLEMENTED - needs HW test)
+ * P2: DMA DOUBLE-BUFFER ARCHITECTURE (IMPLEMENTED - async stream input)
  * ───────────────────────────────────────────────────────────────────────
- * Current bottleneck: SD read blocks CPU via polled HAL_SD_ReadBlocks().
- * Opportunity: Overlap SD→SRAM DMA transfer with CPU strip processing.
+ * Bottleneck was: strip read and strip processing ran back to back.
+ * Now: overlap the SD→SRAM transfer with CPU strip processing.
  *
  * Architecture:
  *   Buffer A ──DMA──▶ SRAM    CPU processes Buffer B
  *   Buffer B ──DMA──▶ SRAM    CPU processes Buffer A  (ping-pong)
  *
- * Required changes:
- *   1. sd_adapter.c: Add SD_Read_DMA() using HAL_SD_ReadBlocks_DMA()
- *      - Configure GPDMA channel for SDMMC1 RX
- *      - Register HAL_SD_RxCpltCallback() to signal ThreadX event flag
- *   2. jpeg_encoder.c: Allocate 2x raw_file_chunk buffers
- *      - Before processing loop, kick first DMA read
- *      - In loop: wait_for_dma() → swap buffers → kick next read → process
- *   3. sdmmc.c: Enable SDMMC DMA in MX_SDMMC1_SD_Init()
- *      - hsd1.Init.TranceiverPresent = ... (check CubeMX config)
- *   4. Memory: +20KB (second raw_file_chunk for 8-row strip @ 1280px)
+ * Pieces:
+ *   1. sd_adapter.c: IDMA transfers, caller sleeps on a semaphore put
+ *      from HAL_SD_RxCpltCallback()
+ *   2. jpeg_encoder.c: second raw strip; when the stream provides
+ *      read_submit/read_wait: wait strip N → submit N+1 → process N
+ *   3. jpeg_processor.c: reader thread runs the submitted f_read
+ *   4. Memory: one more raw strip (+20KB for 8-row strip @ 1280px)
  *
  * Estimated speedup: 15-30% if SD read time ≈ processing time.
  * Risk: DCACHE coherency (need SCB_InvalidateDCache_by_Addr after DMA).
@@ -157,6 +155,8 @@ static int s_y_lut_ready = 0;
 typedef struct {
     uint8_t* raw_file_chunk;
     size_t raw_size;
+    uint8_t* raw_file_chunk2; // second strip for async (double-buffered) input
+    size_t raw2_size;
     uint16_t* unpacked_strip;
     size_t unpack_size;
     uint8_t* out_strip;
@@ -303,23 +303,75 @@ static int calculate_file_stride(int width, jpeg_pixel_format_t format) {
     }
 }
 
+// Fast 4:2:0 writes planar Y/Cb/Cr with chroma already subsampled 2x2
+static int uses_planar_420(const jpeg_encoder_config_t* config) {
+    bool use_fast = config->enable_fast_mode;
+#if defined(FASTMODE)
+    use_fast = true;
+#endif
+    return use_fast && !config->grayscale && !config->mono_sensor &&
+           config->subsample == JPEG_SUBSAMPLE_420;
+}
+
+// Output strip size: one MCU row of Y (+ chroma) in the layout the
+// demosaic stage writes
+static size_t out_strip_size(const jpeg_encoder_config_t* config, int mcu_h) {
+    const int width = config->width;
+    if (uses_planar_420(config)) {
+        size_t y_pitch = ((size_t)width + 15) & ~(size_t)15;
+        return y_pitch * 16 + (y_pitch / 2) * 8 * 2; // Y + Cb + Cr planes
+    }
+    const int luma_only = config->grayscale || config->mono_sensor;
+    int out_bpp = luma_only ? 1 : ((config->subsample == JPEG_SUBSAMPLE_444) ? 3 : 2); // Y, YUV444 or YUV422
+    return (size_t)width * out_bpp * mcu_h;
+}
+
 size_t jpeg_encoder_estimate_memory_requirement(const jpeg_encoder_config_t* config) {
     if (!config) return 0;
     int width = config->width;
     int file_stride = calculate_file_stride(width, config->pixel_format);
 
-    int mcu_h = (config->subsample == JPEG_SUBSAMPLE_420) ? 16 : 8;
+    const int luma_only = config->grayscale || config->mono_sensor;
+    int mcu_h = (!luma_only && config->subsample == JPEG_SUBSAMPLE_420) ? 16 : 8;
     int strip_lines = mcu_h + 2;
-    int out_bpp = (config->subsample == JPEG_SUBSAMPLE_444) ? 3 : 2; // RGB888 or YUV422
 
     size_t sz_raw = file_stride * strip_lines;
     size_t sz_unpack = width * sizeof(uint16_t) * strip_lines;
-    size_t sz_out = width * out_bpp * mcu_h;
+    size_t sz_out = out_strip_size(config, mcu_h);
     size_t sz_misc = (width * sizeof(uint16_t)) * 2; // carry_over + lookahead
 
     return sz_raw + sz_unpack + sz_out + sz_misc;
 }
 
+size_t jpeg_encoder_estimate_output_size(const jpeg_encoder_config_t* config) {
+    if (!config) return 0;
+    const int luma_only = config->grayscale || config->mono_sensor;
+    size_t w = ((size_t)config->width + 15) & ~(size_t)15;
+    size_t h = ((size_t)config->height + 15) & ~(size_t)15;
+
+    // Coded samples per 4 pixels
+    size_t samples4 = 12; // 4:4:4
+    if (luma_only) samples4 = 4;
+    else if (config->subsample == JPEG_SUBSAMPLE_420) samples4 = 6;
+    else if (config->subsample == JPEG_SUBSAMPLE_422) samples4 = 8;
+
+    // Worst-case bytes per coded sample in 1/16ths, by the same bands as the quantizer tables
+    int quality = (config->quality > 0) ? config->quality : 85;
+    size_t per16 = (quality >= 90) ? 6 : ((quality >= 75) ? 4 : ((quality >= 50) ? 3 : 2));
+
+    // Headers/tables plus a restart marker per MCU row
+    return 1024 + h / 4 + (w * h * samples4 * per16) / 64;
+}
+
+// Raw rows the strip loop reads for MCU row mcu_y: its rows plus one lookahead
+// row, minus the first row which the previous strip already read as lookahead
+static int strip_lines_to_read(int mcu_y, int mcu_h, int height) {
+    int y_start = mcu_y * mcu_h;
+    int rows = (y_start + mcu_h <= height) ? mcu_h : (height - y_start);
+    int lines = rows + ((y_start + rows < height) ? 1 : 0);
+    return (mcu_y > 0) ? lines - 1 : lines;
+}
+
 // Unpack one row of raw data into 16-bit buffer (keeping native range)
 static void unpack_row(const uint8_t* src, uint16_t* dst, int width, jpeg_pixel_format_t format) {
     if (format == JPEG_PIXEL_FORMAT_UNPACKED16 || format == JPEG_PIXEL_FORMAT_BAYER12_GRGB) {
@@ -366,10 +418,12 @@ static void subtract_black(uint16_t* row, int width, uint16_t ob) {
     for (int i = 0; i < width; i++) row[i] = (row[i] > ob) ? (row[i] - ob) : 0;
 }
 
-static void subtract_black_fast(uint16_t* row, int width, uint16_t ob) {
-    if (ob == 0) return;
+/* Black level for one row: ob_even applies to even columns, ob_odd to odd
+ * columns, so a per-CFA-channel level costs the same as a scalar one. */
+static void subtract_black_fast(uint16_t* row, int width, uint16_t ob_even, uint16_t ob_odd) {
+    if ((ob_even | ob_odd) == 0) return;
 #if JPEG_ENC_HAS_DSP
-    uint32_t ob2 = ((uint32_t)ob << 16) | ob;
+    uint32_t ob2 = ((uint32_t)ob_odd << 16) | ob_even;
     int i = 0;
     for (; i + 1 < width; i += 2) {
         uint32_t v = *(uint32_t *)&row[i];
@@ -377,13 +431,298 @@ static void subtract_black_fast(uint16_t* row, int width, uint16_t ob) {
         *(uint32_t *)&row[i] = r;
     }
     if (i < width) {
-        row[i] = (row[i] > ob) ? (row[i] - ob) : 0;
+        row[i] = (row[i] > ob_even) ? (row[i] - ob_even) : 0;
     }
 #else
-    for (int i = 0; i < width; i++) row[i] = (row[i] > ob) ? (row[i] - ob) : 0;
+    int i = 0;
+    for (; i + 1 < width; i += 2) {
+        row[i]     = (row[i] > ob_even)    ? (row[i] - ob_even)    : 0;
+        row[i + 1] = (row[i + 1] > ob_odd) ? (row[i + 1] - ob_odd) : 0;
+    }
+    if (i < width) {
+        row[i] = (row[i] > ob_even) ? (row[i] - ob_even) : 0;
+    }
 #endif
 }
 
+static inline void subtract_black_cfa(uint16_t* row, int width, int y, const uint16_t ob_cfa[4]) {
+    const int c0 = (y & 1) * 2;
+    subtract_black_fast(row, width, ob_cfa[c0], ob_cfa[c0 + 1]);
+}
+
+/* Replace a defective sample with the median of its same-colour neighbours
+ * in the row, which are already in cache: x-2*pitch, x-pitch, x+pitch,
+ * x+2*pitch, where pitch is 2 on a Bayer row and 1 on a mono sensor. */
+static uint16_t defect_median(const uint16_t* row, int width, int x, int pitch) {
+    uint16_t v[4];
+    int n = 0;
+    static const int8_t offs[4] = { -2, -1, 1, 2 };
+    for (int k = 0; k < 4; k++) {
+        int xn = x + offs[k] * pitch;
+        if (xn < 0 || xn >= width) continue;
+        uint16_t s = row[xn];
+        int j = n++;
+        while (j > 0 && v[j - 1] > s) { v[j] = v[j - 1]; j--; }
+        v[j] = s;
+    }
+    if (n == 0) return row[x];
+    if (n & 1) return v[n >> 1];
+    return (uint16_t)(((uint32_t)v[(n >> 1) - 1] + v[n >> 1] + 1) >> 1);
+}
+
+/* Correct the defects listed for row y. The list is sorted and rows are
+ * visited in increasing order, so a cursor replaces any search and an empty
+ * list costs one compare per row. Returns the advanced cursor. */
+static size_t correct_defects_row(uint16_t* row, int width, int y, int pitch,
+                                  const jpeg_defect_pixel_t* defects, size_t count, size_t cur) {
+    while (cur < count && defects[cur].row < y) cur++;
+    while (cur < count && defects[cur].row == y) {
+        int x = defects[cur].col;
+        if (x < width) row[x] = defect_median(row, width, x, pitch);
+        cur++;
+    }
+    return cur;
+}
+
+/*
+ * Lens shading correction.
+ * A low-res Q12 gain grid per CFA channel is interpolated vertically once per
+ * row (one node row per channel), then linearly along the row with a Q20
+ * accumulator per column parity: one add per pixel, one divide per segment.
+ */
+typedef struct {
+    const uint16_t* grid;
+    int gw;
+    int gh;
+    int width;
+    int height;
+    uint16_t xs[JPEG_LSC_MAX_GRID_DIM];  /* Pixel column of each grid node */
+} lsc_ctx_t;
+
+static void lsc_init(lsc_ctx_t* lsc, const jpeg_encoder_config_t* config)
+{
+    lsc->grid = config->lsc_grid;
+    lsc->gw = config->lsc_grid_w;
+    lsc->gh = config->lsc_grid_h;
+    lsc->width = config->width;
+    lsc->height = config->height;
+    for (int i = 0; i < lsc->gw; i++) {
+        lsc->xs[i] = (uint16_t)((i * (lsc->width - 1)) / (lsc->gw - 1));
+    }
+}
+
+static void lsc_apply_row(const lsc_ctx_t* lsc, uint16_t* row, int y)
+{
+    const int gw = lsc->gw;
+    const int c0 = (y & 1) * 2;
+    int32_t node[2][JPEG_LSC_MAX_GRID_DIM];
+
+    /* Vertical interpolation: grid row j..j+1, weight fy in Q12 */
+    int gy = y * (lsc->gh - 1);
+    int j = gy / (lsc->height - 1);
+    int fy = ((gy - j * (lsc->height - 1)) << 12) / (lsc->height - 1);
+    if (j >= lsc->gh - 1) { j = lsc->gh - 2; fy = 4096; }
+    for (int p = 0; p < 2; p++) {
+        const uint16_t* g0 = lsc->grid + ((size_t)(c0 + p) * lsc->gh + j) * gw;
+        const uint16_t* g1 = g0 + gw;
+        for (int i = 0; i < gw; i++) {
+            node[p][i] = (int32_t)g0[i] + ((((int32_t)g1[i] - (int32_t)g0[i]) * fy) >> 12);
+        }
+    }
+
+    /* Horizontal: incremental interpolation per segment */
+    for (int i = 0; i < gw - 1; i++) {
+        int x0 = lsc->xs[i];
+        int x1 = (i == gw - 2) ? lsc->width : lsc->xs[i + 1];
+        int len = lsc->xs[i + 1] - x0;
+        int32_t acc[2], step2[2];
+        for (int p = 0; p < 2; p++) {
+            int32_t step = ((node[p][i + 1] - node[p][i]) * 256) / len; /* may be negative: no shift */
+            int first = x0 + ((x0 ^ p) & 1);
+            acc[p] = (node[p][i] << 8) + step * (first - x0);
+            step2[p] = step * 2;
+        }
+        for (int x = x0; x < x1; x++) {
+            const int p = x & 1;
+            uint32_t v = ((uint32_t)row[x] * (uint32_t)(acc[p] >> 8)) >> 12;
+            row[x] = (uint16_t)((v > 65535u) ? 65535u : v);
+            acc[p] += step2[p];
+        }
+    }
+}
+
+/*
+ * Auto white balance statistics.
+ * Samples a sparse grid (one row pair and one column pair every `step`
+ * pixels) right after unpack + black level, so both CFA phases are covered
+ * without touching every pixel. Gains are derived per frame, either from a
+ * seek-based pre-scan of the same grid or carried over to the next frame.
+ */
+#define JPEG_AWB_MIN_SAMPLES  16
+#define JPEG_AWB_MIN_GAIN     0.25f
+#define JPEG_AWB_MAX_GAIN     8.0f
+
+static jpeg_awb_stats_t s_awb_stats;   /* Statistics of the last encoded frame */
+
+static inline int awb_row_sampled(int y, int step)
+{
+    return (y % step) < 2;
+}
+
+static void awb_sample_row(const uint16_t* row, int width, int y, int step, uint16_t clip, jpeg_awb_stats_t* st)
+{
+    const int c0 = (y & 1) * 2;
+    for (int x = 0; x + 1 < width; x += step) {
+        for (int i = 0; i < 2; i++) {
+            uint16_t v = row[x + i];
+            int c = c0 + i;
+            if (v >= clip) {
+                st->clipped[c]++;
+                continue;
+            }
+            st->sum[c] += v;
+            st->count[c]++;
+            if (v > st->max[c]) st->max[c] = v;
+        }
+    }
+}
+
+static float awb_clamp_gain(float g)
+{
+    if (g < JPEG_AWB_MIN_GAIN) return JPEG_AWB_MIN_GAIN;
+    if (g > JPEG_AWB_MAX_GAIN) return JPEG_AWB_MAX_GAIN;
+    return g;
+}
+
+/* Derive R/G/B gains from CFA statistics. Green keeps its calibrated gain;
+ * red and blue are scaled to match it. Leaves valid=false (and the fixed
+ * gains) when there are too few unclipped samples. */
+static void awb_compute_gains(jpeg_awb_stats_t* st, jpeg_awb_mode_t mode, jpeg_bayer_pattern_t pattern)
+{
+    const int p = ((int)pattern) & 3;
+    float level[3] = {0.0f, 0.0f, 0.0f};
+    int n[3] = {0, 0, 0};
+    int ok = 1;
+
+    st->r_gain = JPEG_DEMOSAIC_RED_GAIN;
+    st->g_gain = JPEG_DEMOSAIC_GREEN_GAIN;
+    st->b_gain = JPEG_DEMOSAIC_BLUE_GAIN;
+    st->valid = false;
+
+    for (int c = 0; c < 4; c++) {
+        int color = s_bayer_color_lut[p][c >> 1][c & 1];
+        if (st->count[c] < JPEG_AWB_MIN_SAMPLES) {
+            ok = 0;
+            break;
+        }
+        if (mode == JPEG_AWB_MODE_WHITE_PATCH) {
+            level[color] += (float)st->max[c];
+        } else {
+            level[color] += (float)st->sum[c] / (float)st->count[c];
+        }
+        n[color]++;
+    }
+    if (!ok || n[0] == 0 || n[1] == 0 || n[2] == 0) {
+        return;
+    }
+
+    float r = level[0] / (float)n[0];
+    float g = level[1] / (float)n[1];
+    float b = level[2] / (float)n[2];
+    if (r <= 0.0f || g <= 0.0f || b <= 0.0f) {
+        return;
+    }
+
+    st->r_gain = awb_clamp_gain(st->g_gain * g / r);
+    st->b_gain = awb_clamp_gain(st->g_gain * g / b);
+    st->valid = true;
+}
+
+/* Read only the sampled row pairs via seek, then rewind to data_offset.
+ * Returns 1 if statistics were gathered, 0 if the stream could not provide
+ * them (caller falls back), negative if the stream could not be rewound. */
+static int awb_prescan(jpeg_stream_t* stream, const jpeg_encoder_config_t* config, size_t data_offset,
+                       int file_stride, uint8_t* raw, uint16_t* rows, int step, uint16_t clip,
+                       const uint16_t ob_cfa[4], const lsc_ctx_t* lsc, jpeg_awb_stats_t* st)
+{
+    const int width = config->width;
+    const size_t pair_bytes = (size_t)file_stride * 2;
+    const int defect_pitch = config->mono_sensor ? 1 : 2;
+    size_t defect_cur = 0;
+    int ok = 1;
+
+    for (int y = 0; y + 1 < config->height; y += step) {
+        if (stream->seek(stream->read_ctx, data_offset + (size_t)y * file_stride) != 0 ||
+            stream->read(stream->read_ctx, raw, pair_bytes) != pair_bytes) {
+            ok = 0;
+            break;
+        }
+        for (int k = 0; k < 2; k++) {
+            uint16_t* row = rows + k * width;
+            unpack_row(raw + k * file_stride, row, width, config->pixel_format);
+            if (config->subtract_ob) {
+                subtract_black_cfa(row, width, y + k, ob_cfa);
+            }
+            if (config->defects && config->defect_count) {
+                defect_cur = correct_defects_row(row, width, y + k, defect_pitch, config->defects, config->defect_count, defect_cur);
+            }
+            if (lsc) {
+                lsc_apply_row(lsc, row, y + k);
+            }
+            awb_sample_row(row, width, y + k, step, clip, st);
+        }
+    }
+
+    if (stream->seek(stream->read_ctx, data_offset) != 0) {
+        return -1;
+    }
+    return ok;
+}
+
+int jpeg_encoder_get_awb_stats(jpeg_awb_stats_t* out_stats) {
+    if (!out_stats) return -(int)JPEG_ENCODER_ERR_INVALID_ARGUMENT;
+    *out_stats = s_awb_stats;
+    return 0;
+}
+
+void jpeg_encoder_reset_awb(void) {
+    memset(&s_awb_stats, 0, sizeof(s_awb_stats));
+}
+
+// --- Quantizer tuning ---
+
+static jpeg_quant_stats_t s_quant_stats; /* Statistics of the last encode */
+
+int jpeg_encoder_get_quant_stats(jpeg_quant_stats_t* out_stats) {
+    if (!out_stats) return -(int)JPEG_ENCODER_ERR_INVALID_ARGUMENT;
+    *out_stats = s_quant_stats;
+    return 0;
+}
+
+// Per-band deadzone biases with zero entries replaced by the defaults
+static void deadzone_biases(const uint8_t cfg[JPEG_DEADZONE_BANDS], const uint8_t defaults[JPEG_DEADZONE_BANDS],
+                            uint8_t out[JPEG_DEADZONE_BANDS])
+{
+    for (int i = 0; i < JPEG_DEADZONE_BANDS; i++) {
+        out[i] = cfg[i] ? cfg[i] : defaults[i];
+    }
+}
+
+static void quant_stats_finish(const JPEGE_QSTATS* q)
+{
+    memset(&s_quant_stats, 0, sizeof(s_quant_stats));
+    s_quant_stats.blocks = q->u32Blocks;
+    s_quant_stats.nonzero_ac = q->u32NonZero;
+    s_quant_stats.isolated_dropped = q->u32Isolated;
+    s_quant_stats.sse = q->dSSE;
+    if (q->u32Blocks > 0 && q->dSSE > 0.0) {
+        double mse = q->dSSE / ((double)q->u32Blocks * 64.0);
+        s_quant_stats.psnr_db = (float)(10.0 * log10((255.0 * 255.0) / mse));
+    } else {
+        s_quant_stats.psnr_db = 99.0f;
+    }
+}
+
 static inline int ob_adjust(uint16_t v, bool subtract_ob, uint16_t ob)
 {
     if (!subtract_ob) return (int)v;
@@ -1447,141 +1786,6 @@ static void demosaic_row_bilinear_to_yuv422_fast(
     }
 }
 
-// --- Demosaic to YUV422 luma only (fast path) ---
-// Writes Y for each pixel and leaves chroma untouched for caller to fill.
-__attribute__((hot))
-static void demosaic_row_bilinear_to_yuv422_luma_fast(
-    const uint16_t* restrict row_prev,
-    const uint16_t* restrict row_curr,
-    const uint16_t* restrict row_next,
-    uint8_t* restrict yuv_out,
-    int width,
-    int y,
-    jpeg_bayer_pattern_t pattern,
-    int r_gain_fix,
-    int b_gain_fix,
-    int shift_down,
-    bool subtract_ob,
-    uint16_t ob_value)
-{
-    int row_phase = y & 1;
-
-    for (int x = 0; x < width; x += 2)
-    {
-        int r0=0,g0=0,b0=0;
-        int r1=0,g1=0,b1=0;
-
-        for (int i = 0; i < 2; i++)
-        {
-            int xi = x + i;
-            int *r = (i == 0) ? &r0 : &r1;
-            int *g = (i == 0) ? &g0 : &g1;
-            int *b = (i == 0) ? &b0 : &b1;
-
-            if (xi >= width) {
-                *r = r0; *g = g0; *b = b0;
-                continue;
-            }
-
-            if (row_prev && row_next && xi > 0 && xi < width - 1) {
-                int val = ob_adjust(row_curr[xi], subtract_ob, ob_value);
-                int p = ((int)pattern) & 3;
-                int pixel_color = s_bayer_color_lut[p][row_phase][xi & 1];
-                int row_has_red = s_row_has_red_lut[p][row_phase];
-
-                int h_sum = ob_adjust(row_curr[xi-1], subtract_ob, ob_value) + ob_adjust(row_curr[xi+1], subtract_ob, ob_value);
-                int v_sum = ob_adjust(row_prev[xi], subtract_ob, ob_value) + ob_adjust(row_next[xi], subtract_ob, ob_value);
-
-                if (pixel_color == 1) {
-                    if (row_has_red) { *r = h_sum >> 1; *b = v_sum >> 1; }
-                    else             { *b = h_sum >> 1; *r = v_sum >> 1; }
-                    *g = val;
-                } else if (pixel_color == 0) {
-                    *r = val;
-                    *g = (h_sum + v_sum) >> 2;
-                    *b = (ob_adjust(row_prev[xi-1], subtract_ob, ob_value) + ob_adjust(row_prev[xi+1], subtract_ob, ob_value) +
-                          ob_adjust(row_next[xi-1], subtract_ob, ob_value) + ob_adjust(row_next[xi+1], subtract_ob, ob_value)) >> 2;
-                } else {
-                    *b = val;
-                    *g = (h_sum + v_sum) >> 2;
-                    *r = (ob_adjust(row_prev[xi-1], subtract_ob, ob_value) + ob_adjust(row_prev[xi+1], subtract_ob, ob_value) +
-                          ob_adjust(row_next[xi-1], subtract_ob, ob_value) + ob_adjust(row_next[xi+1], subtract_ob, ob_value)) >> 2;
-                }
-            } else {
-                int r_e=0,g_e=0,b_e=0;
-                int val = ob_adjust(row_curr[xi], subtract_ob, ob_value);
-                int p = ((int)pattern) & 3;
-                int pixel_color = s_bayer_color_lut[p][row_phase][xi & 1];
-                int row_has_red = s_row_has_red_lut[p][row_phase];
-
-                int h_sum = 0, h_cnt = 0;
-                int v_sum = 0, v_cnt = 0;
-                int d_sum = 0, d_cnt = 0;
-
-                if (xi > 0) { h_sum += ob_adjust(row_curr[xi-1], subtract_ob, ob_value); h_cnt++; }
-                if (xi < width-1) { h_sum += ob_adjust(row_curr[xi+1], subtract_ob, ob_value); h_cnt++; }
-                if (row_prev) { v_sum += ob_adjust(row_prev[xi], subtract_ob, ob_value); v_cnt++; }
-                if (row_next) { v_sum += ob_adjust(row_next[xi], subtract_ob, ob_value); v_cnt++; }
-                if (row_prev && xi > 0) { d_sum += ob_adjust(row_prev[xi-1], subtract_ob, ob_value); d_cnt++; }
-                if (row_prev && xi < width-1) { d_sum += ob_adjust(row_prev[xi+1], subtract_ob, ob_value); d_cnt++; }
-                if (row_next && xi > 0) { d_sum += ob_adjust(row_next[xi-1], subtract_ob, ob_value); d_cnt++; }
-                if (row_next && xi < width-1) { d_sum += ob_adjust(row_next[xi+1], subtract_ob, ob_value); d_cnt++; }
-
-                if (pixel_color == 1) {
-                    g_e = val;
-                    if (row_has_red) {
-                        if (h_cnt) r_e = h_sum / h_cnt;
-                        if (v_cnt) b_e = v_sum / v_cnt;
-                    } else {
-                        if (h_cnt) b_e = h_sum / h_cnt;
-                        if (v_cnt) r_e = v_sum / v_cnt;
-                    }
-                }
-                else if (pixel_color == 0) {
-                    r_e = val;
-                    if (h_cnt + v_cnt > 0) g_e = (h_sum + v_sum) / (h_cnt + v_cnt);
-                    if (d_cnt) b_e = d_sum / d_cnt;
-                }
-                else {
-                    b_e = val;
-                    if (h_cnt + v_cnt > 0) g_e = (h_sum + v_sum) / (h_cnt + v_cnt);
-                    if (d_cnt) r_e = d_sum / d_cnt;
-                }
-
-                *r = r_e; *g = g_e; *b = b_e;
-            }
-        }
-
-        int r0_i = (r0 * r_gain_fix) >> 8;
-        int b0_i = (b0 * b_gain_fix) >> 8;
-        int g0_i = (g0 * s_g_gain_fix) >> 8;
-        int r1_i = (r1 * r_gain_fix) >> 8;
-        int b1_i = (b1 * b_gain_fix) >> 8;
-        int g1_i = (g1 * s_g_gain_fix) >> 8;
-
-        r0_i >>= shift_down; g0_i >>= shift_down; b0_i >>= shift_down;
-        r1_i >>= shift_down; g1_i >>= shift_down; b1_i >>= shift_down;
-
-        if (r0_i > 255) r0_i = 255; if (g0_i > 255) g0_i = 255; if (b0_i > 255) b0_i = 255;
-        if (r1_i > 255) r1_i = 255; if (g1_i > 255) g1_i = 255; if (b1_i > 255) b1_i = 255;
-
-        int rg0 = JPEG_ENC_PACK16(r0_i, g0_i);
-        int rg1 = JPEG_ENC_PACK16(r1_i, g1_i);
-
-        int y0 = JPEG_ENC_SMLAD(rg0, JPEG_ENC_COEF_Y_RG, b0_i * JPEG_ENC_COEF_Y_B) >> 12;
-        int y1 = JPEG_ENC_SMLAD(rg1, JPEG_ENC_COEF_Y_RG, b1_i * JPEG_ENC_COEF_Y_B) >> 12;
-
-        if (y0 < 0) y0 = 0; else if (y0 > 255) y0 = 255;
-        if (y1 < 0) y1 = 0; else if (y1 > 255) y1 = 255;
-        y0 = s_y_lut[y0];
-        y1 = s_y_lut[y1];
-
-        int out_idx = x * 2;
-        yuv_out[out_idx + 0] = (uint8_t)y0;
-        yuv_out[out_idx + 2] = (uint8_t)y1;
-    }
-}
-
 // --- Demosaic directly to YUV444 (fast path) ---
 __attribute__((hot))
 static void demosaic_row_bilinear_to_yuv444_fast(
@@ -1731,6 +1935,183 @@ static void demosaic_row_bilinear_to_yuv444_fast(
     }
 }
 
+// --- Luma-only output ---
+
+// Monochrome sensor: samples are already luma, only gain + tone curve.
+__attribute__((hot))
+static void mono_row_to_y(
+    const uint16_t* restrict row_curr,
+    uint8_t* restrict y_out,
+    int width,
+    int g_gain_fix,
+    int shift_down)
+{
+    const int combined_shift = 8 + shift_down;
+    for (int x = 0; x < width; x++) {
+        int v = APPLY_GAIN_SHIFT(row_curr[x], g_gain_fix, combined_shift);
+        CLAMP_SAT(v);
+        y_out[x] = s_y_lut[v];
+    }
+}
+
+// Bilinear R/G/B at x with missing edge neighbours mirrored (x-1 <-> x+1,
+// prev <-> next), which keeps the CFA colour and removes per-pixel edge
+// branches. Returns gained, 8-bit saturated values.
+static inline void bilinear_rgb_mirrored(
+    const uint16_t* restrict row_prev,
+    const uint16_t* restrict row_curr,
+    const uint16_t* restrict row_next,
+    int x,
+    int width,
+    const uint8_t* color_lut_row,
+    int row_has_red,
+    int r_gain_fix,
+    int g_gain_fix,
+    int b_gain_fix,
+    int combined_shift,
+    int* out_r, int* out_g, int* out_b)
+{
+    const int xl = (x > 0) ? x - 1 : ((width > 1) ? 1 : 0);
+    const int xr = (x < width - 1) ? x + 1 : xl;
+    const int val = row_curr[x];
+    const int h_sum = row_curr[xl] + row_curr[xr];
+    const int v_sum = row_prev[x] + row_next[x];
+    int r, g, b;
+
+    const int pixel_color = color_lut_row[x & 1];
+    if (pixel_color == 1) {
+        g = val;
+        if (row_has_red) { r = h_sum >> 1; b = v_sum >> 1; }
+        else             { b = h_sum >> 1; r = v_sum >> 1; }
+    } else {
+        const int d = (row_prev[xl] + row_prev[xr] + row_next[xl] + row_next[xr]) >> 2;
+        g = (h_sum + v_sum) >> 2;
+        if (pixel_color == 0) { r = val; b = d; }
+        else                  { b = val; r = d; }
+    }
+
+    r = APPLY_GAIN_SHIFT(r, r_gain_fix, combined_shift);
+    g = APPLY_GAIN_SHIFT(g, g_gain_fix, combined_shift);
+    b = APPLY_GAIN_SHIFT(b, b_gain_fix, combined_shift);
+    CLAMP_SAT(r); CLAMP_SAT(g); CLAMP_SAT(b);
+    *out_r = r; *out_g = g; *out_b = b;
+}
+
+static inline uint8_t rgb_to_y(int r, int g, int b)
+{
+    int yy = JPEG_ENC_SMLAD(JPEG_ENC_PACK16(r, g), JPEG_ENC_COEF_Y_RG, b * JPEG_ENC_COEF_Y_B) >> 12;
+    CLAMP_SAT(yy);
+    return s_y_lut[yy];
+}
+
+// Bayer input, luma only: bilinear R/G/B per pixel feeding only the Y
+// equation, so no chroma is computed or stored.
+__attribute__((hot))
+static void demosaic_row_bilinear_to_luma_fast(
+    const uint16_t* restrict row_prev,
+    const uint16_t* restrict row_curr,
+    const uint16_t* restrict row_next,
+    uint8_t* restrict y_out,
+    int width,
+    int y,
+    jpeg_bayer_pattern_t pattern,
+    int r_gain_fix,
+    int b_gain_fix,
+    int shift_down)
+{
+    const int row_phase = y & 1;
+    const int p = ((int)pattern) & 3;
+    const int row_has_red = s_row_has_red_lut[p][row_phase];
+    const uint8_t *color_lut_row = s_bayer_color_lut[p][row_phase];
+    const int combined_shift = 8 + shift_down;
+    const int g_gain_fix = s_g_gain_fix;
+
+    if (!row_prev) row_prev = row_next ? row_next : row_curr;
+    if (!row_next) row_next = row_prev;
+
+    for (int x = 0; x < width; x++) {
+        int r, g, b;
+        bilinear_rgb_mirrored(row_prev, row_curr, row_next, x, width, color_lut_row, row_has_red,
+                              r_gain_fix, g_gain_fix, b_gain_fix, combined_shift, &r, &g, &b);
+        y_out[x] = rgb_to_y(r, g, b);
+    }
+}
+
+// --- True 4:2:0 output (fast path) ---
+// Demosaics a pair of Bayer rows (y even, y+1) and writes full-resolution Y
+// for both plus one Cb/Cr sample per 2x2 block, computed from the block's
+// averaged R/G/B. Chroma goes straight into half-width planes, so no
+// per-pixel chroma is produced or stored. row_pair_next may be NULL on an
+// odd last row, in which case row y is duplicated.
+__attribute__((hot))
+static void demosaic_rows_bilinear_to_yuv420_fast(
+    const uint16_t* restrict row_prev,
+    const uint16_t* restrict row0,
+    const uint16_t* restrict row1,
+    const uint16_t* restrict row_next,
+    uint8_t* restrict y_out0,
+    uint8_t* restrict y_out1,
+    uint8_t* restrict cb_out,
+    uint8_t* restrict cr_out,
+    int width,
+    int y,
+    jpeg_bayer_pattern_t pattern,
+    int r_gain_fix,
+    int b_gain_fix,
+    int shift_down)
+{
+    const int p = ((int)pattern) & 3;
+    const int phase0 = y & 1;
+    const int phase1 = phase0 ^ 1;
+    const int has_red0 = s_row_has_red_lut[p][phase0];
+    const int has_red1 = s_row_has_red_lut[p][phase1];
+    const uint8_t *lut0 = s_bayer_color_lut[p][phase0];
+    const uint8_t *lut1 = s_bayer_color_lut[p][phase1];
+    const int combined_shift = 8 + shift_down;
+    const int g_gain_fix = s_g_gain_fix;
+    const int have_row1 = (row1 != NULL);
+
+    // Neighbours of row0 are (row_prev, row1), of row1 are (row0, row_next);
+    // missing ones are mirrored.
+    const uint16_t* n0_below = have_row1 ? row1 : (row_prev ? row_prev : row0);
+    const uint16_t* n0_above = row_prev ? row_prev : n0_below;
+    const uint16_t* n1_below = row_next ? row_next : row0;
+
+    for (int x = 0; x < width; x += 2) {
+        const int x1 = (x + 1 < width) ? x + 1 : x;
+        int r00, g00, b00, r01, g01, b01;
+        int r10, g10, b10, r11, g11, b11;
+
+        bilinear_rgb_mirrored(n0_above, row0, n0_below, x, width, lut0, has_red0,
+                              r_gain_fix, g_gain_fix, b_gain_fix, combined_shift, &r00, &g00, &b00);
+        bilinear_rgb_mirrored(n0_above, row0, n0_below, x1, width, lut0, has_red0,
+                              r_gain_fix, g_gain_fix, b_gain_fix, combined_shift, &r01, &g01, &b01);
+        y_out0[x] = rgb_to_y(r00, g00, b00);
+        if (x + 1 < width) y_out0[x + 1] = rgb_to_y(r01, g01, b01);
+
+        if (have_row1) {
+            bilinear_rgb_mirrored(row0, row1, n1_below, x, width, lut1, has_red1,
+                                  r_gain_fix, g_gain_fix, b_gain_fix, combined_shift, &r10, &g10, &b10);
+            bilinear_rgb_mirrored(row0, row1, n1_below, x1, width, lut1, has_red1,
+                                  r_gain_fix, g_gain_fix, b_gain_fix, combined_shift, &r11, &g11, &b11);
+            y_out1[x] = rgb_to_y(r10, g10, b10);
+            if (x + 1 < width) y_out1[x + 1] = rgb_to_y(r11, g11, b11);
+        } else {
+            r10 = r00; g10 = g00; b10 = b00;
+            r11 = r01; g11 = g01; b11 = b01;
+        }
+
+        const int r = (r00 + r01 + r10 + r11 + 2) >> 2;
+        const int g = (g00 + g01 + g10 + g11 + 2) >> 2;
+        const int b = (b00 + b01 + b10 + b11 + 2) >> 2;
+        const int rg = JPEG_ENC_PACK16(r, g);
+        const int cb = (JPEG_ENC_SMLAD(rg, JPEG_ENC_COEF_CB_RG, b << 11) >> 12) + 128;
+        const int cr = (JPEG_ENC_SMLAD(rg, JPEG_ENC_COEF_CR_RG, b * JPEG_ENC_COEF_CR_B) >> 12) + 128;
+        cb_out[x >> 1] = clamp_u8(cb);
+        cr_out[x >> 1] = clamp_u8(cr);
+    }
+}
+
 // Wrapper to select implementation
 static void demosaic_row_bilinear(
     const uint16_t* row_prev, 
@@ -1761,7 +2142,11 @@ static void demosaic_row_bilinear(
     }
 }
 
-int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* config) {
+/* One encode at a time: the JPEGE_IMAGE, workspace, statistics and last
+ * error are file-scope. Set for the duration of jpeg_encode_stream. */
+static volatile int s_encode_active = 0;
+
+static int jpeg_encode_stream_single(jpeg_stream_t* stream, const jpeg_encoder_config_t* config) {
     JPEG_TIMING_INIT();
     JPEG_TIMING_FRAME_START();
     
@@ -1783,6 +2168,30 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
         return -(int)JPEG_ENCODER_ERR_INVALID_STRIDE;
     }
 
+    if (config->defects) {
+        for (size_t i = 1; i < config->defect_count; i++) {
+            const jpeg_defect_pixel_t* a = &config->defects[i - 1];
+            const jpeg_defect_pixel_t* b = &config->defects[i];
+            if (b->row < a->row || (b->row == a->row && b->col < a->col)) {
+                jpeg_set_error(JPEG_ENCODER_ERR_DEFECT_LIST_UNSORTED, "Defect list not sorted by row/col", __func__, __LINE__);
+                return -(int)JPEG_ENCODER_ERR_DEFECT_LIST_UNSORTED;
+            }
+        }
+    }
+
+    if (config->lsc_grid &&
+        (config->lsc_grid_w < 2 || config->lsc_grid_w > JPEG_LSC_MAX_GRID_DIM ||
+         config->lsc_grid_h < 2 || config->lsc_grid_h > JPEG_LSC_MAX_GRID_DIM ||
+         width < config->lsc_grid_w || height < config->lsc_grid_h)) {
+        jpeg_set_error(JPEG_ENCODER_ERR_INVALID_LSC_GRID, "Invalid lens shading grid size", __func__, __LINE__);
+        return -(int)JPEG_ENCODER_ERR_INVALID_LSC_GRID;
+    }
+
+    if (config->isolated_zero_start >= 64) {
+        jpeg_set_error(JPEG_ENCODER_ERR_INVALID_QUANT_CONFIG, "isolated_zero_start must be 0..63", __func__, __LINE__);
+        return -(int)JPEG_ENCODER_ERR_INVALID_QUANT_CONFIG;
+    }
+
     int downshift = get_downshift_for_format(config->pixel_format);
 
     init_y_lut();
@@ -1815,7 +2224,7 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
         }
     }
 
-    JPEGE_IMAGE jpege;
+    static JPEGE_IMAGE jpege; // holds the JPEGE_FILE_BUF_SIZE staging buffer; keep it off the stack
     memset(&jpege, 0, sizeof(jpege)); 
     jpege.pfnRead = jpeg_read_callback;
     jpege.pfnWrite = jpeg_write_callback;
@@ -1834,33 +2243,62 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
         subsample = JPEGE_SUBSAMPLE_422;
     }
     
-    uint8_t encode_pixel_type = (subsample == JPEGE_SUBSAMPLE_444) ? JPEGE_PIXEL_YUV444 : JPEGE_PIXEL_YUV422;
+    const int luma_only = config->grayscale || config->mono_sensor;
+    if (luma_only) {
+        subsample = JPEGE_SUBSAMPLE_444; // 8x8 MCUs, single component
+    }
+    uint8_t encode_pixel_type = luma_only ? JPEGE_PIXEL_GRAYSCALE :
+                                ((subsample == JPEGE_SUBSAMPLE_444) ? JPEGE_PIXEL_YUV444 : JPEGE_PIXEL_YUV422);
     if (JPEGEncodeBegin(&jpege, &je, width, height, encode_pixel_type, subsample, quality_enum) != JPEGE_SUCCESS) {
         jpeg_set_error(JPEG_ENCODER_ERR_JPEG_INIT_FAILED, "JPEG encoder initialization failed", __func__, __LINE__);
         return -(int)JPEG_ENCODER_ERR_JPEG_INIT_FAILED;
     }
+
+    if (config->deadzone || config->isolated_zero_start) {
+        static const uint8_t def_luma[JPEG_DEADZONE_BANDS] = JPEG_DEADZONE_DEFAULT_LUMA_BIAS;
+        static const uint8_t def_chroma[JPEG_DEADZONE_BANDS] = JPEG_DEADZONE_DEFAULT_CHROMA_BIAS;
+        uint8_t luma_bias[JPEG_DEADZONE_BANDS];
+        uint8_t chroma_bias[JPEG_DEADZONE_BANDS];
+        deadzone_biases(config->deadzone_luma_bias, def_luma, luma_bias);
+        deadzone_biases(config->deadzone_chroma_bias, def_chroma, chroma_bias);
+        JPEGSetDeadzone(&jpege, config->deadzone ? luma_bias : NULL,
+                        config->deadzone ? chroma_bias : NULL, config->isolated_zero_start);
+    }
+
+    static JPEGE_QSTATS qstats;
+    if (config->collect_quant_stats) {
+        memset(&qstats, 0, sizeof(qstats));
+        jpege.pQStats = &qstats;
+    }
     
     int mcu_h = (subsample == JPEGE_SUBSAMPLE_420) ? 16 : 8;
     int mcu_w = (subsample == JPEGE_SUBSAMPLE_444) ? 8 : 16;
     // We need indices 1..8 for current block, 0 for prev, 9 for next.
     // So strip[10] lines total.
     
+    int strip_lines = mcu_h + 2; 
+    size_t sz_raw = file_stride * strip_lines;
+    const int async_in = (stream->read_submit != NULL && stream->read_wait != NULL);
+
     // Check Memory Usage Limits
-    size_t total_alloc = jpeg_encoder_estimate_memory_requirement(config);
+    size_t total_alloc = jpeg_encoder_estimate_memory_requirement(config) + (async_in ? sz_raw : 0);
     if (total_alloc > JPEG_ENCODER_MAX_MEMORY_USAGE) {
         jpeg_set_error(JPEG_ENCODER_ERR_MEMORY_LIMIT_EXCEEDED, "Memory limit exceeded", __func__, __LINE__);
         return -(int)JPEG_ENCODER_ERR_MEMORY_LIMIT_EXCEEDED;
     }
 
-    int strip_lines = mcu_h + 2; 
-    size_t sz_raw = file_stride * strip_lines;
     size_t sz_unpack = width * sizeof(uint16_t) * strip_lines;
-    size_t sz_out = (encode_pixel_type == JPEGE_PIXEL_YUV444) ? (width * 3 * mcu_h) : (width * 2 * mcu_h);
+    const int out_bpp = luma_only ? 1 : ((encode_pixel_type == JPEGE_PIXEL_YUV444) ? 3 : 2);
+    size_t sz_out = out_strip_size(config, mcu_h);
     
     if (!jpeg_alloc_reuse((void**)&s_workspace.raw_file_chunk, &s_workspace.raw_size, sz_raw)) {
         jpeg_set_error(JPEG_ENCODER_ERR_ALLOC_RAW_BUFFER, "Failed to allocate raw input buffer", __func__, __LINE__);
         return -(int)JPEG_ENCODER_ERR_ALLOC_RAW_BUFFER;
     }
+    if (async_in && !jpeg_alloc_reuse((void**)&s_workspace.raw_file_chunk2, &s_workspace.raw2_size, sz_raw)) {
+        jpeg_set_error(JPEG_ENCODER_ERR_ALLOC_RAW_BUFFER, "Failed to allocate second raw input buffer", __func__, __LINE__);
+        return -(int)JPEG_ENCODER_ERR_ALLOC_RAW_BUFFER;
+    }
 
     if (!jpeg_alloc_reuse((void**)&s_workspace.unpacked_strip, &s_workspace.unpack_size, sz_unpack)) {
         jpeg_set_error(JPEG_ENCODER_ERR_ALLOC_UNPACK_BUFFER, "Failed to allocate unpack buffer", __func__, __LINE__);
@@ -1901,6 +2339,77 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
     float r_gain = JPEG_DEMOSAIC_RED_GAIN;
     float g_gain = JPEG_DEMOSAIC_GREEN_GAIN;
     float b_gain = JPEG_DEMOSAIC_BLUE_GAIN;
+
+    // Black level per CFA position (scalar ob_value unless ob_cfa is set)
+    uint16_t ob_cfa[4] = {0, 0, 0, 0};
+    uint16_t ob_max = 0;
+    if (config->subtract_ob) {
+        const int use_cfa = (config->ob_cfa[0] | config->ob_cfa[1] | config->ob_cfa[2] | config->ob_cfa[3]) != 0;
+        for (int c = 0; c < 4; c++) {
+            ob_cfa[c] = use_cfa ? config->ob_cfa[c] : config->ob_value;
+            if (ob_cfa[c] > ob_max) ob_max = ob_cfa[c];
+        }
+    }
+    const size_t defect_count = config->defects ? config->defect_count : 0;
+    const int defect_pitch = config->mono_sensor ? 1 : 2; // same-colour neighbour distance
+    size_t defect_cur = 0;
+
+    // Lens shading (optional)
+    lsc_ctx_t lsc_ctx;
+    const lsc_ctx_t* lsc = NULL;
+    if (config->lsc_grid) {
+        lsc_init(&lsc_ctx, config);
+        lsc = &lsc_ctx;
+    }
+
+    // Statistics-based AWB: pre-scan the sample grid if the input can seek,
+    // otherwise use the previous frame's statistics and gather this frame's
+    // during unpack for the next one.
+    const int awb_enabled = (config->awb_mode != JPEG_AWB_MODE_FIXED) && !config->mono_sensor;
+    int awb_collect = 0;
+    int awb_step = config->awb_sample_step ? config->awb_sample_step : JPEG_AWB_DEFAULT_SAMPLE_STEP;
+    awb_step = (awb_step < 2) ? 2 : ((awb_step + 1) & ~1);
+    uint16_t awb_clip = 0;
+    jpeg_awb_stats_t awb_frame;
+    memset(&awb_frame, 0, sizeof(awb_frame));
+    if (awb_enabled) {
+        uint32_t full_scale = (256u << downshift) - 1u;
+        uint32_t clip = full_scale - (full_scale >> 4);
+        clip = (clip > ob_max) ? (clip - ob_max) : 1u;
+        awb_clip = (uint16_t)clip;
+
+        int scanned = 0;
+        if (stream->seek) {
+            JPEG_TIMING_START(JPEG_TIMING_RAW_READ);
+            scanned = awb_prescan(stream, config, (size_t)config->start_offset_lines * file_stride,
+                                  file_stride, raw_file_chunk, unpacked_strip, awb_step, awb_clip, ob_cfa, lsc, &awb_frame);
+            JPEG_TIMING_END(JPEG_TIMING_RAW_READ);
+            if (scanned < 0) {
+                jpeg_set_error(JPEG_ENCODER_ERR_SEEK_FAILED, "Failed to rewind input after AWB pre-scan", __func__, __LINE__);
+                return -(int)JPEG_ENCODER_ERR_SEEK_FAILED;
+            }
+            memset(unpacked_strip, 0, sz_unpack);
+        }
+
+        if (scanned) {
+            awb_compute_gains(&awb_frame, config->awb_mode, config->bayer_pattern);
+            s_awb_stats = awb_frame;
+        } else {
+            memset(&awb_frame, 0, sizeof(awb_frame));
+            awb_collect = 1;
+            if (s_awb_stats.count[0] > 0) {
+                awb_compute_gains(&s_awb_stats, config->awb_mode, config->bayer_pattern);
+            }
+        }
+
+        const jpeg_awb_stats_t* src = scanned ? &awb_frame : &s_awb_stats;
+        if (src->valid) {
+            r_gain = src->r_gain;
+            g_gain = src->g_gain;
+            b_gain = src->b_gain;
+        }
+    }
+
     if (config->apply_awb) {
         if (config->awb_r_gain > 0.0f) r_gain = config->awb_r_gain;
         if (config->awb_g_gain > 0.0f) g_gain = config->awb_g_gain;
@@ -1912,9 +2421,20 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
     int b_gain_fix = (int)(b_gain * 256.0f + 0.5f);
     
     int total_mcus_y = (height + mcu_h - 1) / mcu_h;
+    const int progress_interval = (config->progress_interval > 0) ? config->progress_interval : 1;
     // int file_lines_read = 0;
     int has_lookahead = 0; // Does strip[1] contain a valid pre-read row?
 
+    // Double-buffered input: raw_bufs[cur] holds (or is receiving) this strip,
+    // the other one receives the next strip while this one is processed
+    uint8_t* raw_bufs[2] = { raw_file_chunk, s_workspace.raw_file_chunk2 };
+    int raw_cur = 0;
+    int read_pending = 0;
+    if (async_in) {
+        read_pending = (stream->read_submit(stream->read_ctx, raw_bufs[0],
+                                            (size_t)strip_lines_to_read(0, mcu_h, height) * file_stride) == 0);
+    }
+
     for (int mcu_y = 0; mcu_y < total_mcus_y; mcu_y++) {
         int y_start = mcu_y * mcu_h;
         int rows_to_process = mcu_h;
@@ -1948,9 +2468,26 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
         
         if (lines_to_read > 0) {
             size_t bytes_to_read = lines_to_read * file_stride;
-            JPEG_TIMING_START(JPEG_TIMING_RAW_READ);
-            size_t br = stream->read(stream->read_ctx, raw_file_chunk, bytes_to_read);
-            JPEG_TIMING_END(JPEG_TIMING_RAW_READ);
+            size_t br;
+            if (read_pending) {
+                JPEG_TIMING_START(JPEG_TIMING_READ_WAIT);
+                br = stream->read_wait(stream->read_ctx, raw_bufs[raw_cur]);
+                JPEG_TIMING_END(JPEG_TIMING_READ_WAIT);
+                read_pending = 0;
+            } else {
+                JPEG_TIMING_START(JPEG_TIMING_RAW_READ);
+                br = stream->read(stream->read_ctx, raw_bufs[raw_cur], bytes_to_read);
+                JPEG_TIMING_END(JPEG_TIMING_RAW_READ);
+            }
+            raw_file_chunk = raw_bufs[raw_cur];
+            if (async_in) {
+                // Start the next strip before unpacking this one
+                raw_cur ^= 1;
+                if (mcu_y + 1 < total_mcus_y) {
+                    size_t next_bytes = (size_t)strip_lines_to_read(mcu_y + 1, mcu_h, height) * file_stride;
+                    read_pending = (stream->read_submit(stream->read_ctx, raw_bufs[raw_cur], next_bytes) == 0);
+                }
+            }
             
             if (br < bytes_to_read) {
                 // Hit EOF or short read: Fill remainder with zeros (Black)
@@ -1962,9 +2499,20 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
             uint8_t* src = raw_file_chunk;
             for (int k = 0; k < lines_to_read; k++) {
                 int target_idx = start_fill_idx + k;
-                unpack_row(src, &unpacked_strip[target_idx * width], width, config->pixel_format);
+                uint16_t* row = &unpacked_strip[target_idx * width];
+                int abs_row = y_start + target_idx - 1;
+                unpack_row(src, row, width, config->pixel_format);
                 if (config->subtract_ob) {
-                    subtract_black_fast(&unpacked_strip[target_idx * width], width, config->ob_value);
+                    subtract_black_cfa(row, width, abs_row, ob_cfa);
+                }
+                if (defect_cur < defect_count) {
+                    defect_cur = correct_defects_row(row, width, abs_row, defect_pitch, config->defects, defect_count, defect_cur);
+                }
+                if (lsc) {
+                    lsc_apply_row(lsc, row, abs_row);
+                }
+                if (awb_collect && awb_row_sampled(abs_row, awb_step)) {
+                    awb_sample_row(row, width, abs_row, awb_step, awb_clip, &awb_frame);
                 }
                 src += file_stride;
             }
@@ -1989,10 +2537,14 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
         JPEG_TIMING_START(JPEG_TIMING_DEMOSAIC);
         
         const int is_yuv444 = (encode_pixel_type == JPEGE_PIXEL_YUV444);
-        const int is_420_fast = (!is_yuv444 && use_fast && config->subsample == JPEG_SUBSAMPLE_420);
+        const int is_420_fast = uses_planar_420(config);
         const int is_422_fast = (!is_yuv444 && use_fast && !is_420_fast);
-        const int out_bpp = is_yuv444 ? 3 : 2;
         const int out_stride = width * out_bpp;
+        /* Planar 4:2:0 layout: Y[16][y_pitch], Cb[8][c_pitch], Cr[8][c_pitch] */
+        const int y_pitch = (width + 15) & ~15;
+        const int c_pitch = y_pitch / 2;
+        uint8_t* const plane_cb = out_strip + y_pitch * 16;
+        uint8_t* const plane_cr = plane_cb + c_pitch * 8;
         const jpeg_bayer_pattern_t bayer = config->bayer_pattern;
         const uint16_t ob_val = config->ob_value;
         
@@ -2002,61 +2554,104 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
         uint16_t* strip_next = unpacked_strip + 2 * width;     /* strip[2] */
         uint8_t*  out_row    = out_strip;
         
-        for (int i = 0; i < rows_to_process; i++) {
-             int abs_y = y_start + i;
-             uint16_t* prev = (abs_y > 0)          ? strip_prev : NULL;
-             uint16_t* curr = strip_curr;
-             uint16_t* next = (abs_y < height - 1) ? strip_next : NULL;
+        if (is_420_fast) {
+            /* Row pairs: strip[i] = prev, strip[i+1..i+2] = pair, strip[i+3] = next */
+            for (int i = 0; i < rows_to_process; i += 2) {
+                int abs_y = y_start + i;
+                const uint16_t* row0 = unpacked_strip + (i + 1) * width;
+                const uint16_t* prev = (abs_y > 0) ? row0 - width : NULL;
+                const uint16_t* row1 = (i + 1 < rows_to_process) ? row0 + width : NULL;
+                const uint16_t* next = (row1 && abs_y + 2 < height) ? row0 + 2 * width : NULL;
+                demosaic_rows_bilinear_to_yuv420_fast(prev, row0, row1, next,
+                                                      out_strip + i * y_pitch, out_strip + (i + 1) * y_pitch,
+                                                      plane_cb + (i >> 1) * c_pitch, plane_cr + (i >> 1) * c_pitch,
+                                                      width, abs_y, bayer, r_gain_fix, b_gain_fix, downshift);
+            }
+        } else {
+            for (int i = 0; i < rows_to_process; i++) {
+                 int abs_y = y_start + i;
+                 uint16_t* prev = (abs_y > 0)          ? strip_prev : NULL;
+                 uint16_t* curr = strip_curr;
+                 uint16_t* next = (abs_y < height - 1) ? strip_next : NULL;
              
-             if (is_yuv444) {
-                 if (use_fast) {
-                     demosaic_row_bilinear_to_yuv444_fast(prev, curr, next, out_row, width, abs_y, bayer, r_gain_fix, b_gain_fix, downshift, false, ob_val);
-                 } else {
-                     demosaic_row_bilinear_to_yuv444_ref(prev, curr, next, out_row, width, abs_y, bayer, r_gain, b_gain, downshift, false, ob_val);
-                 }
-             } else if (is_420_fast) {
-                 bool can_copy_chroma = ((abs_y & 1) != 0) && (i > 0);
-                 if (can_copy_chroma) {
-                     demosaic_row_bilinear_to_yuv422_luma_fast(prev, curr, next, out_row, width, abs_y, bayer, r_gain_fix, b_gain_fix, downshift, false, ob_val);
-                     /* 32-bit word chroma copy: process 4 bytes per iteration        */
-                     /* YUYV layout (little-endian): byte0=Y0, byte1=Cb, byte2=Y1, byte3=Cr */
-                     /* Chroma mask 0xFF00FF00 selects Cb and Cr bytes                */
-                     uint32_t *dst32 = (uint32_t *)out_row;
-                     const uint32_t *prev32 = (const uint32_t *)(out_row - out_stride);
-                     const int n_words = width / 2;  /* width pixels / 2 pixels per YUYV group */
-                     for (int p = 0; p < n_words; p++) {
-                         dst32[p] = (dst32[p] & 0x00FF00FFu) | (prev32[p] & 0xFF00FF00u);
+                 if (luma_only) {
+                     if (config->mono_sensor) {
+                         mono_row_to_y(curr, out_row, width, s_g_gain_fix, downshift);
+                     } else {
+                         demosaic_row_bilinear_to_luma_fast(prev, curr, next, out_row, width, abs_y, bayer, r_gain_fix, b_gain_fix, downshift);
                      }
-                 } else {
+                 } else if (is_yuv444) {
+                     if (use_fast) {
+                         demosaic_row_bilinear_to_yuv444_fast(prev, curr, next, out_row, width, abs_y, bayer, r_gain_fix, b_gain_fix, downshift, false, ob_val);
+                     } else {
+                         demosaic_row_bilinear_to_yuv444_ref(prev, curr, next, out_row, width, abs_y, bayer, r_gain, b_gain, downshift, false, ob_val);
+                     }
+                 } else if (is_422_fast) {
                      demosaic_row_bilinear_to_yuv422_fast(prev, curr, next, out_row, width, abs_y, bayer, r_gain_fix, b_gain_fix, downshift, false, ob_val);
+                 } else {
+                     demosaic_row_bilinear_to_yuv422_ref(prev, curr, next, out_row, width, abs_y, bayer, r_gain, b_gain, downshift, false, ob_val);
                  }
-             } else if (is_422_fast) {
-                 demosaic_row_bilinear_to_yuv422_fast(prev, curr, next, out_row, width, abs_y, bayer, r_gain_fix, b_gain_fix, downshift, false, ob_val);
-             } else {
-                 demosaic_row_bilinear_to_yuv422_ref(prev, curr, next, out_row, width, abs_y, bayer, r_gain, b_gain, downshift, false, ob_val);
-             }
              
-             strip_prev += width;
-             strip_curr += width;
-             strip_next += width;
-             out_row    += out_stride;
+                 strip_prev += width;
+                 strip_curr += width;
+                 strip_next += width;
+                 out_row    += out_stride;
+            }
         }
         JPEG_TIMING_END(JPEG_TIMING_DEMOSAIC);
 
         JPEG_TIMING_START(JPEG_TIMING_MCU_PREPARE);
         for (int mcu_x = 0; mcu_x < width; mcu_x += mcu_w) {
-               int pitch = (encode_pixel_type == JPEGE_PIXEL_YUV444) ? (width * 3) : (width * 2);
-               int bpp = (encode_pixel_type == JPEGE_PIXEL_YUV444) ? 3 : 2;
-             JPEGAddMCU(&jpege, &je, &out_strip[mcu_x * bpp], pitch);
+             if (is_420_fast) {
+                 JPEGAddMCU420P(&jpege, &je, &out_strip[mcu_x], y_pitch,
+                                &plane_cb[mcu_x >> 1], &plane_cr[mcu_x >> 1], c_pitch);
+             } else {
+                 JPEGAddMCU(&jpege, &je, &out_strip[mcu_x * out_bpp], out_stride);
+             }
         }
         JPEG_TIMING_END(JPEG_TIMING_MCU_PREPARE);
+
+        if (config->progress &&
+            ((mcu_y + 1) % progress_interval == 0 || mcu_y == total_mcus_y - 1)) {
+            uint32_t rows_done = (uint32_t)(y_start + rows_to_process);
+            if (config->progress(config->progress_ctx, rows_done, (uint32_t)height) != 0) {
+                if (read_pending) {
+                    (void)stream->read_wait(stream->read_ctx, raw_bufs[raw_cur]); // don't leave a read into our buffer
+                }
+                jpeg_set_error(JPEG_ENCODER_ERR_ABORTED, "Encode aborted by progress callback", __func__, __LINE__);
+                return -(int)JPEG_ENCODER_ERR_ABORTED;
+            }
+        }
     }
     
     JPEGEncodeEnd(&jpege);
+
+    if (config->collect_quant_stats) {
+        quant_stats_finish(&qstats);
+    }
+
+    if (awb_collect) {
+        // Carry this frame's statistics over to the next frame of the burst
+        awb_compute_gains(&awb_frame, config->awb_mode, config->bayer_pattern);
+        s_awb_stats = awb_frame;
+    }
     
     return 0;
 }
 
+int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* config) {
+    // Detects, does not serialize: callers must not overlap encodes.
+    // No jpeg_set_error here, the running encode owns g_last_error.
+    assert(!s_encode_active && "jpeg_encode_stream is not reentrant");
+    if (s_encode_active) {
+        return -(int)JPEG_ENCODER_ERR_BUSY;
+    }
+    s_encode_active = 1;
+    int res = jpeg_encode_stream_single(stream, config);
+    s_encode_active = 0;
+    return res;
+}
+
 // --- Memory Buffer Stream Wrapper ---
 
 typedef struct {
@@ -2083,6 +2678,13 @@ static size_t mem_read_func(void* ctx, void* buf, size_t size) {
     return size;
 }
 
+static int mem_seek_func(void* ctx, size_t offset) {
+    mem_read_ctx_t* m = (mem_read_ctx_t*)ctx;
+    if (offset > m->size) return -1;
+    m->pos = offset;
+    return 0;
+}
+
 static size_t mem_write_func(void* ctx, const void* buf, size_t size) {
     mem_write_ctx_t* m = (mem_write_ctx_t*)ctx;
     if (m->pos >= m->capacity) return 0; 
@@ -2120,11 +2722,12 @@ int jpeg_encode_buffer(const uint8_t* in_buf, size_t in_size, uint8_t* out_buf,
     mem_read_ctx_t ctx_in = { .ptr = in_buf, .size = in_size, .pos = 0 };
     mem_write_ctx_t ctx_out = { .ptr = out_buf, .capacity = out_capacity, .pos = 0 };
 
-    jpeg_stream_t stream;
+    jpeg_stream_t stream = {0};
     stream.read = mem_read_func;
     stream.read_ctx = &ctx_in;
     stream.write = mem_write_func;
     stream.write_ctx = &ctx_out;
+    stream.seek = mem_seek_func;
 
     int res = jpeg_encode_stream(&stream, config);
 
@@ -16,6 +16,12 @@ extern "C" {
 #define JPEG_DEMOSAIC_GREEN_GAIN_Q8  ((int)(JPEG_DEMOSAIC_GREEN_GAIN * 256.0f + 0.5f))
 #define JPEG_DEMOSAIC_BLUE_GAIN_Q8 ((int)(JPEG_DEMOSAIC_BLUE_GAIN * 256.0f + 0.5f))
 
+// Lens shading grid limits (nodes per axis) and gain format (Q12, 4096 = 1.0)
+#ifndef JPEG_LSC_MAX_GRID_DIM
+#define JPEG_LSC_MAX_GRID_DIM 33
+#endif
+#define JPEG_LSC_GAIN_ONE 4096
+
 // Memory Safety Limit (Default: 64KB)
 #ifndef JPEG_ENCODER_MAX_MEMORY_USAGE
 #define JPEG_ENCODER_MAX_MEMORY_USAGE (128 * 1024)
@@ -54,16 +60,105 @@ typedef enum {
     JPEG_SUBSAMPLE_422
 } jpeg_subsample_t;
 
+/**
+ * @brief Auto white balance modes.
+ */
+typedef enum {
+    JPEG_AWB_MODE_FIXED = 0,    // Calibrated JPEG_DEMOSAIC_*_GAIN constants (default)
+    JPEG_AWB_MODE_GRAY_WORLD,   // Scale R/B so their means match green
+    JPEG_AWB_MODE_WHITE_PATCH   // Scale R/B so their brightest unclipped samples match green
+} jpeg_awb_mode_t;
+
+// AWB sampling grid step in pixels (rows and columns) when config leaves it at 0
+#ifndef JPEG_AWB_DEFAULT_SAMPLE_STEP
+#define JPEG_AWB_DEFAULT_SAMPLE_STEP 16
+#endif
+
+// Deadzone quantizer AC bands by zigzag index: 1-5, 6-14, 15-27, 28-63.
+// Biases are rounding offsets in 1/256 of a quantizer step (128 = round to
+// nearest); a config entry of 0 selects these defaults.
+#define JPEG_DEADZONE_BANDS 4
+#ifndef JPEG_DEADZONE_DEFAULT_LUMA_BIAS
+#define JPEG_DEADZONE_DEFAULT_LUMA_BIAS   { 104, 88, 80, 72 }
+#endif
+#ifndef JPEG_DEADZONE_DEFAULT_CHROMA_BIAS
+#define JPEG_DEADZONE_DEFAULT_CHROMA_BIAS { 96, 80, 72, 64 }
+#endif
+
 /**
  * @brief Stream interface for reading/writing data.
+ *
+ * seek is optional (may be NULL). When provided it positions the input at an
+ * absolute byte offset, where 0 is the first byte the encoder would read, and
+ * returns 0 on success. It enables the sparse AWB pre-scan.
+ *
+ * read_submit/read_wait are optional (set both or neither) and turn on
+ * double-buffered input: while strip N is demosaiced and encoded, strip N+1
+ * is being read. read_submit(ctx, buf, size) starts filling buf with the next
+ * size bytes of the input and returns 0 (non-zero = not started, the encoder
+ * then reads that strip with read()). read_wait(ctx, buf) blocks until that
+ * buffer is filled and returns the byte count. At most one read is in flight
+ * and the encoder leaves buf alone until read_wait returns. read/seek are
+ * still used for the start offset and the AWB pre-scan, before any submit.
  */
 typedef struct {
     size_t (*read)(void* ctx, void* buf, size_t size);
     void* read_ctx;
     size_t (*write)(void* ctx, const void* buf, size_t size);
     void* write_ctx;
+    int (*seek)(void* ctx, size_t offset); // optional, uses read_ctx
+    int (*read_submit)(void* ctx, void* buf, size_t size); // optional, uses read_ctx
+    size_t (*read_wait)(void* ctx, void* buf);             // optional, uses read_ctx
 } jpeg_stream_t;
 
+/**
+ * @brief Progress callback, called from inside jpeg_encode_stream() on the
+ *        encoding thread after every progress_interval MCU rows and after
+ *        the last one. rows_done counts image rows fully encoded.
+ *
+ * Return 0 to continue, non-zero to abort the encode. It is a good place to
+ * yield the CPU (e.g. tx_thread_relinquish()) on cooperative schedulers.
+ */
+typedef int (*jpeg_progress_cb_t)(void* ctx, uint32_t rows_done, uint32_t rows_total);
+
+/**
+ * @brief Per-CFA-channel white balance statistics.
+ *        Index is the CFA position: (row & 1) * 2 + (col & 1).
+ */
+typedef struct {
+    uint32_t sum[4];     // Sum of unclipped samples (after black level)
+    uint32_t count[4];   // Number of unclipped samples
+    uint32_t clipped[4]; // Number of samples at or above the clip level
+    uint16_t max[4];     // Brightest unclipped sample
+    float r_gain;        // Gains derived from the statistics
+    float g_gain;
+    float b_gain;
+    bool valid;          // Statistics hold enough samples to be used
+} jpeg_awb_stats_t;
+
+/**
+ * @brief Quantizer statistics of the last encode (collect_quant_stats).
+ *        Error is measured on the DCT coefficients, which for the
+ *        orthonormal JPEG DCT equals the pixel-domain quantization error
+ *        of the encoded (already subsampled) planes.
+ */
+typedef struct {
+    uint32_t blocks;           // 8x8 blocks quantized (all components)
+    uint32_t nonzero_ac;       // Non-zero AC coefficients written
+    uint32_t isolated_dropped; // Isolated +/-1 AC coefficients zeroed
+    double sse;                // Sum of squared quantization error
+    float psnr_db;             // 10*log10(255^2 / (sse / (blocks * 64)))
+} jpeg_quant_stats_t;
+
+/**
+ * @brief Static defect (hot/dead) pixel location.
+ *        Coordinates are image coordinates after start_offset_lines.
+ */
+typedef struct {
+    uint16_t row;
+    uint16_t col;
+} jpeg_defect_pixel_t;
+
 /**
  * @brief Detailed error codes for JPEG encoder.
  *        Each failure path returns a unique negative code.
@@ -85,7 +180,13 @@ typedef enum {
     JPEG_ENCODER_ERR_NULL_OUT_SIZE = 13,
     JPEG_ENCODER_ERR_NULL_IN_BUFFER = 14,
     JPEG_ENCODER_ERR_NULL_OUT_BUFFER = 15,
-    JPEG_ENCODER_ERR_ZERO_OUT_CAPACITY = 16
+    JPEG_ENCODER_ERR_ZERO_OUT_CAPACITY = 16,
+    JPEG_ENCODER_ERR_SEEK_FAILED = 17,
+    JPEG_ENCODER_ERR_DEFECT_LIST_UNSORTED = 18,
+    JPEG_ENCODER_ERR_INVALID_LSC_GRID = 19,
+    JPEG_ENCODER_ERR_INVALID_QUANT_CONFIG = 20,
+    JPEG_ENCODER_ERR_ABORTED = 21,
+    JPEG_ENCODER_ERR_BUSY = 22
 } jpeg_encoder_error_code_t;
 
 /**
@@ -110,13 +211,26 @@ typedef struct {
     jpeg_bayer_pattern_t bayer_pattern;
     bool subtract_ob;
     uint16_t ob_value;
+    uint16_t ob_cfa[4]; // per-CFA-position black levels, index (row & 1) * 2 + (col & 1); used instead of ob_value when any is non-zero
+    const jpeg_defect_pixel_t* defects; // optional defect list, sorted by row then col
+    uint16_t defect_count;
+    const uint16_t* lsc_grid; // optional lens shading gains, Q12, laid out [cfa 0..3][lsc_grid_h][lsc_grid_w]
+    uint8_t lsc_grid_w; // grid nodes across (2..JPEG_LSC_MAX_GRID_DIM), first/last on the image edges
+    uint8_t lsc_grid_h; // grid nodes down (2..JPEG_LSC_MAX_GRID_DIM)
     bool apply_awb;
     float awb_r_gain; // optional override when apply_awb is true
     float awb_g_gain; // optional override when apply_awb is true
     float awb_b_gain; // optional override when apply_awb is true
+    jpeg_awb_mode_t awb_mode; // statistics-based AWB (overridden by explicit awb_*_gain)
+    uint16_t awb_sample_step; // AWB grid step in pixels (0 = JPEG_AWB_DEFAULT_SAMPLE_STEP)
     
     // JPEG Specific
     int quality; // 0-100
+    bool deadzone; // widen the zero bin of AC coefficients per band (smaller files)
+    uint8_t deadzone_luma_bias[JPEG_DEADZONE_BANDS];   // 1/256 of a step, 0 = JPEG_DEADZONE_DEFAULT_LUMA_BIAS
+    uint8_t deadzone_chroma_bias[JPEG_DEADZONE_BANDS]; // 1/256 of a step, 0 = JPEG_DEADZONE_DEFAULT_CHROMA_BIAS
+    uint8_t isolated_zero_start; // zigzag index (1..63) from which lone +/-1 AC terms are dropped, 0 = off
+    bool collect_quant_stats; // gather jpeg_quant_stats_t (costs a float pass per block)
 
     // Stream Processing
     int start_offset_lines; // Skip these many lines from start of stream
@@ -126,12 +240,26 @@ typedef struct {
 
     // Subsampling
     jpeg_subsample_t subsample; // 4:4:4 (default), 4:2:0, or 4:2:2
+
+    // Luma-only output (one-component JPEG, subsample is ignored)
+    bool grayscale;   // Bayer input: reconstruct luma only, skip chroma
+    bool mono_sensor; // Input has no CFA: samples go straight to Y (implies grayscale)
+
+    // Progress / cooperative yield (optional)
+    jpeg_progress_cb_t progress; // non-zero return aborts with JPEG_ENCODER_ERR_ABORTED
+    void* progress_ctx;
+    uint16_t progress_interval; // MCU rows between calls (0 = every MCU row)
     
 } jpeg_encoder_config_t;
 
 
 /**
  * @brief Compress a stream of raw data to JPEG.
+ *
+ * Not reentrant: the encoder keeps its state (JPEG core, work buffers,
+ * statistics, last error) at file scope, so only one encode may run at a
+ * time, across all threads. Overlapping calls trip an assert, or return
+ * JPEG_ENCODER_ERR_BUSY when asserts are compiled out.
  * 
  * @param stream  Input/Output stream interface
  * @param config  Compression configuration
@@ -141,6 +269,7 @@ int jpeg_encode_stream(jpeg_stream_t* stream, const jpeg_encoder_config_t* confi
 
 /**
  * @brief Compress a raw memory buffer to JPEG in another memory buffer.
+ *        Same single-encode restriction as jpeg_encode_stream.
  * 
  * @param in_buf Source buffer containing raw data
  * @param in_size Size of source buffer
@@ -164,12 +293,53 @@ int jpeg_encode_buffer(const uint8_t* in_buf, size_t in_size, uint8_t* out_buf,
 
 /**
  * @brief Calculate the memory required by the encoder for a given configuration.
+ *
+ * Streams with read_submit/read_wait need one more raw strip
+ * (width * bytes per pixel * (MCU height + 2)) on top of this.
  * 
  * @param config Configuration to check
  * @return Size in bytes
  */
 size_t jpeg_encoder_estimate_memory_requirement(const jpeg_encoder_config_t* config);
 
+/**
+ * @brief Upper bound on the JPEG size for a given configuration.
+ *
+ * Derived from the padded pixel count, sampling mode and quality band; it
+ * is a generous planning figure (e.g. for pre-allocating a contiguous
+ * output file), not a hard guarantee for pathological content.
+ *
+ * @param config Configuration to check
+ * @return Size in bytes (0 if config is NULL)
+ */
+size_t jpeg_encoder_estimate_output_size(const jpeg_encoder_config_t* config);
+
+/**
+ * @brief Retrieve the AWB statistics gathered during the last encode.
+ *
+ * Without a seekable input, the gains derived here are applied to the next
+ * frame encoded with the same awb_mode (burst sessions).
+ *
+ * @param out_stats Output structure for the statistics
+ * @return 0 on success, negative on invalid arguments.
+ */
+int jpeg_encoder_get_awb_stats(jpeg_awb_stats_t* out_stats);
+
+/**
+ * @brief Forget AWB statistics carried over from previous frames.
+ *        Call when starting a new burst session or after a scene change.
+ */
+void jpeg_encoder_reset_awb(void);
+
+/**
+ * @brief Retrieve the quantizer statistics of the last encode.
+ *        Only filled when config->collect_quant_stats was set.
+ *
+ * @param out_stats Output structure for the statistics
+ * @return 0 on success, negative on invalid arguments.
+ */
+int jpeg_encoder_get_quant_stats(jpeg_quant_stats_t* out_stats);
+
 /**
  * @brief Retrieve the last error that occurred in the encoder.
  * 
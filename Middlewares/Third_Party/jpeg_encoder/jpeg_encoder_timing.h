@@ -38,6 +38,7 @@ typedef enum {
     JPEG_TIMING_HUFFMAN,            /* Huffman encoding */
     JPEG_TIMING_STREAM_WRITE,       /* Writing to output stream */
     JPEG_TIMING_OVERHEAD,           /* Loop/control overhead */
+    JPEG_TIMING_READ_WAIT,          /* Stalled on an async strip read (not hidden by compute) */
     JPEG_TIMING_COUNT               /* Number of stages */
 } jpeg_timing_stage_t;
 
@@ -161,7 +162,8 @@ static inline const char* jpeg_timing_stage_name(jpeg_timing_stage_t stage)
         "QUANTIZE",
         "HUFFMAN",
         "STREAM_WR",
-        "OVERHEAD"
+        "OVERHEAD",
+        "READ_WAIT"
     };
     if (stage < JPEG_TIMING_COUNT) {
         return names[stage];
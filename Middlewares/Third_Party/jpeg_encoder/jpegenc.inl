@@ -768,7 +768,9 @@ void JPEGFixQuantE(JPEGE_IMAGE *pJPEG)
         p = (signed short *) &pJPEG->sQuantTable[iTableOffset];
         for (i = 0; i < DCTSIZE; i++)
         {
+            pJPEG->usQuantTrue[iTableOffset + i] = (unsigned short)p[i];
             p[i] = (short) ((p[i] * s_iScaleBits[i]) >> 11);
+            pJPEG->sQuantBias[iTableOffset + i] = p[i] >> 1; // round to nearest
         }
         // Create "inverted" values for quicker multiplication instead of division
         pus = (unsigned short *) &pJPEG->sQuantTable[iTableOffset];
@@ -916,6 +918,7 @@ int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHe
     pJPEG->iHeight = iHeight;
     pJPEG->ucPixelType = ucPixelType;
     pJPEG->ucSubSample = ucSubSample;
+    pJPEG->ucIsolatedStart = DCTSIZE; // isolated coefficient dropping off
     pEncode->x = pEncode->y = 0; // starting point
     if (ucSubSample == JPEGE_SUBSAMPLE_444) {
         pEncode->cx = pEncode->cy = 8;
@@ -1135,6 +1138,9 @@ int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHe
     pBuf[iOffset++] = 0; // successive approximation bit
     // Set the output pointer for writing the variable length codes
     pJPEG->pc.pOut = &pBuf[iOffset];
+    if (pJPEG->pOutput == NULL) { // flush once the file buffer can't take another MCU
+        pJPEG->pHighWater = &pJPEG->ucFileBuf[JPEGE_FILE_BUF_SIZE - JPEGE_FILE_BUF_MARGIN];
+    }
     
     // prepare the luma & chroma quantization tables
     for (i = 0; i<64; i++)
@@ -1169,50 +1175,119 @@ int JPEGEncodeBegin(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, int iWidth, int iHe
     return JPEGE_SUCCESS;
 } /* JPEGEncodeBegin() */
 
-int JPEGQuantize(JPEGE_IMAGE *pJPEG, signed short *pMCUSrc, int iTable)
+//
+// Set up the deadzone quantizer (call after JPEGEncodeBegin)
+// pLumBias/pChromaBias hold JPEGE_DEADZONE_BANDS rounding offsets for the
+// AC bands as a fraction of the quantizer step in 1/256 units: 128 is the
+// default round-to-nearest, smaller values widen the zero bin. NULL keeps
+// the table as it is. DC is always rounded to nearest.
+// iIsolatedStart (1..63) drops +/-1 AC terms at or past that zigzag index
+// whose zigzag neighbours are both zero; 0 or 64 disables it.
+//
+int JPEGSetDeadzone(JPEGE_IMAGE *pJPEG, const uint8_t *pLumBias, const uint8_t *pChromaBias, int iIsolatedStart)
 {
-    signed int d, sQ1, sQ2, sum;
-    int i;
-    signed short *pQuant;
-    
-    pQuant = (signed short *)&pJPEG->sQuantTable[iTable * DCTSIZE];
-    for (i=0; i<33; i++) // do first half and then check for second half being all 0's
+    const uint8_t *pBias;
+    int iTable, i, iBand, iZig;
+
+    if (pJPEG == NULL || iIsolatedStart < 0 || iIsolatedStart > DCTSIZE) {
+        return JPEGE_INVALID_PARAMETER;
+    }
+    for (iTable = 0; iTable < 2; iTable++)
     {
-        sQ1 = pQuant[i];
-        sQ2 = sQ1 >> 1;
-        d = *pMCUSrc;
-        // Avoid doing divides; the second half of the quantization table has 65536/Q values
-        // so that we can use multiplies in this step
-        if (d < 0)
+        pBias = (iTable == 0) ? pLumBias : pChromaBias;
+        if (pBias == NULL)
+            continue;
+        for (i = 1; i < DCTSIZE; i++) // natural order, skip DC
         {
-            *pMCUSrc++ = 0 - (((sQ2 - d) * pQuant[i + 128]) >> 16);
+            iZig = s_cZigZag[i];
+            iBand = (iZig < 6) ? 0 : ((iZig < 15) ? 1 : ((iZig < 28) ? 2 : 3));
+            pJPEG->sQuantBias[iTable*DCTSIZE + i] = (signed short)((pJPEG->sQuantTable[iTable*DCTSIZE + i] * pBias[iBand] + 128) >> 8);
         }
-        else
+    }
+    pJPEG->ucIsolatedStart = (uint8_t)((iIsolatedStart == 0) ? DCTSIZE : iIsolatedStart);
+    return JPEGE_SUCCESS;
+} /* JPEGSetDeadzone() */
+
+//
+// Drop lone +/-1 AC coefficients in the high frequencies. Each one costs a
+// run/size code plus a sign bit while carrying very little energy
+//
+static int JPEGDropIsolated(signed short *pMCU, int iStart)
+{
+    int i, iDropped = 0;
+    int iPrev = pMCU[s_cZigZag2[iStart - 1]];
+
+    for (i = iStart; i < DCTSIZE; i++)
+    {
+        int iCur = pMCU[s_cZigZag2[i]];
+        int iNext = (i < DCTSIZE-1) ? pMCU[s_cZigZag2[i+1]] : 0;
+        if ((iCur == 1 || iCur == -1) && iPrev == 0 && iNext == 0)
         {
-            *pMCUSrc++ = (((sQ2 + d) * pQuant[i + 128]) >> 16);
+            pMCU[s_cZigZag2[i]] = 0;
+            iCur = 0;
+            iDropped++;
         }
-    } // for
-    sum = 0;
-    for (i=33; i<64; i++) // second half; check for 'sparseness'
+        iPrev = iCur;
+    }
+    return iDropped;
+} /* JPEGDropIsolated() */
+
+static void JPEGQuantStats(JPEGE_IMAGE *pJPEG, const signed short *pOrig, const signed short *pQuantized, int iTable, int iDropped)
+{
+    JPEGE_QSTATS *pStats = pJPEG->pQStats;
+    double dSSE = 0.0;
+    int i;
+
+    for (i = 0; i < DCTSIZE; i++)
+    {
+        // true coefficient = scaled FDCT output * 2048 / scale, reconstructed as q * Q
+        double dCoef = (double)pOrig[i] * 2048.0 / (double)s_iScaleBits[i];
+        double dErr = dCoef - (double)pQuantized[i] * pJPEG->usQuantTrue[iTable*DCTSIZE + i];
+        dSSE += dErr * dErr;
+        if (i != 0 && pQuantized[i] != 0)
+            pStats->u32NonZero++;
+    }
+    pStats->dSSE += dSSE;
+    pStats->u32Blocks++;
+    pStats->u32Isolated += (uint32_t)iDropped;
+} /* JPEGQuantStats() */
+
+int JPEGQuantize(JPEGE_IMAGE *pJPEG, signed short *pMCUSrc, int iTable)
+{
+    signed int d;
+    int i, iDropped = 0;
+    signed short *pQuant, *pBias, *pMCU = pMCUSrc;
+    signed short sOrig[DCTSIZE];
+    
+    if (pJPEG->pQStats)
+        memcpy(sOrig, pMCUSrc, sizeof(sOrig));
+    pQuant = (signed short *)&pJPEG->sQuantTable[iTable * DCTSIZE];
+    pBias = &pJPEG->sQuantBias[iTable * DCTSIZE];
+    for (i=0; i<64; i++)
     {
-        sQ1 = pQuant[i];
-        sQ2 = sQ1 >> 1;
-        d = *pMCUSrc;
+        d = *pMCU;
         // Avoid doing divides; the second half of the quantization table has 65536/Q values
         // so that we can use multiplies in this step
         if (d < 0)
         {
-            d = 0 - (((sQ2 - d) * pQuant[i + 128]) >> 16);
-            sum -= d;
+            *pMCU++ = 0 - (((pBias[i] - d) * pQuant[i + 128]) >> 16);
         }
         else
         {
-            d = (((sQ2 + d) * pQuant[i + 128]) >> 16);
-            sum += d;
+            *pMCU++ = (((pBias[i] + d) * pQuant[i + 128]) >> 16);
         }
-        *pMCUSrc++ = d;
     } // for
-    return (sum == 0); // if the last half of the quantized results was 0, call it 'sparse'
+    if (pJPEG->ucIsolatedStart < DCTSIZE)
+        iDropped = JPEGDropIsolated(pMCUSrc, pJPEG->ucIsolatedStart);
+    if (pJPEG->pQStats)
+        JPEGQuantStats(pJPEG, sOrig, pMCUSrc, iTable, iDropped);
+    // 'sparse' if the second half in zigzag order (what JPEGEncodeMCU skips) is all 0's
+    for (i=33; i<64; i++)
+    {
+        if (pMCUSrc[s_cZigZag2[i]] != 0)
+            return 0;
+    }
+    return 1;
 } /* JPEGQuantize() */
 
 int JPEGEncodeMCU(int iDCTable, JPEGE_IMAGE *pJPEG, signed short *pMCUData, int iDCPred, int bSparse)
@@ -1303,7 +1378,13 @@ int JPEGEncodeMCU(int iDCTable, JPEGE_IMAGE *pJPEG, signed short *pMCUData, int
             STORECODE(pOut, iLen, ulCode, ulAcc, iNewLen)
         }
     }
-    
+    if (bSparse) // last coded term was zigzag 32; the zeros after it still need an EOB
+    {
+        ulCode = (BIGUINT) pHuff[0];
+        iNewLen = pHuff[256];
+        STORECODE(pOut, iLen, ulCode, ulAcc, iNewLen)
+    }
+
 encodemcuz:
     pJPEG->pc.ulAcc = ulAcc; // place local copies back in the object pointer version
     pJPEG->pc.pOut = pOut;
@@ -2027,6 +2108,42 @@ void JPEGGetMCU22(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch)
     }
 } /* JPEGGetMCU22() */
 
+//
+// Build a 4:2:0 MCU from planar input: a 16x16 Y block plus 8x8 Cb and Cr
+// blocks that the caller has already subsampled. No chroma averaging is
+// done here. Chroma block order matches JPEGSubSampleYUV422().
+//
+void JPEGGetMCU420P(const uint8_t *pY, int iYPitch, const uint8_t *pCb, const uint8_t *pCr, int iCPitch, int8_t *pMCUData)
+{
+    int y;
+    uint32_t *pU32;
+    uint8_t *pY0 = (uint8_t *)pMCUData;
+    uint8_t *pCrOut = (uint8_t *)&pMCUData[64*4];
+    uint8_t *pCbOut = (uint8_t *)&pMCUData[64*5];
+
+    for (y = 0; y < 8; y++)
+    {
+        const uint8_t *s0 = pY + (y * iYPitch);
+        const uint8_t *s1 = s0 + (8 * iYPitch);
+        memcpy(&pY0[(64*0) + y*8], s0, 8);
+        memcpy(&pY0[(64*1) + y*8], s0 + 8, 8);
+        memcpy(&pY0[(64*2) + y*8], s1, 8);
+        memcpy(&pY0[(64*3) + y*8], s1 + 8, 8);
+        memcpy(&pCbOut[y*8], pCb + (y * iCPitch), 8);
+        memcpy(&pCrOut[y*8], pCr + (y * iCPitch), 8);
+    }
+
+    pU32 = (uint32_t *)pMCUData;
+    // all of the YUV values need to be adjusted +/-128, so XOR with 0x80
+    for (y = 0; y < (6*16); y += 4) {
+        pU32[0] ^= 0x80808080;
+        pU32[1] ^= 0x80808080;
+        pU32[2] ^= 0x80808080;
+        pU32[3] ^= 0x80808080;
+        pU32 += 4;
+    }
+} /* JPEGGetMCU420P() */
+
 void JPEGGetMCU21(unsigned char *pImage, JPEGE_IMAGE *pPage, int iPitch)
 {
     int cx, cy;
@@ -2349,17 +2466,15 @@ void FlushCode(PIL_CODE *pPC)
     pPC->iLen = 0;
 } /* FlushCode() */
 
-int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
+//
+// Compress the MCU already sampled into pJPEG->MCUc and advance the
+// encoder position (restart marker at the end of each MCU row)
+//
+static int JPEGCompressMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode)
 {
     int bSparse;
-    
-    if (pEncode->y >= pJPEG->iHeight) {
-        // the image is already complete or was not initialized properly
-        pJPEG->iError = JPEGE_INVALID_PARAMETER;
-        return JPEGE_INVALID_PARAMETER;
-    }
+
     if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAYSCALE) {
-        JPEGGetMCU(pPixels, iPitch, pJPEG->MCUc);
         JPEGFDCT(pJPEG->MCUc, pJPEG->MCUs);
         bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
         pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
@@ -2380,7 +2495,6 @@ int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iP
         } // grayscale
     } else { // color
         if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_444) {
-            JPEGGetMCU11(pPixels, pJPEG, iPitch);
             JPEGFDCT(&pJPEG->MCUc[0*DCTSIZE], pJPEG->MCUs);
             // Y
             bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
@@ -2394,7 +2508,6 @@ int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iP
             bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
             pJPEG->iDCPred2 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred2, bSparse);
         } else if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_422) {
-            JPEGGetMCU21(pPixels, pJPEG, iPitch);
             JPEGFDCT(&pJPEG->MCUc[0*DCTSIZE], pJPEG->MCUs); // Y0
             bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
             pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
@@ -2408,7 +2521,6 @@ int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iP
             bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 1);
             pJPEG->iDCPred2 = JPEGEncodeMCU(1, pJPEG, pJPEG->MCUs, pJPEG->iDCPred2, bSparse);
         } else { // must be 420
-            JPEGGetMCU22(pPixels, pJPEG, iPitch);
             JPEGFDCT(&pJPEG->MCUc[0*DCTSIZE], pJPEG->MCUs); // Y0
             bSparse = JPEGQuantize(pJPEG, pJPEG->MCUs, 0);
             pJPEG->iDCPred0 = JPEGEncodeMCU(0, pJPEG, pJPEG->MCUs, pJPEG->iDCPred0, bSparse);
@@ -2456,8 +2568,42 @@ int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iP
         }
     }
     return JPEGE_SUCCESS;
+} /* JPEGCompressMCU() */
+
+int JPEGAddMCU(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
+{
+    if (pEncode->y >= pJPEG->iHeight) {
+        // the image is already complete or was not initialized properly
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    if (pJPEG->ucPixelType == JPEGE_PIXEL_GRAYSCALE) {
+        JPEGGetMCU(pPixels, iPitch, pJPEG->MCUc);
+    } else if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_444) {
+        JPEGGetMCU11(pPixels, pJPEG, iPitch);
+    } else if (pJPEG->ucSubSample == JPEGE_SUBSAMPLE_422) {
+        JPEGGetMCU21(pPixels, pJPEG, iPitch);
+    } else { // must be 420
+        JPEGGetMCU22(pPixels, pJPEG, iPitch);
+    }
+    return JPEGCompressMCU(pJPEG, pEncode);
 } /* JPEGAddMCU() */
 
+//
+// Add a 4:2:0 MCU from separate Y/Cb/Cr planes (16x16 luma, 8x8 chroma)
+// Only valid when the encoder was started with JPEGE_SUBSAMPLE_420
+//
+int JPEGAddMCU420P(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, const uint8_t *pY, int iYPitch, const uint8_t *pCb, const uint8_t *pCr, int iCPitch)
+{
+    if (pEncode->y >= pJPEG->iHeight || pJPEG->ucSubSample != JPEGE_SUBSAMPLE_420 ||
+        pJPEG->ucPixelType == JPEGE_PIXEL_GRAYSCALE) {
+        pJPEG->iError = JPEGE_INVALID_PARAMETER;
+        return JPEGE_INVALID_PARAMETER;
+    }
+    JPEGGetMCU420P(pY, iYPitch, pCb, pCr, iCPitch, pJPEG->MCUc);
+    return JPEGCompressMCU(pJPEG, pEncode);
+} /* JPEGAddMCU420P() */
+
 int JPEGAddFrame(JPEGE_IMAGE *pJPEG, JPEGENCODE *pEncode, uint8_t *pPixels, int iPitch)
 {
 int x, y;
@@ -1,3 +1,3 @@
 # Generated by ./configure
 CC=gcc
-CFLAGS=-O2 -Wall -I../ -I. -Wno-unused-function
+CFLAGS=-O2 -Wall -I../ -I. -Wno-unused-function -pthread
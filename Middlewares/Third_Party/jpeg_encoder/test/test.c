@@ -2,8 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
 #include <sys/resource.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "jpeg_encoder.h"
 
 // Input Parameters
@@ -19,6 +21,13 @@
 #define OUTPUT_FILENAME_FAST_444 "output_fast_444.jpg"
 #define OUTPUT_FILENAME_SLOW_444 "output_slow_444.jpg"
 #define OUTPUT_FILENAME_BUFFER_FAST_444 "output_buffer_fast_444.jpg"
+#define OUTPUT_FILENAME_FAST_GRAY "output_fast_gray.jpg"
+#define OUTPUT_FILENAME_FAST_MONO "output_fast_mono.jpg"
+#define OUTPUT_FILENAME_FAST_420_DZ "output_fast_420_dz.jpg"
+#define OUTPUT_FILENAME_FAST_420_DZ_ISO "output_fast_420_dz_iso.jpg"
+#define OUTPUT_FILENAME_FAST_422_ABORT "output_fast_422_abort.jpg"
+#define OUTPUT_FILENAME_FAST_422_SIM_SYNC "output_fast_422_sim_sync.jpg"
+#define OUTPUT_FILENAME_FAST_422_SIM_ASYNC "output_fast_422_sim_async.jpg"
 #define OUTPUT_FILENAME_BUFFER_SLOW_444 "output_buffer_slow_444.jpg"
 
 #define IMG_WIDTH 640
@@ -32,6 +41,68 @@
 static float g_awb_r_gain = AWB_RED_GAIN;
 static float g_awb_g_gain = AWB_GREEN_GAIN;
 static float g_awb_b_gain = AWB_BLUE_GAIN;
+static jpeg_awb_mode_t g_awb_mode = JPEG_AWB_MODE_FIXED;
+
+// Lens shading: synthetic radial grid (corners +40%), enabled by JPEG_TEST_LSC=1
+#define LSC_GRID_W 17
+#define LSC_GRID_H 13
+static uint16_t g_lsc_grid[4 * LSC_GRID_H * LSC_GRID_W];
+static bool g_use_lsc = false;
+
+// Luma-only passes
+static bool g_grayscale = false;
+static bool g_mono_sensor = false;
+
+// Quantizer: deadzone (JPEG_TEST_DEADZONE=1) and isolated +/-1 dropping
+// (JPEG_TEST_ISOLATED=<zigzag index>) for all passes
+static bool g_deadzone = false;
+static uint8_t g_isolated_start = 0;
+static bool g_quant_stats = false; // PSNR reporting (JPEG_TEST_QSTATS=1), adds per-block float work
+
+// Progress callback: counts calls, aborts once g_progress_abort_row is reached (0 = never)
+#define PROGRESS_INTERVAL_MCU_ROWS 4
+static uint32_t g_progress_calls = 0;
+static uint32_t g_progress_last_row = 0;
+static uint32_t g_progress_abort_row = 0;
+
+static int test_progress(void* ctx, uint32_t rows_done, uint32_t rows_total) {
+    (void)ctx;
+    (void)rows_total;
+    g_progress_calls++;
+    g_progress_last_row = rows_done;
+    return (g_progress_abort_row > 0 && rows_done >= g_progress_abort_row) ? 1 : 0;
+}
+
+static void build_lsc_grid(void) {
+    for (int c = 0; c < 4; c++) {
+        for (int j = 0; j < LSC_GRID_H; j++) {
+            for (int i = 0; i < LSC_GRID_W; i++) {
+                float dx = (float)(i - LSC_GRID_W / 2) / (float)(LSC_GRID_W / 2);
+                float dy = (float)(j - LSC_GRID_H / 2) / (float)(LSC_GRID_H / 2);
+                float gain = 1.0f + 0.2f * (dx * dx + dy * dy);
+                g_lsc_grid[(c * LSC_GRID_H + j) * LSC_GRID_W + i] = (uint16_t)(gain * JPEG_LSC_GAIN_ONE + 0.5f);
+            }
+        }
+    }
+}
+
+static void apply_test_options(jpeg_encoder_config_t* config) {
+    config->grayscale = g_grayscale;
+    config->mono_sensor = g_mono_sensor;
+    config->deadzone = g_deadzone;
+    config->isolated_zero_start = g_isolated_start;
+    config->collect_quant_stats = g_quant_stats;
+    config->progress = test_progress;
+    config->progress_ctx = NULL;
+    config->progress_interval = PROGRESS_INTERVAL_MCU_ROWS;
+    g_progress_calls = 0;
+    g_progress_last_row = 0;
+    if (g_use_lsc) {
+        config->lsc_grid = g_lsc_grid;
+        config->lsc_grid_w = LSC_GRID_W;
+        config->lsc_grid_h = LSC_GRID_H;
+    }
+}
 
 // --- Stream Interface ---
 
@@ -44,6 +115,11 @@ size_t file_read(void* ctx, void* buf, size_t size) {
     return fread(buf, 1, size, f->fp);
 }
 
+int file_seek(void* ctx, size_t offset) {
+    file_ctx_t* f = (file_ctx_t*)ctx;
+    return fseek(f->fp, (long)offset, SEEK_SET);
+}
+
 size_t file_write(void* ctx, const void* buf, size_t size) {
     file_ctx_t* f = (file_ctx_t*)ctx;
     return fwrite(buf, 1, size, f->fp);
@@ -69,6 +145,592 @@ static void print_last_error(const char* context) {
     }
 }
 
+static void print_awb_stats(void) {
+    jpeg_awb_stats_t st;
+    if (g_awb_mode == JPEG_AWB_MODE_FIXED || jpeg_encoder_get_awb_stats(&st) != 0) {
+        return;
+    }
+    printf("AWB: %s gains R=%.3f G=%.3f B=%.3f (samples %u/%u/%u/%u, clipped %u)\n",
+           st.valid ? "auto" : "fallback", st.r_gain, st.g_gain, st.b_gain,
+           st.count[0], st.count[1], st.count[2], st.count[3],
+           st.clipped[0] + st.clipped[1] + st.clipped[2] + st.clipped[3]);
+}
+
+static void print_quant_stats(void) {
+    jpeg_quant_stats_t st;
+    if (!g_quant_stats || jpeg_encoder_get_quant_stats(&st) != 0) {
+        return;
+    }
+    printf("Quant: PSNR %.2f dB, %u non-zero AC in %u blocks, %u isolated dropped\n",
+           st.psnr_db, st.nonzero_ac, st.blocks, st.isolated_dropped);
+}
+
+// --- Simulated SD input (sync and async) ---
+// Reads sleep SIM_READ_US_PER_KB per KB to stand in for the card. In async
+// mode a worker thread plays the reader thread + DMA: read_submit hands it a
+// strip, read_wait blocks until it is done, so the sleep overlaps encoding.
+
+#define SIM_READ_US_PER_KB 100 // ~10 MB/s, 4-bit SDMMC at 25 MHz
+
+typedef enum { SIM_READ_OFF = 0, SIM_READ_SYNC, SIM_READ_ASYNC } sim_read_mode_t;
+static sim_read_mode_t g_sim_read = SIM_READ_OFF;
+
+typedef struct {
+    FILE* fp;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    void* buf;
+    size_t size;
+    size_t result;
+    int state;      // 0 idle, 1 submitted, 2 done, 3 quit
+    double busy_ms; // time spent reading (worker or inline)
+    double wait_ms; // time the encoder blocked in read_wait
+} sim_ctx_t;
+
+static size_t sim_read_now(sim_ctx_t* s, void* buf, size_t size) {
+    double t0 = get_wall_time_ms();
+    size_t r = fread(buf, 1, size, s->fp);
+    usleep((useconds_t)((size * SIM_READ_US_PER_KB) / 1024));
+    s->busy_ms += get_wall_time_ms() - t0;
+    return r;
+}
+
+static void* sim_worker(void* arg) {
+    sim_ctx_t* s = (sim_ctx_t*)arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (s->state != 1 && s->state != 3) pthread_cond_wait(&s->cond, &s->lock);
+        if (s->state == 3) break;
+        pthread_mutex_unlock(&s->lock);
+        size_t r = sim_read_now(s, s->buf, s->size);
+        pthread_mutex_lock(&s->lock);
+        s->result = r;
+        s->state = 2;
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static size_t sim_read(void* ctx, void* buf, size_t size) {
+    return sim_read_now((sim_ctx_t*)ctx, buf, size);
+}
+
+static int sim_seek(void* ctx, size_t offset) {
+    return fseek(((sim_ctx_t*)ctx)->fp, (long)offset, SEEK_SET);
+}
+
+static int sim_read_submit(void* ctx, void* buf, size_t size) {
+    sim_ctx_t* s = (sim_ctx_t*)ctx;
+    pthread_mutex_lock(&s->lock);
+    s->buf = buf;
+    s->size = size;
+    s->state = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static size_t sim_read_wait(void* ctx, void* buf) {
+    sim_ctx_t* s = (sim_ctx_t*)ctx;
+    (void)buf;
+    double t0 = get_wall_time_ms();
+    pthread_mutex_lock(&s->lock);
+    while (s->state != 2) pthread_cond_wait(&s->cond, &s->lock);
+    s->state = 0;
+    size_t r = s->result;
+    pthread_mutex_unlock(&s->lock);
+    s->wait_ms += get_wall_time_ms() - t0;
+    return r;
+}
+
+static void sim_start(sim_ctx_t* s, FILE* fp, jpeg_stream_t* stream) {
+    memset(s, 0, sizeof(*s));
+    s->fp = fp;
+    stream->read = sim_read;
+    stream->read_ctx = s;
+    stream->seek = sim_seek;
+    if (g_sim_read == SIM_READ_ASYNC) {
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->cond, NULL);
+        pthread_create(&s->thread, NULL, sim_worker, s);
+        stream->read_submit = sim_read_submit;
+        stream->read_wait = sim_read_wait;
+    }
+}
+
+static void sim_stop(sim_ctx_t* s) {
+    if (g_sim_read != SIM_READ_ASYNC) return;
+    pthread_mutex_lock(&s->lock);
+    s->state = 3;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+}
+
+static void print_sim_stats(const sim_ctx_t* s) {
+    if (g_sim_read == SIM_READ_SYNC) {
+        printf("Input: %.1f ms reading, all on the encoder thread\n", s->busy_ms);
+    } else if (g_sim_read == SIM_READ_ASYNC) {
+        double hidden = s->busy_ms - s->wait_ms;
+        printf("Input: %.1f ms reading, encoder stalled %.1f ms, overlapped %.1f ms (%.0f%%)\n",
+               s->busy_ms, s->wait_ms, hidden, (s->busy_ms > 0.0) ? 100.0 * hidden / s->busy_ms : 0.0);
+    }
+}
+
+// --- Decode check (strict baseline decoder, no external library) ---
+
+// Every output is decoded again: Huffman tables, DC prediction, restart
+// markers and the padding before EOI. A block that runs into a marker, bits
+// left over after the last MCU, or anything but the expected marker after
+// padding fail the check (libjpeg reports these as "premature end of data
+// segment" / "extraneous bytes before marker"). The luma plane is rebuilt
+// with a float IDCT so the quantizer passes can be compared in pixels.
+
+static const uint8_t chk_natural[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+typedef struct {
+    int maxcode[17];
+    int mincode[17];
+    int valptr[17];
+    uint8_t vals[256];
+    bool present;
+} chk_huff_t;
+
+typedef struct {
+    int id, h, v, tq, td, ta;
+    int pred;
+} chk_comp_t;
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t acc;
+    int nbits;
+    bool marker; // a block needed bits past the end of the entropy data
+} chk_bits_t;
+
+typedef struct {
+    int width, height, ncomp, restart;
+    int hmax, vmax;
+    uint16_t quant[4][64];
+    chk_huff_t dc[4], ac[4];
+    chk_comp_t comp[3];
+    uint8_t* luma; // width * height, optional
+} chk_jpeg_t;
+
+static uint32_t g_decode_failures = 0;
+static uint8_t* g_decode_luma = NULL; // set to capture the next pass's luma plane
+
+static int chk_getbit(chk_bits_t* b) {
+    if (b->nbits == 0) {
+        if (b->p >= b->end || (b->p[0] == 0xFF && (b->p + 1 >= b->end || b->p[1] != 0x00))) {
+            b->marker = true;
+            return 0;
+        }
+        b->acc = *b->p++;
+        if (b->acc == 0xFF) {
+            b->p++; // stuffed zero
+        }
+        b->nbits = 8;
+    }
+    b->nbits--;
+    return (int)((b->acc >> b->nbits) & 1U);
+}
+
+static int chk_receive(chk_bits_t* b, int s) {
+    int v = 0;
+    for (int i = 0; i < s; i++) {
+        v = (v << 1) | chk_getbit(b);
+    }
+    if (s > 0 && v < (1 << (s - 1))) {
+        v -= (1 << s) - 1;
+    }
+    return v;
+}
+
+static int chk_decode(chk_bits_t* b, const chk_huff_t* h) {
+    int code = 0;
+    for (int len = 1; len <= 16; len++) {
+        code = (code << 1) | chk_getbit(b);
+        if (code <= h->maxcode[len]) {
+            return h->vals[h->valptr[len] + code - h->mincode[len]];
+        }
+    }
+    return -1;
+}
+
+static const char* chk_build_huff(chk_huff_t* h, const uint8_t* counts, const uint8_t* vals, int total) {
+    int code = 0, k = 0;
+    for (int len = 1; len <= 16; len++) {
+        h->valptr[len] = k;
+        h->mincode[len] = code;
+        code += counts[len - 1];
+        k += counts[len - 1];
+        h->maxcode[len] = counts[len - 1] ? code - 1 : -1;
+        if (code > (1 << len)) {
+            return "over-subscribed Huffman table";
+        }
+        code <<= 1;
+    }
+    if (k != total || k > 256) {
+        return "bad Huffman table length";
+    }
+    memcpy(h->vals, vals, (size_t)k);
+    h->present = true;
+    return NULL;
+}
+
+static void chk_idct_store(const chk_jpeg_t* j, const float* coef, int x0, int y0) {
+    static float cosv[8][8];
+    static bool init = false;
+    if (!init) {
+        for (int x = 0; x < 8; x++) {
+            for (int u = 0; u < 8; u++) {
+                cosv[x][u] = (float)((u == 0 ? sqrt(0.5) : 1.0) * cos((2 * x + 1) * u * M_PI / 16.0) / 2.0);
+            }
+        }
+        init = true;
+    }
+    float tmp[64];
+    for (int v = 0; v < 8; v++) {
+        for (int x = 0; x < 8; x++) {
+            float s = 0.0f;
+            for (int u = 0; u < 8; u++) {
+                s += cosv[x][u] * coef[v * 8 + u];
+            }
+            tmp[v * 8 + x] = s;
+        }
+    }
+    for (int y = 0; y < 8 && y0 + y < j->height; y++) {
+        for (int x = 0; x < 8 && x0 + x < j->width; x++) {
+            float s = 128.0f;
+            for (int v = 0; v < 8; v++) {
+                s += cosv[y][v] * tmp[v * 8 + x];
+            }
+            j->luma[(y0 + y) * j->width + x0 + x] = (uint8_t)(s < 0.0f ? 0 : (s > 255.0f ? 255 : (int)(s + 0.5f)));
+        }
+    }
+}
+
+static const char* chk_block(chk_jpeg_t* j, chk_bits_t* b, chk_comp_t* c, int x0, int y0) {
+    float coef[64];
+    int s = chk_decode(b, &j->dc[c->td]);
+    if (s < 0 || s > 11) {
+        return "bad DC code";
+    }
+    c->pred += chk_receive(b, s);
+    memset(coef, 0, sizeof(coef));
+    coef[0] = (float)(c->pred * j->quant[c->tq][0]);
+    for (int k = 1; k < 64; ) {
+        int rs = chk_decode(b, &j->ac[c->ta]);
+        if (rs < 0) {
+            return "bad AC code";
+        }
+        int r = rs >> 4;
+        s = rs & 15;
+        if (s == 0) {
+            if (r != 15) {
+                break; // EOB
+            }
+            k += 16; // ZRL
+            continue;
+        }
+        k += r;
+        if (k > 63) {
+            return "coefficient past the end of the block";
+        }
+        coef[chk_natural[k]] = (float)(chk_receive(b, s) * j->quant[c->tq][k]);
+        k++;
+    }
+    if (b->marker) {
+        return "premature end of entropy data";
+    }
+    if (j->luma != NULL && c == &j->comp[0]) {
+        chk_idct_store(j, coef, x0, y0);
+    }
+    return NULL;
+}
+
+// Only the rest of the current byte may be padding; the next bytes must be
+// exactly the marker. The pad bit values are not checked: FlushCode pads
+// with 0s, which decoders accept.
+static const char* chk_expect_marker(chk_bits_t* b, uint8_t marker) {
+    if (b->p + 1 >= b->end || b->p[0] != 0xFF || b->p[1] != marker) {
+        return (marker == 0xD9) ? "extraneous bytes before EOI" : "missing or out-of-order RST marker";
+    }
+    b->p += 2;
+    b->nbits = 0;
+    return NULL;
+}
+
+static const char* chk_scan(chk_jpeg_t* j, chk_bits_t* b, int* mcu_out) {
+    bool single = (j->ncomp == 1);
+    int mcu_w = single ? 8 : 8 * j->hmax;
+    int mcu_h = single ? 8 : 8 * j->vmax;
+    int mcus_x = (j->width + mcu_w - 1) / mcu_w;
+    int mcus_y = (j->height + mcu_h - 1) / mcu_h;
+    int total = mcus_x * mcus_y;
+    int rst = 0;
+    const char* err;
+
+    for (int m = 0; m < total; m++) {
+        *mcu_out = m;
+        if (j->restart && m > 0 && (m % j->restart) == 0) {
+            if ((err = chk_expect_marker(b, (uint8_t)(0xD0 + (rst++ & 7)))) != NULL) {
+                return err;
+            }
+            for (int c = 0; c < j->ncomp; c++) {
+                j->comp[c].pred = 0;
+            }
+        }
+        int mx = m % mcus_x, my = m / mcus_x;
+        for (int c = 0; c < j->ncomp; c++) {
+            chk_comp_t* comp = &j->comp[c];
+            int bh = single ? 1 : comp->h, bv = single ? 1 : comp->v;
+            for (int by = 0; by < bv; by++) {
+                for (int bx = 0; bx < bh; bx++) {
+                    if ((err = chk_block(j, b, comp, (mx * bh + bx) * 8, (my * bv + by) * 8)) != NULL) {
+                        return err;
+                    }
+                }
+            }
+        }
+    }
+    *mcu_out = total;
+    // The encoder also ends the last MCU row with a restart marker
+    if (j->restart && (total % j->restart) == 0 && b->p + 1 < b->end && b->p[0] == 0xFF && b->p[1] != 0xD9) {
+        if ((err = chk_expect_marker(b, (uint8_t)(0xD0 + (rst & 7)))) != NULL) {
+            return err;
+        }
+    }
+    return chk_expect_marker(b, 0xD9);
+}
+
+// Returns 0 if buf is a well-formed baseline JPEG whose scan decodes exactly
+static int check_decode(const char* name, const uint8_t* buf, size_t len, int expect_w, int expect_h) {
+    static chk_jpeg_t j;
+    const uint8_t* p = buf;
+    const uint8_t* end = buf + len;
+    const char* err = NULL;
+    int mcu = -1;
+
+    memset(&j, 0, sizeof(j));
+    j.luma = g_decode_luma;
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+        err = "no SOI";
+    }
+    p += 2;
+    while (err == NULL) {
+        if (p + 4 > end || p[0] != 0xFF) {
+            err = "bad marker segment";
+            break;
+        }
+        uint8_t marker = p[1];
+        int seg = (p[2] << 8) | p[3];
+        const uint8_t* s = p + 4;
+        const uint8_t* s_end = p + 2 + seg;
+        if (seg < 2 || s_end > end) {
+            err = "truncated marker segment";
+            break;
+        }
+        if (marker == 0xDB) { // DQT
+            while (s < s_end) {
+                int pq = s[0] >> 4, tq = s[0] & 15;
+                if (tq > 3 || s + 1 + 64 * (pq + 1) > s_end) {
+                    err = "bad DQT";
+                    break;
+                }
+                for (int k = 0; k < 64; k++) {
+                    j.quant[tq][k] = pq ? (uint16_t)((s[1 + 2 * k] << 8) | s[2 + 2 * k]) : s[1 + k];
+                }
+                s += 1 + 64 * (pq + 1);
+            }
+        } else if (marker == 0xC0 || marker == 0xC1) { // SOF0/SOF1
+            j.height = (s[1] << 8) | s[2];
+            j.width = (s[3] << 8) | s[4];
+            j.ncomp = s[5];
+            if (j.ncomp != 1 && j.ncomp != 3) {
+                err = "unsupported component count";
+                break;
+            }
+            for (int c = 0; c < j.ncomp; c++) {
+                j.comp[c].id = s[6 + 3 * c];
+                j.comp[c].h = s[7 + 3 * c] >> 4;
+                j.comp[c].v = s[7 + 3 * c] & 15;
+                j.comp[c].tq = s[8 + 3 * c] & 3;
+                j.hmax = (j.comp[c].h > j.hmax) ? j.comp[c].h : j.hmax;
+                j.vmax = (j.comp[c].v > j.vmax) ? j.comp[c].v : j.vmax;
+            }
+        } else if (marker == 0xC4) { // DHT
+            while (s < s_end && err == NULL) {
+                int total = 0;
+                for (int i = 0; i < 16; i++) {
+                    total += s[1 + i];
+                }
+                if ((s[0] & 15) > 3 || s + 17 + total > s_end) {
+                    err = "bad DHT";
+                    break;
+                }
+                err = chk_build_huff((s[0] >> 4) ? &j.ac[s[0] & 3] : &j.dc[s[0] & 3], s + 1, s + 17, total);
+                s += 17 + total;
+            }
+        } else if (marker == 0xDD) { // DRI
+            j.restart = (s[0] << 8) | s[1];
+        } else if (marker == 0xDA) { // SOS
+            if (j.ncomp == 0 || s[0] != j.ncomp) {
+                err = "SOS does not cover every component";
+                break;
+            }
+            for (int c = 0; c < j.ncomp; c++) {
+                if (s[1 + 2 * c] != j.comp[c].id) {
+                    err = "SOS component order";
+                    break;
+                }
+                j.comp[c].td = s[2 + 2 * c] >> 4 & 3;
+                j.comp[c].ta = s[2 + 2 * c] & 3;
+                if (!j.dc[j.comp[c].td].present || !j.ac[j.comp[c].ta].present) {
+                    err = "SOS references a missing Huffman table";
+                }
+            }
+            if (err != NULL) {
+                break;
+            }
+            chk_bits_t bits = { .p = s_end, .end = end };
+            err = chk_scan(&j, &bits, &mcu);
+            if (err == NULL && bits.p != end) {
+                err = "data after EOI";
+            }
+            break;
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            err = "not a baseline JPEG";
+            break;
+        }
+        p = s_end;
+    }
+    if (err == NULL && (j.width != expect_w || j.height != expect_h)) {
+        err = "wrong image size";
+    }
+    if (err != NULL) {
+        if (mcu >= 0) {
+            printf("Decode check: FAILED (%s) %s, MCU %d\n", name, err, mcu);
+        } else {
+            printf("Decode check: FAILED (%s) %s\n", name, err);
+        }
+        g_decode_failures++;
+        return 1;
+    }
+    printf("Decode check: OK (%dx%d, %d component%s%s)\n", j.width, j.height, j.ncomp,
+           j.ncomp > 1 ? "s" : "", j.restart ? ", restart markers" : "");
+    return 0;
+}
+
+static int check_decode_file(const char* filename, int expect_w, int expect_h) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        printf("Decode check: FAILED (%s) cannot open\n", filename);
+        g_decode_failures++;
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t* buf = (uint8_t*)malloc(size > 0 ? (size_t)size : 1U);
+    int res = 1;
+    if (buf && fread(buf, 1, (size_t)size, fp) == (size_t)size) {
+        res = check_decode(filename, buf, (size_t)size, expect_w, expect_h);
+    } else {
+        printf("Decode check: FAILED (%s) cannot read\n", filename);
+        g_decode_failures++;
+    }
+    free(buf);
+    fclose(fp);
+    return res;
+}
+
+static double luma_psnr(const uint8_t* a, const uint8_t* b, size_t n) {
+    double sse = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double d = (double)a[i] - (double)b[i];
+        sse += d * d;
+    }
+    return (sse > 0.0) ? 10.0 * log10(255.0 * 255.0 * (double)n / sse) : 99.0;
+}
+
+// --- Raw correction check (synthetic frame, no input file needed) ---
+
+// Flat frame, one level per CFA position, with per-CFA black levels, one hot
+// and one dead pixel listed in the defect map. AWB statistics sample every
+// pixel (step 2), so each channel must average exactly level - black.
+#define RAW_CHECK_W 32
+#define RAW_CHECK_H 16
+
+static int run_raw_correction_check(void) {
+    static const uint16_t level[4] = { 8000, 12000, 16000, 20000 };
+    static const jpeg_defect_pixel_t defects[2] = { { 2, 4 }, { 5, 9 } };
+    static uint16_t frame[RAW_CHECK_W * RAW_CHECK_H];
+    static uint8_t out_buf[16 * 1024];
+
+    printf("\n=== Running [Raw correction check: per-CFA black level + defect map] ===\n");
+    for (int y = 0; y < RAW_CHECK_H; y++) {
+        for (int x = 0; x < RAW_CHECK_W; x++) {
+            frame[y * RAW_CHECK_W + x] = level[(y & 1) * 2 + (x & 1)];
+        }
+    }
+    frame[2 * RAW_CHECK_W + 4] = 0;     // dead, CFA 0
+    frame[5 * RAW_CHECK_W + 9] = 40000; // hot (below clip), CFA 3
+
+    jpeg_encoder_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.width = RAW_CHECK_W;
+    config.height = RAW_CHECK_H;
+    config.pixel_format = JPEG_PIXEL_FORMAT_UNPACKED16;
+    config.bayer_pattern = BAYER_PATTERN;
+    config.quality = 90;
+    config.subtract_ob = true;
+    config.ob_value = 4000; // must be ignored: ob_cfa is set
+    config.ob_cfa[0] = 256;
+    config.ob_cfa[1] = 512;
+    config.ob_cfa[2] = 768;
+    config.ob_cfa[3] = 1024;
+    config.defects = defects;
+    config.defect_count = 2;
+    config.awb_mode = JPEG_AWB_MODE_GRAY_WORLD;
+    config.awb_sample_step = 2;
+    config.enable_fast_mode = true;
+
+    size_t out_size = 0;
+    jpeg_awb_stats_t st;
+    int res = jpeg_encode_buffer((const uint8_t*)frame, sizeof(frame), out_buf, sizeof(out_buf), &out_size, &config);
+    if (res != 0 || jpeg_encoder_get_awb_stats(&st) != 0) {
+        printf("Result: FAILED (%d)\n", res);
+        print_last_error("raw correction check");
+        return 1;
+    }
+
+    int failures = 0;
+    for (int c = 0; c < 4; c++) {
+        uint32_t expected = (uint32_t)(level[c] - config.ob_cfa[c]);
+        uint32_t n = st.count[c];
+        if (n == 0 || st.clipped[c] != 0 || st.sum[c] != expected * n || st.max[c] != expected) {
+            printf("CFA %d: expected %u, got mean %.2f max %u (samples %u, clipped %u)\n",
+                   c, expected, n ? (double)st.sum[c] / (double)n : 0.0, st.max[c], n, st.clipped[c]);
+            failures++;
+        }
+    }
+    failures += check_decode("raw correction check", out_buf, out_size, RAW_CHECK_W, RAW_CHECK_H);
+    printf("Result: %s\n", failures ? "FAILED" : "SUCCESS");
+    return failures ? 1 : 0;
+}
+
 // --- Benchmark Runner ---
 
 size_t run_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_subsample_t subsample, const char* out_filename, size_t raw_size) {
@@ -90,11 +752,16 @@ size_t run_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_subsample_
     file_ctx_t ctx_in = { .fp = fin };
     file_ctx_t ctx_out = { .fp = fout };
 
-    jpeg_stream_t stream;
+    jpeg_stream_t stream = {0};
     stream.read = file_read;
     stream.read_ctx = &ctx_in;
     stream.write = file_write;
     stream.write_ctx = &ctx_out;
+    stream.seek = file_seek;
+    sim_ctx_t sim;
+    if (g_sim_read != SIM_READ_OFF) {
+        sim_start(&sim, fin, &stream);
+    }
 
     jpeg_encoder_config_t config;
     memset(&config, 0, sizeof(config));
@@ -106,12 +773,14 @@ size_t run_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_subsample_
     config.quality = 90;
     config.ob_value = 0; 
     config.subtract_ob = false;
-    config.apply_awb = true;
+    config.apply_awb = (g_awb_mode == JPEG_AWB_MODE_FIXED);
+    config.awb_mode = g_awb_mode;
     config.awb_r_gain = g_awb_r_gain;
     config.awb_g_gain = g_awb_g_gain;
     config.awb_b_gain = g_awb_b_gain;
     config.enable_fast_mode = fast_mode; // Control Flag
     config.subsample = subsample;
+    apply_test_options(&config);
 
     // Warmup / Cache Priming? Maybe not needed for simple FS tests.
     
@@ -122,6 +791,9 @@ size_t run_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_subsample_
     
     double wall_end = get_wall_time_ms();
     clock_t cpu_end = clock();
+    if (g_sim_read != SIM_READ_OFF) {
+        sim_stop(&sim);
+    }
 
     size_t out_size = 0;
     if (res == 0) {
@@ -133,9 +805,16 @@ size_t run_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_subsample_
         printf("Time (Wall): %.3f ms\n", wall_ms);
         printf("Time (CPU):  %.3f ms\n", cpu_ms);
         printf("Output Size: %zu bytes\n", out_size);
+        printf("Size Bound:  %zu bytes\n", jpeg_encoder_estimate_output_size(&config));
         if (raw_size > 0 && out_size > 0) {
             printf("Compression Ratio: %.2fx\n", (double)raw_size / (double)out_size);
         }
+        print_awb_stats();
+        print_quant_stats();
+        printf("Progress: %u callbacks, %u/%d rows\n", g_progress_calls, g_progress_last_row, IMG_HEIGHT);
+        if (g_sim_read != SIM_READ_OFF) {
+            print_sim_stats(&sim);
+        }
     } else {
         printf("Result: FAILED (%d)\n", res);
         print_last_error("stream encode");
@@ -143,6 +822,9 @@ size_t run_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_subsample_
 
     fclose(fin);
     fclose(fout);
+    if (res == 0) {
+        check_decode_file(out_filename, IMG_WIDTH, IMG_HEIGHT);
+    }
     return out_size;
 }
 
@@ -190,12 +872,14 @@ size_t run_buffer_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_sub
     config.quality = 90;
     config.ob_value = 0; 
     config.subtract_ob = false;
-    config.apply_awb = true;
+    config.apply_awb = (g_awb_mode == JPEG_AWB_MODE_FIXED);
+    config.awb_mode = g_awb_mode;
     config.awb_r_gain = g_awb_r_gain;
     config.awb_g_gain = g_awb_g_gain;
     config.awb_b_gain = g_awb_b_gain;
     config.enable_fast_mode = fast_mode; 
     config.subsample = subsample;
+    apply_test_options(&config);
 
     size_t out_size = 0;
     
@@ -218,6 +902,10 @@ size_t run_buffer_benchmark_pass(const char* mode_name, bool fast_mode, jpeg_sub
         if (raw_size > 0 && out_size > 0) {
             printf("Compression Ratio: %.2fx\n", (double)raw_size / (double)out_size);
         }
+        print_awb_stats();
+        print_quant_stats();
+        printf("Progress: %u callbacks, %u/%d rows\n", g_progress_calls, g_progress_last_row, IMG_HEIGHT);
+        check_decode(out_filename, out_buf, out_size, IMG_WIDTH, IMG_HEIGHT);
         
         FILE* fout = fopen(out_filename, "wb");
         if (fout) {
@@ -263,11 +951,39 @@ int main(int argc, char** argv) {
         g_awb_b_gain = strtof(b_env, NULL);
     }
 
+    const char* awb_env = getenv("JPEG_TEST_AWB");
+    if (awb_env && strcmp(awb_env, "gray") == 0) {
+        g_awb_mode = JPEG_AWB_MODE_GRAY_WORLD;
+    } else if (awb_env && strcmp(awb_env, "white") == 0) {
+        g_awb_mode = JPEG_AWB_MODE_WHITE_PATCH;
+    }
+
+    const char* lsc_env = getenv("JPEG_TEST_LSC");
+    if (lsc_env && strcmp(lsc_env, "1") == 0) {
+        build_lsc_grid();
+        g_use_lsc = true;
+    }
+
+    const char* dz_env = getenv("JPEG_TEST_DEADZONE");
+    if (dz_env && strcmp(dz_env, "1") == 0) {
+        g_deadzone = true;
+    }
+    const char* iso_env = getenv("JPEG_TEST_ISOLATED");
+    if (iso_env && *iso_env) {
+        g_isolated_start = (uint8_t)atoi(iso_env);
+    }
+    const char* qstats_env = getenv("JPEG_TEST_QSTATS");
+    if (qstats_env && strcmp(qstats_env, "1") == 0) {
+        g_quant_stats = true;
+    }
+
+    int raw_check_failed = run_raw_correction_check();
+
     const char* only_fast_444 = getenv("JPEG_TEST_ONLY_FAST_444");
     if (only_fast_444 && strcmp(only_fast_444, "1") == 0) {
         run_benchmark_pass("Fast Mode (Q8 Fixed) 4:4:4", true, JPEG_SUBSAMPLE_444, OUTPUT_FILENAME_FAST_444, raw_size);
         printf("\nDone.\n");
-        return 0;
+        return (raw_check_failed || g_decode_failures > 0) ? 1 : 0;
     }
     
     // 1. Reference (Slow) Mode - 4:2:0
@@ -306,6 +1022,65 @@ int main(int argc, char** argv) {
     // 12. Fast (Buffer) Mode - 4:4:4
     run_buffer_benchmark_pass("Fast Mode (Q8 Fixed) 4:4:4", true, JPEG_SUBSAMPLE_444, OUTPUT_FILENAME_BUFFER_FAST_444, raw_size);
 
+    // 13. Fast Mode - Luma only from Bayer (one-component JPEG)
+    g_grayscale = true;
+    run_benchmark_pass("Fast Mode (Q8 Fixed) Luma-only Bayer", true, JPEG_SUBSAMPLE_444, OUTPUT_FILENAME_FAST_GRAY, raw_size);
+    g_grayscale = false;
+
+    // 14. Fast Mode - Mono sensor (raw samples straight to Y)
+    g_mono_sensor = true;
+    run_benchmark_pass("Fast Mode (Q8 Fixed) Mono sensor", true, JPEG_SUBSAMPLE_444, OUTPUT_FILENAME_FAST_MONO, raw_size);
+    g_mono_sensor = false;
+
+    // 15-17. Quantizer trade-off on Fast 4:2:0 with PSNR: plain, deadzone,
+    // then deadzone + isolated dropping. The decoded luma of each is kept
+    // so the two options can also be compared with plain in pixels.
+    if (!g_deadzone && !g_isolated_start) {
+        size_t plane = (size_t)IMG_WIDTH * IMG_HEIGHT;
+        uint8_t* luma = (uint8_t*)calloc(3, plane);
+        bool quant_stats = g_quant_stats;
+        g_quant_stats = true;
+        g_decode_luma = luma;
+        size_t size_fast_420 = run_benchmark_pass("Fast Mode (Q8 Fixed) 4:2:0 Plain quantizer", true, JPEG_SUBSAMPLE_420, OUTPUT_FILENAME_FAST_420, raw_size);
+        g_deadzone = true;
+        g_decode_luma = luma ? luma + plane : NULL;
+        size_t size_dz = run_benchmark_pass("Fast Mode (Q8 Fixed) 4:2:0 Deadzone", true, JPEG_SUBSAMPLE_420, OUTPUT_FILENAME_FAST_420_DZ, raw_size);
+        g_isolated_start = 15;
+        g_decode_luma = luma ? luma + 2 * plane : NULL;
+        size_t size_dz_iso = run_benchmark_pass("Fast Mode (Q8 Fixed) 4:2:0 Deadzone + Isolated", true, JPEG_SUBSAMPLE_420, OUTPUT_FILENAME_FAST_420_DZ_ISO, raw_size);
+        g_decode_luma = NULL;
+        g_deadzone = false;
+        g_isolated_start = 0;
+        g_quant_stats = quant_stats;
+        if (size_fast_420 > 0) {
+            printf("\nQuantizer size vs Fast 4:2:0: deadzone %+.1f%%, deadzone + isolated %+.1f%%\n",
+                   100.0 * ((double)size_dz / (double)size_fast_420 - 1.0),
+                   100.0 * ((double)size_dz_iso / (double)size_fast_420 - 1.0));
+        }
+        if (luma && size_dz > 0 && size_dz_iso > 0) {
+            printf("Decoded luma PSNR vs plain: deadzone %.2f dB, deadzone + isolated %.2f dB\n",
+                   luma_psnr(luma, luma + plane, plane), luma_psnr(luma, luma + 2 * plane, plane));
+        }
+        free(luma);
+    }
+
+    // 18. Progress callback aborting halfway (expected to fail with JPEG_ENCODER_ERR_ABORTED)
+    g_progress_abort_row = IMG_HEIGHT / 2;
+    run_benchmark_pass("Fast Mode (Q8 Fixed) 4:2:2 Abort at 50%", true, JPEG_SUBSAMPLE_422, OUTPUT_FILENAME_FAST_422_ABORT, raw_size);
+    printf("Progress: %u callbacks, stopped at %u/%d rows\n", g_progress_calls, g_progress_last_row, IMG_HEIGHT);
+    g_progress_abort_row = 0;
+
+    // 19-20. Simulated SD input: strip reads inline vs. on a worker thread
+    // (read_submit/read_wait), same output, overlap reported
+    g_sim_read = SIM_READ_SYNC;
+    run_benchmark_pass("Fast Mode (Q8 Fixed) 4:2:2 Simulated SD, sync read", true, JPEG_SUBSAMPLE_422, OUTPUT_FILENAME_FAST_422_SIM_SYNC, raw_size);
+    g_sim_read = SIM_READ_ASYNC;
+    run_benchmark_pass("Fast Mode (Q8 Fixed) 4:2:2 Simulated SD, async read", true, JPEG_SUBSAMPLE_422, OUTPUT_FILENAME_FAST_422_SIM_ASYNC, raw_size);
+    g_sim_read = SIM_READ_OFF;
+
+    if (g_decode_failures > 0) {
+        printf("\nDecode check: %u output(s) FAILED\n", g_decode_failures);
+    }
     printf("\nDone.\n");
-    return 0;
+    return (raw_check_failed || g_decode_failures > 0) ? 1 : 0;
 }
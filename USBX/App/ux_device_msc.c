@@ -25,6 +25,7 @@
 /* USER CODE BEGIN Includes */
 #include "sdmmc.h"
 #include "sd_adapter.h"
+#include "msc_storage.h"
 #include "logger.h"
 #include "ux_device_class_storage.h"
 /* USER CODE END Includes */
@@ -56,35 +57,12 @@ volatile uint32_t g_msc_write_count = 0U;
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
-static int32_t check_sd_status(void);
+
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 
-/**
-  * @brief  check_sd_status
-  *         Quick check if SD card is ready. Non-blocking.
-  * @param  none
-  * @retval 0 if ready, -1 if not
-  */
-static int32_t check_sd_status(void)
-{
-  /* Just check if already initialized */
-  if (!SDMMC1_IsInitialized())
-  {
-    return -1;
-  }
-
-  /* Quick non-blocking check - just see if card is in transfer state now */
-  if (HAL_SD_GetCardState(&hsd1) == HAL_SD_CARD_TRANSFER)
-  {
-    return 0;
-  }
-
-  /* Card busy - don't wait, just report not ready */
-  return -1;
-}
 /* USER CODE END 0 */
 
 /**
@@ -154,8 +132,9 @@ UINT USBD_STORAGE_Read(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
     return UX_ERROR;
   }
 
-  /* Check if SD card is ready */
-  if (check_sd_status() != 0)
+  /* Card present? SD_Read/SD_Write wait for the transfer state themselves,
+   * so a card still busy programming is not reported as missing. */
+  if (!SDMMC1_IsInitialized())
   {
     /* No SD card - set sense code. */
     if (media_status != UX_NULL)
@@ -168,8 +147,9 @@ UINT USBD_STORAGE_Read(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
   /* Notify activity for idle timeout detection */
   SD_MscNotifyActivity();
 
-  /* Use SD adapter for read */
-  if (SD_Read(data_pointer, lba, number_blocks) != 0)
+  /* Read into the bulk IN buffer: straight from the card, or from the
+   * read-ahead extent fetched while the previous chunk went out */
+  if (MSC_Storage_Read(data_pointer, lba, number_blocks) != 0)
   {
     LOG_ERROR_TAG("MSC", "Read failed at LBA %lu", (unsigned long)lba);
     return UX_ERROR;
@@ -213,8 +193,9 @@ UINT USBD_STORAGE_Write(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
     return UX_ERROR;
   }
 
-  /* Check if SD card is ready */
-  if (check_sd_status() != 0)
+  /* Card present? SD_Read/SD_Write wait for the transfer state themselves,
+   * so a card still busy programming is not reported as missing. */
+  if (!SDMMC1_IsInitialized())
   {
     /* No SD card - set sense code. */
     if (media_status != UX_NULL)
@@ -227,8 +208,8 @@ UINT USBD_STORAGE_Write(VOID *storage_instance, ULONG lun, UCHAR *data_pointer,
   /* Notify activity for idle timeout detection */
   SD_MscNotifyActivity();
 
-  /* Use SD adapter for write (mark as MSC source) */
-  if (SD_Write(data_pointer, lba, number_blocks, SD_SOURCE_MSC) != 0)
+  /* Stage the chunk; it is programmed while the host sends the next one */
+  if (MSC_Storage_Write(data_pointer, lba, number_blocks) != 0)
   {
     LOG_ERROR_TAG("MSC", "Write failed at LBA %lu", (unsigned long)lba);
     return UX_ERROR;
@@ -258,8 +239,15 @@ UINT USBD_STORAGE_Flush(VOID *storage_instance, ULONG lun, ULONG number_blocks,
   UX_PARAMETER_NOT_USED(lun);
   UX_PARAMETER_NOT_USED(number_blocks);
   UX_PARAMETER_NOT_USED(lba);
-  UX_PARAMETER_NOT_USED(media_status);
   
+  /* SYNCHRONIZE CACHE: staged writes must be on the card before we answer.
+   * A failed write fails the command with medium error / write fault. */
+  if (MSC_Storage_Flush() != 0)
+  {
+    *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(0x03, 0x03, 0x00);
+    return UX_ERROR;
+  }
+
   /* ThreadX (RTOS) mode expects UX_SUCCESS for success */
   /* USER CODE END USBD_STORAGE_Flush */
 
@@ -441,14 +429,24 @@ ULONG USBD_STORAGE_GetMediaBlocklength(VOID)
   * @brief  USBD_STORAGE_EjectNotify
   *         Called by USBX when host sends START_STOP_UNIT with eject bit.
   *         This is a weak function called from the modified ux_device_class_storage_start_stop.c
-  *         WARNING: This runs in USBX thread context - do NOT log or block here!
-  * @retval none
+  *         WARNING: This runs in USBX thread context - do NOT log or wait on USB here!
+  * @param  media_status: sense data for the failed command
+  * @retval UX_SUCCESS, or UX_ERROR if a cached write could not be flushed
   */
-void USBD_STORAGE_EjectNotify(void)
+UINT USBD_STORAGE_EjectNotify(ULONG *media_status)
 {
-  /* Just set the flag - don't log from USBX callback context!
-   * Logging to CDC from the storage thread causes deadlock. */
+  /* Just flush and set the flag - don't log from USBX callback context!
+   * Logging to CDC from the storage thread causes deadlock.
+   * The flush only waits on the SD card, not on USB.
+   * A failed flush fails the eject (medium error, write fault) and keeps
+   * the media loaded, so the host reports the loss instead of a clean eject. */
+  if (MSC_Storage_Flush() != 0)
+  {
+    *media_status = UX_DEVICE_CLASS_STORAGE_SENSE_STATUS(0x03, 0x03, 0x00);
+    return UX_ERROR;
+  }
   SD_SetEjected();
+  return UX_SUCCESS;
 }
 
 /* USER CODE END 1 */
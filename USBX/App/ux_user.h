@@ -231,7 +231,7 @@
    0 - The default, endpoint buffer is managed by core stack. Each endpoint takes UX_SLAVE_REQUEST_DATA_MAX_LENGTH bytes.
    1 - Endpoint buffer managed by classes. In this case not all endpoints consume UX_SLAVE_REQUEST_DATA_MAX_LENGTH bytes.  */
 
-/* #define UX_DEVICE_ENDPOINT_BUFFER_OWNER      0 */
+#define UX_DEVICE_ENDPOINT_BUFFER_OWNER      1
 
 /* Defined, it enables device CDC ACM zero copy for bulk in/out endpoints (write/read).
    Enabled, the endpoint buffer is not allocated in class, application must provide the buffer for read/write,
@@ -644,6 +644,14 @@
 
 /* USER CODE BEGIN 2 */
 
+/* MSC bulk buffer (one each for IN and OUT, owned by the storage class).
+ * Each READ(10)/WRITE(10) is split into media calls of at most this size,
+ * so it sets the SD multi-block length; independent of the 1 KB limit
+ * above, which is what every other endpoint gets. */
+#ifndef UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE
+#define UX_SLAVE_CLASS_STORAGE_BUFFER_SIZE   (16U * 1024U)
+#endif
+
 /* USER CODE END 2 */
 
 #endif